@@ -74,7 +74,63 @@ static uint64_t bs_read_ull(bs_t *b, int n);
 
 // impl
 
-// FIXME optimize for performance
+// Bit reads are served from a 64-bit big-endian window loaded at b->p, so
+// reading (or skipping) n bits costs the same for any n. The window is not
+// kept in bs_t, as callers move b->p and b->bits_left directly.
+
+#if defined(__GNUC__)
+#define _bs_clz32(x) __builtin_clz(x)
+#else
+static inline int _bs_clz32(uint32_t x) 
+{ 
+   int n = 0; 
+   while (!(x & 0x80000000)) { x <<= 1; n++; } 
+   return n;
+}
+#endif
+
+/**
+ * Up to 64 bits following the current position, MSB-first; bits past the
+ * end of the buffer read as zeros. Valid for at least 57 bits.
+ */
+static inline uint64_t _bs_peek_window(const bs_t *const b) 
+{ 
+   uint64_t w = 0; 
+   if (b->end - b->p >= 8) 
+   {
+      memcpy(&w, b->p, sizeof(w)); 
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+      w = __builtin_bswap64(w); 
+#elif !defined(__BYTE_ORDER__) || (__BYTE_ORDER__ != __ORDER_BIG_ENDIAN__)
+      w = 0; 
+      for (int i = 0; i < 8; i++) w = (w << 8) | b->p[i]; 
+#endif
+   } 
+   else 
+   {
+      int i = 0; 
+      for (; b->p + i < b->end; i++) w = (w << 8) | b->p[i]; 
+      for (; i < 8; i++) w <<= 8;
+   }
+   return w << (8 - b->bits_left);
+}
+
+/**
+ * Advance by n bits, stopping at the end of the buffer like a bit-by-bit
+ * read would.
+ */
+static inline void _bs_advance(bs_t *b, int n) 
+{ 
+   int consumed = (8 - b->bits_left) + n; 
+   if (consumed >= (b->end - b->p) * 8) 
+   {
+      b->p = b->end; 
+      b->bits_left = 8; 
+      return;
+   }
+   b->p += consumed >> 3; 
+   b->bits_left = 8 - (consumed & 7);
+}
 
 static inline bs_t* bs_init(bs_t *b, uint8_t *buf, size_t size) 
 { 
@@ -169,14 +225,11 @@ static inline void bs_write_u1(bs_t *b, uint32_t v)
 
 static inline uint32_t bs_read_u(bs_t *b, int n) 
 { 
-   if (!b || bs_eof(b)) return 0; 
+   if (!b || bs_eof(b) || n < 1) return 0; 
+   if (n > 32) return (uint32_t)bs_read_ull(b, n); 
    
-   uint32_t result = 0; 
-   while (n--) 
-   {
-      result <<= 1; 
-      result |= bs_read_u1(b);
-   }
+   uint32_t result = (uint32_t)(_bs_peek_window(b) >> (64 - n)); 
+   _bs_advance(b, n); 
    return result;
 }
 
@@ -228,11 +281,28 @@ static inline uint32_t bs_read_ue(bs_t *b)
 { 
    if (!b) return 0; 
    
+   if (!bs_eof(b)) 
+   {
+      // fast path: the terminating 1 bit is within the next 32 bits
+      uint64_t w = _bs_peek_window(b); 
+      if ((w >> 32) != 0) 
+      {
+         int lz = _bs_clz32((uint32_t)(w >> 32)); 
+         if (lz < 28) // whole codeword is in the window
+         {
+            _bs_advance(b, 2 * lz + 1); 
+            return (uint32_t)(w >> (63 - 2 * lz)) - 1;
+         }
+         _bs_advance(b, lz + 1); 
+         return bs_read_u(b, lz) + (uint32_t)((1ULL << lz) - 1);
+      }
+   }
+   
    int i = 0; 
    while ((bs_read_u1(b) == 0) && (i < 32) && !bs_eof(b)) i++; 
    
    int32_t result = bs_read_u(b, i); 
-   result += (1 << i) - 1; 
+   result += (int32_t)((1ULL << i) - 1); 
    return result;
 }
 
@@ -326,9 +396,9 @@ static inline void bs_skip_u1(bs_t *b)
 
 static inline void bs_skip_u(bs_t *b, int n) 
 { 
-   if (!b || bs_eof(b)) return; 
+   if (!b || bs_eof(b) || n < 1) return; 
    
-   while (n--) bs_skip_u1(b);
+   _bs_advance(b, n);
 }
 
 static inline uint64_t bs_read_ull(bs_t *b, int n) 
@@ -336,7 +406,14 @@ static inline uint64_t bs_read_ull(bs_t *b, int n)
    if (!b || bs_eof(b) || n < 1) return 0; 
    
    uint64_t r = 0; 
-   while (n--) r |= ((uint64_t)bs_read_u1(b) << n); 
+   if (n > 56) // the window only guarantees 57 valid bits
+   {
+      r = (uint64_t)bs_read_u(b, 32) << (n - 32); 
+      n -= 32;
+      if (bs_eof(b)) return r;
+   }
+   r |= _bs_peek_window(b) >> (64 - n); 
+   _bs_advance(b, n); 
    return r;
 }
 
@@ -351,16 +428,7 @@ static inline uint64_t bs_read_uN(bs_t *b, int n)
 { 
     if (!b || bs_eof(b)) return 0; 
 
-    uint64_t r = 0; 
-    int i;
-    if ( n > 4 )
-        for (i = 1; i <= n; i++)
-            r += ((uint64_t)bs_read_u8(b)) << ((n - i) << 3); 
-    else
-        for (i = 1; i <= n; i++)
-            r += bs_read_u8(b) << ((n - i) << 3); 
-
-    return r;
+    return bs_read_ull(b, n << 3);
 }
 
 static inline void bs_write_uN(bs_t *b, int n, uint64_t v) 
@@ -27,6 +27,7 @@
 #include "bs.h"
 #include "h264_stream.h"
 #include "h264_sei.h"
+#include "h264_nal_scan.h"
 
 /**
  Create a new H264 stream object.  Allocates all structures contained within it.
@@ -82,6 +83,7 @@ void h264_free(h264_stream_t* h)
     		free(h->slice_data->rbsp_buf);
     	free(h->slice_data);
     }
+    free(h->rbsp_buf);
     free(h);
 }
 
@@ -145,39 +147,19 @@ int find_nal_unit(uint8_t* buf, int size, int* nal_start, int* nal_end)
     *nal_start = 0;
     *nal_end = 0;
 
-    i = 0;
-//    while (   //( next_bits( 24 ) != 0x000001 && next_bits( 32 ) != 0x00000001 )
-//        (buf[i] != 0 || buf[i+1] != 0 || buf[i+2] != 0x01) &&
-//        (buf[i] != 0 || buf[i+1] != 0 || buf[i+2] != 0 || buf[i+3] != 0x01)
-//        )
-
-    while (buf[i] != 0x0 || buf[i+1] != 0x0 || (buf[i+2] != 0x1 && (buf[i+2] != 0x0 || buf[i+3] != 0x1))) {
-        i++; // skip leading zero
-        if (i+4 >= size)
-        	return 0; // did not find nal start
-    }
+    // a 4-byte start code is found as the 0x000001 following its zero_byte
+    i = nal_find_start_code(buf, size);
+    if (i >= size)
+        return 0; // did not find nal start
 
-    if  (buf[i] != 0 || buf[i+1] != 0 || buf[i+2] != 0x01) // ( next_bits( 24 ) != 0x000001 )
-        i++;
+    *nal_start = i + 3;
 
-    if  (buf[i] != 0 || buf[i+1] != 0 || buf[i+2] != 0x01) {
-    	fprintf(stderr, "ERROR: should never happen\n");
-    	return 0;
-    }
-    i+= 3;
-    *nal_start = i;
-    
-//    while (   //( next_bits( 24 ) != 0x000000 && next_bits( 24 ) != 0x000001 )
-//        (buf[i] != 0 || buf[i+1] != 0 || buf[i+2] != 0) &&
-//        (buf[i] != 0 || buf[i+1] != 0 || buf[i+2] != 0x01)
-//        )
-    while (buf[i] != 0 || buf[i+1] != 0 || (buf[i+2] != 0 && buf[i+2] != 1)) {
-        i++; // FIXME the next line fails when reading a nal that ends exactly at the end of the data
-        if (i+3 >= size) {
-        	*nal_end = size;
-        	return -1;
-        } // did not find nal end, stream ended first
-    }
+    // ( next_bits( 24 ) != 0x000000 && next_bits( 24 ) != 0x000001 )
+    i = *nal_start + nal_find_end(buf + *nal_start, size - *nal_start);
+    if (i >= size) {
+        *nal_end = size;
+        return -1;
+    } // did not find nal end, stream ended first
 
     *nal_end = i;
     return (*nal_end - *nal_start);
@@ -249,57 +231,45 @@ int rbsp_to_nal(const uint8_t* rbsp_buf, const int* rbsp_size, uint8_t* nal_buf,
 // 7.4.1.1 Encapsulation of an SODB within an RBSP
 int nal_to_rbsp(const uint8_t* nal_buf, int* nal_size, uint8_t* rbsp_buf, int* rbsp_size)
 {
-    int i;
-    int j     = 0;
-    int count = 0;
-  
-    for( i = 0; i < *nal_size; i++ )
-    { 
-        // in NAL unit, 0x000000, 0x000001 or 0x000002 shall not occur at any byte-aligned position
-        if( ( count == 2 ) && ( nal_buf[i] < 0x03) ) 
-        {
-            return -1;
-        }
+    // runs between emulation prevention bytes are found with a vectorized scan and moved in one go
+    return nal_unescape(nal_buf, nal_size, rbsp_buf, rbsp_size, 0);
+}
 
-        if( ( count == 2 ) && ( nal_buf[i] == 0x03) )
-        {
-            // check the 4th byte after 0x000003, except when cabac_zero_word is used, in which case the last three bytes of this NAL unit must be 0x000003
-            if((i < *nal_size - 1) && (nal_buf[i+1] > 0x03))
-            {
-                return -1;
-            }
-
-            // if cabac_zero_word is used, the final byte of this NAL unit(0x03) is discarded, and the last two bytes of RBSP must be 0x0000
-            if(i == *nal_size - 1)
-            {
-                break;
-            }
-
-            i++;
-            count = 0;
-        }
+/**
+ Get the stream's RBSP scratch buffer, growing it to at least size bytes.
+ The buffer is reused by every read_nal_unit call and freed by h264_free.
+ @return    the buffer, or NULL if out of memory
+ */
+uint8_t* h264_rbsp_buffer(h264_stream_t* h, int size)
+{
+    if (size > h->rbsp_buf_size) {
+        int new_size = (size > 2 * h->rbsp_buf_size) ? size : 2 * h->rbsp_buf_size;
+        uint8_t* new_buf = (uint8_t*)realloc(h->rbsp_buf, new_size);
+        if (new_buf == NULL) return NULL;
+        h->rbsp_buf = new_buf;
+        h->rbsp_buf_size = new_size;
+    }
+    return h->rbsp_buf;
+}
 
-        if ( j >= *rbsp_size ) 
-        {
-            // error, not enough space
-            return -1;
-        }
+/**
+ Number of RBSP bytes read_nal_unit should unescape: the whole NAL unit, unless
+ h->rbsp_lazy_size is set and this is a coded slice.
+ @param[in] buf     the nal data, starting with the nal header
+ @param[in] size    the size of the nal data
+ @return    size, or less if only the slice header is needed
+ */
+int h264_rbsp_unescape_size(h264_stream_t* h, const uint8_t* buf, int size)
+{
+    if (h->rbsp_lazy_size <= 0 || h->rbsp_lazy_size >= size) return size;
 
-        rbsp_buf[j] = nal_buf[i];
-        if(nal_buf[i] == 0x00)
-        {
-            count++;
-        }
-        else
-        {
-            count = 0;
-        }
-        j++;
-    }
+    int nal_unit_type = buf[0] & 0x1F;
+    if (nal_unit_type == NAL_UNIT_TYPE_CODED_SLICE_NON_IDR ||
+        nal_unit_type == NAL_UNIT_TYPE_CODED_SLICE_IDR ||
+        nal_unit_type == NAL_UNIT_TYPE_CODED_SLICE_AUX)
+        return h->rbsp_lazy_size;
 
-    *nal_size = i;
-    *rbsp_size = j;
-    return j;
+    return size;
 }
 
 
@@ -0,0 +1,228 @@
+/*
+ * h264bitstream - a library for reading and writing H.264 video
+ * Copyright (C) 2005-2007 Auroras Entertainment, LLC
+ * Copyright (C) 2008-2011 Avail-TVN
+ *
+ * Written by Alex Izvorski <aizvorski@gmail.com> and Alex Giladi <alex.giladi@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "h264_nal_scan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NAL_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+// all scanners return the first i with buf[i] == 0, buf[i+1] == 0 and
+// lo <= buf[i+2] <= hi, i + 2 < size; size if there is none. hi is at least 1.
+typedef int (*nal_scan_func_t)(const uint8_t* buf, int size, int lo, int hi);
+
+static int nal_scan_scalar(const uint8_t* buf, int size, int lo, int hi)
+{
+    int i = 0;
+    // a match needs buf[i+2] <= hi and two zeros before it, which lets us skip ahead
+    while (i + 2 < size) {
+        if (buf[i+2] > hi) i += 3;
+        else if (buf[i+1] != 0) i += 2;
+        else if (buf[i] != 0) i += 1;
+        else if (buf[i+2] >= lo) return i;
+        else i += 1;
+    }
+    return size;
+}
+
+#ifdef NAL_SCAN_X86
+
+__attribute__((target("sse2")))
+static int nal_scan_sse2(const uint8_t* buf, int size, int lo, int hi)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i vlo = _mm_set1_epi8((char)lo);
+    const __m128i vhi = _mm_set1_epi8((char)hi);
+    int i = 0;
+
+    for (; i + 18 <= size; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(buf + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(buf + i + 1));
+        __m128i c = _mm_loadu_si128((const __m128i*)(buf + i + 2));
+        __m128i c_ok = _mm_and_si128(_mm_cmpeq_epi8(_mm_min_epu8(c, vhi), c), _mm_cmpeq_epi8(_mm_max_epu8(c, vlo), c));
+        __m128i m = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(a, zero), _mm_cmpeq_epi8(b, zero)), c_ok);
+        int mask = _mm_movemask_epi8(m);
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+    int j = nal_scan_scalar(buf + i, size - i, lo, hi);
+    return i + j;
+}
+
+__attribute__((target("avx2")))
+static int nal_scan_avx2(const uint8_t* buf, int size, int lo, int hi)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i vlo = _mm256_set1_epi8((char)lo);
+    const __m256i vhi = _mm256_set1_epi8((char)hi);
+    int i = 0;
+
+    for (; i + 34 <= size; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(buf + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(buf + i + 1));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(buf + i + 2));
+        __m256i c_ok = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(c, vhi), c), _mm256_cmpeq_epi8(_mm256_max_epu8(c, vlo), c));
+        __m256i m = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(a, zero), _mm256_cmpeq_epi8(b, zero)), c_ok);
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(m);
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+    int j = nal_scan_scalar(buf + i, size - i, lo, hi);
+    return i + j;
+}
+
+#endif
+
+static nal_scan_func_t nal_scan_func = NULL;
+
+static nal_scan_func_t nal_scan_select(int impl)
+{
+#ifdef NAL_SCAN_X86
+    __builtin_cpu_init();
+    if ((impl == NAL_SCAN_IMPL_AUTO || impl == NAL_SCAN_IMPL_AVX2) && __builtin_cpu_supports("avx2")) return nal_scan_avx2;
+    if ((impl == NAL_SCAN_IMPL_AUTO || impl == NAL_SCAN_IMPL_SSE2) && __builtin_cpu_supports("sse2")) return nal_scan_sse2;
+#endif
+    if (impl == NAL_SCAN_IMPL_AUTO || impl == NAL_SCAN_IMPL_SCALAR) return nal_scan_scalar;
+    return NULL;
+}
+
+static int nal_scan(const uint8_t* buf, int size, int lo, int hi)
+{
+    // racing threads all store the same pointer, relaxed is enough for that
+    nal_scan_func_t f = __atomic_load_n(&nal_scan_func, __ATOMIC_RELAXED);
+    if (f == NULL) {
+        f = nal_scan_select(NAL_SCAN_IMPL_AUTO);
+        __atomic_store_n(&nal_scan_func, f, __ATOMIC_RELAXED);
+    }
+    return f(buf, size, lo, hi);
+}
+
+int nal_scan_set_impl(int impl)
+{
+    nal_scan_func_t f = nal_scan_select(impl);
+    if (f == NULL) return 0;
+    __atomic_store_n(&nal_scan_func, f, __ATOMIC_RELAXED);
+    return 1;
+}
+
+int nal_find_start_code(const uint8_t* buf, int size)
+{
+    return nal_scan(buf, size, 1, 1);
+}
+
+int nal_find_end(const uint8_t* buf, int size)
+{
+    return nal_scan(buf, size, 0, 1);
+}
+
+int nal_find_escape(const uint8_t* buf, int size)
+{
+    return nal_scan(buf, size, 0, 3);
+}
+
+int nal_unescape(const uint8_t* nal_buf, int* nal_size, uint8_t* rbsp_buf, int* rbsp_size, int partial)
+{
+    int i = 0;
+    int j = 0;
+
+    while (i < *nal_size) {
+        // everything up to and including the 0x0000 of the next 0x0000xx, xx <= 3, is copied as is
+        int left = *nal_size - i;
+        if (partial && left > *rbsp_size - j + 1) left = *rbsp_size - j + 1; // no need to look past what fits
+        int k = nal_find_escape(nal_buf + i, left);
+        int found = (k < left);
+        int run = found ? k + 2 : *nal_size - i;
+
+        if (j + run > *rbsp_size) {
+            if (!partial) return -1; // error, not enough space
+            run = *rbsp_size - j;
+            found = 0;
+        }
+        memmove(rbsp_buf + j, nal_buf + i, run);
+        i += run;
+        j += run;
+        if (!found) break;
+
+        // in NAL unit, 0x000000, 0x000001 or 0x000002 shall not occur at any byte-aligned position
+        if (nal_buf[i] < 0x03) return -1;
+
+        // check the 4th byte after 0x000003, except when cabac_zero_word is used, in which case the last three bytes of this NAL unit must be 0x000003
+        if ((i < *nal_size - 1) && (nal_buf[i+1] > 0x03)) return -1;
+
+        // if cabac_zero_word is used, the final byte of this NAL unit(0x03) is discarded, and the last two bytes of RBSP must be 0x0000
+        if (i == *nal_size - 1) break;
+
+        i++; // skip emulation_prevention_three_byte
+    }
+
+    *nal_size = i;
+    *rbsp_size = j;
+    return j;
+}
+
+void nal_scanner_init(nal_scanner_t* s)
+{
+    s->pos = 0;
+    s->start_code_pos = 0;
+    s->zeros = 0;
+}
+
+int nal_scanner_next(nal_scanner_t* s, const uint8_t* buf, int size)
+{
+    int i;
+
+    // start code split between the previous fragment(s) and this one
+    if (s->zeros == 2 && size >= 1 && buf[0] == 1) {
+        s->start_code_pos = s->pos - 2;
+        i = 1;
+        goto found;
+    }
+    if (s->zeros >= 1 && size >= 2 && buf[0] == 0 && buf[1] == 1) {
+        s->start_code_pos = s->pos - 1;
+        i = 2;
+        goto found;
+    }
+
+    i = nal_scan(buf, size, 1, 1);
+    if (i < size) {
+        s->start_code_pos = s->pos + i;
+        i += 3;
+        goto found;
+    }
+
+    // no luck, remember how many zeros the data ends with
+    if (size >= 2) {
+        s->zeros = (buf[size-1] == 0) ? ((buf[size-2] == 0) ? 2 : 1) : 0;
+    } else if (size == 1) {
+        s->zeros = (buf[0] == 0) ? ((s->zeros > 0) ? 2 : 1) : 0;
+    }
+    s->pos += size;
+    return -1;
+
+found:
+    s->zeros = 0;
+    s->pos += i;
+    return i;
+}
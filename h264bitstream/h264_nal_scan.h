@@ -0,0 +1,116 @@
+/*
+ * h264bitstream - a library for reading and writing H.264 video
+ * Copyright (C) 2005-2007 Auroras Entertainment, LLC
+ * Copyright (C) 2008-2011 Avail-TVN
+ *
+ * Written by Alex Izvorski <aizvorski@gmail.com> and Alex Giladi <alex.giladi@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _H264_NAL_SCAN_H
+#define _H264_NAL_SCAN_H        1
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// scanner implementations, see nal_scan_set_impl
+#define NAL_SCAN_IMPL_AUTO     0
+#define NAL_SCAN_IMPL_SCALAR   1
+#define NAL_SCAN_IMPL_SSE2     2
+#define NAL_SCAN_IMPL_AVX2     3
+
+/**
+   Find the first Annex B start code prefix (0x000001) in a buffer.
+   A four-byte start code (0x00000001) is found as the 0x000001 at offset + 1.
+   @param[in]   buf        the data to scan
+   @param[in]   size       the size of the data
+   @return                 offset of the first byte of the prefix, or size if there is none
+ */
+int nal_find_start_code(const uint8_t* buf, int size);
+
+/**
+   Find the end of a NAL unit, i.e. the first 0x000000 or 0x000001 in a buffer.
+   @param[in]   buf        the data to scan, starting right after the start code
+   @param[in]   size       the size of the data
+   @return                 offset of the end of the NAL unit, or size if it is not terminated within buf
+ */
+int nal_find_end(const uint8_t* buf, int size);
+
+/**
+   Find the first 0x000000, 0x000001, 0x000002 or 0x000003 in a buffer, i.e. the next
+   emulation_prevention_three_byte or error in a NAL unit.
+   @return                 offset of the first byte of the sequence, or size if there is none
+ */
+int nal_find_escape(const uint8_t* buf, int size);
+
+/**
+   Convert NAL data to RBSP data by removing emulation prevention bytes, same as nal_to_rbsp.
+   Escapes are located with nal_find_escape and the runs between them moved in one go,
+   so rbsp_buf may be the same as nal_buf to unescape in place.
+   @param[in]      nal_buf    the nal data
+   @param[in,out]  nal_size   size of the nal data; set to the number of bytes consumed
+   @param[out]     rbsp_buf   the rbsp data
+   @param[in,out]  rbsp_size  size of the rbsp buffer; set to the size of the rbsp data
+   @param[in]      partial    if set, stop once rbsp_buf is full instead of failing;
+                              enough to parse e.g. a slice header without unescaping the slice data
+   @return                    size of the rbsp data, or -1 on error (invalid data or, unless partial, not enough space)
+ */
+int nal_unescape(const uint8_t* nal_buf, int* nal_size, uint8_t* rbsp_buf, int* rbsp_size, int partial);
+
+/**
+   Select the scanner implementation.
+   By default the fastest one supported by the CPU is picked on first use.
+   Applies to all nal_find_* functions and nal_unescape.
+   @param[in]   impl       one of NAL_SCAN_IMPL_*
+   @return                 1 if the implementation is available, 0 otherwise (selection unchanged)
+ */
+int nal_scan_set_impl(int impl);
+
+/**
+   Streaming start code scanner state, for data which arrives in fragments
+   (e.g. PES payloads split across TS packets). Start codes split between
+   fragments are found as well.
+ */
+typedef struct
+{
+    uint64_t pos;               // stream offset of the next byte to be scanned
+    uint64_t start_code_pos;    // stream offset of the 0x000001 of the last start code found
+    int zeros;                  // number of 0x00 bytes (up to 2) ending the data scanned so far
+} nal_scanner_t;
+
+void nal_scanner_init(nal_scanner_t* s);
+
+/**
+   Scan the next fragment for a start code.
+   @param[in,out] s        scanner state
+   @param[in]   buf        fragment
+   @param[in]   size       size of the fragment
+   @return                 number of bytes consumed up to and including the start code,
+                           i.e. offset of the first byte of the NAL unit in buf;
+                           -1 if no start code ends in buf (the whole fragment is consumed).
+                           On success s->start_code_pos is set, and the rest of the
+                           fragment should be passed to the next call.
+ */
+int nal_scanner_next(nal_scanner_t* s, const uint8_t* buf, int size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -28,6 +28,7 @@
 
 #include "bs.h"
 #include "h264_stream.h"
+#include "h264_nal_scan.h"
 #include "h264_sei.h"
 
 FILE* h264_dbgfile = NULL;
@@ -148,12 +149,15 @@ int read_nal_unit(h264_stream_t* h, uint8_t* buf, int size) {
     nal_t* nal = h->nal;
 
     int nal_size = size, ret = -1, rbsp_size = size, rc;
-    uint8_t* rbsp_buf = (uint8_t*)calloc(1, rbsp_size);
+    bs_t* b = 0;
+    // the stream's scratch buffer is reused, see h264_rbsp_buffer
+    rbsp_size = h264_rbsp_unescape_size(h, buf, size);
+    int lazy = (rbsp_size < size);
+    uint8_t* rbsp_buf = h264_rbsp_buffer(h, rbsp_size);
     if (!rbsp_buf)
     	goto read_nal_unit_wrap_up;
-    bs_t* b = 0;
 
-    if ((rc = nal_to_rbsp(buf, &nal_size, rbsp_buf, &rbsp_size)) < 0) // handle conversion error
+    if ((rc = nal_unescape(buf, &nal_size, rbsp_buf, &rbsp_size, lazy)) < 0) // handle conversion error
     	goto read_nal_unit_wrap_up;
 
     if (0)
@@ -221,10 +225,8 @@ int read_nal_unit(h264_stream_t* h, uint8_t* buf, int size) {
 			goto read_nal_unit_wrap_up;
     }
 
-    ret = nal_size;
+    ret = lazy ? size : nal_size;
 read_nal_unit_wrap_up:
-	if (rbsp_buf)
-		free(rbsp_buf);
     if (b)
     	bs_free(b);
     return ret;
@@ -1927,11 +1929,16 @@ int read_debug_nal_unit(h264_stream_t* h, uint8_t* buf, int size)
     nal_t* nal = h->nal;
 
     int nal_size = size, ret = -1, rbsp_size = size;
-    uint8_t* rbsp_buf = (uint8_t*)calloc(rbsp_size, 1);
     bs_t* b = 0;
+    // the stream's scratch buffer is reused, see h264_rbsp_buffer
+    rbsp_size = h264_rbsp_unescape_size(h, buf, size);
+    int lazy = (rbsp_size < size);
+    uint8_t* rbsp_buf = h264_rbsp_buffer(h, rbsp_size);
+    if (!rbsp_buf)
+    	goto read_debug_nal_unit_wrap_up;
 
     if (1) {
-    	int rc = nal_to_rbsp(buf, &nal_size, rbsp_buf, &rbsp_size);
+    	int rc = nal_unescape(buf, &nal_size, rbsp_buf, &rbsp_size, lazy);
     	if (rc < 0) // handle conversion error
     		goto read_debug_nal_unit_wrap_up;
     }
@@ -1939,7 +1946,8 @@ int read_debug_nal_unit(h264_stream_t* h, uint8_t* buf, int size)
     if (0)
     	rbsp_size = size*3/4; // NOTE this may have to be slightly smaller (3/4 smaller, worst case) in order to be guaranteed to fit
 
-    b = bs_new(rbsp_buf, rbsp_size);
+    if ((b = bs_new(rbsp_buf, rbsp_size)) == NULL)
+    	goto read_debug_nal_unit_wrap_up;
     printf("%d.%d: ", b->p - b->start, b->bits_left);
     int forbidden_zero_bit = bs_read_u(b, 1);
     printf("forbidden_zero_bit: %d \n", forbidden_zero_bit);
@@ -2006,9 +2014,8 @@ int read_debug_nal_unit(h264_stream_t* h, uint8_t* buf, int size)
 			goto read_debug_nal_unit_wrap_up;
     }
 
-    ret = nal_size;
+    ret = lazy ? size : nal_size;
 read_debug_nal_unit_wrap_up:
-    free(rbsp_buf);
     if (b)
         bs_free(b);
     return ret;
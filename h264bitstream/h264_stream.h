@@ -372,6 +372,11 @@ typedef struct
     pps_t* pps_table[256];
     sei_t** seis;
 
+    uint8_t* rbsp_buf;      // scratch buffer for unescaped NAL units, see h264_rbsp_buffer
+    int rbsp_buf_size;
+    int rbsp_lazy_size;     // if > 0, only the first rbsp_lazy_size bytes of coded slice NAL units are unescaped:
+                            // enough for the slice header, slice data is truncated
+
 } h264_stream_t;
 
 h264_stream_t* h264_new();
@@ -381,6 +386,8 @@ int find_nal_unit(uint8_t* buf, int size, int* nal_start, int* nal_end);
 
 int rbsp_to_nal(const uint8_t* rbsp_buf, const int* rbsp_size, uint8_t* nal_buf, int* nal_size);
 int nal_to_rbsp(const uint8_t* nal_buf, int* nal_size, uint8_t* rbsp_buf, int* rbsp_size);
+uint8_t* h264_rbsp_buffer(h264_stream_t* h, int size);
+int h264_rbsp_unescape_size(h264_stream_t* h, const uint8_t* buf, int size);
 
 int read_nal_unit(h264_stream_t* h, uint8_t* buf, int size);
 int peek_nal_unit(h264_stream_t* h, uint8_t* buf, int size);
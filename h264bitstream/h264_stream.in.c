@@ -28,6 +28,7 @@
 
 #include "bs.h"
 #include "h264_stream.h"
+#include "h264_nal_scan.h"
 #include "h264_sei.h"
 
 FILE* h264_dbgfile = NULL;
@@ -108,6 +109,14 @@ void debug_bytes(uint8_t* buf, int len)
     printf("\n");
 }
 
+void debug_sps(sps_t* sps) {
+	// FIXME implement
+}
+
+void debug_pps(pps_t* pps) {
+	// FIXME implement
+}
+
 #end_preamble
 
 #function_declarations
@@ -118,23 +127,35 @@ int structure(nal_unit)(h264_stream_t* h, uint8_t* buf, int size)
 {
     nal_t* nal = h->nal;
 
-    int nal_size = size;
-    int rbsp_size = size;
-    uint8_t* rbsp_buf = (uint8_t*)calloc(1, rbsp_size);
+    int nal_size = size, ret = -1, rbsp_size = size;
+    int lazy = 0;
+    uint8_t* rbsp_buf = NULL;
+    bs_t* b = 0;
 
     if( is_reading )
     {
-    int rc = nal_to_rbsp(buf, &nal_size, rbsp_buf, &rbsp_size);
+    // the stream's scratch buffer is reused, see h264_rbsp_buffer
+    rbsp_size = h264_rbsp_unescape_size(h, buf, size);
+    lazy = (rbsp_size < size);
+    rbsp_buf = h264_rbsp_buffer(h, rbsp_size);
+    if (!rbsp_buf)
+    	goto nal_unit_wrap_up;
 
-    if (rc < 0) { free(rbsp_buf); return -1; } // handle conversion error
+    int rc = nal_unescape(buf, &nal_size, rbsp_buf, &rbsp_size, lazy);
+    if (rc < 0) // handle conversion error
+    	goto nal_unit_wrap_up;
     }
 
     if( is_writing )
     {
+    rbsp_buf = (uint8_t*)calloc(1, rbsp_size);
+    if (!rbsp_buf)
+    	goto nal_unit_wrap_up;
     rbsp_size = size*3/4; // NOTE this may have to be slightly smaller (3/4 smaller, worst case) in order to be guaranteed to fit
     }
 
-    bs_t* b = bs_new(rbsp_buf, rbsp_size);
+    if ((b = bs_new(rbsp_buf, rbsp_size)) == NULL)
+    	goto nal_unit_wrap_up;
     value( forbidden_zero_bit, f(1, 0) );
     value( nal->nal_ref_idc, u(2) );
     value( nal->nal_unit_type, u(5) );
@@ -180,10 +201,12 @@ int structure(nal_unit)(h264_stream_t* h, uint8_t* buf, int size)
         case NAL_UNIT_TYPE_CODED_SLICE_DATA_PARTITION_B: 
         case NAL_UNIT_TYPE_CODED_SLICE_DATA_PARTITION_C:
         default:
-            return -1;
+            if( is_reading && !is_debug ) { ret = 0; } // unsupported, yet not error
+            goto nal_unit_wrap_up;
     }
 
-    if (bs_overrun(b)) { bs_free(b); free(rbsp_buf); return -1; }
+    if (bs_overrun(b))
+    	goto nal_unit_wrap_up;
 
     if( is_writing )
     {
@@ -191,13 +214,16 @@ int structure(nal_unit)(h264_stream_t* h, uint8_t* buf, int size)
     rbsp_size = bs_pos(b);
 
     int rc = rbsp_to_nal(rbsp_buf, &rbsp_size, buf, &nal_size);
-    if (rc < 0) { bs_free(b); free(rbsp_buf); return -1; }
+    if (rc < 0)
+    	goto nal_unit_wrap_up;
     }
 
-    bs_free(b);
-    free(rbsp_buf);
-
-    return nal_size;
+    ret = lazy ? size : nal_size;
+nal_unit_wrap_up:
+    if( is_writing ) { free(rbsp_buf); }
+    if (b)
+    	bs_free(b);
+    return ret;
 }
 
 
@@ -639,6 +665,8 @@ void structure(filler_data_rbsp)(h264_stream_t* h, bs_t* b)
 void structure(slice_layer_rbsp)(h264_stream_t* h,  bs_t* b)
 {
     structure(slice_header)(h, b);
+    if( is_reading ) { if (bs_eof(b)) return; } // there might be no bits left beyond the header
+
     slice_data_rbsp_t* slice_data = h->slice_data;
 
     if ( slice_data != NULL )
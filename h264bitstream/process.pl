@@ -43,6 +43,7 @@ $code_read =~ s{^(\s*) value \s* \( \s* ([^,]*) , (.*) \);}{ &proc_value_read($2
 $code_read =~ s{structure\( (\w+) \)}{read_$1}xg;
 $code_read =~ s{is_reading}{1}g;
 $code_read =~ s{is_writing}{0}g;
+$code_read =~ s{is_debug}{0}g;
 print $code_read;
 
 $code_write = $code;
@@ -50,6 +51,7 @@ $code_write =~ s{^(\s*) value \s* \( \s* ([^,]*) , (.*) \);}{ &proc_value_write(
 $code_write =~ s{structure\( (\w+) \)}{write_$1}xg;
 $code_write =~ s{is_reading}{0}g;
 $code_write =~ s{is_writing}{1}g;
+$code_write =~ s{is_debug}{0}g;
 print $code_write;
 
 $code_read_debug = $code;
@@ -57,6 +59,7 @@ $code_read_debug =~ s{^(\s*) value \s* \( \s* ([^,]*) , (.*) \);}{ &proc_value_r
 $code_read_debug =~ s{structure\( (\w+) \)}{read_debug_$1}xg;
 $code_read_debug =~ s{is_reading}{1}g;
 $code_read_debug =~ s{is_writing}{0}g;
+$code_read_debug =~ s{is_debug}{1}g;
 print $code_read_debug;
 
 sub proc_value_read
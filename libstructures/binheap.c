@@ -61,6 +61,12 @@ void binheap_insert(binheap_t* bh, binheap_elem_t* e)
     _binheap_sift_up(bh, bh->length-1);
 }
 
+int binheap_reserve(binheap_t* bh, int length)
+{
+    _binheap_expand_to_length(bh, length);
+    return bh->array != NULL;
+}
+
 binheap_elem_t* binheap_remove_first(binheap_t* bh)
 {
     if (bh->length == 0) { return NULL; }
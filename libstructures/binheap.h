@@ -40,6 +40,8 @@ typedef struct
 binheap_t* binheap_new(binheap_cmp_func_t cmp_func);
 void binheap_free(binheap_t* bh);
 void binheap_insert(binheap_t* bh, binheap_elem_t* e);
+// make room for length elements, so that inserting up to that many does not allocate; 0 if out of memory
+int binheap_reserve(binheap_t* bh, int length);
 
 binheap_elem_t* binheap_remove_first(binheap_t* bh);
 void binheap_foreach(binheap_t* bh, void (*func) (binheap_elem_t* e));
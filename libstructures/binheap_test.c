@@ -44,6 +44,21 @@ START_TEST (test_binheap_strings)
 }
 END_TEST
 
+START_TEST (test_binheap_reserve)
+{
+    binheap_t* bh = binheap_new(string_cmp_func);
+    fail_unless( binheap_reserve(bh, 5000), "reserve failed" );
+    binheap_elem_t** array = bh->array;
+    int i;
+    for (i = 0; i < 5000; i++)
+    {
+        binheap_insert(bh, (binheap_elem_t*)"a");
+    }
+    fail_unless( bh->array == array, "reallocated after reserve" );
+    binheap_free(bh);
+}
+END_TEST
+
 uint64_t gettimeusec()
 {
     struct timeval tv;
@@ -109,6 +124,7 @@ int main(int argc, char** argv)
     int _testnum = 1;
 
     ok( test_binheap_strings() , "strings");
+    ok( test_binheap_reserve() , "reserve");
     ok( test_binheap_uint64_benchmark() , "benchmark");
 
     return 0;
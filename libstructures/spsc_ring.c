@@ -0,0 +1,83 @@
+/* 
+ * libstructures - a library for generic data structures in C
+ * Copyright (C) 2005-2008 Avail Media, Inc.
+ * 
+ * Written by Alex Izvorski <aizvorski@gmail.com>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "spsc_ring.h"
+
+spsc_ring_t* spsc_ring_new(size_t capacity, size_t elem_size)
+{
+    if (capacity == 0 || elem_size == 0) return NULL;
+    if (capacity > SIZE_MAX / 2) return NULL; // rounding up would overflow
+
+    size_t n = 1;
+    while (n < capacity) n <<= 1;
+    if (n > SIZE_MAX / elem_size) return NULL;
+
+    spsc_ring_t* r = (spsc_ring_t*)calloc(1, sizeof(spsc_ring_t));
+    if (r == NULL) return NULL;
+    r->buf = (uint8_t*)malloc(n * elem_size);
+    if (r->buf == NULL) { free(r); return NULL; }
+    r->mask = n - 1;
+    r->elem_size = elem_size;
+    return r;
+}
+
+void spsc_ring_free(spsc_ring_t* r)
+{
+    if (r == NULL) return;
+    free(r->buf);
+    free(r);
+}
+
+int spsc_ring_push(spsc_ring_t* r, const void* elem)
+{
+    size_t tail = r->tail; // only we write it
+    if (tail - r->cached_head > r->mask)
+    {
+        r->cached_head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        if (tail - r->cached_head > r->mask) return 0;
+    }
+    memcpy(r->buf + (tail & r->mask) * r->elem_size, elem, r->elem_size);
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+int spsc_ring_pop(spsc_ring_t* r, void* elem)
+{
+    size_t head = r->head; // only we write it
+    if (head == r->cached_tail)
+    {
+        r->cached_tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        if (head == r->cached_tail) return 0;
+    }
+    memcpy(elem, r->buf + (head & r->mask) * r->elem_size, r->elem_size);
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+size_t spsc_ring_count(spsc_ring_t* r)
+{
+    size_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    size_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    return tail - head;
+}
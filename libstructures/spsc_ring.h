@@ -0,0 +1,79 @@
+/* 
+ * libstructures - a library for generic data structures in C
+ * Copyright (C) 2005-2008 Avail Media, Inc.
+ * 
+ * Written by Alex Izvorski <aizvorski@gmail.com>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef SPSC_RING_INCLUDE
+#define SPSC_RING_INCLUDE
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SPSC_RING_CACHE_LINE 64
+
+/**
+   Bounded lock-free FIFO of fixed-size elements for exactly one producer
+   thread and one consumer thread. The producer only writes tail, the consumer
+   only writes head; each side keeps a cached copy of the other's index so the
+   shared cache lines are touched only when the cached view runs out.
+ */
+typedef struct
+{
+    uint8_t* buf;
+    size_t mask;                // capacity - 1, capacity is a power of 2
+    size_t elem_size;
+    char _pad0[SPSC_RING_CACHE_LINE];
+
+    size_t head;                // next element to pop, written by the consumer
+    size_t cached_tail;         // consumer's view of tail
+    char _pad1[SPSC_RING_CACHE_LINE];
+
+    size_t tail;                // next free slot, written by the producer
+    size_t cached_head;         // producer's view of head
+    char _pad2[SPSC_RING_CACHE_LINE];
+} spsc_ring_t;
+
+/**
+   Create a ring holding at least capacity elements of elem_size bytes each.
+   @return  the new ring, or NULL if out of memory or capacity is above SIZE_MAX / 2
+ */
+spsc_ring_t* spsc_ring_new(size_t capacity, size_t elem_size);
+void spsc_ring_free(spsc_ring_t* r);
+
+/**
+   Append a copy of *elem. Producer thread only.
+   @return  1 on success, 0 if the ring is full
+ */
+int spsc_ring_push(spsc_ring_t* r, const void* elem);
+
+/**
+   Remove the oldest element into *elem. Consumer thread only.
+   @return  1 on success, 0 if the ring is empty
+ */
+int spsc_ring_pop(spsc_ring_t* r, void* elem);
+
+/**
+   Number of elements in the ring. Exact on either side when the other one is
+   idle, a snapshot otherwise.
+ */
+size_t spsc_ring_count(spsc_ring_t* r);
+
+static inline size_t spsc_ring_capacity(const spsc_ring_t* r) { return r->mask + 1; }
+
+#endif
@@ -0,0 +1,113 @@
+#include "spsc_ring.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "test_macros.h"
+
+int verbose = 0;
+
+#define NUM_STRESS_ELEMS 2000000
+
+typedef struct
+{
+    uint64_t seq;
+    uint32_t check;
+} test_elem_t;
+
+START_TEST (test_spsc_ring_fifo)
+{
+    spsc_ring_t* r = spsc_ring_new(5, sizeof(test_elem_t));
+    test_elem_t e;
+
+    fail_unless( r != NULL, "ring not created" );
+    fail_unless( spsc_ring_capacity(r) == 8, "capacity not rounded up to a power of 2" );
+    fail_unless( spsc_ring_pop(r, &e) == 0, "popped from an empty ring" );
+    fail_unless( spsc_ring_new(SIZE_MAX, 1) == NULL, "capacity overflowed" );
+    fail_unless( spsc_ring_new(SIZE_MAX / 4, sizeof(test_elem_t)) == NULL, "ring size overflowed" );
+
+    // go around a few times so that the indices wrap
+    uint64_t next_in = 0, next_out = 0;
+    for (int round = 0; round < 10; round++)
+    {
+        while (1)
+        {
+            e.seq = next_in; e.check = (uint32_t)(next_in * 7);
+            if (!spsc_ring_push(r, &e)) break;
+            next_in++;
+        }
+        fail_unless( spsc_ring_count(r) == 8, "ring not full when push fails" );
+        for (int i = 0; i < 3 + round % 5; i++)
+        {
+            fail_unless( spsc_ring_pop(r, &e) == 1, "pop failed" );
+            fail_unless( e.seq == next_out && e.check == (uint32_t)(next_out * 7), "got wrong element" );
+            next_out++;
+        }
+    }
+    while (spsc_ring_pop(r, &e))
+    {
+        fail_unless( e.seq == next_out, "got wrong element" );
+        next_out++;
+    }
+    fail_unless( next_out == next_in, "elements lost" );
+    fail_unless( spsc_ring_count(r) == 0, "ring not empty" );
+
+    spsc_ring_free(r);
+}
+END_TEST
+
+static void* consume(void* arg)
+{
+    spsc_ring_t* r = (spsc_ring_t*)arg;
+    test_elem_t e;
+    uint64_t next = 0;
+    uint64_t* num_bad = (uint64_t*)calloc(1, sizeof(uint64_t));
+
+    while (next < NUM_STRESS_ELEMS)
+    {
+        if (!spsc_ring_pop(r, &e)) { sched_yield(); continue; }
+        if (e.seq != next || e.check != (uint32_t)(next * 7)) (*num_bad)++;
+        next++;
+    }
+    return num_bad;
+}
+
+START_TEST (test_spsc_ring_threads)
+{
+    spsc_ring_t* r = spsc_ring_new(1024, sizeof(test_elem_t));
+    pthread_t consumer;
+    uint64_t* num_bad = NULL;
+    uint64_t num_full = 0;
+
+    fail_unless( pthread_create(&consumer, NULL, consume, r) == 0, "failed to start consumer" );
+    for (uint64_t i = 0; i < NUM_STRESS_ELEMS; i++)
+    {
+        test_elem_t e = { i, (uint32_t)(i * 7) };
+        while (!spsc_ring_push(r, &e)) { num_full++; sched_yield(); }
+    }
+    pthread_join(consumer, (void**)&num_bad);
+
+    fail_unless( num_bad != NULL && *num_bad == 0, "consumer got elements out of order" );
+    fail_unless( spsc_ring_count(r) == 0, "ring not empty" );
+    if (verbose) { printf("%d elements, producer found the ring full %lu times\n", NUM_STRESS_ELEMS, (unsigned long)num_full); }
+
+    free(num_bad);
+    spsc_ring_free(r);
+}
+END_TEST
+
+int main(int argc, char** argv)
+{
+    int _testnum = 1;
+
+    if (argc > 1 && strcmp(argv[1], "-v") == 0) verbose = 1;
+
+    ok( test_spsc_ring_fifo() , "fifo");
+    ok( test_spsc_ring_threads() , "threads");
+
+    return 0;
+}
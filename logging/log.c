@@ -34,8 +34,8 @@
 
 #include "log.h"
 
-int tslib_loglevel = TSLIB_LOG_LEVEL_INFO; 
-FILE* tslib_logfile = NULL;
+__thread int tslib_loglevel = TSLIB_LOG_LEVEL_INFO; 
+__thread FILE* tslib_logfile = NULL;
 
 
 #define INDENT_LEVEL	4
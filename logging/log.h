@@ -44,11 +44,13 @@ extern "C" {
 #include <errno.h>
 #include <stdlib.h>
 
+// log level and log file are per-thread: each thread starts at TSLIB_LOG_LEVEL_INFO,
+// logging to stdout, and set_log_file/cleanup_log_file only affect the calling thread.
 int set_log_file(char * logFilePath);
 void cleanup_log_file();
 
-extern int tslib_loglevel;
-extern FILE* tslib_logfile;
+extern __thread int tslib_loglevel;
+extern __thread FILE* tslib_logfile;
 
 
 
@@ -75,7 +77,7 @@ extern FILE* tslib_logfile;
 int skit_log_struct(int level, char *name, uint64_t value, int type, char *str);
 
 // More traditional debug logging
-// tslib-global loglevel: error > warn (default) > info > debug
+// tslib per-thread loglevel: error > warn (default) > info > debug
 #define TSLIB_LOG_LEVEL_ERROR		1
 #define TSLIB_LOG_LEVEL_WARN		((TSLIB_LOG_LEVEL_ERROR) + 1)
 #define TSLIB_LOG_LEVEL_INFO		((TSLIB_LOG_LEVEL_ERROR) + 2)
@@ -0,0 +1,354 @@
+/*
+
+ Copyright (c) 2012-, ISO/IEC JTC1/SC29/WG11
+ Written by Alex Giladi <alex.giladi@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of the ISO/IEC nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bs.h"
+#include "log.h"
+#include "ts.h"
+#include "ts_test_util.h"
+#include "test_macros.h"
+
+int verbose = 0;
+
+// Bit-at-a-time reader, as bs.h used to implement it; reference for
+// correctness and the "before" side of the benchmarks.
+
+static uint32_t ref_read_u(bs_t *b, int n)
+{
+   if (!b || bs_eof(b)) return 0;
+   uint32_t result = 0;
+   while (n--)
+   {
+      result <<= 1;
+      result |= bs_read_u1(b);
+   }
+   return result;
+}
+
+static uint64_t ref_read_ull(bs_t *b, int n)
+{
+   if (!b || bs_eof(b) || n < 1) return 0;
+   uint64_t r = 0;
+   while (n--) r |= ((uint64_t)bs_read_u1(b) << n);
+   return r;
+}
+
+static void ref_skip_u(bs_t *b, int n)
+{
+   if (!b || bs_eof(b)) return;
+   while (n--) bs_skip_u1(b);
+}
+
+static uint32_t ref_read_ue(bs_t *b)
+{
+   int i = 0;
+   while ((bs_read_u1(b) == 0) && (i < 32) && !bs_eof(b)) i++;
+   int32_t result = ref_read_u(b, i);
+   result += (int32_t)((1ULL << i) - 1);
+   return result;
+}
+
+static int32_t ref_read_se(bs_t *b)
+{
+   int32_t result = ref_read_ue(b);
+   if (result & 1) result = (result + 1) >> 1;
+   else result = -(result >> 1);
+   return result;
+}
+
+// Same syntax parsed with either reader
+
+#define DEFINE_TS_HEADER_PARSER(name, read_u) \
+   static uint32_t name(bs_t *b) \
+   { \
+      uint32_t r = bs_read_u8(b); \
+      r += bs_read_u1(b); \
+      r += bs_read_u1(b); \
+      r += bs_read_u1(b); \
+      r += read_u(b, 13); \
+      r += read_u(b, 2); \
+      r += read_u(b, 2); \
+      r += read_u(b, 4); \
+      return r; \
+   }
+
+// 7.3.3 slice_header(), P slice with a single reference, no weighting
+#define DEFINE_SLICE_HEADER_PARSER(name, read_u, read_ue, read_se) \
+   static uint32_t name(bs_t *b) \
+   { \
+      uint32_t r = read_u(b, 8);   /* NAL header */ \
+      r += read_ue(b);             /* first_mb_in_slice */ \
+      r += read_ue(b);             /* slice_type */ \
+      r += read_ue(b);             /* pic_parameter_set_id */ \
+      r += read_u(b, 9);           /* frame_num */ \
+      r += read_u(b, 10);          /* pic_order_cnt_lsb */ \
+      r += bs_read_u1(b);          /* num_ref_idx_active_override_flag */ \
+      r += bs_read_u1(b);          /* ref_pic_list_modification_flag_l0 */ \
+      r += bs_read_u1(b);          /* adaptive_ref_pic_marking_mode_flag */ \
+      r += read_ue(b);             /* cabac_init_idc */ \
+      r += read_se(b);             /* slice_qp_delta */ \
+      r += read_ue(b);             /* disable_deblocking_filter_idc */ \
+      r += read_se(b);             /* slice_alpha_c0_offset_div2 */ \
+      r += read_se(b);             /* slice_beta_offset_div2 */ \
+      return r; \
+   }
+
+DEFINE_TS_HEADER_PARSER(ref_parse_ts_header, ref_read_u)
+DEFINE_TS_HEADER_PARSER(parse_ts_header, bs_read_u)
+DEFINE_SLICE_HEADER_PARSER(ref_parse_slice_header, ref_read_u, ref_read_ue, ref_read_se)
+DEFINE_SLICE_HEADER_PARSER(parse_slice_header, bs_read_u, bs_read_ue, bs_read_se)
+
+// minimal bit writer for building slice headers
+typedef struct
+{
+   uint8_t *buf;
+   int pos;
+} bit_writer_t;
+
+static void put_u(bit_writer_t *w, int n, uint32_t v)
+{
+   while (n--)
+   {
+      if ((v >> n) & 1) w->buf[w->pos >> 3] |= 0x80 >> (w->pos & 7);
+      w->pos++;
+   }
+}
+
+static void put_ue(bit_writer_t *w, uint32_t v)
+{
+   int len = 0;
+   while (((uint64_t)v + 1) >> (len + 1)) len++;
+   put_u(w, len, 0);
+   put_u(w, len + 1, v + 1);
+}
+
+static void put_se(bit_writer_t *w, int32_t v)
+{
+   put_ue(w, v > 0 ? 2 * v - 1 : -2 * v);
+}
+
+static int write_slice_header(uint8_t *buf, int i)
+{
+   bit_writer_t w = { buf, 0 };
+   memset(buf, 0, 32);
+   put_u(&w, 8, 0x41);
+   put_ue(&w, (i * 37) % 8160);
+   put_ue(&w, 5);
+   put_ue(&w, 0);
+   put_u(&w, 9, i & 0x1FF);
+   put_u(&w, 10, (2 * i) & 0x3FF);
+   put_u(&w, 1, 0);
+   put_u(&w, 1, 0);
+   put_u(&w, 1, 0);
+   put_ue(&w, i % 3);
+   put_se(&w, (i % 11) - 5);
+   put_ue(&w, 0);
+   put_se(&w, (i % 3) - 1);
+   put_se(&w, (i % 5) - 2);
+   put_u(&w, 1, 1);                             // rbsp_stop_one_bit
+   return (w.pos + 7) >> 3;
+}
+
+#define SAME_STATE(b1, b2) ((b1).p == (b2).p && (b1).bits_left == (b2).bits_left)
+
+START_TEST(test_bs_against_reference)
+{
+   uint8_t buf[64];
+   srand(1234);
+
+   for (int iter = 0; iter < 200000 && rc; iter++)
+   {
+      int size = 1 + rand() % 24;
+      for (int i = 0; i < size; i++)
+      {
+         // mostly zeros so that long exp-golomb prefixes show up
+         buf[i] = (rand() % 4 == 0) ? (uint8_t)rand() : 0;
+      }
+
+      bs_t b1 = { NULL, NULL, NULL, 8 }, b2 = b1;
+      bs_init(&b1, buf, size);
+      bs_init(&b2, buf, size);
+
+      for (int op = 0; op < 12 && rc; op++)
+      {
+         int n = rand() % 65;
+         uint64_t v1 = 0, v2 = 0;
+         switch (rand() % 6)
+         {
+         case 0:
+            if (n > 32) n = 1 + n % 32;
+            v1 = bs_read_u(&b1, n); v2 = ref_read_u(&b2, n);
+            break;
+         case 1:
+            v1 = bs_read_ull(&b1, n); v2 = ref_read_ull(&b2, n);
+            break;
+         case 2:
+            bs_skip_u(&b1, n); ref_skip_u(&b2, n);
+            break;
+         case 3:
+            v1 = bs_read_ue(&b1); v2 = ref_read_ue(&b2);
+            break;
+         case 4:
+            v1 = (uint32_t)bs_read_se(&b1); v2 = (uint32_t)ref_read_se(&b2);
+            break;
+         case 5:
+            v1 = bs_read_u8(&b1); v2 = ref_read_u(&b2, 8);
+            break;
+         }
+         fail_unless2(v1 == v2 && SAME_STATE(b1, b2), "mismatch", "iter %d op %d", iter, op);
+         fail_unless(!bs_overrun(&b1), "overrun");
+      }
+   }
+}
+END_TEST
+
+START_TEST(test_bs_read_uN)
+{
+   uint8_t buf[] = { 0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF, 0xF0 };
+   bs_t b;
+
+   bs_init(&b, buf, sizeof(buf));
+   fail_unless(bs_read_u16(&b) == 0x0123, "u16");
+   fail_unless(bs_read_u24(&b) == 0x456789, "u24");
+   fail_unless(bs_read_u32(&b) == 0xABCDEFF0, "u32");
+   fail_unless(bs_eof(&b) && !bs_overrun(&b), "eof");
+
+   bs_init(&b, buf, sizeof(buf));
+   bs_skip_u(&b, 4);
+   fail_unless(bs_read_u64(&b) == 0x123456789ABCDEFFULL, "unaligned u64");
+   fail_unless(bs_read_u(&b, 4) == 0, "last nibble");
+   fail_unless(bs_eof(&b) && bs_read_u(&b, 8) == 0, "read past end");
+}
+END_TEST
+
+START_TEST(test_bs_benchmark)
+{
+   const int num_packets = 1000;
+   const int num_repeats = 2000;
+   const int num_slices = 1000;
+   uint8_t *ts_buf = malloc(num_packets * TS_SIZE);
+   uint8_t *slice_buf = calloc(num_slices, 32);
+   int *slice_len = malloc(num_slices * sizeof(int));
+   uint32_t sum_ref = 0, sum = 0;
+   uint64_t t1, t2, t_ref, t_new;
+
+   for (int i = 0; i < num_packets; i++)
+   {
+      ts_test_write_pes_packet(ts_buf + i * TS_SIZE, 0x100 + i % 16, i, i % 50 == 0, 0xE0, i * 3003, 0);
+   }
+   for (int i = 0; i < num_slices; i++) slice_len[i] = write_slice_header(slice_buf + i * 32, i);
+
+   bs_t b;
+   t1 = gettimeusec();
+   for (int r = 0; r < num_repeats; r++)
+   {
+      for (int i = 0; i < num_packets; i++)
+      {
+         bs_init(&b, ts_buf + i * TS_SIZE, TS_SIZE);
+         sum_ref += ref_parse_ts_header(&b);
+      }
+   }
+   t2 = gettimeusec(); t_ref = t2 - t1 + 1;
+   for (int r = 0; r < num_repeats; r++)
+   {
+      for (int i = 0; i < num_packets; i++)
+      {
+         bs_init(&b, ts_buf + i * TS_SIZE, TS_SIZE);
+         sum += parse_ts_header(&b);
+      }
+   }
+   t1 = gettimeusec(); t_new = t1 - t2 + 1;
+   fail_unless(sum == sum_ref, "TS header parse mismatch");
+   printf("# TS header: %.1f ns bit-at-a-time, %.1f ns word-at-a-time\n",
+          t_ref * 1000.0 / ((double)num_packets * num_repeats),
+          t_new * 1000.0 / ((double)num_packets * num_repeats));
+
+   ts_header_t tsh;
+   t1 = gettimeusec();
+   for (int r = 0; r < num_repeats; r++)
+   {
+      for (int i = 0; i < num_packets; i++)
+      {
+         bs_init(&b, ts_buf + i * TS_SIZE, TS_SIZE);
+         ts_read_header(&tsh, &b);
+      }
+   }
+   t2 = gettimeusec();
+   printf("# ts_read_header: %.1f ns\n", (t2 - t1 + 1) * 1000.0 / ((double)num_packets * num_repeats));
+
+   sum = sum_ref = 0;
+   t1 = gettimeusec();
+   for (int r = 0; r < num_repeats; r++)
+   {
+      for (int i = 0; i < num_slices; i++)
+      {
+         bs_init(&b, slice_buf + i * 32, slice_len[i]);
+         sum_ref += ref_parse_slice_header(&b);
+      }
+   }
+   t2 = gettimeusec(); t_ref = t2 - t1 + 1;
+   for (int r = 0; r < num_repeats; r++)
+   {
+      for (int i = 0; i < num_slices; i++)
+      {
+         bs_init(&b, slice_buf + i * 32, slice_len[i]);
+         sum += parse_slice_header(&b);
+      }
+   }
+   t1 = gettimeusec(); t_new = t1 - t2 + 1;
+   fail_unless(sum == sum_ref, "slice header parse mismatch");
+   printf("# H.264 slice header: %.1f ns bit-at-a-time, %.1f ns word-at-a-time\n",
+          t_ref * 1000.0 / ((double)num_slices * num_repeats),
+          t_new * 1000.0 / ((double)num_slices * num_repeats));
+
+   free(ts_buf);
+   free(slice_buf);
+   free(slice_len);
+}
+END_TEST
+
+int main(int argc, char **argv)
+{
+   int _testnum = 1;
+   int failed = 0;
+   int r;
+
+   if (argc > 1 && strcmp(argv[1], "-v") == 0) verbose = 1;
+   tslib_loglevel = verbose ? TSLIB_LOG_LEVEL_INFO : TSLIB_LOG_LEVEL_ERROR;
+
+   r = test_bs_against_reference(); ok(r, "bs_against_reference"); failed += !r;
+   r = test_bs_read_uN(); ok(r, "bs_read_uN"); failed += !r;
+   r = test_bs_benchmark(); ok(r, "bs_benchmark"); failed += !r;
+
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -60,6 +60,26 @@ static inline crc_t crc_init(void)
 crc_t crc_update(crc_t crc, const unsigned char *data, size_t data_len);
 
 
+/**
+ * crc_update implementations, see crc_set_impl.
+ *****************************************************************************/
+#define CRC_IMPL_AUTO       0   /* fastest one supported by the CPU */
+#define CRC_IMPL_TABLE      1   /* byte-wise table-driven, as generated by pycrc */
+#define CRC_IMPL_SLICE8     2   /* slicing-by-8 */
+#define CRC_IMPL_PCLMUL     3   /* carry-less multiplication folding (x86 PCLMULQDQ) */
+
+
+/**
+ * Select the crc_update implementation.
+ * By default the fastest one supported by the CPU is picked on first use.
+ * All implementations produce the same crc values.
+ *
+ * \param impl     One of CRC_IMPL_*.
+ * \return         1 if the implementation is available, 0 otherwise (selection unchanged).
+ *****************************************************************************/
+int crc_set_impl(int impl);
+
+
 /**
  * Calculate the final crc value.
  *
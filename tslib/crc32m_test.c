@@ -0,0 +1,196 @@
+/*
+
+ Copyright (c) 2012-, ISO/IEC JTC1/SC29/WG11
+ Written by Alex Giladi <alex.giladi@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of the ISO/IEC nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "crc32m.h"
+#include "ts_test_util.h"
+#include "test_macros.h"
+
+#define BENCH_BUF_SIZE (64 << 20)
+
+int verbose = 0;
+
+static const int impls[] = { CRC_IMPL_TABLE, CRC_IMPL_SLICE8, CRC_IMPL_PCLMUL };
+static const char *impl_names[] = { "table", "slicing-by-8", "PCLMULQDQ" };
+#define NUM_IMPLS ((int)(sizeof(impls) / sizeof(impls[0])))
+
+// bit-at-a-time CRC-32/MPEG-2, straight from the definition
+static crc_t ref_crc(const uint8_t *data, size_t len)
+{
+   crc_t crc = 0xffffffff;
+   for (size_t i = 0; i < len; i++)
+   {
+      crc ^= (crc_t)data[i] << 24;
+      for (int b = 0; b < 8; b++) crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+   }
+   return crc;
+}
+
+static crc_t crc_of(const uint8_t *data, size_t len)
+{
+   return crc_finalize(crc_update(crc_init(), data, len));
+}
+
+static void fill_random(uint8_t *buf, size_t size)
+{
+   uint32_t x32 = 2463534242u;
+   for (size_t i = 0; i < size; i++)
+   {
+      x32 ^= x32 << 13; x32 ^= x32 >> 17; x32 ^= x32 << 5;
+      buf[i] = (uint8_t)(x32 >> 24);
+   }
+}
+
+START_TEST(test_crc_vectors)
+{
+   uint8_t section[1024];
+   uint8_t zeros[256];
+   uint32_t program_numbers[] = { 1, 2, 3 };
+   uint32_t pids[] = { 0x100, 0x200, 0x300 };
+   uint32_t stream_types[] = { 0x1B, 0x0F, 0x86 };
+   uint32_t es_pids[] = { 0x101, 0x102, 0x103 };
+
+   memset(zeros, 0, sizeof(zeros));
+
+   for (int k = 0; k < NUM_IMPLS; k++)
+   {
+      if (!crc_set_impl(impls[k]))
+      {
+         printf("# %s not supported, skipped\n", impl_names[k]);
+         continue;
+      }
+
+      // check value from the CRC catalogue
+      fail_unless2(crc_of((const uint8_t *)"123456789", 9) == 0x0376e6e7, impl_names[k],
+                   "check value %08x", crc_of((const uint8_t *)"123456789", 9));
+      fail_unless2(crc_of(zeros, 0) == 0xffffffff, impl_names[k], "empty %08x", crc_of(zeros, 0));
+      fail_unless2(crc_of(zeros, 4) == 0xc704dd7b, impl_names[k], "4 zeros %08x", crc_of(zeros, 4));
+      fail_unless2(crc_of(zeros, sizeof(zeros)) == ref_crc(zeros, sizeof(zeros)), impl_names[k],
+                   "256 zeros %08x", crc_of(zeros, sizeof(zeros)));
+
+      // a section followed by its CRC_32 checks to 0, which is how PSI is validated
+      int len = ts_test_build_pat(section, 0, 3, program_numbers, pids);
+      fail_unless2(crc_of(section, len) == 0, impl_names[k], "PAT residue %08x", crc_of(section, len));
+      len = ts_test_build_pmt(section, 0, 1, 0x101, 3, stream_types, es_pids);
+      fail_unless2(crc_of(section, len) == 0, impl_names[k], "PMT residue %08x", crc_of(section, len));
+
+      // maximum size private section with random content
+      fill_random(section, sizeof(section) - 4);
+      ts_test_put_crc(section, sizeof(section) - 4);
+      fail_unless2(crc_of(section, sizeof(section)) == 0, impl_names[k], "1024 byte residue %08x",
+                   crc_of(section, sizeof(section)));
+   }
+
+   crc_set_impl(CRC_IMPL_AUTO);
+}
+END_TEST
+
+// every length around the SIMD block sizes, every alignment, and split updates
+START_TEST(test_crc_random)
+{
+   uint8_t *buf = malloc(4096 + 16);
+   fill_random(buf, 4096 + 16);
+
+   for (int k = 0; k < NUM_IMPLS; k++)
+   {
+      if (!crc_set_impl(impls[k])) continue;
+
+      for (size_t len = 0; len <= 4096; len += (len < 300) ? 1 : 61)
+      {
+         for (int align = 0; align < 16; align += (len < 300) ? 5 : 1)
+         {
+            crc_t expected = ref_crc(buf + align, len);
+            crc_t actual = crc_of(buf + align, len);
+            fail_unless2(actual == expected, impl_names[k], "len %zu align %d: %08x != %08x", len, align, actual, expected);
+         }
+      }
+
+      for (int t = 0; t < 2000; t++)
+      {
+         size_t len = rand() % 4096;
+         size_t split = len ? rand() % len : 0;
+         crc_t crc = crc_update(crc_init(), buf, split);
+         crc = crc_finalize(crc_update(crc, buf + split, len - split));
+         fail_unless2(crc == ref_crc(buf, len), impl_names[k], "len %zu split %zu", len, split);
+      }
+   }
+
+   crc_set_impl(CRC_IMPL_AUTO);
+   free(buf);
+}
+END_TEST
+
+START_TEST(test_crc_benchmark)
+{
+   uint8_t *buf = malloc(BENCH_BUF_SIZE);
+   fill_random(buf, BENCH_BUF_SIZE);
+   crc_t crc0 = 0;
+
+   for (int k = 0; k < NUM_IMPLS; k++)
+   {
+      if (!crc_set_impl(impls[k])) continue;
+
+      // one large buffer, and the same data as 1 KB sections
+      uint64_t t1 = gettimeusec();
+      crc_t crc = crc_of(buf, BENCH_BUF_SIZE);
+      uint64_t t2 = gettimeusec();
+      crc_t sum = 0;
+      for (size_t i = 0; i < BENCH_BUF_SIZE; i += 1024) sum ^= crc_of(buf + i, 1024);
+      uint64_t t3 = gettimeusec();
+
+      if (k == 0) crc0 = crc;
+      fail_unless2(crc == crc0, impl_names[k], "%08x != %08x", crc, crc0);
+      printf("# %s: %d MB %.0f MB/s, 1 KB sections %.0f MB/s (%08x)\n", impl_names[k], BENCH_BUF_SIZE >> 20,
+             (double)BENCH_BUF_SIZE / (t2 - t1 + 1), (double)BENCH_BUF_SIZE / (t3 - t2 + 1), sum);
+   }
+
+   crc_set_impl(CRC_IMPL_AUTO);
+   free(buf);
+}
+END_TEST
+
+int main(int argc, char **argv)
+{
+   int _testnum = 1;
+   int failed = 0;
+   int r;
+
+   if (argc > 1 && strcmp(argv[1], "-v") == 0) verbose = 1;
+   srand(1);
+
+   r = test_crc_vectors(); ok(r, "crc_vectors"); failed += !r;
+   r = test_crc_random(); ok(r, "crc_random"); failed += !r;
+   r = test_crc_benchmark(); ok(r, "crc_benchmark"); failed += !r;
+
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
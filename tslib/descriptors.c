@@ -32,20 +32,23 @@
 #include "log.h"
 #include "ebp.h"
 
-#include <hashtable.h>
-#include <hashtable_str.h>
+// descriptor tags are 8 bits, so the registry is a plain array indexed by tag.
+// entries are published with atomic stores and never freed, so streams on
+// different threads can look them up without taking a lock.
+static descriptor_table_entry_t *g_descriptor_table[DESCRIPTOR_TABLE_SIZE]; 
+static int g_descriptors_initialized = 0; 
 
-
-DEFINE_HASHTABLE_INSERT(descriptor_table_insert, uint32_t, descriptor_table_entry_t);
-DEFINE_HASHTABLE_SEARCH(descriptor_table_search, uint32_t, descriptor_table_entry_t);
-DEFINE_HASHTABLE_REMOVE(descriptor_table_remove, uint32_t, descriptor_table_entry_t);
-
-static hashtable_t *g_descriptor_table = NULL;
+static descriptor_table_entry_t* descriptor_table_search(uint32_t tag)
+{
+   if (tag >= DESCRIPTOR_TABLE_SIZE) return NULL; 
+   return __atomic_load_n(&g_descriptor_table[tag], __ATOMIC_ACQUIRE); 
+}
 
 int register_descriptor(descriptor_table_entry_t *desc)
 {
-   descriptor_table_remove(g_descriptor_table, &desc->tag);
-   return descriptor_table_insert(g_descriptor_table, &desc->tag, desc);
+   if (desc == NULL || desc->tag >= DESCRIPTOR_TABLE_SIZE) return 0; 
+   __atomic_store_n(&g_descriptor_table[desc->tag], desc, __ATOMIC_RELEASE); 
+   return 1;
 }
 
 // "factory methods"
@@ -97,7 +100,7 @@ void descriptor_free(descriptor_t *desc)
 { 
    if (desc == NULL) return;
    descriptor_table_entry_t *dte =
-         descriptor_table_search(g_descriptor_table, &desc->tag);
+         descriptor_table_search(desc->tag);
    if (dte == NULL) return;
 
    dte->free_descriptor(desc);
@@ -121,7 +124,7 @@ descriptor_t* descriptor_read(descriptor_t *desc, bs_t *b)
 
    if (desc == NULL || b == NULL) return NULL;
    descriptor_table_entry_t *dte =
-         descriptor_table_search(g_descriptor_table, &desc->tag);
+         descriptor_table_search(desc->tag);
    
    if (dte != NULL)
    {
@@ -143,7 +146,7 @@ int descriptor_print(const descriptor_t *desc, int level, char *str, size_t str_
    if (desc == NULL || str == NULL || str_len < 2 || tslib_loglevel < TSLIB_LOG_LEVEL_INFO) return 0; 
    int bytes = 0; 
    descriptor_table_entry_t *dte =
-         descriptor_table_search(g_descriptor_table, (uint32_t*)&desc->tag);
+         descriptor_table_search(desc->tag);
 
    if (dte != NULL)
    {
@@ -757,64 +760,31 @@ int ac3_descriptor_print(const descriptor_t *desc, int level, char *str, size_t
 }
 
 
+static descriptor_table_entry_t g_builtin_descriptors[] = 
+{
+   { ISO_639_LANGUAGE_DESCRIPTOR, language_descriptor_read, language_descriptor_print, language_descriptor_free }, 
+   { COMPONENT_NAME_DESCRIPTOR, component_name_descriptor_read, component_name_descriptor_print, component_name_descriptor_free }, 
+   { AC3_DESCRIPTOR, ac3_descriptor_read, ac3_descriptor_print, ac3_descriptor_free }, 
+   { CA_DESCRIPTOR, ca_descriptor_read, ca_descriptor_print, ca_descriptor_free }, 
+   { MAXIMUM_BITRATE_DESCRIPTOR, max_bitrate_descriptor_read, max_bitrate_descriptor_print, max_bitrate_descriptor_free }, 
+   { EBP_DESCRIPTOR, ebp_descriptor_read, ebp_descriptor_print, ebp_descriptor_free }, 
+}; 
+
 void init_descriptors()
 {
-   if (g_descriptor_table != NULL)
+   // racing threads all register the same entries
+   if (__atomic_load_n(&g_descriptors_initialized, __ATOMIC_ACQUIRE)) 
       return;
 
-   g_descriptor_table =
-         hashtable_new(hashtable_hashfn_uint32, hashtable_eqfn_uint32);
-
-   // Register our known descriptors
-   descriptor_table_entry_t *d;
-
-   // ISO 639 language
-   d = calloc(1, sizeof(descriptor_table_entry_t));
-   d->tag = ISO_639_LANGUAGE_DESCRIPTOR;
-   d->free_descriptor = language_descriptor_free;
-   d->print_descriptor = language_descriptor_print;
-   d->read_descriptor = language_descriptor_read;
-   register_descriptor(d);
-
-   // Component Name Descriptor
-   d = calloc(1, sizeof(descriptor_table_entry_t));
-   d->tag = COMPONENT_NAME_DESCRIPTOR;
-   d->free_descriptor = component_name_descriptor_free;
-   d->print_descriptor = component_name_descriptor_print;
-   d->read_descriptor = component_name_descriptor_read;
-   register_descriptor(d);
-
-   // Component Name Descriptor
-   d = calloc(1, sizeof(descriptor_table_entry_t));
-   d->tag = AC3_DESCRIPTOR;
-   d->free_descriptor = ac3_descriptor_free;
-   d->print_descriptor = ac3_descriptor_print;
-   d->read_descriptor = ac3_descriptor_read;
-   register_descriptor(d);
-
-   // CA descriptor
-   d = calloc(1, sizeof(descriptor_table_entry_t));
-   d->tag = CA_DESCRIPTOR;
-   d->free_descriptor = ca_descriptor_free;
-   d->print_descriptor = ca_descriptor_print;
-   d->read_descriptor = ca_descriptor_read;
-   register_descriptor(d);
-
-   // Max bitrate descriptor
-   d = calloc(1, sizeof(descriptor_table_entry_t));
-   d->tag = MAXIMUM_BITRATE_DESCRIPTOR;
-   d->free_descriptor = max_bitrate_descriptor_free;
-   d->print_descriptor = max_bitrate_descriptor_print;
-   d->read_descriptor = max_bitrate_descriptor_read;
-   register_descriptor(d);
-
-   // EBP descriptor
-   d = (descriptor_table_entry_t *) calloc(1, sizeof(descriptor_table_entry_t));
-   d->tag = EBP_DESCRIPTOR;
-   d->free_descriptor = ebp_descriptor_free;
-   d->print_descriptor = ebp_descriptor_print;
-   d->read_descriptor = ebp_descriptor_read;
-   register_descriptor(d);
+   // Register our known descriptors, unless the application already replaced them
+   for (size_t i = 0; i < sizeof(g_builtin_descriptors) / sizeof(g_builtin_descriptors[0]); i++) 
+   {
+      descriptor_table_entry_t *d = &g_builtin_descriptors[i]; 
+      descriptor_table_entry_t *expected = NULL; 
+      __atomic_compare_exchange_n(&g_descriptor_table[d->tag], &expected, d, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED); 
+   }
+
+   __atomic_store_n(&g_descriptors_initialized, 1, __ATOMIC_RELEASE); 
 }
 
 /*
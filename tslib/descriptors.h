@@ -112,11 +112,16 @@ typedef struct {
    descriptor_destructor_t free_descriptor;
 } descriptor_table_entry_t; 
 
+#define DESCRIPTOR_TABLE_SIZE 256   /// one registry slot per 8-bit descriptor tag
+
 // Must be called to initialize known descriptors and the descriptor
-// registration system
+// registration system. Safe to call from any number of threads; only
+// the first call does anything.
 void init_descriptors();
 
-// Register a new descriptor to be parsed by the system
+// Register a new descriptor to be parsed by the system, replacing any
+// previous entry for desc->tag. The entry is used by all streams, so it
+// must stay valid until the process exits. Returns 0 if the tag is invalid.
 int register_descriptor(descriptor_table_entry_t *desc);
 
 // "factory methods"
@@ -25,8 +25,11 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <string.h>
 #include <ebp.h>
+#include <ebp_validator.h>
 #include <bs.h>
+#include <pes.h>
 #include <arpa/inet.h>
 
 
@@ -43,158 +46,283 @@ void ebp_free(ebp_t *ebp)
    }
 }
 
-int ebp_read(ebp_t *ebp, ts_scte128_private_data_t *scte128)
+int ebp_decode(ebp_info_t *ebp, const uint8_t *buf, size_t len)
 {
-   if (ebp == NULL || scte128 == NULL)
+   if (ebp == NULL || buf == NULL)
    {
       return 0;
    }
 
-   bs_t *b = bs_new(scte128->private_data_bytes.bytes, scte128->private_data_bytes.len);
-
-   ebp->ebp_fragment_flag = bs_read_u1(b);
-   ebp->ebp_segment_flag = bs_read_u1(b);
-   ebp->ebp_sap_flag = bs_read_u1(b);
-   ebp->ebp_grouping_flag = bs_read_u1(b);
-   ebp->ebp_time_flag = bs_read_u1(b);
-   ebp->ebp_concealment_flag = bs_read_u1(b);
+   memset(ebp, 0, sizeof(ebp_info_t));
 
-   bs_skip_u1(b);
+   // every field is byte aligned, so this is read a byte at a time
+   const uint8_t *p = buf;
+   const uint8_t *end = buf + len;
 
-   ebp->ebp_extension_flag = bs_read_u1(b);
+   if (p == end) return 0;
+   ebp->ebp_fragment_flag = (*p >> 7) & 1;
+   ebp->ebp_segment_flag = (*p >> 6) & 1;
+   ebp->ebp_sap_flag = (*p >> 5) & 1;
+   ebp->ebp_grouping_flag = (*p >> 4) & 1;
+   ebp->ebp_time_flag = (*p >> 3) & 1;
+   ebp->ebp_concealment_flag = (*p >> 2) & 1;
+   ebp->ebp_extension_flag = *p & 1;
+   p++;
 
    if (ebp->ebp_extension_flag)
    {
-      ebp->ebp_ext_partition_flag = bs_read_u1(b);
-      bs_skip_u(b,7);
+      if (p == end) return 0;
+      ebp->ebp_ext_partition_flag = (*p++ >> 7) & 1;
    }
 
    if (ebp->ebp_sap_flag)
    {
-      ebp->ebp_sap_type = bs_read_u(b, 3);
-      bs_skip_u(b, 5);
+      if (p == end) return 0;
+      ebp->ebp_sap_type = *p++ >> 5;
    }
 
    if (ebp->ebp_grouping_flag)
    {
-      ebp->ebp_grouping_ids = vqarray_new();
       uint32_t more = 1;
       while (more)
       {
-         more = bs_read_u1(b);
-         uint32_t *grouping_id = calloc(1, sizeof(uint32_t));
-         *grouping_id = bs_read_u(b, 7);
-         vqarray_add(ebp->ebp_grouping_ids, (vqarray_elem_t*)grouping_id);
+         if (p == end) return 0;
+         more = *p >> 7;
+         if (ebp->num_grouping_ids < EBP_MAX_GROUPING_IDS)
+         {
+            ebp->grouping_ids[ebp->num_grouping_ids] = *p & 0x7F;
+         }
+         ebp->num_grouping_ids++;
+         p++;
       }
-
    }
 
    if (ebp->ebp_time_flag)
    {
-      ebp->ebp_acquisition_time = bs_read_u64(b);
- //     ebp->ebp_acquisition_time = ntohll(ebp->ebp_acquisition_time);
+      if (end - p < 8) return 0;
+      for (int i = 0; i < 8; i++) ebp->ebp_acquisition_time = (ebp->ebp_acquisition_time << 8) | *p++;
    }
 
    if (ebp->ebp_ext_partition_flag)
    {
-      ebp->ebp_ext_partitions = bs_read_u8(b);
+      if (p == end) return 0;
+      ebp->ebp_ext_partitions = *p++;
    }
 
-   bs_free (b);
+   return 1;
+}
 
-   ebp_print_stdout(ebp);
+int ebp_read(ebp_t *ebp, ts_scte128_private_data_t *scte128)
+{
+   if (ebp == NULL || scte128 == NULL)
+   {
+      return 0;
+   }
+
+   ebp_info_t info;
+   ebp_decode(&info, scte128->private_data_bytes.bytes, scte128->private_data_bytes.len);
+
+   ebp->ebp_fragment_flag = info.ebp_fragment_flag;
+   ebp->ebp_segment_flag = info.ebp_segment_flag;
+   ebp->ebp_sap_flag = info.ebp_sap_flag;
+   ebp->ebp_grouping_flag = info.ebp_grouping_flag;
+   ebp->ebp_time_flag = info.ebp_time_flag;
+   ebp->ebp_concealment_flag = info.ebp_concealment_flag;
+   ebp->ebp_extension_flag = info.ebp_extension_flag;
+   ebp->ebp_ext_partition_flag = info.ebp_ext_partition_flag;
+   ebp->ebp_sap_type = info.ebp_sap_type;
+   ebp->ebp_acquisition_time = info.ebp_acquisition_time;
+   ebp->ebp_ext_partitions = info.ebp_ext_partitions;
+
+   if (ebp->ebp_grouping_flag)
+   {
+      ebp->ebp_grouping_ids = vqarray_new();
+      for (uint32_t i = 0; i < info.num_grouping_ids && i < EBP_MAX_GROUPING_IDS; i++)
+      {
+         uint32_t *grouping_id = calloc(1, sizeof(uint32_t));
+         *grouping_id = info.grouping_ids[i];
+         vqarray_add(ebp->ebp_grouping_ids, (vqarray_elem_t*)grouping_id);
+      }
+   }
+
+   // a full dump per EBP is too much at INFO level on a live feed
+   if (tslib_loglevel >= TSLIB_LOG_LEVEL_DEBUG)
+   {
+      ebp_print_stdout(ebp);
+   }
 
    return 1;
 }
 
-int ebp_validate_groups(const ebp_t *ebp)
+int ebp_find(const ts_adaptation_field_t *af, buf_t *ebp_data)
 {
-   // GroupId range:
-   //    0: default
-   //    1-31: private
-   //    35: Ad insertion
-   //    126: start
-   //    127: end
-   
-   // For start, group Id is followed by 126; for end it is followed by 127; could
-   // be followed by both 126 and 127.
-   //
-   // except for 126/127, group id cannot appear more than once
-   //
-   // groupid does not require associated 126 or 127
+   if (af == NULL || ebp_data == NULL || af->private_data_bytes.bytes == NULL)
+   {
+      return 0;
+   }
 
+   const uint8_t *p = af->private_data_bytes.bytes;
+   const uint8_t *end = p + af->private_data_bytes.len;
 
-   // check range of each group id
-   // check that no group ids are present more than once
-   // check that every 126 is preceded by another groupid
-   // check that every 127 is preceded by either 126 or another groupid
+   // SCTE-128 items: tag, length, data; EBP is a registered item (tag 0xDF)
+   while (end - p >= 2)
+   {
+      uint32_t tag = p[0];
+      uint32_t length = p[1];
+      p += 2;
+      if (length > (uint32_t)(end - p))
+      {
+         return 0;
+      }
+      if (tag == 0xDF && length >= 4 &&
+          (((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3]) == EBP_FORMAT_IDENTIFIER)
+      {
+         ebp_data->bytes = (uint8_t *)p + 4;
+         ebp_data->len = length - 4;
+         return 1;
+      }
+      p += length;
+   }
 
-   int returnCode = 0;
+   return 0;
+}
+
+void ebp_event_ring_init(ebp_event_ring_t *ring, ebp_event_t *events, uint32_t size)
+{
+   ring->events = events;
+   ring->size = size;
+   ring->head = 0;
+   ring->count = 0;
+   ring->num_dropped = 0;
+}
 
-   if (ebp->ebp_grouping_flag == 0)
+int ebp_event_ring_push(ebp_event_ring_t *ring, const ebp_event_t *event)
+{
+   if (ring->count == ring->size)
    {
-      return returnCode;
+      ring->num_dropped++;
+      return 0;
    }
 
-   // first, check for grouping id duplicates
-   for (int i=0; i<vqarray_length (ebp->ebp_grouping_ids); i++)
+   uint32_t tail = ring->head + ring->count;
+   if (tail >= ring->size) tail -= ring->size;
+   ring->events[tail] = *event;
+   ring->count++;
+   return 1;
+}
+
+int ebp_event_ring_pop(ebp_event_ring_t *ring, ebp_event_t *event)
+{
+   if (ring->count == 0)
    {
-      uint32_t grouping_id_i = *((uint32_t *) vqarray_get (ebp->ebp_grouping_ids, i));
+      return 0;
+   }
 
-      for (int j=0; j<vqarray_length (ebp->ebp_grouping_ids); j++)
-      {
-         if (i==j) continue;
-      
-         uint32_t grouping_id_j = *((uint32_t *) vqarray_get (ebp->ebp_grouping_ids, j));
+   *event = ring->events[ring->head];
+   if (++ring->head == ring->size) ring->head = 0;
+   ring->count--;
+   return 1;
+}
 
-         if (grouping_id_i == grouping_id_j)
-         {
-            LOG_ERROR_ARGS ("ebp_validate_groups: FAIL: duplicate group id %d detected", grouping_id_i);
-            returnCode = -1;
-         }
-      }
+// PTS of the PES header at the start of the payload, if there is one
+static int ebp_read_pes_pts(const ts_packet_t *ts, uint64_t *pts)
+{
+   const uint8_t *p = ts->payload.bytes;
+   if (!ts->header.payload_unit_start_indicator || p == NULL || ts->payload.len < 14)
+   {
+      return 0;
+   }
+   if (p[0] != 0 || p[1] != 0 || p[2] != 1 || !HAS_PES_HEADER(p[3]))
+   {
+      return 0;
+   }
+   if ((p[6] & 0xC0) != 0x80 || !(p[7] & 0x80))   // '10' marker, PTS_DTS_flags
+   {
+      return 0;
    }
 
+   *pts = ((uint64_t)((p[9] >> 1) & 0x07) << 30) | ((uint64_t)p[10] << 22) |
+          ((uint64_t)(p[11] >> 1) << 15) | ((uint64_t)p[12] << 7) | (p[13] >> 1);
+   return 1;
+}
 
-   for (int i=0; i<vqarray_length (ebp->ebp_grouping_ids); i++)
+int ebp_decode_ts_packet(const ts_packet_t *ts, uint64_t packet_offset, ebp_info_t *ebp, ebp_event_ring_t *ring)
+{
+   if (ts == NULL || !(ts->header.adaptation_field_control & TS_ADAPTATION_FIELD) ||
+       !ts->adaptation_field.transport_private_data_flag)
    {
-      uint32_t grouping_id = *((uint32_t *) vqarray_get (ebp->ebp_grouping_ids, i));
+      return 0;
+   }
 
-      if (grouping_id == 126)
-      {
-         if (i == 0)
-         {
-            LOG_ERROR ("ebp_validate_groups: FAIL: orphan group id 126 detected (1)");
-            returnCode = -1;
-            continue;
-         }
+   buf_t ebp_data;
+   if (!ebp_find(&ts->adaptation_field, &ebp_data))
+   {
+      return 0;
+   }
 
-         uint32_t previous_grouping_id = *((uint32_t *) vqarray_get (ebp->ebp_grouping_ids, i-1));
-         if (previous_grouping_id == 126 || previous_grouping_id == 127)
-         {
-            LOG_ERROR ("ebp_validate_groups: FAIL: orphan group id 126 detected (2)");
-            returnCode = -1;
-         }
-      }
-      else if (grouping_id == 127)
-      {
-         if (i == 0)
-         {
-            LOG_ERROR ("ebp_validate_groups: FAIL: orphan group id 127 detected (1)");
-            returnCode = -1;
-            continue;
-         }
+   ebp_info_t local;
+   if (ebp == NULL) ebp = &local;
+   if (!ebp_decode(ebp, ebp_data.bytes, ebp_data.len))
+   {
+      return 0;
+   }
 
-         uint32_t previous_grouping_id = *((uint32_t *) vqarray_get (ebp->ebp_grouping_ids, i-1));
-         if (previous_grouping_id == 127)
-         {
-            LOG_ERROR ("ebp_validate_groups: FAIL: orphan group id 127 detected (2)");
-            returnCode = -1;
-         }
-      }
+   if (ring != NULL)
+   {
+      ebp_event_t event;
+      memset(&event, 0, sizeof(event));
+      event.packet_offset = packet_offset;
+      event.pid = ts->header.PID;
+      event.flags = (ebp->ebp_fragment_flag ? EBP_EVENT_FRAGMENT : 0) |
+                    (ebp->ebp_segment_flag ? EBP_EVENT_SEGMENT : 0) |
+                    (ebp->ebp_sap_flag ? EBP_EVENT_SAP : 0) |
+                    (ebp->ebp_time_flag ? EBP_EVENT_TIME : 0) |
+                    (ebp->ebp_grouping_flag ? EBP_EVENT_GROUPING : 0) |
+                    (ebp->ebp_concealment_flag ? EBP_EVENT_CONCEALMENT : 0);
+      event.sap_type = ebp->ebp_sap_type;
+      event.acquisition_time = ebp->ebp_acquisition_time;
+      if (ebp_read_pes_pts(ts, &event.pts)) event.flags |= EBP_EVENT_PTS;
+      ebp_event_ring_push(ring, &event);
    }
 
-   return returnCode;
+   return 1;
+}
+
+int ebp_validate_groups(const ebp_t *ebp)
+{
+   // see ebp_check_grouping_ids for the rules
+   if (ebp->ebp_grouping_flag == 0 || ebp->ebp_grouping_ids == NULL)
+   {
+      return 0;
+   }
+
+   uint8_t grouping_ids[EBP_MAX_GROUPING_IDS];
+   int num_grouping_ids = vqarray_length(ebp->ebp_grouping_ids);
+   if (num_grouping_ids > EBP_MAX_GROUPING_IDS)
+   {
+      LOG_ERROR_ARGS ("ebp_validate_groups: FAIL: %d group ids, some are duplicates", num_grouping_ids);
+      return -1;
+   }
+   for (int i = 0; i < num_grouping_ids; i++)
+   {
+      grouping_ids[i] = *((uint32_t *) vqarray_get (ebp->ebp_grouping_ids, i));
+   }
+
+   int errors = ebp_check_grouping_ids(grouping_ids, num_grouping_ids);
+   if (errors & EBP_ERROR_GROUP_RANGE)
+   {
+      LOG_ERROR ("ebp_validate_groups: FAIL: reserved group id detected");
+   }
+   if (errors & EBP_ERROR_GROUP_DUPLICATE)
+   {
+      LOG_ERROR ("ebp_validate_groups: FAIL: duplicate group id detected");
+   }
+   if (errors & EBP_ERROR_GROUP_ORDER)
+   {
+      LOG_ERROR ("ebp_validate_groups: FAIL: orphan group id 126 or 127 detected");
+   }
+
+   return errors ? -1 : 0;
 }
 
 ebp_t* ebp_copy(const ebp_t *ebp)
@@ -375,6 +503,7 @@ descriptor_t* ebp_descriptor_read(descriptor_t *desc, bs_t *b)
          vqarray_add(ebp->partition_data, partition_data);
       }
    }
+   ebp_descriptor_build_index(ebp);
 
 //   ebp_descriptor_print_stdout(ebp);
 
@@ -437,6 +566,7 @@ ebp_descriptor_t* ebp_descriptor_copy(const ebp_descriptor_t *ebp_in)
          vqarray_add(ebp->partition_data, partition_data);
       }
    }
+   ebp_descriptor_build_index(ebp);
 
 //   ebp_descriptor_print_stdout(ebp);
 
@@ -476,6 +606,41 @@ void ebp_descriptor_print_stdout(const ebp_descriptor_t *ebp_desc)
    }
 }
 
+void ebp_descriptor_build_index(ebp_descriptor_t *ebp_desc)
+{
+   ebp_partition_index_t *index = &ebp_desc->index;
+   memset(index, 0, sizeof(ebp_partition_index_t));
+
+   int num_partitions = (ebp_desc->partition_data != NULL) ? vqarray_length(ebp_desc->partition_data) : 0;
+   for (int i=0; i<num_partitions; i++)
+   {
+      ebp_partition_data_t* partition = (ebp_partition_data_t *) vqarray_get(ebp_desc->partition_data, i);
+      int id = partition->partition_id & (EBP_MAX_PARTITIONS - 1);
+      if (index->present & (1u << id))
+      {
+         LOG_WARN_ARGS ("ebp_descriptor_build_index: partition %d listed more than once, using the first", id);
+         continue;
+      }
+
+      index->present |= 1u << id;
+      index->partitions[id] = partition;
+      if (partition->ebp_data_explicit_flag)
+      {
+         index->ebp_pids[id] = EBP_PID_SELF;
+         if (partition->boundary_flag) index->boundaries |= 1u << id;
+         if (ebp_desc->ticks_per_second > 0)
+         {
+            index->distances[id] = (uint64_t)partition->ebp_distance * 90000 / ebp_desc->ticks_per_second;
+         }
+      }
+      else
+      {
+         index->ebp_pids[id] = partition->ebp_pid;
+      }
+   }
+   index->valid = 1;
+}
+
 ebp_partition_data_t* get_fragment_partition (const ebp_descriptor_t *ebp_desc)
 {
    return get_partition (ebp_desc, EBP_PARTITION_FRAGMENT);
@@ -488,7 +653,18 @@ ebp_partition_data_t* get_segment_partition (const ebp_descriptor_t *ebp_desc)
 
 ebp_partition_data_t* get_partition (const ebp_descriptor_t *ebp_desc, int partitionId)
 {
-   for (int i=0; i<vqarray_length(ebp_desc->partition_data); i++)
+   if (partitionId < 0 || partitionId >= EBP_MAX_PARTITIONS)
+   {
+      return NULL;
+   }
+   if (ebp_desc->index.valid)
+   {
+      return ebp_desc->index.partitions[partitionId];
+   }
+
+   // descriptor put together without an index
+   int num_partitions = (ebp_desc->partition_data != NULL) ? vqarray_length(ebp_desc->partition_data) : 0;
+   for (int i=0; i<num_partitions; i++)
    {
       ebp_partition_data_t* partition = (ebp_partition_data_t *) vqarray_get(ebp_desc->partition_data, i);
       if (partition->partition_id == partitionId)
@@ -503,80 +679,41 @@ ebp_partition_data_t* get_partition (const ebp_descriptor_t *ebp_desc, int parti
 
 int does_fragment_mark_boundary (const ebp_descriptor_t *ebp_desc)
 {
-   // walk partitions looking for partitionId == 2
-   // then return boundary_flag
-
-   for (int i=0; i<vqarray_length(ebp_desc->partition_data); i++)
-   {
-      ebp_partition_data_t* partition = (ebp_partition_data_t *) vqarray_get(ebp_desc->partition_data, i);
-      if (partition->partition_id == EBP_PARTITION_FRAGMENT)
-      {
-         if (partition->ebp_data_explicit_flag)
-         {
-            return partition->boundary_flag;
-         }
-         else
-         {
-            return 0;
-         }
-      }
-   }
-
-   return 0;
+   ebp_partition_data_t* partition = get_fragment_partition (ebp_desc);
+   return (partition != NULL && partition->ebp_data_explicit_flag) ? partition->boundary_flag : 0;
 }
 
 int does_segment_mark_boundary (const ebp_descriptor_t *ebp_desc)
 {
-   // walk partitions looking for partitionId == 1
-   // then return boundary_flag
-
-   for (int i=0; i<vqarray_length(ebp_desc->partition_data); i++)
-   {
-      ebp_partition_data_t* partition = (ebp_partition_data_t *) vqarray_get(ebp_desc->partition_data, i);
-      if (partition->partition_id == EBP_PARTITION_SEGMENT)
-      {
-         if (partition->ebp_data_explicit_flag)
-         {
-            return partition->boundary_flag;
-         }
-         else
-         {
-            return 0;
-         }
-      }
-   }
-
-   return 0;
+   ebp_partition_data_t* partition = get_segment_partition (ebp_desc);
+   return (partition != NULL && partition->ebp_data_explicit_flag) ? partition->boundary_flag : 0;
 }
 
 uint8_t get_fragment_SAP_max (const ebp_descriptor_t *ebp_desc)
 {
-   // walk partitions looking for partitionId == 1
-   for (int i=0; i<vqarray_length(ebp_desc->partition_data); i++)
-   {
-      ebp_partition_data_t* partition = (ebp_partition_data_t *) vqarray_get(ebp_desc->partition_data, i);
-      if (partition->partition_id == EBP_PARTITION_FRAGMENT)
-      {
-         return partition->sap_type_max;
-      }
-   }
-
-   return 0;
+   ebp_partition_data_t* partition = get_fragment_partition (ebp_desc);
+   return (partition != NULL) ? partition->sap_type_max : 0;
 }
 
 uint8_t get_segment_SAP_max (const ebp_descriptor_t *ebp_desc)
 {
-   // walk partitions looking for partitionId == 1
-   for (int i=0; i<vqarray_length(ebp_desc->partition_data); i++)
+   ebp_partition_data_t* partition = get_segment_partition (ebp_desc);
+   return (partition != NULL) ? partition->sap_type_max : 0;
+}
+
+uint64_t get_partition_distance (const ebp_descriptor_t *ebp_desc, int partitionId)
+{
+   if (ebp_desc->index.valid)
    {
-      ebp_partition_data_t* partition = (ebp_partition_data_t *) vqarray_get(ebp_desc->partition_data, i);
-      if (partition->partition_id == EBP_PARTITION_SEGMENT)
-      {
-         return partition->sap_type_max;
-      }
+      return (partitionId >= 0 && partitionId < EBP_MAX_PARTITIONS) ? ebp_desc->index.distances[partitionId] : 0;
    }
 
-   return 0;
+   ebp_partition_data_t* partition = get_partition (ebp_desc, partitionId);
+   if (partition == NULL || !partition->ebp_data_explicit_flag || ebp_desc->ticks_per_second == 0)
+   {
+      return 0;
+   }
+   return (uint64_t)partition->ebp_distance * 90000 / ebp_desc->ticks_per_second;
 }
 
 uint64_t ntohll(uint64_t num)
@@ -29,6 +29,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define EBP_H_
 
 #include <stdint.h>
+#include <stddef.h>
 #include <vqarray.h>
 #include <ts.h>
 #include <descriptors.h>
@@ -40,6 +41,7 @@ extern "C"
 
 #define EBP_PARTITION_SEGMENT    1
 #define EBP_PARTITION_FRAGMENT   2
+#define EBP_MAX_PARTITIONS       32    // partition_id is 5 bits
 
 typedef struct {
 
@@ -71,6 +73,101 @@ int ebp_validate_groups(const ebp_t *ebp);
 ebp_t* ebp_copy(const ebp_t *ebp);
 void parseNTPTimestamp(uint64_t ntpTime, uint32_t *numSeconds, float *fractionalSecond);
 
+#define EBP_FORMAT_IDENTIFIER    0x45425030  // "EBP0", SCTE-128 format_identifier of EBP
+#define EBP_MAX_GROUPING_IDS     128         // grouping IDs are 7 bits and may not repeat
+
+/**
+ * EBP decoded by ebp_decode: same fields as ebp_t, with the grouping IDs
+ * held inline so that decoding allocates nothing.
+ */
+typedef struct {
+
+   uint8_t ebp_fragment_flag;
+   uint8_t ebp_segment_flag;
+   uint8_t ebp_sap_flag;
+   uint8_t ebp_grouping_flag;
+   uint8_t ebp_time_flag;
+   uint8_t ebp_concealment_flag;
+   uint8_t ebp_extension_flag;
+
+   uint8_t ebp_ext_partition_flag;
+   uint8_t ebp_sap_type;
+   uint8_t ebp_ext_partitions;
+
+   uint32_t num_grouping_ids;       // may exceed EBP_MAX_GROUPING_IDS in a broken EBP, only as many are kept
+   uint8_t grouping_ids[EBP_MAX_GROUPING_IDS];
+
+   uint64_t ebp_acquisition_time;
+
+} ebp_info_t;
+
+/**
+ * Decode an EBP without allocating or logging anything.
+ * @param ebp decoded EBP
+ * @param buf EBP private data (private_data_bytes of the SCTE-128 item)
+ * @param len length of the EBP private data
+ * @return 1 on success, 0 if the data is truncated
+ */
+int ebp_decode(ebp_info_t *ebp, const uint8_t *buf, size_t len);
+
+/**
+ * Locate the EBP in adaptation field private data, without parsing the
+ * SCTE-128 items into the adaptation field.
+ * @return 1 and the EBP private data in ebp_data if found, 0 otherwise
+ */
+int ebp_find(const ts_adaptation_field_t *af, buf_t *ebp_data);
+
+// ebp_event_t flags
+#define EBP_EVENT_FRAGMENT       0x01
+#define EBP_EVENT_SEGMENT        0x02
+#define EBP_EVENT_SAP            0x04        // sap_type is valid
+#define EBP_EVENT_TIME           0x08        // acquisition_time is valid
+#define EBP_EVENT_GROUPING       0x10
+#define EBP_EVENT_CONCEALMENT    0x20
+#define EBP_EVENT_PTS            0x40        // pts is valid
+
+/**
+ * Compact record of an EBP, 32 bytes.
+ */
+typedef struct {
+   uint64_t packet_offset;          // position of the TS packet carrying the EBP, as given by the caller
+   uint64_t pts;                    // PTS of the PES starting in that packet
+   uint64_t acquisition_time;       // EBP acquisition time, NTP format
+   uint16_t pid;
+   uint8_t flags;                   // EBP_EVENT_*
+   uint8_t sap_type;
+   uint32_t reserved;
+} ebp_event_t;
+
+/**
+ * Ring of EBP events over storage supplied by the caller. One producer and
+ * one consumer on the same thread; when full, new events are dropped and
+ * counted.
+ */
+typedef struct {
+   ebp_event_t *events;
+   uint32_t size;                   // number of entries in events
+   uint32_t head;                   // next event to pop
+   uint32_t count;                  // events in the ring
+   uint64_t num_dropped;            // events dropped because the ring was full
+} ebp_event_ring_t;
+
+void ebp_event_ring_init(ebp_event_ring_t *ring, ebp_event_t *events, uint32_t size);
+int ebp_event_ring_push(ebp_event_ring_t *ring, const ebp_event_t *event);
+int ebp_event_ring_pop(ebp_event_ring_t *ring, ebp_event_t *event);
+
+/**
+ * Decode the EBP of a TS packet, if any, into an event pushed to ring.
+ * The PTS is taken from the PES header if one starts in the packet.
+ * Nothing is allocated or logged, and the packet is not modified.
+ * @param ts TS packet, read with ts_read or ts_read_view
+ * @param packet_offset recorded in the event, e.g. packet number or byte offset
+ * @param ebp if not NULL, receives the decoded EBP
+ * @param ring event ring, may be NULL
+ * @return 1 if the packet has an EBP, 0 if not or if it is truncated
+ */
+int ebp_decode_ts_packet(const ts_packet_t *ts, uint64_t packet_offset, ebp_info_t *ebp, ebp_event_ring_t *ring);
+
 typedef struct {
 
    uint8_t ebp_data_explicit_flag;
@@ -89,6 +186,23 @@ typedef struct {
 
 } ebp_partition_data_t;
 
+/**
+ * EBP descriptor compiled for per-EBP lookups, so that nothing walks
+ * partition_data per packet. Built by ebp_descriptor_read and 
+ * ebp_descriptor_copy, i.e. once per PMT; descriptors put together by hand
+ * need ebp_descriptor_build_index.
+ */
+typedef struct {
+   int valid;                                         // built from the current partition_data
+   uint32_t present;                                  // bit per partition_id in the descriptor
+   uint32_t boundaries;                               // bit per partition_id with explicit data and boundary_flag
+   ebp_partition_data_t *partitions[EBP_MAX_PARTITIONS];   // by partition_id, NULL if absent
+   uint16_t ebp_pids[EBP_MAX_PARTITIONS];             // PID carrying the EBP data, EBP_PID_SELF if it is this PID
+   uint64_t distances[EBP_MAX_PARTITIONS];            // ebp_distance in 90kHz ticks, 0 if not signalled
+} ebp_partition_index_t;
+
+#define EBP_PID_SELF             0xFFFF
+
 typedef struct {
    descriptor_t descriptor;
 
@@ -101,6 +215,8 @@ typedef struct {
 
    vqarray_t *partition_data; // Array of ebp_partition_data_t
 
+   ebp_partition_index_t index;
+
 } ebp_descriptor_t;
 
 #define EBP_DESCRIPTOR 0xE9
@@ -111,6 +227,22 @@ int ebp_descriptor_print(const descriptor_t *desc, int level, char *str, size_t
 void ebp_descriptor_print_stdout(const ebp_descriptor_t *ebp_desc);
 ebp_descriptor_t* ebp_descriptor_copy(const ebp_descriptor_t *ebp_desc);
 
+/**
+ * (Re)build the partition index of an EBP descriptor. Needed only if 
+ * partition_data was filled in or changed by hand.
+ */
+void ebp_descriptor_build_index(ebp_descriptor_t *ebp_desc);
+
+/**
+ * @return PID carrying the EBP data of a partition, pid itself if the data is 
+ * explicit, 0 if the descriptor has no such partition
+ */
+static inline uint32_t ebp_partition_pid(const ebp_descriptor_t *ebp_desc, int partition_id, uint32_t pid)
+{
+   if (partition_id < 0 || partition_id >= EBP_MAX_PARTITIONS || !(ebp_desc->index.present & (1u << partition_id))) return 0;
+   return (ebp_desc->index.ebp_pids[partition_id] == EBP_PID_SELF) ? pid : ebp_desc->index.ebp_pids[partition_id];
+}
+
 int does_fragment_mark_boundary (const ebp_descriptor_t *ebp_desc);
 int does_segment_mark_boundary (const ebp_descriptor_t *ebp_desc);
 
@@ -121,6 +253,11 @@ ebp_partition_data_t* get_partition (const ebp_descriptor_t *ebp_desc, int parti
 uint8_t get_fragment_SAP_max (const ebp_descriptor_t *ebp_desc);
 uint8_t get_segment_SAP_max (const ebp_descriptor_t *ebp_desc);
 
+/**
+ * @return ebp_distance of a partition in 90kHz ticks, 0 if not signalled
+ */
+uint64_t get_partition_distance (const ebp_descriptor_t *ebp_desc, int partitionId);
+
 
 
 uint64_t ntohll(uint64_t num);
@@ -0,0 +1,338 @@
+/*
+Copyright (c) 2015, Cable Television Laboratories, Inc.(“CableLabs”)
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of CableLabs nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL CABLELABS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <string.h>
+#include <ebp_align.h>
+#include <log.h>
+
+#define EBP_ALIGN_PTS_WRAP    (1ULL << 33)
+
+typedef struct _ebp_align_node_ {
+   uint64_t pts;                    // unwrapped
+   uint64_t seq;
+   ebp_event_t event;
+   int rendition;
+   struct _ebp_align_node_ *next;   // free list
+} ebp_align_node_t;
+
+static int ebp_align_node_cmp(binheap_elem_t *e1, binheap_elem_t *e2)
+{
+   const ebp_align_node_t *n1 = e1;
+   const ebp_align_node_t *n2 = e2;
+   if (n1->pts != n2->pts) return (n1->pts < n2->pts) ? -1 : 1;
+   return (n1->seq < n2->seq) ? -1 : (n1->seq > n2->seq);
+}
+
+ebp_align_t* ebp_align_new(int num_renditions, int max_pending, ebp_align_callback_t callback, void *arg)
+{
+   if (num_renditions < 1 || num_renditions > EBP_ALIGN_MAX_RENDITIONS)
+   {
+      LOG_ERROR_ARGS("ebp_align_new: %d renditions, 1 to %d supported", num_renditions, EBP_ALIGN_MAX_RENDITIONS);
+      return NULL;
+   }
+   if (max_pending <= 0) max_pending = EBP_ALIGN_MAX_PENDING;
+
+   ebp_align_t *a = calloc(1, sizeof(ebp_align_t));
+   if (a == NULL) return NULL;
+   a->num_renditions = num_renditions;
+   a->boundary_flags = EBP_EVENT_SEGMENT | EBP_EVENT_FRAGMENT;
+   a->max_latency = EBP_ALIGN_MAX_LATENCY;
+   a->callback = callback;
+   a->arg = arg;
+   a->max_pending = max_pending;
+
+   a->heap = binheap_new(ebp_align_node_cmp);
+   a->nodes = calloc(max_pending, sizeof(ebp_align_node_t));
+   a->group = calloc(max_pending, sizeof(ebp_align_node_t *));
+   // sized for all the nodes, so that inserting never reallocates
+   if (a->heap == NULL || !binheap_reserve(a->heap, max_pending) || a->nodes == NULL || a->group == NULL)
+   {
+      ebp_align_free(a);
+      return NULL;
+   }
+   for (int i = 0; i < max_pending; i++)
+   {
+      a->nodes[i].next = (i + 1 < max_pending) ? &a->nodes[i + 1] : NULL;
+   }
+   a->free_nodes = a->nodes;
+
+   for (int r = 0; r < num_renditions; r++)
+   {
+      a->queues[r] = spsc_ring_new(EBP_ALIGN_QUEUE_SIZE, sizeof(ebp_event_t));
+      if (a->queues[r] == NULL)
+      {
+         ebp_align_free(a);
+         return NULL;
+      }
+   }
+   return a;
+}
+
+void ebp_align_free(ebp_align_t *a)
+{
+   if (a == NULL) return;
+   for (int r = 0; r < a->num_renditions; r++)
+   {
+      spsc_ring_free(a->queues[r]);
+   }
+   if (a->heap != NULL) binheap_free(a->heap);
+   free(a->group);
+   free(a->nodes);
+   free(a);
+}
+
+int ebp_align_push(ebp_align_t *a, int rendition, const ebp_event_t *event)
+{
+   if (a == NULL || event == NULL || rendition < 0 || rendition >= a->num_renditions) return 0;
+   if (!(event->flags & EBP_EVENT_PTS)) return 0;
+
+   if (!spsc_ring_push(a->queues[rendition], event))
+   {
+      // only this rendition's thread writes its counter
+      __atomic_store_n(&a->num_dropped[rendition], a->num_dropped[rendition] + 1, __ATOMIC_RELAXED);
+      return 0;
+   }
+   return 1;
+}
+
+int ebp_align_advance(ebp_align_t *a, int rendition, uint64_t pts)
+{
+   ebp_event_t event;
+   memset(&event, 0, sizeof(event));
+   event.pts = pts;
+   event.flags = EBP_EVENT_PTS;
+   return ebp_align_push(a, rendition, &event);
+}
+
+int ebp_align_ts_packet(ebp_align_t *a, int rendition, const ts_packet_t *ts, uint64_t packet_offset)
+{
+   ebp_event_t event;
+   ebp_event_ring_t ring;
+   ebp_event_ring_init(&ring, &event, 1);
+   if (!ebp_decode_ts_packet(ts, packet_offset, NULL, &ring)) return 0;
+   return ebp_align_push(a, rendition, &event);
+}
+
+// PTS on a 64-bit timeline per rendition; late events across a wrap stay before it
+static uint64_t ebp_align_unwrap(ebp_align_t *a, int r, uint64_t pts)
+{
+   pts &= EBP_ALIGN_PTS_WRAP - 1;
+   if (!a->seen[r])
+   {
+      a->seen[r] = 1;
+      a->last_pts[r] = pts;
+      return pts;
+   }
+   if (pts + EBP_ALIGN_PTS_WRAP / 2 < a->last_pts[r])
+   {
+      a->pts_base[r] += EBP_ALIGN_PTS_WRAP;
+   }
+   else if (pts > a->last_pts[r] + EBP_ALIGN_PTS_WRAP / 2 && a->pts_base[r] >= EBP_ALIGN_PTS_WRAP)
+   {
+      return pts + a->pts_base[r] - EBP_ALIGN_PTS_WRAP;
+   }
+   a->last_pts[r] = pts;
+   return pts + a->pts_base[r];
+}
+
+// move queued events into the heap while there is room; returns 1 if some had to be left in the queues
+static int ebp_align_drain(ebp_align_t *a)
+{
+   ebp_event_t event;
+   for (int r = 0; r < a->num_renditions; r++)
+   {
+      while (a->free_nodes != NULL && spsc_ring_pop(a->queues[r], &event))
+      {
+         uint64_t pts = ebp_align_unwrap(a, r, event.pts);
+         if (pts > a->watermark[r]) a->watermark[r] = pts;
+         if (!(event.flags & a->boundary_flags)) continue;
+
+         ebp_align_node_t *node = a->free_nodes;
+         a->free_nodes = node->next;
+         node->pts = pts;
+         node->seq = a->num_inserted++;
+         node->event = event;
+         node->rendition = r;
+         binheap_insert(a->heap, node);
+      }
+      if (a->free_nodes == NULL && spsc_ring_count(a->queues[r]) > 0) return 1;
+   }
+   return 0;
+}
+
+static void ebp_align_report(ebp_align_t *a, int type, int rendition, uint64_t pts, const ebp_align_node_t *node)
+{
+   if (type == EBP_ALIGN_MISALIGNED) a->num_misaligned[rendition]++;
+   else if (type == EBP_ALIGN_MISSING) a->num_missing[rendition]++;
+   else if (type == EBP_ALIGN_EXTRA) a->num_extra[rendition]++;
+   if (a->callback == NULL) return;
+
+   ebp_align_report_t report;
+   report.type = type;
+   report.rendition = rendition;
+   report.pts = pts & (EBP_ALIGN_PTS_WRAP - 1);
+   report.pts_offset = (node != NULL) ? (int64_t)(node->pts - pts) : 0;
+   report.flags = (node != NULL) ? node->event.flags : 0;
+   report.packet_offset = (node != NULL) ? node->event.packet_offset : 0;
+   a->callback(&report, a->arg);
+}
+
+// decide on the boundaries up to end, which are all in the heap
+static void ebp_align_decide_group(ebp_align_t *a, uint64_t end)
+{
+   ebp_align_node_t *best[EBP_ALIGN_MAX_RENDITIONS] = { NULL };
+   int num_nodes = 0;
+   int count = 0;
+
+   ebp_align_node_t *node;
+   while ((node = binheap_get_first(a->heap)) != NULL && node->pts <= end)
+   {
+      binheap_remove_first(a->heap);
+      a->group[num_nodes++] = node;
+      if (best[node->rendition] == NULL)
+      {
+         best[node->rendition] = node;
+         count++;
+      }
+   }
+   a->num_groups++;
+
+   // the reference is the boundary (PTS and type) most renditions agree on
+   const ebp_align_node_t *ref = NULL;
+   int ref_votes = 0;
+   for (int r = 0; r < a->num_renditions; r++)
+   {
+      if (best[r] == NULL) continue;
+      int votes = 0;
+      for (int q = 0; q < a->num_renditions; q++)
+      {
+         votes += (best[q] != NULL && best[q]->pts == best[r]->pts &&
+                   (best[q]->event.flags & a->boundary_flags) == (best[r]->event.flags & a->boundary_flags));
+      }
+      if (votes > ref_votes)
+      {
+         ref = best[r];
+         ref_votes = votes;
+      }
+   }
+
+   if (2 * count >= a->num_renditions)
+   {
+      if (ref_votes == a->num_renditions)
+      {
+         a->num_aligned++;
+         ebp_align_report(a, EBP_ALIGN_ALIGNED, -1, ref->pts, ref);
+      }
+      else
+      {
+         for (int r = 0; r < a->num_renditions; r++)
+         {
+            if (best[r] == NULL)
+            {
+               ebp_align_report(a, EBP_ALIGN_MISSING, r, ref->pts, NULL);
+            }
+            else if (best[r]->pts != ref->pts ||
+                     (best[r]->event.flags & a->boundary_flags) != (ref->event.flags & a->boundary_flags))
+            {
+               ebp_align_report(a, EBP_ALIGN_MISALIGNED, r, ref->pts, best[r]);
+            }
+         }
+      }
+   }
+   else
+   {
+      for (int r = 0; r < a->num_renditions; r++)
+      {
+         if (best[r] != NULL) ebp_align_report(a, EBP_ALIGN_EXTRA, r, best[r]->pts, best[r]);
+      }
+   }
+
+   for (int i = 0; i < num_nodes; i++)
+   {
+      // a second boundary of the same rendition within tolerance is one too many
+      if (best[a->group[i]->rendition] != a->group[i])
+      {
+         ebp_align_report(a, EBP_ALIGN_EXTRA, a->group[i]->rendition, a->group[i]->pts, a->group[i]);
+      }
+      a->group[i]->next = a->free_nodes;
+      a->free_nodes = a->group[i];
+   }
+}
+
+// decide on the groups every rendition has moved past; force_one decides the first one regardless
+static int ebp_align_decide(ebp_align_t *a, int force_one, int force_all)
+{
+   int n = 0;
+   ebp_align_node_t *first;
+   while ((first = binheap_get_first(a->heap)) != NULL)
+   {
+      uint64_t end = first->pts + a->tolerance;
+      uint64_t max_watermark = 0;
+      int ready = 1;
+      for (int r = 0; r < a->num_renditions; r++)
+      {
+         if (!a->seen[r] || a->watermark[r] <= end) ready = 0;
+         if (a->watermark[r] > max_watermark) max_watermark = a->watermark[r];
+      }
+
+      if (!ready && !force_all)
+      {
+         int late = (max_watermark > end && max_watermark - end > a->max_latency);
+         if (!late && !force_one) break;
+         a->num_forced++;
+      }
+      force_one = 0;
+
+      ebp_align_decide_group(a, end);
+      n++;
+   }
+   return n;
+}
+
+int ebp_align_poll(ebp_align_t *a)
+{
+   if (a == NULL) return 0;
+
+   int n = 0;
+   int full;
+   do
+   {
+      // when all nodes are in use, the oldest group is decided early to make room
+      full = ebp_align_drain(a);
+      n += ebp_align_decide(a, full, 0);
+   }
+   while (full);
+   return n;
+}
+
+int ebp_align_flush(ebp_align_t *a)
+{
+   if (a == NULL) return 0;
+
+   int n = ebp_align_poll(a);
+   return n + ebp_align_decide(a, 0, 1);
+}
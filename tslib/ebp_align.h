@@ -0,0 +1,161 @@
+/*
+Copyright (c) 2015, Cable Television Laboratories, Inc.(“CableLabs”)
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of CableLabs nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL CABLELABS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef EBP_ALIGN_H_
+#define EBP_ALIGN_H_
+
+#include <stdint.h>
+#include <binheap.h>
+#include <spsc_ring.h>
+#include <ts.h>
+#include <ebp.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define EBP_ALIGN_MAX_RENDITIONS    32
+#define EBP_ALIGN_QUEUE_SIZE        256      // boundaries queued per rendition until ebp_align_poll picks them up
+#define EBP_ALIGN_MAX_PENDING       (4 * EBP_ALIGN_QUEUE_SIZE)  // default, boundaries held for matching
+#define EBP_ALIGN_MAX_LATENCY       (10 * 90000)                // default, in 90kHz ticks
+
+// ebp_align_report_t types
+#define EBP_ALIGN_ALIGNED           0        // all renditions have the boundary, same PTS and type
+#define EBP_ALIGN_MISALIGNED        1        // rendition has the boundary at another PTS or of another type
+#define EBP_ALIGN_MISSING           2        // most renditions have the boundary, this one does not
+#define EBP_ALIGN_EXTRA             3        // rendition has a boundary most others do not
+
+typedef struct {
+   int type;                        // EBP_ALIGN_*
+   int rendition;                   // rendition reported on, -1 for EBP_ALIGN_ALIGNED
+   uint64_t pts;                    // PTS of the boundary in most renditions (the rendition's own for EBP_ALIGN_EXTRA)
+   int64_t pts_offset;              // EBP_ALIGN_MISALIGNED: rendition's PTS - pts
+   uint8_t flags;                   // EBP_EVENT_* of the rendition's boundary (of most renditions if missing)
+   uint64_t packet_offset;          // packet_offset of the rendition's boundary, 0 if missing
+} ebp_align_report_t;
+
+typedef void (*ebp_align_callback_t)(const ebp_align_report_t *report, void *arg);
+
+struct _ebp_align_node_;
+
+/**
+ * Checks that EBP boundaries line up across the renditions of an ABR encoder.
+ *
+ * Each rendition is demuxed on its own thread, which feeds the boundaries it
+ * finds with ebp_align_push (or ebp_align_ts_packet) into a per-rendition
+ * lock-free queue. The alignment thread calls ebp_align_poll, which merges
+ * them in PTS order in a binheap_t and matches boundaries within tolerance
+ * of each other across renditions. A group of boundaries is decided once
+ * every rendition has moved past it, or when the furthest rendition is
+ * max_latency ahead, or when max_pending boundaries are held; each
+ * rendition's boundary is then reported to callback as aligned,
+ * misaligned, missing or extra.
+ *
+ * Memory is allocated only by ebp_align_new. PTS are unwrapped per
+ * rendition, so streams may run across the 33-bit wrap.
+ */
+typedef struct {
+   int num_renditions;
+   uint8_t boundary_flags;          // EBP_EVENT_* which make an event a boundary, default segment | fragment
+   uint64_t tolerance;              // PTS distance (90kHz) up to which boundaries are the same one, default 0
+   uint64_t max_latency;            // PTS distance (90kHz) after which a boundary is decided regardless
+   ebp_align_callback_t callback;
+   void *arg;
+
+   spsc_ring_t *queues[EBP_ALIGN_MAX_RENDITIONS];    // rendition threads to alignment thread
+   binheap_t *heap;                 // boundaries waiting to be matched, in PTS order
+   struct _ebp_align_node_ *nodes;  // max_pending heap entries
+   struct _ebp_align_node_ *free_nodes;
+   struct _ebp_align_node_ **group; // boundaries of the group being decided
+   int max_pending;
+   uint64_t num_inserted;           // tie-break, equal PTS are kept in arrival order
+
+   // alignment thread only
+   uint64_t watermark[EBP_ALIGN_MAX_RENDITIONS];     // highest unwrapped PTS seen per rendition
+   uint64_t last_pts[EBP_ALIGN_MAX_RENDITIONS];      // last raw PTS per rendition
+   uint64_t pts_base[EBP_ALIGN_MAX_RENDITIONS];      // unwrapping offset per rendition
+   int seen[EBP_ALIGN_MAX_RENDITIONS];               // rendition has delivered anything yet
+
+   uint64_t num_groups;             // boundary groups decided
+   uint64_t num_aligned;            // groups aligned in all renditions
+   uint64_t num_misaligned[EBP_ALIGN_MAX_RENDITIONS];
+   uint64_t num_missing[EBP_ALIGN_MAX_RENDITIONS];
+   uint64_t num_extra[EBP_ALIGN_MAX_RENDITIONS];
+   uint64_t num_forced;             // groups decided early by max_latency or max_pending
+   uint64_t num_dropped[EBP_ALIGN_MAX_RENDITIONS];   // updated by rendition threads: pushes refused, the queue was full
+} ebp_align_t;
+
+/**
+ * @param num_renditions 1 to EBP_ALIGN_MAX_RENDITIONS
+ * @param max_pending boundaries held for matching, 0 for EBP_ALIGN_MAX_PENDING
+ * @param callback called for each decision on the thread calling ebp_align_poll, may be NULL
+ * @return engine, or NULL if out of memory or num_renditions is out of range
+ */
+ebp_align_t* ebp_align_new(int num_renditions, int max_pending, ebp_align_callback_t callback, void *arg);
+void ebp_align_free(ebp_align_t *a);
+
+/**
+ * Queue an EBP event of a rendition; rendition thread only. Events without
+ * a PTS are ignored; events which are not boundaries (see boundary_flags)
+ * only tell that the rendition has got this far.
+ * @return 1 if queued, 0 if ignored or the queue is full (counted in num_dropped)
+ */
+int ebp_align_push(ebp_align_t *a, int rendition, const ebp_event_t *event);
+
+/**
+ * Tell that a rendition has got to pts, e.g. from the PTS of a PES without 
+ * EBP, so that boundaries missing from it are detected sooner. Rendition 
+ * thread only.
+ */
+int ebp_align_advance(ebp_align_t *a, int rendition, uint64_t pts);
+
+/**
+ * Decode the EBP of a TS packet, if any, and queue it. Rendition thread only.
+ * @return 1 if an EBP was found and queued
+ */
+int ebp_align_ts_packet(ebp_align_t *a, int rendition, const ts_packet_t *ts, uint64_t packet_offset);
+
+/**
+ * Merge the queued events and decide on the boundary groups which are 
+ * complete. Alignment thread only.
+ * @return number of groups decided
+ */
+int ebp_align_poll(ebp_align_t *a);
+
+/**
+ * ebp_align_poll, then decide on every boundary still held, once the input
+ * has ended.
+ * @return number of groups decided
+ */
+int ebp_align_flush(ebp_align_t *a);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EBP_ALIGN_H_ */
@@ -0,0 +1,376 @@
+/*
+
+ Copyright (c) 2012-, ISO/IEC JTC1/SC29/WG11
+ Written by Alex Giladi <alex.giladi@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of the ISO/IEC nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "log.h"
+#include "ebp_align.h"
+#include "mpeg2ts_demux.h"
+#include "ts_test_util.h"
+#include "test_macros.h"
+
+#define TEST_PID       0x100
+#define PMT_PID        0x20
+#define SEGMENT_TICKS  180000
+
+int verbose = 0;
+
+typedef struct
+{
+   int num_reports[4];
+   int last_rendition[4];
+   uint64_t last_pts[4];
+   int64_t last_offset[4];
+} report_log_t;
+
+static void log_report(const ebp_align_report_t *report, void *arg)
+{
+   report_log_t *log = arg;
+   log->num_reports[report->type]++;
+   log->last_rendition[report->type] = report->rendition;
+   log->last_pts[report->type] = report->pts;
+   log->last_offset[report->type] = report->pts_offset;
+   if (verbose && report->type != EBP_ALIGN_ALIGNED)
+   {
+      printf("# report %d: rendition %d, pts %llu, offset %lld\n", report->type, report->rendition,
+             (unsigned long long)report->pts, (long long)report->pts_offset);
+   }
+}
+
+START_TEST(test_align)
+{
+   const int num_renditions = 4;
+   const int num_boundaries = 20;
+   const uint64_t start_pts = (1ULL << 33) - 5 * SEGMENT_TICKS;     // wraps after the 5th boundary
+   uint8_t ebp_buf[32];
+   uint8_t pkt[TS_SIZE];
+   report_log_t log;
+
+   memset(&log, 0, sizeof(log));
+   ebp_align_t *a = ebp_align_new(num_renditions, 0, log_report, &log);
+   fail_unless(a != NULL, "cannot create engine");
+   if (a == NULL) return 0;
+
+   a->tolerance = 3003;
+
+   ts_packet_t *ts = ts_new();
+   int ebp_len = ts_test_build_ebp(ebp_buf, 1, 1, 1, NULL, 0, 0);
+   for (int i = 0; i < num_boundaries; i++)
+   {
+      for (int r = 0; r < num_renditions; r++)
+      {
+         uint64_t pts = (start_pts + (uint64_t)i * SEGMENT_TICKS) & ((1ULL << 33) - 1);
+         if (r == 2 && i == 5) continue;                  // missing
+         if (r == 3 && i == 7) pts += 3003;               // misaligned
+         ts_test_write_ebp_packet(pkt, TEST_PID, i, ebp_buf, ebp_len, pts);
+         ts_read_view(ts, pkt, TS_SIZE);
+         fail_unless(ebp_align_ts_packet(a, r, ts, i), "EBP not queued");
+         if (r == 1 && i == 10)                            // extra
+         {
+            ebp_event_t ev = { 0, pts + SEGMENT_TICKS / 2, 0, TEST_PID, EBP_EVENT_PTS | EBP_EVENT_FRAGMENT, 0, 0 };
+            ebp_align_push(a, r, &ev);
+         }
+      }
+      ebp_align_poll(a);
+      // nothing can be decided before all renditions have moved past it
+      fail_unless2(a->num_groups <= (uint64_t)(i + (i > 10)), "group decided early", "(%llu at %d)", (unsigned long long)a->num_groups, i);
+   }
+   ebp_align_flush(a);
+
+   fail_unless2(a->num_aligned == (uint64_t)num_boundaries - 2, "wrong number of aligned boundaries",
+                "(%llu)", (unsigned long long)a->num_aligned);
+   fail_unless2(a->num_missing[2] == 1 && log.num_reports[EBP_ALIGN_MISSING] == 1 && log.last_rendition[EBP_ALIGN_MISSING] == 2,
+                "missing boundary not reported", "(%llu)", (unsigned long long)a->num_missing[2]);
+   fail_unless(log.last_pts[EBP_ALIGN_MISSING] == ((start_pts + 5 * SEGMENT_TICKS) & ((1ULL << 33) - 1)), "wrong missing PTS");
+   fail_unless2(a->num_misaligned[3] == 1 && log.num_reports[EBP_ALIGN_MISALIGNED] == 1 && log.last_offset[EBP_ALIGN_MISALIGNED] == 3003,
+                "misaligned boundary not reported", "(%llu)", (unsigned long long)a->num_misaligned[3]);
+   fail_unless2(a->num_extra[1] == 1 && log.num_reports[EBP_ALIGN_EXTRA] == 1, "extra boundary not reported",
+                "(%llu)", (unsigned long long)a->num_extra[1]);
+   fail_unless(a->num_groups == (uint64_t)num_boundaries + 1 && a->num_forced == 0, "wrong number of groups");
+
+   ts->bytes = NULL;
+   ts_free(ts);
+   ebp_align_free(a);
+}
+END_TEST
+
+START_TEST(test_bounded)
+{
+   const int num_renditions = 3;
+   report_log_t log;
+
+   // rendition 2 stalls: boundaries are decided max_latency behind the others
+   memset(&log, 0, sizeof(log));
+   ebp_align_t *a = ebp_align_new(num_renditions, 16, log_report, &log);
+   a->max_latency = 3 * SEGMENT_TICKS;
+   for (int i = 0; i < 10; i++)
+   {
+      for (int r = 0; r < num_renditions; r++)
+      {
+         if (r == 2 && i >= 3) continue;
+         ebp_event_t ev = { 0, (uint64_t)i * SEGMENT_TICKS, 0, TEST_PID, EBP_EVENT_PTS | EBP_EVENT_SEGMENT, 0, 0 };
+         ebp_align_push(a, r, &ev);
+      }
+      ebp_align_poll(a);
+   }
+   fail_unless2(a->num_missing[2] >= 3 && a->num_forced >= 4, "stalled rendition held up decisions",
+                "(%llu missing, %llu forced)", (unsigned long long)a->num_missing[2], (unsigned long long)a->num_forced);
+   ebp_align_flush(a);
+   fail_unless2(a->num_aligned == 3 && a->num_missing[2] == 7, "wrong result", 
+                "(%llu aligned, %llu missing)", (unsigned long long)a->num_aligned, (unsigned long long)a->num_missing[2]);
+   ebp_align_free(a);
+
+   // no more than max_pending boundaries are held
+   a = ebp_align_new(num_renditions, 16, NULL, NULL);
+   a->max_latency = UINT64_MAX;
+   for (int i = 0; i < 100; i++)
+   {
+      for (int r = 0; r < 2; r++)
+      {
+         ebp_event_t ev = { 0, (uint64_t)i * SEGMENT_TICKS, 0, TEST_PID, EBP_EVENT_PTS | EBP_EVENT_SEGMENT, 0, 0 };
+         ebp_align_push(a, r, &ev);
+      }
+      ebp_align_poll(a);
+      fail_unless2(binheap_size(a->heap) <= 16, "too many boundaries held", "(%d)", binheap_size(a->heap));
+   }
+   ebp_align_flush(a);
+   fail_unless2(a->num_groups == 100 && a->num_missing[2] == 100, "wrong result with a full heap",
+                "(%llu groups)", (unsigned long long)a->num_groups);
+   ebp_align_free(a);
+
+   // tolerance
+   memset(&log, 0, sizeof(log));
+   a = ebp_align_new(2, 0, log_report, &log);
+   a->tolerance = 3003;
+   for (int i = 0; i < 5; i++)
+   {
+      for (int r = 0; r < 2; r++)
+      {
+         ebp_event_t ev = { 0, (uint64_t)i * SEGMENT_TICKS + (r == 1 && i == 2 ? 3003 : 0), 0, TEST_PID, EBP_EVENT_PTS | EBP_EVENT_SEGMENT, 0, 0 };
+         ebp_align_push(a, r, &ev);
+      }
+   }
+   ebp_align_flush(a);
+   fail_unless2(a->num_groups == 5 && a->num_aligned == 4 && a->num_misaligned[1] == 1 && log.last_offset[EBP_ALIGN_MISALIGNED] == 3003,
+                "boundary within tolerance not matched", "(%llu groups)", (unsigned long long)a->num_groups);
+   ebp_align_free(a);
+}
+END_TEST
+
+typedef struct
+{
+   ebp_align_t *align;
+   int rendition;
+   int num_packets;
+   uint8_t *pkts;
+   uint64_t num_ebps;
+   int done;
+} rendition_t;
+
+static int align_ts_packet(ts_packet_t *ts, elementary_stream_info_t *es_info, void *arg)
+{
+   (void)es_info;
+   rendition_t *rd = arg;
+   if (ts == NULL) return 1;
+
+   ebp_event_t ev;
+   ebp_event_ring_t ring;
+   ebp_event_ring_init(&ring, &ev, 1);
+   if (ebp_decode_ts_packet(ts, 0, NULL, &ring))
+   {
+      rd->num_ebps++;
+      // wait for the alignment thread rather than lose the boundary
+      while (!ebp_align_push(rd->align, rd->rendition, &ev)) sched_yield();
+   }
+   ts_free(ts);
+   return 1;
+}
+
+static int register_es(mpeg2ts_program_t *m2p, void *arg)
+{
+   demux_pid_handler_t *h = calloc(1, sizeof(demux_pid_handler_t));
+   h->process_ts_packet = align_ts_packet;
+   h->arg = arg;
+   mpeg2ts_program_register_pid_processor(m2p, TEST_PID, h, NULL);
+   return 1;
+}
+
+static int set_pmt_processor(mpeg2ts_stream_t *m2s, void *arg)
+{
+   for (int i = 0; i < vqarray_length(m2s->programs); i++)
+   {
+      mpeg2ts_program_t *m2p = vqarray_get(m2s->programs, i);
+      m2p->pmt_processor = register_es;
+      m2p->arg = arg;
+   }
+   return 1;
+}
+
+static void* demux_rendition(void *arg)
+{
+   rendition_t *rd = arg;
+   tslib_loglevel = verbose ? TSLIB_LOG_LEVEL_INFO : TSLIB_LOG_LEVEL_ERROR;   // per thread
+   mpeg2ts_stream_t *m2s = mpeg2ts_stream_new();
+   m2s->pat_processor = set_pmt_processor;
+   m2s->arg = rd;
+   mpeg2ts_stream_read_buffer(m2s, rd->pkts, (size_t)rd->num_packets * TS_SIZE);
+   mpeg2ts_stream_free(m2s);
+   __atomic_store_n(&rd->done, 1, __ATOMIC_RELEASE);
+   return NULL;
+}
+
+/**
+ * PAT, PMT and num_packets - 2 video packets, every ebp_every'th starting a 
+ * segment with an EBP
+ */
+static void build_rendition(uint8_t *pkts, int num_packets, int ebp_every)
+{
+   uint8_t section[1024];
+   uint8_t ebp_buf[32];
+   uint32_t program_number = 1, pmt_pid = PMT_PID;
+   uint32_t stream_type = 0x1B, es_pid = TEST_PID;
+
+   int len = ts_test_build_pat(section, 0, 1, &program_number, &pmt_pid);
+   ts_test_write_section_packet(pkts, PAT_PID, 0, section, len);
+   len = ts_test_build_pmt(section, 0, program_number, TEST_PID, 1, &stream_type, &es_pid);
+   ts_test_write_section_packet(pkts + TS_SIZE, PMT_PID, 0, section, len);
+
+   int ebp_len = ts_test_build_ebp(ebp_buf, 1, 1, 1, NULL, 0, 0);
+   for (int i = 2; i < num_packets; i++)
+   {
+      if ((i - 2) % ebp_every == 0)
+      {
+         ts_test_write_ebp_packet(pkts + i * TS_SIZE, TEST_PID, i, ebp_buf, ebp_len, (uint64_t)((i - 2) / ebp_every) * SEGMENT_TICKS);
+      }
+      else
+      {
+         ts_test_write_pes_packet(pkts + i * TS_SIZE, TEST_PID, i, 0, 0xE0, 0, 0);
+      }
+   }
+}
+
+START_TEST(test_threads)
+{
+   const int num_renditions = 12;
+   const int num_packets = 20002;
+   const int ebp_every = 50;
+   rendition_t rd[12];
+   pthread_t threads[12];
+
+   uint8_t *pkts = malloc((size_t)num_packets * TS_SIZE);
+   build_rendition(pkts, num_packets, ebp_every);
+
+   // live renditions run in lockstep, here the threads may get far apart on a
+   // single core: hold everything rather than decide early
+   ebp_align_t *a = ebp_align_new(num_renditions, num_renditions * (num_packets / ebp_every + 1), NULL, NULL);
+   a->max_latency = UINT64_MAX;
+   uint64_t t1 = gettimeusec();
+   for (int r = 0; r < num_renditions; r++)
+   {
+      rd[r] = (rendition_t){ a, r, num_packets, pkts, 0, 0 };
+      pthread_create(&threads[r], NULL, demux_rendition, &rd[r]);
+   }
+
+   int running = num_renditions;
+   while (running > 0)
+   {
+      if (ebp_align_poll(a) == 0) sched_yield();
+      running = 0;
+      for (int r = 0; r < num_renditions; r++)
+      {
+         running += !__atomic_load_n(&rd[r].done, __ATOMIC_ACQUIRE);
+      }
+   }
+   for (int r = 0; r < num_renditions; r++) pthread_join(threads[r], NULL);
+   ebp_align_flush(a);
+   uint64_t t2 = gettimeusec();
+
+   int num_boundaries = (num_packets - 2) / ebp_every;
+   for (int r = 0; r < num_renditions; r++)
+   {
+      fail_unless2(rd[r].num_ebps == (uint64_t)num_boundaries, "EBPs not found", "(rendition %d: %llu)", r, (unsigned long long)rd[r].num_ebps);
+      fail_unless2(a->num_missing[r] == 0 && a->num_extra[r] == 0 && a->num_misaligned[r] == 0,
+                   "rendition not aligned", "(%d)", r);
+   }
+   fail_unless2(a->num_aligned == (uint64_t)num_boundaries, "wrong number of aligned boundaries", "(%llu)", (unsigned long long)a->num_aligned);
+   printf("# %d renditions demuxed and aligned on their own threads: %.0f packets/sec\n", num_renditions,
+          (double)num_renditions * num_packets * 1000000.0 / (double)(t2 - t1 + 1));
+
+   ebp_align_free(a);
+   free(pkts);
+}
+END_TEST
+
+START_TEST(test_align_benchmark)
+{
+   const int num_renditions = 16;
+   const int num_boundaries = 100000;
+
+   ebp_align_t *a = ebp_align_new(num_renditions, 0, NULL, NULL);
+   uint64_t t1 = gettimeusec();
+   for (int i = 0; i < num_boundaries; i++)
+   {
+      for (int r = 0; r < num_renditions; r++)
+      {
+         ebp_event_t ev = { 0, (uint64_t)i * 3003, 0, TEST_PID, EBP_EVENT_PTS | EBP_EVENT_FRAGMENT, 0, 0 };
+         ebp_align_push(a, r, &ev);
+      }
+      if (i % 64 == 63) ebp_align_poll(a);
+   }
+   ebp_align_flush(a);
+   uint64_t t2 = gettimeusec();
+
+   fail_unless2(a->num_aligned == (uint64_t)num_boundaries, "wrong number of aligned boundaries", "(%llu)", (unsigned long long)a->num_aligned);
+   printf("# %d renditions: %.0f boundaries/sec aligned\n", num_renditions,
+          (double)num_renditions * num_boundaries * 1000000.0 / (double)(t2 - t1 + 1));
+   ebp_align_free(a);
+}
+END_TEST
+
+int main(int argc, char **argv)
+{
+   int _testnum = 1;
+   int failed = 0;
+   int r;
+
+   if (argc > 1 && strcmp(argv[1], "-v") == 0) verbose = 1;
+   tslib_loglevel = verbose ? TSLIB_LOG_LEVEL_INFO : TSLIB_LOG_LEVEL_ERROR;
+
+   r = test_align(); ok(r, "align"); failed += !r;
+   r = test_bounded(); ok(r, "bounded"); failed += !r;
+   r = test_threads(); ok(r, "threads"); failed += !r;
+   r = test_align_benchmark(); ok(r, "align_benchmark"); failed += !r;
+
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
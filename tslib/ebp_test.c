@@ -0,0 +1,318 @@
+/*
+
+ Copyright (c) 2012-, ISO/IEC JTC1/SC29/WG11
+ Written by Alex Giladi <alex.giladi@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of the ISO/IEC nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "log.h"
+#include "ts.h"
+#include "ebp.h"
+#include "ts_test_util.h"
+#include "test_macros.h"
+
+#define TEST_PID       0x100
+
+int verbose = 0;
+
+static size_t heap_in_use()
+{
+#ifdef __GLIBC__
+   return mallinfo2().uordblks;
+#else
+   return 0;
+#endif
+}
+
+START_TEST(test_decode)
+{
+   const uint8_t grouping_ids[] = { 5, 126 };
+   const uint64_t acquisition_time = 0xE0123456789ABCDEULL;
+   uint8_t buf[64];
+   ebp_info_t ebp;
+
+   int len = ts_test_build_ebp(buf, 1, 1, 2, grouping_ids, 2, acquisition_time);
+   fail_unless(ebp_decode(&ebp, buf, len), "decode failed");
+   fail_unless(ebp.ebp_fragment_flag && ebp.ebp_segment_flag && ebp.ebp_sap_flag && ebp.ebp_grouping_flag &&
+               ebp.ebp_time_flag && !ebp.ebp_concealment_flag && !ebp.ebp_extension_flag, "wrong flags");
+   fail_unless2(ebp.ebp_sap_type == 2, "wrong SAP type", "(%d)", ebp.ebp_sap_type);
+   fail_unless2(ebp.num_grouping_ids == 2 && ebp.grouping_ids[0] == 5 && ebp.grouping_ids[1] == 126,
+                "wrong grouping IDs", "(%u)", ebp.num_grouping_ids);
+   fail_unless(ebp.ebp_acquisition_time == acquisition_time, "wrong acquisition time");
+
+   fail_unless(!ebp_decode(&ebp, buf, len - 1), "truncated EBP accepted");
+
+   len = ts_test_build_ebp(buf, 0, 1, -1, NULL, 0, 0);
+   fail_unless(ebp_decode(&ebp, buf, len) && len == 1, "minimal EBP");
+   fail_unless(!ebp.ebp_fragment_flag && ebp.ebp_segment_flag && !ebp.ebp_sap_flag && ebp.num_grouping_ids == 0,
+               "wrong minimal EBP");
+
+   // the same through the allocating interface
+   len = ts_test_build_ebp(buf, 1, 1, 2, grouping_ids, 2, acquisition_time);
+   ts_scte128_private_data_t scte128 = { 0xDF, 4 + len, EBP_FORMAT_IDENTIFIER, { buf, len } };
+   ebp_t *e = ebp_new();
+   fail_unless(ebp_read(e, &scte128), "ebp_read failed");
+   fail_unless(e->ebp_grouping_ids != NULL && vqarray_length(e->ebp_grouping_ids) == 2 &&
+               *(uint32_t *)vqarray_get(e->ebp_grouping_ids, 1) == 126, "ebp_read grouping IDs");
+   fail_unless(e->ebp_sap_type == 2 && e->ebp_acquisition_time == acquisition_time, "ebp_read fields");
+   fail_unless(ebp_validate_groups(e) == 0, "valid groups rejected");
+   while (vqarray_length(e->ebp_grouping_ids) > 0) free(vqarray_pop(e->ebp_grouping_ids));
+   vqarray_free(e->ebp_grouping_ids);
+   ebp_free(e);
+}
+END_TEST
+
+START_TEST(test_events)
+{
+   const uint8_t grouping_ids[] = { 1 };
+   const int num_packets = 10;
+   uint8_t pkts[10][TS_SIZE];
+   uint8_t ebp_buf[32];
+   ebp_event_t storage[4];
+   ebp_event_ring_t ring;
+
+   for (int i = 0; i < num_packets; i++)
+   {
+      if (i % 2 == 0)
+      {
+         int len = ts_test_build_ebp(ebp_buf, 1, i % 4 == 0, 1, grouping_ids, 1, 1000 + i);
+         ts_test_write_ebp_packet(pkts[i], TEST_PID, i, ebp_buf, len, 3003 * i);
+      }
+      else
+      {
+         ts_test_write_pes_packet(pkts[i], TEST_PID, i, 0, 0xE0, 0, 0);
+      }
+   }
+
+   ebp_event_ring_init(&ring, storage, 4);
+   ts_packet_t *ts = ts_new();
+   ebp_info_t ebp;
+   int found = 0;
+
+   size_t heap = heap_in_use();
+   for (int k = 0; k < 2; k++)
+   {
+      for (int i = 0; i < num_packets; i++)
+      {
+         ts_read_view(ts, pkts[i], TS_SIZE);
+         int r = ebp_decode_ts_packet(ts, (uint64_t)i * TS_SIZE, &ebp, &ring);
+         fail_unless2(r == (i % 2 == 0), "wrong EBP detection", "(packet %d)", i);
+         found += r;
+      }
+
+      if (k == 0)
+      {
+         // 5 events into 4 slots, the last one is dropped
+         fail_unless2(found == 5 && ring.count == 4 && ring.num_dropped == 1, "wrong ring state",
+                      "(%d found, %u queued, %llu dropped)", found, ring.count, (unsigned long long)ring.num_dropped);
+         ebp_event_t ev;
+         for (int j = 0; j < 4; j++)
+         {
+            fail_unless(ebp_event_ring_pop(&ring, &ev), "event missing");
+            int i = 2 * j;
+            fail_unless2(ev.packet_offset == (uint64_t)i * TS_SIZE && ev.pid == TEST_PID && ev.sap_type == 1,
+                         "wrong event", "(%d)", j);
+            fail_unless2(ev.flags == (EBP_EVENT_FRAGMENT | (i % 4 == 0 ? EBP_EVENT_SEGMENT : 0) | EBP_EVENT_SAP |
+                                      EBP_EVENT_TIME | EBP_EVENT_GROUPING | EBP_EVENT_PTS),
+                         "wrong event flags", "(%d: 0x%02x)", j, ev.flags);
+            fail_unless2(ev.pts == 3003u * i && ev.acquisition_time == 1000u + i, "wrong event times", "(%d)", j);
+         }
+         fail_unless(!ebp_event_ring_pop(&ring, &ev), "ring not empty");
+      }
+   }
+   fail_unless(heap_in_use() == heap, "EBP decode allocated memory");
+   fail_unless2(ring.count == 4 && ring.num_dropped == 2, "ring did not wrap", "(%u queued)", ring.count);
+
+   ts->bytes = NULL;
+   ts_free(ts);
+}
+END_TEST
+
+// segment (2s apart, SAP type up to 2), fragment (1s apart), partition 5 on PID 0x101 
+// and partition 1 again, on PID 0x200; 1000 ticks per second, 16-bit distances
+static const uint8_t test_ebp_descriptor[] = {
+   0x27, 0x00, 0x1F, 0x41,
+   0x83, 0x07, 0xD0, 0x5E,
+   0x84, 0x03, 0xE8, 0xFE,
+   0x0B, 0x08, 0x0F,
+   0x03, 0x10, 0x07
+};
+
+static ebp_descriptor_t* read_test_ebp_descriptor()
+{
+   descriptor_t *desc = calloc(1, sizeof(descriptor_t));
+   desc->tag = EBP_DESCRIPTOR;
+   desc->length = sizeof(test_ebp_descriptor);
+   bs_t *b = bs_new((uint8_t *)test_ebp_descriptor, sizeof(test_ebp_descriptor));
+   ebp_descriptor_t *ebp_desc = (ebp_descriptor_t *)ebp_descriptor_read(desc, b);
+   bs_free(b);
+   return ebp_desc;
+}
+
+START_TEST(test_descriptor_index)
+{
+   ebp_descriptor_t *ebp_desc = read_test_ebp_descriptor();
+   fail_unless(ebp_desc != NULL && ebp_desc->num_partitions == 4 && ebp_desc->ticks_per_second == 1000, "descriptor read");
+
+   for (int k = 0; k < 3; k++)
+   {
+      // with the index, through a copy, and by walking partition_data
+      ebp_descriptor_t *d = (k == 1) ? ebp_descriptor_copy(ebp_desc) : ebp_desc;
+      if (k == 2) d->index.valid = 0;
+      fail_unless2(k == 2 || (d->index.present == 0x26 && d->index.boundaries == 0x02), "wrong index", "(%d)", k);
+
+      ebp_partition_data_t *segment = get_segment_partition(d);
+      ebp_partition_data_t *fragment = get_fragment_partition(d);
+      fail_unless2(segment != NULL && segment->ebp_data_explicit_flag && segment->ebp_distance == 2000,
+                   "wrong segment partition", "(%d)", k);
+      fail_unless2(fragment != NULL && fragment->ebp_distance == 1000, "wrong fragment partition", "(%d)", k);
+      fail_unless2(get_partition(d, 5) != NULL && get_partition(d, 3) == NULL && get_partition(d, 32) == NULL &&
+                   get_partition(d, -1) == NULL, "wrong partition lookup", "(%d)", k);
+      fail_unless2(does_segment_mark_boundary(d) && !does_fragment_mark_boundary(d), "wrong boundary flags", "(%d)", k);
+      fail_unless2(get_segment_SAP_max(d) == 2 && get_fragment_SAP_max(d) == 0, "wrong SAP_type_max", "(%d)", k);
+      fail_unless2(get_partition_distance(d, EBP_PARTITION_SEGMENT) == 180000 &&
+                   get_partition_distance(d, EBP_PARTITION_FRAGMENT) == 90000 &&
+                   get_partition_distance(d, 5) == 0, "wrong distances", "(%d)", k);
+      if (k < 2)
+      {
+         fail_unless2(ebp_partition_pid(d, EBP_PARTITION_SEGMENT, TEST_PID) == TEST_PID && 
+                      ebp_partition_pid(d, 5, TEST_PID) == 0x101 && ebp_partition_pid(d, 3, TEST_PID) == 0,
+                      "wrong EBP PIDs", "(%d)", k);
+      }
+      if (k == 1) ebp_descriptor_free((descriptor_t *)d);
+   }
+
+   // no partitions at all
+   ebp_descriptor_t empty;
+   memset(&empty, 0, sizeof(empty));
+   fail_unless(get_segment_partition(&empty) == NULL && !does_segment_mark_boundary(&empty), "empty descriptor");
+   ebp_descriptor_build_index(&empty);
+   fail_unless(empty.index.valid && empty.index.present == 0, "empty descriptor index");
+
+   ebp_descriptor_free((descriptor_t *)ebp_desc);
+}
+END_TEST
+
+START_TEST(test_descriptor_index_benchmark)
+{
+   const int num_iterations = 10000000;
+   ebp_descriptor_t *ebp_desc = read_test_ebp_descriptor();
+   uint64_t t[3];
+   int n = 0;
+
+   for (int k = 0; k < 2; k++)
+   {
+      ebp_desc->index.valid = (k == 0);
+      t[k] = gettimeusec();
+      for (int i = 0; i < num_iterations; i++)
+      {
+         n += does_fragment_mark_boundary(ebp_desc) + get_segment_SAP_max(ebp_desc);
+      }
+      t[k + 1] = gettimeusec();
+   }
+   fail_unless(n == 2 * 2 * num_iterations, "wrong lookups");
+
+   printf("# EBP descriptor lookups: %.0f/sec (indexed), %.0f/sec (walking partition_data)\n",
+          2.0 * num_iterations * 1000000.0 / (double)(t[1] - t[0] + 1),
+          2.0 * num_iterations * 1000000.0 / (double)(t[2] - t[1] + 1));
+
+   ebp_descriptor_free((descriptor_t *)ebp_desc);
+}
+END_TEST
+
+START_TEST(test_decode_benchmark)
+{
+   const int num_iterations = 1000000;
+   const uint8_t grouping_ids[] = { 1, 126 };
+   uint8_t pkt[TS_SIZE];
+   uint8_t ebp_buf[32];
+   ebp_event_t storage[1024];
+   ebp_event_ring_t ring;
+   ebp_event_t ev;
+
+   int len = ts_test_build_ebp(ebp_buf, 1, 1, 1, grouping_ids, 2, 123456789);
+   ts_test_write_ebp_packet(pkt, TEST_PID, 0, ebp_buf, len, 90000);
+   ebp_event_ring_init(&ring, storage, 1024);
+
+   ts_packet_t *ts = ts_new();
+   ts_read_view(ts, pkt, TS_SIZE);
+   int n = 0;
+   uint64_t t1 = gettimeusec();
+   for (int i = 0; i < num_iterations; i++)
+   {
+      n += ebp_decode_ts_packet(ts, i, NULL, &ring);
+      if (ring.count == ring.size) while (ebp_event_ring_pop(&ring, &ev)) ;
+   }
+   uint64_t t2 = gettimeusec();
+   fail_unless(n == num_iterations && ring.num_dropped == 0, "EBP lost");
+
+   // what an ebp_t costs, with printing off
+   ts_scte128_private_data_t scte128 = { 0xDF, 4 + len, EBP_FORMAT_IDENTIFIER, { ebp_buf, len } };
+   uint64_t t3 = gettimeusec();
+   for (int i = 0; i < num_iterations / 10; i++)
+   {
+      ebp_t *e = ebp_new();
+      ebp_read(e, &scte128);
+      while (vqarray_length(e->ebp_grouping_ids) > 0) free(vqarray_pop(e->ebp_grouping_ids));
+      vqarray_free(e->ebp_grouping_ids);
+      ebp_free(e);
+   }
+   uint64_t t4 = gettimeusec();
+
+   printf("# EBP decode: %.0f EBPs/sec (ebp_decode_ts_packet), %.0f EBPs/sec (ebp_read)\n",
+          (double)num_iterations * 1000000.0 / (double)(t2 - t1 + 1),
+          (double)(num_iterations / 10) * 1000000.0 / (double)(t4 - t3 + 1));
+
+   ts->bytes = NULL;
+   ts_free(ts);
+}
+END_TEST
+
+int main(int argc, char **argv)
+{
+   int _testnum = 1;
+   int failed = 0;
+   int r;
+
+   if (argc > 1 && strcmp(argv[1], "-v") == 0) verbose = 1;
+   tslib_loglevel = verbose ? TSLIB_LOG_LEVEL_INFO : TSLIB_LOG_LEVEL_ERROR;
+
+   r = test_decode(); ok(r, "decode"); failed += !r;
+   r = test_events(); ok(r, "events"); failed += !r;
+   r = test_descriptor_index(); ok(r, "descriptor_index"); failed += !r;
+   r = test_decode_benchmark(); ok(r, "decode_benchmark"); failed += !r;
+   r = test_descriptor_index_benchmark(); ok(r, "descriptor_index_benchmark"); failed += !r;
+
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
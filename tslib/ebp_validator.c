@@ -0,0 +1,208 @@
+/*
+Copyright (c) 2015, Cable Television Laboratories, Inc.(“CableLabs”)
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of CableLabs nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL CABLELABS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <string.h>
+#include <ebp_validator.h>
+#include <log.h>
+
+#define EBP_PTS_MASK    ((1ULL << 33) - 1)
+
+// grouping IDs: 0 default, 1-31 private, 35 ad insertion, 126 start, 127 end; the rest is reserved
+static const uint64_t ebp_valid_grouping_ids[2] = { 0xFFFFFFFFULL | (1ULL << 35), (1ULL << (126 - 64)) | (1ULL << (127 - 64)) };
+
+int ebp_check_grouping_ids(const uint8_t *grouping_ids, int num_grouping_ids)
+{
+   uint64_t seen[2] = { 0, 0 };
+   int errors = 0;
+   int previous = -1;
+
+   for (int i = 0; i < num_grouping_ids; i++)
+   {
+      int id = grouping_ids[i] & 0x7F;
+      uint64_t bit = 1ULL << (id & 63);
+
+      if (!(ebp_valid_grouping_ids[id >> 6] & bit))
+      {
+         errors |= EBP_ERROR_GROUP_RANGE;
+      }
+
+      if (id == 126)
+      {
+         // start of the group before it
+         if (previous < 0 || previous == 126 || previous == 127) errors |= EBP_ERROR_GROUP_ORDER;
+      }
+      else if (id == 127)
+      {
+         // end of the group before it, which may also start here
+         if (previous < 0 || previous == 127) errors |= EBP_ERROR_GROUP_ORDER;
+      }
+      else
+      {
+         if (seen[id >> 6] & bit) errors |= EBP_ERROR_GROUP_DUPLICATE;
+         seen[id >> 6] |= bit;
+      }
+      previous = id;
+   }
+
+   return errors;
+}
+
+static void ebp_partition_state_init(ebp_partition_state_t *ps, const ebp_descriptor_t *ebp_desc, int partition_id, int keep_history)
+{
+   if (!keep_history)
+   {
+      memset(ps, 0, sizeof(ebp_partition_state_t));
+   }
+   ps->sap_type_max = 0;
+   ps->distance = 0;
+
+   if (ebp_desc == NULL)
+   {
+      ps->present = 1;
+      return;
+   }
+
+   // O(1) through the descriptor's partition index
+   const ebp_partition_data_t *pd = get_partition(ebp_desc, partition_id);
+   ps->present = (pd != NULL);
+   if (pd == NULL || !pd->ebp_data_explicit_flag)
+   {
+      return;  // EBP data on another PID, nothing to hold this one to
+   }
+
+   if (pd->boundary_flag)
+   {
+      ps->sap_type_max = pd->sap_type_max;
+   }
+   ps->distance = get_partition_distance(ebp_desc, partition_id);
+}
+
+void ebp_validator_init(ebp_validator_t *v, uint32_t pid, const ebp_descriptor_t *ebp_desc)
+{
+   int keep_history = (v->pid == pid && v->num_ebps > 0);
+   if (!keep_history)
+   {
+      memset(v, 0, sizeof(ebp_validator_t));
+      v->distance_tolerance = EBP_VALIDATOR_DISTANCE_TOLERANCE;
+   }
+   v->pid = pid;
+   v->has_descriptor = (ebp_desc != NULL);
+   ebp_partition_state_init(&v->segment, ebp_desc, EBP_PARTITION_SEGMENT, keep_history);
+   ebp_partition_state_init(&v->fragment, ebp_desc, EBP_PARTITION_FRAGMENT, keep_history);
+}
+
+static int ebp_validator_check_boundary(ebp_validator_t *v, ebp_partition_state_t *ps, const ebp_info_t *ebp, uint64_t pts, int has_pts)
+{
+   int errors = 0;
+
+   if (!ps->present)
+   {
+      errors |= EBP_ERROR_PARTITION;
+   }
+   if (ebp->ebp_sap_flag && ps->sap_type_max > 0 && ebp->ebp_sap_type > ps->sap_type_max)
+   {
+      errors |= EBP_ERROR_SAP_TYPE;
+   }
+
+   if (has_pts)
+   {
+      if (ps->have_last)
+      {
+         uint64_t delta = (pts - ps->last_pts) & EBP_PTS_MASK;
+         if (delta == 0 || delta > EBP_PTS_MASK / 2)
+         {
+            errors |= EBP_ERROR_SPACING;
+         }
+         else if (ps->distance > 0)
+         {
+            uint64_t deviation = (delta > ps->distance) ? delta - ps->distance : ps->distance - delta;
+            if (deviation > v->distance_tolerance) errors |= EBP_ERROR_DISTANCE;
+         }
+      }
+      ps->last_pts = pts & EBP_PTS_MASK;
+      ps->have_last = 1;
+   }
+   ps->num_boundaries++;
+
+   return errors;
+}
+
+int ebp_validator_check(ebp_validator_t *v, const ebp_info_t *ebp, uint64_t pts, int has_pts)
+{
+   if (v == NULL || ebp == NULL)
+   {
+      return 0;
+   }
+
+   int errors = 0;
+
+   if (ebp->ebp_grouping_flag)
+   {
+      uint32_t n = ebp->num_grouping_ids;
+      if (n > EBP_MAX_GROUPING_IDS)
+      {
+         n = EBP_MAX_GROUPING_IDS;
+         errors |= EBP_ERROR_GROUP_DUPLICATE;  // there are only 128 IDs
+      }
+      errors |= ebp_check_grouping_ids(ebp->grouping_ids, n);
+   }
+   if (ebp->ebp_segment_flag)
+   {
+      errors |= ebp_validator_check_boundary(v, &v->segment, ebp, pts, has_pts);
+   }
+   if (ebp->ebp_fragment_flag)
+   {
+      errors |= ebp_validator_check_boundary(v, &v->fragment, ebp, pts, has_pts);
+   }
+
+   v->num_ebps++;
+   if (errors)
+   {
+      v->num_invalid++;
+      for (int i = 0; i < EBP_NUM_ERRORS; i++)
+      {
+         if (errors & (1 << i)) v->num_errors[i]++;
+      }
+      LOG_DEBUG_ARGS("EBP on PID %u failed checks 0x%02x", v->pid, errors);
+   }
+   v->last_errors = errors;
+   return errors;
+}
+
+int ebp_validator_ts_packet(ebp_validator_t *v, const ts_packet_t *ts)
+{
+   ebp_info_t ebp;
+   ebp_event_t event;
+   ebp_event_ring_t ring;
+
+   ebp_event_ring_init(&ring, &event, 1);
+   if (!ebp_decode_ts_packet(ts, 0, &ebp, &ring))
+   {
+      return 0;
+   }
+   return ebp_validator_check(v, &ebp, event.pts, (event.flags & EBP_EVENT_PTS) != 0);
+}
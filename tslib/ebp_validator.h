@@ -0,0 +1,120 @@
+/*
+Copyright (c) 2015, Cable Television Laboratories, Inc.(“CableLabs”)
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of CableLabs nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL CABLELABS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef EBP_VALIDATOR_H_
+#define EBP_VALIDATOR_H_
+
+#include <stdint.h>
+#include <ts.h>
+#include <ebp.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// ebp_validator_check results, or'ed
+#define EBP_ERROR_GROUP_RANGE       0x01     // reserved grouping ID
+#define EBP_ERROR_GROUP_DUPLICATE   0x02     // grouping ID other than 126/127 repeated
+#define EBP_ERROR_GROUP_ORDER       0x04     // 126 or 127 not following a grouping ID
+#define EBP_ERROR_SAP_TYPE          0x08     // SAP type above the partition's SAP_type_max
+#define EBP_ERROR_DISTANCE          0x10     // boundary spacing differs from ebp_distance
+#define EBP_ERROR_SPACING           0x20     // boundary not after the previous one
+#define EBP_ERROR_PARTITION         0x40     // boundary of a partition the EBP descriptor does not have
+#define EBP_NUM_ERRORS              7
+
+#define EBP_VALIDATOR_DISTANCE_TOLERANCE   1      // default, 90kHz ticks
+
+/**
+ * Per-partition state, precomputed from the EBP descriptor
+ */
+typedef struct {
+   uint8_t present;                 // the descriptor has the partition
+   uint8_t sap_type_max;            // 0 if not limited
+   uint64_t distance;               // expected boundary spacing in 90kHz ticks, 0 if not signalled
+   uint64_t last_pts;               // PTS of the last boundary
+   uint8_t have_last;               // last_pts is set
+   uint64_t num_boundaries;
+} ebp_partition_state_t;
+
+/**
+ * Streaming EBP conformance check for one PID. Everything needed from the 
+ * EBP descriptor is worked out by ebp_validator_init, so each EBP is checked
+ * in constant time and without allocation: grouping ID range, uniqueness 
+ * and 126/127 order, SAP type against SAP_type_max, and boundary spacing 
+ * against ebp_distance.
+ */
+typedef struct {
+   uint32_t pid;
+   int has_descriptor;              // partitions are constrained by an EBP descriptor
+   ebp_partition_state_t segment;
+   ebp_partition_state_t fragment;
+   uint64_t distance_tolerance;     // allowed deviation from ebp_distance, 90kHz ticks
+
+   uint64_t num_ebps;               // EBPs checked
+   uint64_t num_invalid;            // EBPs with at least one error
+   uint64_t num_errors[EBP_NUM_ERRORS];   // per error, by bit position
+   int last_errors;                 // result of the last check
+} ebp_validator_t;
+
+/**
+ * Set up a validator, which must be zeroed before the first call. May be 
+ * called again when the PMT changes; boundary history and counters are kept
+ * if the PID stays the same.
+ * @param v validator
+ * @param pid PID carrying the EBPs
+ * @param ebp_desc EBP descriptor of the PID, NULL if there is none (no partition constraints)
+ */
+void ebp_validator_init(ebp_validator_t *v, uint32_t pid, const ebp_descriptor_t *ebp_desc);
+
+/**
+ * Check an EBP.
+ * @param v validator
+ * @param ebp decoded EBP
+ * @param pts PTS of the access unit the EBP is on, needed for spacing checks
+ * @param has_pts pts is valid
+ * @return 0 if conformant, EBP_ERROR_* otherwise
+ */
+int ebp_validator_check(ebp_validator_t *v, const ebp_info_t *ebp, uint64_t pts, int has_pts);
+
+/**
+ * Decode and check the EBP of a TS packet, if any.
+ * @return as ebp_validator_check, 0 if the packet has no EBP
+ */
+int ebp_validator_ts_packet(ebp_validator_t *v, const ts_packet_t *ts);
+
+/**
+ * Check grouping IDs: range, uniqueness and 126/127 order.
+ * @return 0 or EBP_ERROR_GROUP_*
+ */
+int ebp_check_grouping_ids(const uint8_t *grouping_ids, int num_grouping_ids);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EBP_VALIDATOR_H_ */
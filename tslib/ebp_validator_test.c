@@ -0,0 +1,316 @@
+/*
+
+ Copyright (c) 2012-, ISO/IEC JTC1/SC29/WG11
+ Written by Alex Giladi <alex.giladi@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of the ISO/IEC nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "log.h"
+#include "ts.h"
+#include "ebp.h"
+#include "ebp_validator.h"
+#include "ts_test_util.h"
+#include "test_macros.h"
+
+#define TEST_PID       0x100
+
+int verbose = 0;
+
+/**
+ * EBP descriptor with a segment partition (2s apart, SAP type up to 2) and,
+ * if with_fragment, a fragment partition (1s apart, any SAP type)
+ */
+static ebp_descriptor_t* build_ebp_descriptor(int with_fragment)
+{
+   ebp_descriptor_t *ebp_desc = calloc(1, sizeof(ebp_descriptor_t));
+   ebp_desc->descriptor.tag = EBP_DESCRIPTOR;
+   ebp_desc->timescale_flag = 1;
+   ebp_desc->ticks_per_second = 1000;
+   ebp_desc->partition_data = vqarray_new();
+
+   ebp_partition_data_t *segment = calloc(1, sizeof(ebp_partition_data_t));
+   segment->partition_id = EBP_PARTITION_SEGMENT;
+   segment->ebp_data_explicit_flag = 1;
+   segment->boundary_flag = 1;
+   segment->ebp_distance = 2000;
+   segment->sap_type_max = 2;
+   vqarray_add(ebp_desc->partition_data, segment);
+
+   if (with_fragment)
+   {
+      ebp_partition_data_t *fragment = calloc(1, sizeof(ebp_partition_data_t));
+      fragment->partition_id = EBP_PARTITION_FRAGMENT;
+      fragment->ebp_data_explicit_flag = 1;
+      fragment->boundary_flag = 1;
+      fragment->ebp_distance = 1000;
+      vqarray_add(ebp_desc->partition_data, fragment);
+   }
+   ebp_desc->num_partitions = vqarray_length(ebp_desc->partition_data);
+   ebp_descriptor_build_index(ebp_desc);
+
+   return ebp_desc;
+}
+
+static int check_ebp(ebp_validator_t *v, int fragment, int segment, int sap_type,
+                     const uint8_t *grouping_ids, int num_grouping_ids, uint64_t pts)
+{
+   uint8_t buf[EBP_MAX_GROUPING_IDS + 16];
+   ebp_info_t ebp;
+
+   int len = ts_test_build_ebp(buf, fragment, segment, sap_type, grouping_ids, num_grouping_ids, 0);
+   if (!ebp_decode(&ebp, buf, len)) return -1;
+   return ebp_validator_check(v, &ebp, pts, 1);
+}
+
+START_TEST(test_grouping_ids)
+{
+   const struct
+   {
+      uint8_t ids[8];
+      int n;
+      int errors;
+   } cases[] = {
+      { { 0 }, 1, 0 },
+      { { 1, 31, 35 }, 3, 0 },
+      { { 5, 126 }, 2, 0 },
+      { { 5, 127 }, 2, 0 },
+      { { 5, 126, 127 }, 3, 0 },
+      { { 5, 126, 6, 126, 127 }, 5, 0 },          // 126/127 may repeat
+      { { 32 }, 1, EBP_ERROR_GROUP_RANGE },
+      { { 5, 100 }, 2, EBP_ERROR_GROUP_RANGE },
+      { { 5, 6, 5 }, 3, EBP_ERROR_GROUP_DUPLICATE },
+      { { 126 }, 1, EBP_ERROR_GROUP_ORDER },
+      { { 127 }, 1, EBP_ERROR_GROUP_ORDER },
+      { { 5, 127, 126 }, 3, EBP_ERROR_GROUP_ORDER },
+      { { 5, 127, 127 }, 3, EBP_ERROR_GROUP_ORDER },
+      { { 5, 126, 126 }, 3, EBP_ERROR_GROUP_ORDER },
+      { { 34, 34, 126, 126 }, 4, EBP_ERROR_GROUP_RANGE | EBP_ERROR_GROUP_DUPLICATE | EBP_ERROR_GROUP_ORDER },
+   };
+
+   for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+   {
+      int errors = ebp_check_grouping_ids(cases[i].ids, cases[i].n);
+      fail_unless2(errors == cases[i].errors, "wrong grouping ID check", "(case %zu: 0x%02x)", i, errors);
+   }
+
+   // ebp_validate_groups agrees
+   const uint32_t duplicate[] = { 5, 6, 5 };
+   ebp_t *e = ebp_new();
+   e->ebp_grouping_flag = 1;
+   e->ebp_grouping_ids = vqarray_new();
+   for (int i = 0; i < 3; i++)
+   {
+      uint32_t *id = malloc(sizeof(uint32_t));
+      *id = duplicate[i];
+      vqarray_add(e->ebp_grouping_ids, id);
+   }
+   tslib_loglevel = 0;
+   int r = ebp_validate_groups(e);
+   tslib_loglevel = verbose ? TSLIB_LOG_LEVEL_INFO : TSLIB_LOG_LEVEL_ERROR;
+   fail_unless(r == -1, "duplicate group ID accepted");
+   free(vqarray_pop(e->ebp_grouping_ids));
+   fail_unless(ebp_validate_groups(e) == 0, "valid group IDs rejected");
+   while (vqarray_length(e->ebp_grouping_ids) > 0) free(vqarray_pop(e->ebp_grouping_ids));
+   vqarray_free(e->ebp_grouping_ids);
+   ebp_free(e);
+}
+END_TEST
+
+START_TEST(test_partitions)
+{
+   const uint8_t grouping_ids[] = { 1 };
+   ebp_descriptor_t *ebp_desc = build_ebp_descriptor(1);
+   ebp_validator_t v;
+   memset(&v, 0, sizeof(v));
+   ebp_validator_init(&v, TEST_PID, ebp_desc);
+
+   fail_unless(v.segment.present && v.segment.sap_type_max == 2 && v.segment.distance == 180000, "wrong segment setup");
+   fail_unless(v.fragment.present && v.fragment.sap_type_max == 0 && v.fragment.distance == 90000, "wrong fragment setup");
+
+   // segment every other fragment, 1s apart
+   uint64_t pts = 0;
+   for (int i = 0; i < 8; i++)
+   {
+      int r = check_ebp(&v, 1, i % 2 == 0, 1, grouping_ids, 1, pts);
+      fail_unless2(r == 0, "valid EBP rejected", "(%d: 0x%02x)", i, r);
+      pts += 90000;
+   }
+
+   int r = check_ebp(&v, 1, 1, 3, grouping_ids, 1, pts);
+   fail_unless2(r == EBP_ERROR_SAP_TYPE, "SAP type over the maximum", "(0x%02x)", r);
+   pts += 90000;
+
+   // fragment 1 tick late is tolerated, 2 are not
+   r = check_ebp(&v, 1, 0, 1, NULL, 0, pts + 1);
+   fail_unless2(r == 0, "late fragment within tolerance", "(0x%02x)", r);
+   pts += 90000;
+   r = check_ebp(&v, 1, 0, 1, NULL, 0, pts + 3);
+   fail_unless2(r == EBP_ERROR_DISTANCE, "late fragment", "(0x%02x)", r);
+
+   // going backwards, and repeating the PTS
+   r = check_ebp(&v, 1, 0, 1, NULL, 0, pts - 90000);
+   fail_unless2(r == EBP_ERROR_SPACING, "fragment going backwards", "(0x%02x)", r);
+   r = check_ebp(&v, 1, 0, 1, NULL, 0, pts - 90000);
+   fail_unless2(r == EBP_ERROR_SPACING, "repeated fragment", "(0x%02x)", r);
+
+   // spacing is checked across the PTS wrap
+   ebp_validator_t w;
+   memset(&w, 0, sizeof(w));
+   ebp_validator_init(&w, TEST_PID, ebp_desc);
+   fail_unless(check_ebp(&w, 1, 0, 1, NULL, 0, (1ULL << 33) - 45000) == 0, "first fragment");
+   r = check_ebp(&w, 1, 0, 1, NULL, 0, 45000);
+   fail_unless2(r == 0, "fragment across the PTS wrap", "(0x%02x)", r);
+
+   fail_unless2(v.num_ebps == 13 && v.num_invalid == 4 && v.num_errors[0] == 0 &&
+                v.num_errors[3] == 1 && v.num_errors[4] == 1 && v.num_errors[5] == 2, "wrong counters",
+                "(%llu EBPs, %llu invalid)", (unsigned long long)v.num_ebps, (unsigned long long)v.num_invalid);
+
+   // PMT update without the fragment partition, history of the PID is kept
+   ebp_descriptor_free((descriptor_t *)ebp_desc);
+   ebp_desc = build_ebp_descriptor(0);
+   ebp_validator_init(&v, TEST_PID, ebp_desc);
+   fail_unless(v.num_ebps == 13 && v.segment.have_last && !v.fragment.present, "PMT update lost the history");
+   r = check_ebp(&v, 1, 0, 1, NULL, 0, pts);
+   fail_unless2(r == EBP_ERROR_PARTITION, "fragment without a partition", "(0x%02x)", r);
+
+   // no descriptor, nothing to check but the grouping IDs and the order
+   ebp_validator_init(&v, TEST_PID + 1, NULL);
+   fail_unless(v.num_ebps == 0 && !v.has_descriptor, "new PID kept the history");
+   fail_unless(check_ebp(&v, 1, 1, 6, NULL, 0, 1000) == 0, "EBP without a descriptor");
+   fail_unless(check_ebp(&v, 1, 0, 6, NULL, 0, 1234) == 0, "EBP without a descriptor");
+   fail_unless(check_ebp(&v, 1, 0, 6, NULL, 0, 1234) == EBP_ERROR_SPACING, "repeated EBP without a descriptor");
+
+   ebp_descriptor_free((descriptor_t *)ebp_desc);
+}
+END_TEST
+
+START_TEST(test_ts_packets)
+{
+   const uint8_t grouping_ids[] = { 1, 126 };
+   uint8_t pkt[TS_SIZE];
+   uint8_t ebp_buf[32];
+   ebp_descriptor_t *ebp_desc = build_ebp_descriptor(1);
+   ebp_validator_t v;
+   memset(&v, 0, sizeof(v));
+   ebp_validator_init(&v, TEST_PID, ebp_desc);
+   ts_packet_t *ts = ts_new();
+
+   for (int i = 0; i < 10; i++)
+   {
+      // the 7th fragment, also a segment, comes half a second late
+      uint64_t pts = 90000ULL * i + (i == 6 ? 45000 : 0);
+      int len = ts_test_build_ebp(ebp_buf, 1, i % 2 == 0, 1, grouping_ids, 2, 0);
+      ts_test_write_ebp_packet(pkt, TEST_PID, i, ebp_buf, len, pts);
+      ts_read_view(ts, pkt, TS_SIZE);
+      int r = ebp_validator_ts_packet(&v, ts);
+      int expected = (i >= 6 && i <= 8) ? EBP_ERROR_DISTANCE : 0;
+      fail_unless2(r == expected, "wrong result", "(packet %d: 0x%02x)", i, r);
+
+      ts_test_write_pes_packet(pkt, TEST_PID, i, 0, 0xE0, 0, 0);
+      ts_read_view(ts, pkt, TS_SIZE);
+      fail_unless(ebp_validator_ts_packet(&v, ts) == 0, "packet without EBP");
+   }
+   fail_unless2(v.num_ebps == 10 && v.num_invalid == 3 && v.segment.num_boundaries == 5, "wrong counters",
+                "(%llu EBPs, %llu invalid)", (unsigned long long)v.num_ebps, (unsigned long long)v.num_invalid);
+
+   ts->bytes = NULL;
+   ts_free(ts);
+   ebp_descriptor_free((descriptor_t *)ebp_desc);
+}
+END_TEST
+
+START_TEST(test_validator_benchmark)
+{
+   const int num_iterations = 1000000;
+   const uint8_t grouping_ids[] = { 1, 2, 3, 4, 5, 6, 7, 8, 126, 127 };
+   uint8_t buf[32];
+   ebp_info_t ebp;
+   ebp_descriptor_t *ebp_desc = build_ebp_descriptor(1);
+   ebp_validator_t v;
+   memset(&v, 0, sizeof(v));
+   ebp_validator_init(&v, TEST_PID, ebp_desc);
+
+   int len = ts_test_build_ebp(buf, 1, 0, 1, grouping_ids, 10, 0);
+   fail_unless(ebp_decode(&ebp, buf, len), "decode failed");
+
+   int errors = 0;
+   uint64_t t1 = gettimeusec();
+   for (int i = 0; i < num_iterations; i++)
+   {
+      errors |= ebp_validator_check(&v, &ebp, 90000ULL * i, 1);
+   }
+   uint64_t t2 = gettimeusec();
+   fail_unless2(errors == 0 && v.num_ebps == (uint64_t)num_iterations, "valid EBPs rejected", "(0x%02x)", errors);
+
+   // grouping IDs through the allocating interface
+   ebp_t *e = ebp_new();
+   e->ebp_grouping_flag = 1;
+   e->ebp_grouping_ids = vqarray_new();
+   for (int i = 0; i < 10; i++)
+   {
+      uint32_t *id = malloc(sizeof(uint32_t));
+      *id = grouping_ids[i];
+      vqarray_add(e->ebp_grouping_ids, id);
+   }
+   uint64_t t3 = gettimeusec();
+   for (int i = 0; i < num_iterations; i++)
+   {
+      errors |= ebp_validate_groups(e);
+   }
+   uint64_t t4 = gettimeusec();
+   fail_unless(errors == 0, "valid group IDs rejected");
+
+   printf("# EBP validation: %.0f EBPs/sec (ebp_validator_check), %.0f EBPs/sec (ebp_validate_groups)\n",
+          (double)num_iterations * 1000000.0 / (double)(t2 - t1 + 1),
+          (double)num_iterations * 1000000.0 / (double)(t4 - t3 + 1));
+
+   while (vqarray_length(e->ebp_grouping_ids) > 0) free(vqarray_pop(e->ebp_grouping_ids));
+   vqarray_free(e->ebp_grouping_ids);
+   ebp_free(e);
+   ebp_descriptor_free((descriptor_t *)ebp_desc);
+}
+END_TEST
+
+int main(int argc, char **argv)
+{
+   int _testnum = 1;
+   int failed = 0;
+   int r;
+
+   if (argc > 1 && strcmp(argv[1], "-v") == 0) verbose = 1;
+   tslib_loglevel = verbose ? TSLIB_LOG_LEVEL_INFO : TSLIB_LOG_LEVEL_ERROR;
+
+   r = test_grouping_ids(); ok(r, "grouping_ids"); failed += !r;
+   r = test_partitions(); ok(r, "partitions"); failed += !r;
+   r = test_ts_packets(); ok(r, "ts_packets"); failed += !r;
+   r = test_validator_benchmark(); ok(r, "validator_benchmark"); failed += !r;
+
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
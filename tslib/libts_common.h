@@ -86,9 +86,10 @@ static inline void bs_write_marker_bit(bs_t *b)
    bs_write_u1(b, 1);
 }
 
-// Dirty hack: our own errno, error reporting via a global var. Initialized to zero on start.
-extern volatile int tslib_errno; 
-// This macro is NOT thread-safe
+// Dirty hack: our own errno, error reporting via a per-thread var. Initialized to zero in every thread.
+// Like errno, it is only meaningful to the thread which called into tslib.
+extern __thread volatile int tslib_errno; 
+// Keeps the first error reported by the calling thread
 #define SAFE_REPORT_TS_ERR(errCode)		if (tslib_errno == 0) tslib_errno = (errCode)
 
 #ifdef __cplusplus
@@ -27,11 +27,45 @@
  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
 #include "libts_common.h"
 #include "mpeg2ts_demux.h"
 #include "cas.h"
 #include "psi.h"
 #include <descriptors.h>
+#include <spsc_ring.h>
+
+typedef struct 
+{
+   ts_packet_t *ts; 
+   pid_info_t *pi; 
+} mpeg2ts_work_item_t; 
+
+typedef struct 
+{
+   pthread_t thread; 
+   spsc_ring_t *queue;                 /// packets for this worker, filled by the reading thread
+   uint64_t num_queued;                /// packets queued, reading thread only
+   uint64_t num_done;                  /// packets processed, written by the worker
+   int sleeping;                       /// worker found its queue empty and waits on wake
+   int stop;                           /// worker exits once its queue is empty
+   int loglevel;                       /// tslib_loglevel and tslib_logfile of the thread which started the worker
+   FILE *logfile; 
+   pthread_mutex_t lock; 
+   pthread_cond_t wake; 
+} mpeg2ts_worker_t; 
+
+struct _mpeg2ts_workers_ 
+{
+   int num_workers; 
+   mpeg2ts_worker_t *workers; 
+   int8_t pid_worker[NUM_PIDS];        /// worker owning each PID, -1 if not assigned yet
+   int next_video_worker;              /// round-robin state for PIDs assigned on first packet
+   int next_other_worker; 
+}; 
 
 
 pid_info_t* pid_info_new() 
@@ -75,6 +109,7 @@ mpeg2ts_program_t* mpeg2ts_program_new(int program_number, int PID)
    
    m2p->pmt_processor = NULL;
    m2p->scte128_enabled = 1;
+   section_assembler_init(&m2p->pmt_sa);
 
    return m2p;
 }
@@ -98,8 +133,6 @@ void mpeg2ts_program_free(mpeg2ts_program_t *m2p)
    {
       m2p->arg_destructor(m2p->arg);
    }
-   
-   resetPSITableBuffer(&m2p->pmtBuffer);
 
    free(m2p);
 }
@@ -107,6 +140,7 @@ void mpeg2ts_program_free(mpeg2ts_program_t *m2p)
 int mpeg2ts_program_replace_pid_processor(mpeg2ts_program_t *m2p, pid_info_t *piNew)
 {
    if (m2p == NULL) return 0;
+   if (m2p->m2s != NULL) mpeg2ts_stream_sync_workers(m2p->m2s);
 
    int i;
    uint32_t PID = piNew->es_info->elementary_PID;
@@ -162,6 +196,7 @@ int mpeg2ts_program_register_pid_processor(mpeg2ts_program_t *m2p, uint32_t PID,
    if ( validator != NULL ) pid->demux_validator = validator;
 
    mpeg2ts_program_replace_pid_processor(m2p, pid);
+   if (m2p->m2s != NULL) mpeg2ts_stream_rebuild_pid_map(m2p->m2s);
    
    return 1;
 }
@@ -184,8 +219,10 @@ int mpeg2ts_program_unregister_pid_processor(mpeg2ts_program_t *m2p, uint32_t PI
    if (pi == NULL) // not found
       return 0; 
    
+   if (m2p->m2s != NULL) mpeg2ts_stream_sync_workers(m2p->m2s);
    pid_info_free(pi); 
    vqarray_remove(m2p->pids, i); 
+   if (m2p->m2s != NULL) mpeg2ts_stream_rebuild_pid_map(m2p->m2s);
    
    return 0;
 }
@@ -229,19 +266,118 @@ pid_info_t* mpeg2ts_program_get_pid_info(mpeg2ts_program_t *m2p, uint32_t PID)
    return pi;
 }
 
+static void mpeg2ts_stream_set_pid_interest(mpeg2ts_stream_t *m2s, uint32_t PID)
+{
+   PID &= NUM_PIDS - 1;
+   m2s->pid_interest[PID >> 6] |= UINT64_C(1) << (PID & 63);
+}
+
+// a packet on a PID without validator or handler would only be logged and dropped
+static int mpeg2ts_pid_info_has_processor(const pid_info_t *pi)
+{
+   return (pi->demux_validator != NULL && pi->demux_validator->process_ts_packet != NULL) || 
+          (pi->demux_handler != NULL && pi->demux_handler->process_ts_packet != NULL);
+}
+
+void mpeg2ts_stream_rebuild_pid_map(mpeg2ts_stream_t *m2s)
+{
+   if (m2s == NULL) return;
+
+   memset(m2s->pid_map, 0, sizeof(m2s->pid_map));
+   memset(m2s->pid_interest, 0, sizeof(m2s->pid_interest));
+   m2s->num_unbound_pids = 0;
+   
+   mpeg2ts_stream_set_pid_interest(m2s, PAT_PID);
+   mpeg2ts_stream_set_pid_interest(m2s, CAT_PID);
+
+   // walk in the same order as the linear search did, first claim wins
+   for (int i = 0; i < vqarray_length(m2s->programs); i++)
+   {
+      mpeg2ts_program_t *m2p = vqarray_get(m2s->programs, i);
+      if (m2p == NULL) continue;
+
+      pid_map_entry_t *e = &m2s->pid_map[m2p->PID & (NUM_PIDS - 1)];
+      if (e->program == NULL)
+      {
+         e->program = m2p;
+         e->is_pmt = 1;
+      }
+      mpeg2ts_stream_set_pid_interest(m2s, m2p->PID);
+
+      for (int j = 0; j < vqarray_length(m2p->pids); j++)
+      {
+         pid_info_t *pi = vqarray_get(m2p->pids, j);
+         if (pi == NULL || pi->es_info == NULL) continue;
+
+         if (pi->es_info->elementary_PID == NULL_PID)
+         {
+            m2s->num_unbound_pids++;
+            continue;
+         }
+
+         e = &m2s->pid_map[pi->es_info->elementary_PID & (NUM_PIDS - 1)];
+         if (e->program == NULL)
+         {
+            e->program = m2p;
+            e->pid_info = pi;
+         }
+         if (mpeg2ts_pid_info_has_processor(pi)) 
+         {
+            mpeg2ts_stream_set_pid_interest(m2s, pi->es_info->elementary_PID);
+         }
+      }
+   }
+   
+   // any PID may turn out to be the one an unbound pid_info is waiting for
+   if (m2s->num_unbound_pids > 0) 
+   {
+      memset(m2s->pid_interest, 0xFF, sizeof(m2s->pid_interest));
+   }
+}
+
+/**
+ * Slow path for PIDs missing from the map while some pid_info has no PID yet:
+ * let mpeg2ts_program_get_pid_info bind it, then refresh the map.
+ */
+static pid_info_t* mpeg2ts_stream_bind_pid(mpeg2ts_stream_t *m2s, uint32_t PID)
+{
+   pid_info_t *pi = NULL;
+   for (int i = 0; i < vqarray_length(m2s->programs) && (pi == NULL); i++)
+   {
+      mpeg2ts_program_t *m2p = vqarray_get(m2s->programs, i);
+      if (m2p == NULL) continue;
+      pi = mpeg2ts_program_get_pid_info(m2p, PID);
+   }
+
+   if (pi == NULL) return NULL;
 
+   mpeg2ts_stream_rebuild_pid_map(m2s);
+   return m2s->pid_map[PID].pid_info;
+}
 
 mpeg2ts_stream_t* mpeg2ts_stream_new() 
 { 
    mpeg2ts_stream_t *m2s = calloc(1, sizeof(mpeg2ts_stream_t)); 
    m2s->programs = vqarray_new(); 
+   m2s->ts_pool = ts_packet_pool_new(MPEG2TS_STREAM_POOL_SLAB_SIZE); 
+   section_assembler_init(&m2s->pat_sa); 
+   section_assembler_init(&m2s->cat_sa); 
+   ts_sync_init(&m2s->sync, 0); 
+   mpeg2ts_stream_rebuild_pid_map(m2s); 
    init_descriptors();
    return m2s;
 }
 
+ts_packet_t* mpeg2ts_stream_new_ts_packet(mpeg2ts_stream_t *m2s) 
+{ 
+   if (m2s == NULL) return NULL; 
+   return ts_packet_pool_get(m2s->ts_pool);
+}
+
 void mpeg2ts_stream_free(mpeg2ts_stream_t *m2s) 
 { 
    if (m2s == NULL) return; 
+   mpeg2ts_stream_stop_workers(m2s); 
    if (m2s->programs != NULL) 
    {
       vqarray_foreach(m2s->programs, (vqarray_functor_t)mpeg2ts_program_free); 
@@ -259,29 +395,28 @@ void mpeg2ts_stream_free(mpeg2ts_stream_t *m2s)
    {
       m2s->arg_destructor(m2s->arg);
    }
+   // packets still held by the user keep the pool alive until freed
+   ts_packet_pool_free(m2s->ts_pool); 
    free(m2s);
 }
 
-int mpeg2ts_stream_read_cat(mpeg2ts_stream_t *m2s, ts_packet_t *ts) 
+static int mpeg2ts_stream_process_cat(uint8_t *section, size_t section_len, void *arg) 
 { 
-   int ret = 0; 
+   mpeg2ts_stream_t *m2s = (mpeg2ts_stream_t *)arg; 
+   
+   // unchanged repetition of the last accepted section, nothing to do
+   if (psi_section_cache_check(&m2s->cat_cache, section, section_len)) return 1; 
    
    conditional_access_section_t *new_cas = conditional_access_section_new(); 
    
-   if (new_cas == NULL) 
-   {
-      ts_free(ts);    
-      return 0; 
-   }
+   if (new_cas == NULL) return 0; 
    
-
-   if (conditional_access_section_read(new_cas, ts->payload.bytes, ts->payload.len, ts->header.payload_unit_start_indicator,
-      &(m2s->catBuffer)) == 0) 
+   if (conditional_access_section_read(new_cas, section, section_len) == 0) 
    {
       conditional_access_section_free(new_cas); 
-      ts_free(ts);    
       return 0; 
    }
+   psi_section_cache_store(&m2s->cat_cache, section, section_len); 
    
    // we know that we have a complete new cat
    int new_cat_version = (m2s->cat == NULL); 
@@ -298,6 +433,7 @@ int mpeg2ts_stream_read_cat(mpeg2ts_stream_t *m2s, ts_packet_t *ts)
    
    if (new_cat_version) 
    {
+      mpeg2ts_stream_sync_workers(m2s); 
       if (m2s->cat != NULL) conditional_access_section_free(m2s->cat); 
 
       m2s->cat = new_cas; 
@@ -323,29 +459,34 @@ int mpeg2ts_stream_read_cat(mpeg2ts_stream_t *m2s, ts_packet_t *ts)
       conditional_access_section_free(new_cas); 
    }
    
-   ts_free(ts);    
-   return ret;
+   return 1;
+}
+
+int mpeg2ts_stream_read_cat(mpeg2ts_stream_t *m2s, ts_packet_t *ts)
+{ 
+   section_assembler_push(&m2s->cat_sa, ts->payload.bytes, ts->payload.len, ts->header.payload_unit_start_indicator, 
+                          mpeg2ts_stream_process_cat, m2s); 
+   ts_free(ts); 
+   return 0;
 }
 
-int mpeg2ts_stream_read_pat(mpeg2ts_stream_t *m2s, ts_packet_t *ts) 
+static int mpeg2ts_stream_process_pat(uint8_t *section, size_t section_len, void *arg) 
 { 
-   int ret = 0; 
+   mpeg2ts_stream_t *m2s = (mpeg2ts_stream_t *)arg; 
+   
+   // unchanged repetition of the last accepted section, nothing to do
+   if (psi_section_cache_check(&m2s->pat_cache, section, section_len)) return 1; 
    
    program_association_section_t *new_pas = program_association_section_new(); 
    
-   if (new_pas == NULL) 
-   {
-      ts_free(ts);    
-      return 0; 
-   }
+   if (new_pas == NULL) return 0; 
    
-   if (program_association_section_read(new_pas, ts->payload.bytes, ts->payload.len, ts->header.payload_unit_start_indicator,
-      &(m2s->patBuffer)) == 0) 
+   if (program_association_section_read(new_pas, section, section_len) == 0) 
    {
       program_association_section_free(new_pas); 
-      ts_free(ts);    
       return 0; 
    }
+   psi_section_cache_store(&m2s->pat_cache, section, section_len); 
    
    // we know that we have a complete new PAT
    int new_pat_version = (m2s->pat == NULL); 
@@ -362,6 +503,7 @@ int mpeg2ts_stream_read_pat(mpeg2ts_stream_t *m2s, ts_packet_t *ts)
    
    if (new_pat_version) 
    {
+      mpeg2ts_stream_sync_workers(m2s); 
       if (m2s->pat != NULL) program_association_section_free(m2s->pat); 
       
       m2s->pat = new_pas; 
@@ -370,43 +512,67 @@ int mpeg2ts_stream_read_pat(mpeg2ts_stream_t *m2s, ts_packet_t *ts)
          mpeg2ts_program_t *prog = mpeg2ts_program_new(
             m2s->pat->programs[i].program_number, 
             m2s->pat->programs[i].program_map_PID); 
+         prog->m2s = m2s;
          vqarray_add(m2s->programs, (void *)prog);
       }
       
       if (m2s->pat_processor != NULL) m2s->pat_processor(m2s, m2s->arg); 
+      mpeg2ts_stream_rebuild_pid_map(m2s);
    }
    else
    {
       program_association_section_free(new_pas);
    }
    
-   ts_free(ts);    
-   return ret;
+   return 1;
 }
 
-int mpeg2ts_program_read_pmt(mpeg2ts_program_t *m2p, ts_packet_t *ts) 
+int mpeg2ts_stream_read_pat(mpeg2ts_stream_t *m2s, ts_packet_t *ts)
 { 
-   LOG_INFO ("mpeg2ts_program_read_pmt");
-   int ret = 0; 
+   section_assembler_push(&m2s->pat_sa, ts->payload.bytes, ts->payload.len, ts->header.payload_unit_start_indicator, 
+                          mpeg2ts_stream_process_pat, m2s); 
+   ts_free(ts); 
+   return 0;
+}
+
+static elementary_stream_info_t* mpeg2ts_find_es_info(program_map_section_t *pms, uint32_t PID) 
+{
+   for (int i = 0; i < vqarray_length(pms->es_info); i++) 
+   {
+      elementary_stream_info_t *es = vqarray_get(pms->es_info, i); 
+      if (es != NULL && es->elementary_PID == PID) return es;
+   }
+   return NULL;
+}
+
+static int mpeg2ts_program_has_es_info(mpeg2ts_program_t *m2p, elementary_stream_info_t *es) 
+{
+   for (int i = 0; i < vqarray_length(m2p->pids); i++) 
+   {
+      pid_info_t *pi = vqarray_get(m2p->pids, i); 
+      if (pi != NULL && pi->es_info == es) return 1;
+   }
+   return 0;
+}
+
+static int mpeg2ts_program_process_pmt(uint8_t *section, size_t section_len, void *arg) 
+{ 
+   mpeg2ts_program_t *m2p = (mpeg2ts_program_t *)arg; 
+   
+   // unchanged repetition of the last accepted section, nothing to do
+   if (psi_section_cache_check(&m2p->pmt_cache, section, section_len)) return 1; 
    
+   LOG_INFO ("mpeg2ts_program_process_pmt");
    program_map_section_t *new_pms = program_map_section_new(); 
    
-   if (new_pms == NULL)  
-   {
-      ts_free(ts);    
-      return ret;
-   }
+   if (new_pms == NULL) return 0; 
    
-   LOG_DEBUG_ARGS ("mpeg2ts_program_read_pmt -- 1: ts->payload.len = %ld, adaptation_field_control = %d, payload_unit_start_indicator = %d", 
-      ts->payload.len, ts->header.adaptation_field_control, ts->header.payload_unit_start_indicator);
-   if (program_map_section_read(new_pms, ts->payload.bytes, ts->payload.len, ts->header.payload_unit_start_indicator,
-      &(m2p->pmtBuffer)) == 0) 
+   if (program_map_section_read(new_pms, section, section_len) == 0) 
    {
-      LOG_INFO ("mpeg2ts_program_read_pmt returned 0");
       program_map_section_free(new_pms); 
-      ts_free(ts);    
-      return ret;
+      return 0; 
    }
+   psi_section_cache_store(&m2p->pmt_cache, section, section_len); 
    
 // we know that we have a complete new PAT
    int new_pmt_version = (m2p->pmt == NULL); 
@@ -422,6 +588,26 @@ int mpeg2ts_program_read_pmt(mpeg2ts_program_t *m2p, ts_packet_t *ts)
    
    if (new_pmt_version) 
    {
+      if (m2p->m2s != NULL) mpeg2ts_stream_sync_workers(m2p->m2s); 
+      
+      // pid_info's reference es_info's of the old PMT: the ones whose PID is still 
+      // listed move over to the new PMT with their handlers, the others are dropped
+      for (int i = vqarray_length(m2p->pids) - 1; i >= 0; i--) 
+      {
+         pid_info_t *pi = vqarray_get(m2p->pids, i); 
+         if (pi == NULL) continue; 
+         elementary_stream_info_t *es = mpeg2ts_find_es_info(new_pms, pi->es_info->elementary_PID); 
+         if (es != NULL) 
+         {
+            pi->es_info = es; 
+         }
+         else 
+         {
+            pid_info_free(pi); 
+            vqarray_remove(m2p->pids, i);
+         }
+      }
+      
       if (m2p->pmt != NULL) program_map_section_free(m2p->pmt); 
       
       m2p->pmt = new_pms; 
@@ -429,7 +615,7 @@ int mpeg2ts_program_read_pmt(mpeg2ts_program_t *m2p, ts_packet_t *ts)
       for (int es_idx = 0; es_idx < vqarray_length(m2p->pmt->es_info); es_idx++) 
       {
          elementary_stream_info_t *es = vqarray_get(m2p->pmt->es_info, es_idx); 
-         if (es == NULL) continue; 
+         if (es == NULL || mpeg2ts_program_has_es_info(m2p, es)) continue; 
          pid_info_t *pi = pid_info_new(); 
          pi->es_info = es; 
          
@@ -438,14 +624,22 @@ int mpeg2ts_program_read_pmt(mpeg2ts_program_t *m2p, ts_packet_t *ts)
       }
       
       if (m2p->pmt_processor != NULL) m2p->pmt_processor(m2p, m2p->arg); 
+      if (m2p->m2s != NULL) mpeg2ts_stream_rebuild_pid_map(m2p->m2s);
    }
    else
    {
       program_map_section_free(new_pms);
    }
    
+   return 1;
+}
+
+int mpeg2ts_program_read_pmt(mpeg2ts_program_t *m2p, ts_packet_t *ts)
+{ 
+   section_assembler_push(&m2p->pmt_sa, ts->payload.bytes, ts->payload.len, ts->header.payload_unit_start_indicator, 
+                          mpeg2ts_program_process_pmt, m2p); 
    ts_free(ts); 
-   return ret;
+   return 0;
 }
 
 
@@ -454,6 +648,7 @@ int mpeg2ts_stream_reset(mpeg2ts_stream_t *m2s)
    pid_info_t *pi = NULL; 
    int pid_cnt = 0;
    if (m2s == NULL) return 0; 
+   mpeg2ts_stream_sync_workers(m2s); 
    
    for (int i = 0; i < vqarray_length(m2s->programs); i++) 
    {
@@ -482,6 +677,195 @@ void mpeg2ts_program_enable_scte128(mpeg2ts_program_t *m2p)
    m2p->scte128_enabled = 1;
 }
 
+static int mpeg2ts_pid_info_process_ts_packet(pid_info_t *pi, ts_packet_t *ts) 
+{ 
+   // FIXME: this can misfire if we have an MPTS and same PID is "owned" by more than one program
+   // this is an *extremely unlikely* case       
+   if ((pi->demux_validator != NULL) && (pi->demux_validator->process_ts_packet != NULL)) 
+   {
+      // TODO: check return value and do something intelligent 
+      if (pi->demux_validator->process_ts_packet(ts, pi->es_info, pi->demux_validator->arg) == 0)
+      {
+         return 0;
+      }
+   }
+   
+   if ((pi->demux_handler != NULL) && (pi->demux_handler->process_ts_packet != NULL)) 
+   {
+      return pi->demux_handler->process_ts_packet(ts, pi->es_info, pi->demux_handler->arg);             
+   }
+   
+   LOG_INFO_ARGS("Unknown PID 0x%02X", ts->header.PID); 
+   ts_free(ts);         
+   return 0;
+}
+
+static void* mpeg2ts_worker_run(void *arg) 
+{ 
+   mpeg2ts_worker_t *w = (mpeg2ts_worker_t *)arg; 
+   mpeg2ts_work_item_t item; 
+   
+   tslib_loglevel = w->loglevel; 
+   tslib_logfile = w->logfile; 
+   
+   while (1) 
+   {
+      if (spsc_ring_pop(w->queue, &item)) 
+      {
+         mpeg2ts_pid_info_process_ts_packet(item.pi, item.ts); 
+         __atomic_store_n(&w->num_done, w->num_done + 1, __ATOMIC_RELEASE); 
+         continue;
+      }
+      
+      // announce we are going to sleep, then look again: either we see the
+      // packet queued meanwhile, or mpeg2ts_workers_queue sees us sleeping
+      pthread_mutex_lock(&w->lock); 
+      __atomic_store_n(&w->sleeping, 1, __ATOMIC_RELAXED); 
+      __atomic_thread_fence(__ATOMIC_SEQ_CST); 
+      while (spsc_ring_count(w->queue) == 0 && !__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE)) 
+      {
+         pthread_cond_wait(&w->wake, &w->lock); 
+      }
+      __atomic_store_n(&w->sleeping, 0, __ATOMIC_RELAXED); 
+      int done = (spsc_ring_count(w->queue) == 0); 
+      pthread_mutex_unlock(&w->lock); 
+      if (done) break; 
+   }
+   return NULL;
+}
+
+static void mpeg2ts_worker_wake(mpeg2ts_worker_t *w) 
+{ 
+   pthread_mutex_lock(&w->lock); 
+   pthread_cond_signal(&w->wake); 
+   pthread_mutex_unlock(&w->lock);
+}
+
+static int mpeg2ts_workers_assign_pid(struct _mpeg2ts_workers_ *mw, elementary_stream_info_t *es_info) 
+{ 
+   if (mw->num_workers == 1) return 0; 
+   if (es_info != NULL && IS_VIDEO_STREAM(es_info->stream_type)) 
+   {
+      return mw->next_video_worker++ % mw->num_workers; 
+   }
+   return 1 + mw->next_other_worker++ % (mw->num_workers - 1); 
+}
+
+static int mpeg2ts_workers_queue(struct _mpeg2ts_workers_ *mw, ts_packet_t *ts, pid_info_t *pi) 
+{ 
+   uint32_t PID = ts->header.PID; 
+   if (mw->pid_worker[PID] < 0) 
+   {
+      mw->pid_worker[PID] = mpeg2ts_workers_assign_pid(mw, pi->es_info); 
+   }
+   mpeg2ts_worker_t *w = &mw->workers[(int)mw->pid_worker[PID]]; 
+   
+   mpeg2ts_work_item_t item = { ts, pi }; 
+   while (!spsc_ring_push(w->queue, &item)) 
+   {
+      sched_yield(); // worker is busy, it won't sleep before the queue is empty
+   }
+   w->num_queued++; 
+   
+   __atomic_thread_fence(__ATOMIC_SEQ_CST); 
+   if (__atomic_load_n(&w->sleeping, __ATOMIC_RELAXED)) mpeg2ts_worker_wake(w); 
+   return 1;
+}
+
+int mpeg2ts_stream_start_workers(mpeg2ts_stream_t *m2s, int num_workers, size_t queue_size) 
+{ 
+   if (m2s == NULL || m2s->workers != NULL || num_workers < 1 || num_workers > MPEG2TS_MAX_WORKERS) return 0; 
+   if (queue_size == 0) queue_size = MPEG2TS_WORKER_QUEUE_SIZE; 
+   
+   struct _mpeg2ts_workers_ *mw = calloc(1, sizeof(struct _mpeg2ts_workers_)); 
+   if (mw == NULL || (mw->workers = calloc(num_workers, sizeof(mpeg2ts_worker_t))) == NULL) 
+   {
+      LOG_ERROR("Out of memory for workers"); 
+      free(mw); 
+      return 0;
+   }
+   memset(mw->pid_worker, -1, sizeof(mw->pid_worker)); 
+   
+   // packets queued for a worker are freed there
+   ts_packet_pool_set_concurrent(m2s->ts_pool, 1); 
+   m2s->workers = mw; 
+   
+   for (int i = 0; i < num_workers; i++) 
+   {
+      mpeg2ts_worker_t *w = &mw->workers[i]; 
+      w->queue = spsc_ring_new(queue_size, sizeof(mpeg2ts_work_item_t)); 
+      w->loglevel = tslib_loglevel; 
+      w->logfile = tslib_logfile; 
+      pthread_mutex_init(&w->lock, NULL); 
+      pthread_cond_init(&w->wake, NULL); 
+      if (w->queue == NULL || pthread_create(&w->thread, NULL, mpeg2ts_worker_run, w) != 0) 
+      {
+         LOG_ERROR_ARGS("Failed to start worker %d", i); 
+         spsc_ring_free(w->queue); 
+         pthread_mutex_destroy(&w->lock); 
+         pthread_cond_destroy(&w->wake); 
+         mpeg2ts_stream_stop_workers(m2s); 
+         return 0;
+      }
+      mw->num_workers++; 
+   }
+   return 1;
+}
+
+void mpeg2ts_stream_sync_workers(mpeg2ts_stream_t *m2s) 
+{ 
+   if (m2s == NULL || m2s->workers == NULL) return; 
+   
+   for (int i = 0; i < m2s->workers->num_workers; i++) 
+   {
+      mpeg2ts_worker_t *w = &m2s->workers->workers[i]; 
+      while (__atomic_load_n(&w->num_done, __ATOMIC_ACQUIRE) != w->num_queued) 
+      {
+         sched_yield(); 
+      }
+   }
+}
+
+void mpeg2ts_stream_stop_workers(mpeg2ts_stream_t *m2s) 
+{ 
+   if (m2s == NULL || m2s->workers == NULL) return; 
+   
+   struct _mpeg2ts_workers_ *mw = m2s->workers; 
+   for (int i = 0; i < mw->num_workers; i++) 
+   {
+      mpeg2ts_worker_t *w = &mw->workers[i]; 
+      pthread_mutex_lock(&w->lock); 
+      __atomic_store_n(&w->stop, 1, __ATOMIC_RELEASE); 
+      pthread_cond_signal(&w->wake); 
+      pthread_mutex_unlock(&w->lock); 
+      
+      pthread_join(w->thread, NULL); 
+      spsc_ring_free(w->queue); 
+      pthread_mutex_destroy(&w->lock); 
+      pthread_cond_destroy(&w->wake); 
+   }
+   free(mw->workers); 
+   free(mw); 
+   m2s->workers = NULL; 
+   ts_packet_pool_set_concurrent(m2s->ts_pool, 0);
+}
+
+int mpeg2ts_stream_set_pid_worker(mpeg2ts_stream_t *m2s, uint32_t PID, int worker) 
+{ 
+   if (m2s == NULL || m2s->workers == NULL || PID >= NUM_PIDS || worker < 0 || worker >= m2s->workers->num_workers) return 0; 
+   
+   int old = m2s->workers->pid_worker[PID]; 
+   if (old >= 0 && old != worker) mpeg2ts_stream_sync_workers(m2s); // keep the PID in order
+   m2s->workers->pid_worker[PID] = worker; 
+   return 1;
+}
+
+int mpeg2ts_stream_get_pid_worker(mpeg2ts_stream_t *m2s, uint32_t PID) 
+{ 
+   if (m2s == NULL || m2s->workers == NULL || PID >= NUM_PIDS) return -1; 
+   return m2s->workers->pid_worker[PID];
+}
+
 int mpeg2ts_stream_read_ts_packet(mpeg2ts_stream_t *m2s, ts_packet_t *ts) 
 {    
    if (m2s == NULL ) 
@@ -511,50 +895,33 @@ int mpeg2ts_stream_read_ts_packet(mpeg2ts_stream_t *m2s, ts_packet_t *ts)
       return 0;    
    }
       
-   pid_info_t *pi = NULL; 
-   for (int i = 0; i < vqarray_length(m2s->programs) && (pi == NULL); i++) 
+   pid_map_entry_t *e = &m2s->pid_map[ts->header.PID & (NUM_PIDS - 1)];
+   if (e->is_pmt)
    {
-      mpeg2ts_program_t* m2p = vqarray_get(m2s->programs, i);
-      
-      if (m2p == NULL)
-      {
-          continue;
-      }
-      
-      if (m2p->PID == ts->header.PID)
-      {
-          return mpeg2ts_program_read_pmt(m2p, ts);  // got a PMT
-      }
+      return mpeg2ts_program_read_pmt(e->program, ts);  // got a PMT
+   }
 
-      if (m2p->scte128_enabled) 
+   pid_info_t *pi = e->pid_info; 
+   if (pi == NULL && m2s->num_unbound_pids > 0)
+   {
+      pi = mpeg2ts_stream_bind_pid(m2s, ts->header.PID);
+   }
+
+   if (pi != NULL) 
+   {
+      if (e->program->scte128_enabled) 
       {
          ts_parse_scte128_af_private(&ts->adaptation_field);
       }
-     
-      // pi == NULL => this PID does not belong to this program
-      pi = mpeg2ts_program_get_pid_info(m2p, ts->header.PID); 
+
+      // check for discontinuity
+      pi->num_packets++;
       
-      if (pi != NULL) 
+      if (m2s->workers != NULL) 
       {
-         // check for discontinuity
-         pi->num_packets++;
-         
-         // FIXME: this can misfire if we have an MPTS and same PID is "owned" by more than one program
-         // this is an *extremely unlikely* case       
-         if ((pi->demux_validator != NULL) && (pi->demux_validator->process_ts_packet != NULL)) 
-         {
-            // TODO: check return value and do something intelligent 
-            if (pi->demux_validator->process_ts_packet(ts, pi->es_info, pi->demux_validator->arg) == 0)
-            {
-               return 0;
-            }
-         }
-         
-         if ((pi->demux_handler != NULL) && (pi->demux_handler->process_ts_packet != NULL)) 
-         {
-            return pi->demux_handler->process_ts_packet(ts, pi->es_info, pi->demux_handler->arg);             
-         }
+         return mpeg2ts_workers_queue(m2s->workers, ts, pi);
       }
+      return mpeg2ts_pid_info_process_ts_packet(pi, ts);
    }
    
    
@@ -564,3 +931,86 @@ int mpeg2ts_stream_read_ts_packet(mpeg2ts_stream_t *m2s, ts_packet_t *ts)
    return 0;
 }
 
+// bytes holds a complete packet starting with the sync byte
+static int mpeg2ts_stream_read_packet_bytes(mpeg2ts_stream_t *m2s, const uint8_t *bytes) 
+{ 
+   if (!mpeg2ts_stream_wants_packet(m2s, bytes)) 
+   {
+      m2s->num_packets_filtered++; 
+      return 1;
+   }
+   
+   ts_packet_t *ts = ts_packet_pool_get(m2s->ts_pool); 
+   if (ts == NULL) 
+   {
+      LOG_ERROR("Out of memory for TS packets"); 
+      return 0;
+   }
+   memcpy(ts->bytes, bytes, TS_SIZE); 
+   if (!ts_read_view(ts, ts->bytes, TS_SIZE)) 
+   {
+      ts_free(ts); // broken packet, already reported
+      return 1;
+   }
+   mpeg2ts_stream_read_ts_packet(m2s, ts); 
+   return 1;
+}
+
+size_t mpeg2ts_stream_read_buffer(mpeg2ts_stream_t *m2s, const uint8_t *buf, size_t len) 
+{ 
+   if (m2s == NULL || buf == NULL) return 0; 
+   size_t pos = 0; 
+   const uint8_t *p; 
+   
+   // data left over from the previous buffer goes first, topped up from this one
+   while (m2s->partial_len > 0 && pos < len) 
+   {
+      size_t old_len = m2s->partial_len; 
+      size_t n = sizeof(m2s->partial) - old_len; 
+      if (n > len - pos) n = len - pos; 
+      memcpy(m2s->partial + old_len, buf + pos, n); 
+      m2s->partial_len += n; 
+      
+      size_t ppos = 0; 
+      while ((p = ts_sync_next(&m2s->sync, m2s->partial, m2s->partial_len, &ppos, 0)) != NULL) 
+      {
+         if (!mpeg2ts_stream_read_packet_bytes(m2s, p)) 
+         {
+            // keep the packet for the next call
+            ts_sync_unread(&m2s->sync, m2s->partial, p, &ppos); 
+            memmove(m2s->partial, m2s->partial + ppos, m2s->partial_len - ppos); 
+            m2s->partial_len -= ppos; 
+            return pos + n;
+         }
+      }
+      
+      if (ppos >= old_len) // the rest is in buf as well
+      {
+         pos += ppos - old_len; 
+         m2s->partial_len = 0;
+      }
+      else 
+      {
+         memmove(m2s->partial, m2s->partial + ppos, m2s->partial_len - ppos); 
+         m2s->partial_len -= ppos; 
+         pos += n;
+      }
+   }
+   
+   while (pos < len && (p = ts_sync_next(&m2s->sync, buf, len, &pos, 0)) != NULL) 
+   {
+      if (!mpeg2ts_stream_read_packet_bytes(m2s, p)) 
+      {
+         ts_sync_unread(&m2s->sync, buf, p, &pos); 
+         return pos;
+      }
+   }
+   
+   // start of a packet, or not enough data yet to confirm the lock
+   if (pos < len) 
+   {
+      memcpy(m2s->partial, buf + pos, len - pos); 
+      m2s->partial_len = len - pos;
+   }
+   return len;
+}
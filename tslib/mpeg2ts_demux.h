@@ -37,6 +37,8 @@
 #include "ts.h"
 #include "pes.h"
 #include "psi.h"
+#include "section.h"
+#include "ts_sync.h"
 #include "cas.h"
 #include "descriptors.h"
 #include "vqarray.h"
@@ -46,8 +48,13 @@ extern "C"
 {
 #endif
 
+#define MPEG2TS_STREAM_POOL_SLAB_SIZE 256   /// packets allocated at once by the stream packet pool
+#define MPEG2TS_MAX_WORKERS           64    /// max worker threads, see mpeg2ts_stream_start_workers
+#define MPEG2TS_WORKER_QUEUE_SIZE     4096  /// default per-worker queue size, in packets
+
 struct _mpeg2ts_stream_; 
 struct _mpeg2ts_program_; 
+struct _mpeg2ts_workers_; 
 
 typedef int (*ts_pid_processor_t)(ts_packet_t *, elementary_stream_info_t *, void *); 
 typedef int (*pat_processor_t)(struct _mpeg2ts_stream_ *, void *); 
@@ -58,6 +65,7 @@ typedef int (*arg_destructor_t)(void *);
 
 struct _mpeg2ts_program_
 {
+   struct _mpeg2ts_stream_ *m2s; /// multiplex this program belongs to
    uint32_t PID;            /// PMT PID
    uint32_t program_number; 
    
@@ -82,10 +90,22 @@ struct _mpeg2ts_program_
    uint32_t scte128_enabled;        /// Determines if SCTE128 private data is available
                                     /// and should be parsed
 
-   // used for decoding pmt split among multiple TS packets
-   psi_table_buffer_t pmtBuffer;
+   section_assembler_t pmt_sa;      /// PMT sections split among multiple TS packets
+
+   psi_section_cache_t pmt_cache;   /// last accepted PMT section, see psi_section_cache_check
 }; 
 
+/**
+ * Per-PID dispatch entry. Derived from the programs/pids lists, never owns
+ * anything; rebuilt by mpeg2ts_stream_rebuild_pid_map().
+ */
+typedef struct
+{
+   struct _pid_info_ *pid_info;          /// handler state for an ES PID, NULL if none
+   struct _mpeg2ts_program_ *program;    /// program owning this PID (ES or PMT)
+   uint32_t is_pmt;                      /// PID carries the PMT of program
+} pid_map_entry_t;
+
 struct _mpeg2ts_stream_ 
 {
    program_association_section_t *pat; /// PAT
@@ -97,11 +117,27 @@ struct _mpeg2ts_stream_
    void *arg;                          /// argument for PAT/CAT callbacks
    arg_destructor_t arg_destructor;    /// destructor for the callback argument
 
-   // used for decoding pmt split among multiple TS packets
-   psi_table_buffer_t patBuffer;
+   section_assembler_t pat_sa;         /// PAT sections split among multiple TS packets
+   section_assembler_t cat_sa;         /// CAT sections split among multiple TS packets
+
+   psi_section_cache_t pat_cache;      /// last accepted PAT section, see psi_section_cache_check
+   psi_section_cache_t cat_cache;      /// last accepted CAT section
 
-   // used for decoding pmt split among multiple TS packets
-   psi_table_buffer_t catBuffer;
+   pid_map_entry_t pid_map[NUM_PIDS];  /// direct-indexed PID lookup, see mpeg2ts_stream_rebuild_pid_map
+   int num_unbound_pids;               /// pid_info entries with no PID assigned yet (elementary_PID == 0x1FFF)
+   uint64_t pid_interest[NUM_PIDS / 64]; /// bit per PID worth parsing, see mpeg2ts_stream_wants_packet
+   uint64_t num_packets_filtered;      /// packets dropped by mpeg2ts_stream_read_buffer without parsing
+
+   ts_packet_pool_t *ts_pool;          /// packet pool, see mpeg2ts_stream_new_ts_packet. 
+                                       /// num_outstanding and high_water_mark give pool usage
+
+   ts_sync_t sync;                     /// packet sync of mpeg2ts_stream_read_buffer, counts lost bytes
+   uint8_t partial[TS_SYNC_WINDOW_SIZE]; /// data carried over between mpeg2ts_stream_read_buffer calls:
+                                       /// start of a split packet, or data the lock is not confirmed on yet
+   size_t partial_len;                 /// bytes in partial
+
+   struct _mpeg2ts_workers_ *workers;  /// worker threads in threaded mode, see mpeg2ts_stream_start_workers. 
+                                       /// NULL if ES packets are processed on the calling thread
 }; 
 
 typedef struct _mpeg2ts_stream_  mpeg2ts_stream_t; 
@@ -120,7 +156,7 @@ typedef struct
    // TODO impl
 } mux_pid_handler_t; 
 
-typedef struct 
+typedef struct _pid_info_
 {
    demux_pid_handler_t *demux_handler;   /// demux handler
    demux_pid_handler_t *demux_validator; /// demux validator
@@ -146,6 +182,18 @@ mpeg2ts_stream_t* mpeg2ts_stream_new();
  */
 void mpeg2ts_stream_free(mpeg2ts_stream_t *m2s); 
 
+/**
+ * Get a packet from the stream's packet pool. Copy the TS packet into 
+ * ts->bytes and parse it with ts_read_view(ts, ts->bytes, TS_SIZE) before
+ * passing it to mpeg2ts_stream_read_ts_packet; whoever ends up calling
+ * ts_free on it returns it to the pool. Together this makes reading a
+ * packet, including its SCTE-128 private data, free of heap allocations.
+ * 
+ * @param m2s MPEG-2 TS multiplex
+ * @return packet, or NULL if out of memory
+ */
+ts_packet_t* mpeg2ts_stream_new_ts_packet(mpeg2ts_stream_t *m2s); 
+
 /**
  * Read a parsed transport stream packet
  * 
@@ -162,6 +210,101 @@ void mpeg2ts_stream_free(mpeg2ts_stream_t *m2s);
  */
 int mpeg2ts_stream_read_ts_packet(mpeg2ts_stream_t *m2s, ts_packet_t *ts); 
 
+/**
+ * Check from its PID alone whether a raw TS packet is of any use to the 
+ * stream, so that callers can drop it before ts_read parses its adaptation 
+ * field and payload. Wanted are PAT, CAT, the PMT PIDs of the current PAT 
+ * and ES PIDs with a registered validator or handler; while some pid_info 
+ * has no PID bound yet, every PID is. Everything else would be dropped by 
+ * mpeg2ts_stream_read_ts_packet anyway, only without the "Unknown PID" message.
+ * The set is updated whenever the PID map is rebuilt.
+ * 
+ * @param m2s MPEG-2 TS multiplex
+ * @param bytes start of the packet, at least the 3 header bytes up to the PID
+ * @return 1 if the packet should be parsed and read, 0 if it can be dropped
+ */
+static inline int mpeg2ts_stream_wants_packet(const mpeg2ts_stream_t *m2s, const uint8_t *bytes) 
+{ 
+   uint32_t PID = ((uint32_t)(bytes[1] & 0x1F) << 8) | bytes[2]; 
+   return (int)((m2s->pid_interest[PID >> 6] >> (PID & 63)) & 1);
+}
+
+/**
+ * Read a chunk of a transport stream of any size, e.g. straight from a 1 MB
+ * read(). Packets are parsed into packets from the stream packet pool and 
+ * dispatched as by mpeg2ts_stream_read_ts_packet, so nothing is allocated 
+ * per packet. A packet split across calls is kept in the stream and 
+ * completed by the next call. 188, 192 (M2TS) and 204-byte packets are 
+ * accepted, the packet size is detected by the stream's ts_sync_t (or fixed
+ * with ts_sync_init(&m2s->sync, packet_size) before the first call); no
+ * packet is delivered until it has locked, and bytes lost to corruption are 
+ * counted in sync.num_bytes_lost. Packets the 
+ * stream has no use for (see mpeg2ts_stream_wants_packet) are counted in 
+ * num_packets_filtered and never parsed.
+ * 
+ * @param m2s MPEG-2 TS multiplex
+ * @param buf transport stream bytes, not referenced after the call
+ * @param len number of bytes in buf
+ * @return number of bytes consumed: len, or less if out of memory (the 
+ *         rest should be passed again), 0 if m2s or buf is NULL
+ */
+size_t mpeg2ts_stream_read_buffer(mpeg2ts_stream_t *m2s, const uint8_t *buf, size_t len); 
+
+/**
+ * Switch to threaded mode. The thread calling mpeg2ts_stream_read_ts_packet
+ * keeps parsing PSI and looking up PIDs, but ES packets are handed over to 
+ * num_workers worker threads through lock-free single-producer/single-consumer
+ * queues, and the PID's validator and handler run there. Each PID is owned
+ * by one worker, so packets of a PID are processed in order; handlers of PIDs
+ * on different workers run concurrently and must not share unprotected state.
+ * 
+ * Unless pinned with mpeg2ts_stream_set_pid_worker, a PID is assigned on its
+ * first packet: video PIDs round-robin over all workers starting with the
+ * first one, other PIDs (audio, SCTE-35, ...) round-robin over the rest.
+ * 
+ * Before PSI changes are applied (new PAT, PMT or CAT version, PID processor
+ * (un)registration) and before flushing with a NULL packet, the calling
+ * thread waits until the workers have processed all queued packets, so
+ * handlers, es_info and PSI are never freed or changed under a worker. The
+ * pat/pmt/cat processor callbacks run on the calling thread with all workers idle.
+ * 
+ * The stream packet pool is switched to concurrent mode, since packets are
+ * freed on the workers. Workers log with the log level and file of the thread
+ * which started them; errors reported by handlers set the workers' tslib_errno.
+ * 
+ * @param m2s MPEG-2 TS multiplex
+ * @param num_workers number of worker threads, 1 to MPEG2TS_MAX_WORKERS
+ * @param queue_size per-worker queue size in packets, 0 for MPEG2TS_WORKER_QUEUE_SIZE
+ * @return 1 on success, 0 on error or if already in threaded mode
+ */
+int mpeg2ts_stream_start_workers(mpeg2ts_stream_t *m2s, int num_workers, size_t queue_size); 
+
+/**
+ * Wait until the workers have processed all packets queued so far. Handler
+ * state may be looked at from the calling thread afterwards. No-op if not 
+ * in threaded mode.
+ */
+void mpeg2ts_stream_sync_workers(mpeg2ts_stream_t *m2s); 
+
+/**
+ * Process the remaining queued packets, stop the worker threads and go back
+ * to processing ES packets on the calling thread. Called by mpeg2ts_stream_free.
+ */
+void mpeg2ts_stream_stop_workers(mpeg2ts_stream_t *m2s); 
+
+/**
+ * Pin a PID to a worker. If the PID already had packets queued on another
+ * worker, those are processed first.
+ * 
+ * @return 1 on success, 0 if not in threaded mode or worker is out of range
+ */
+int mpeg2ts_stream_set_pid_worker(mpeg2ts_stream_t *m2s, uint32_t PID, int worker); 
+
+/**
+ * @return worker owning PID, -1 if not in threaded mode or not assigned yet
+ */
+int mpeg2ts_stream_get_pid_worker(mpeg2ts_stream_t *m2s, uint32_t PID); 
+
 /**
  * Initialize new program object
  * 
@@ -217,6 +360,18 @@ int mpeg2ts_program_unregister_pid_processor(mpeg2ts_program_t *m2p, uint32_t PI
  */
 void mpeg2ts_program_enable_scte128(mpeg2ts_program_t *m2p);
 
+/**
+ * Rebuild the PID dispatch table and the set of wanted PIDs (see 
+ * mpeg2ts_stream_wants_packet) from the program list. Called internally
+ * whenever PAT, PMT or PID processor registrations change; needs to be called
+ * by the user only after modifying programs/pids lists directly.
+ * If a PID is claimed more than once, the first program (and the first
+ * pid_info within it) wins, same as with the linear lookup it replaces.
+ *
+ * @param m2s MPEG-2 TS multiplex
+ */
+void mpeg2ts_stream_rebuild_pid_map(mpeg2ts_stream_t *m2s);
+
 //int mpeg2ts_program_read_ts_packet(mpeg2ts_program_t *m2p, ts_packet_t *ts);
 int mpeg2ts_stream_reset(mpeg2ts_stream_t *m2s);
 
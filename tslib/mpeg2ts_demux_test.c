@@ -0,0 +1,542 @@
+/*
+
+ Copyright (c) 2012-, ISO/IEC JTC1/SC29/WG11
+ Written by Alex Giladi <alex.giladi@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of the ISO/IEC nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "log.h"
+#include "libts_common.h"
+#include "mpeg2ts_demux.h"
+#include "ts_test_util.h"
+#include "test_macros.h"
+
+#define NUM_PROGRAMS      20
+#define NUM_ES_PER_PROGRAM 5
+#define PMT_PID_BASE      0x100
+#define ES_PID_BASE       0x200
+
+int verbose = 0;
+
+static uint64_t g_pid_count[0x2000];
+
+static int count_ts_packet(ts_packet_t *ts, elementary_stream_info_t *es_info, void *arg)
+{
+   (void)es_info;
+   (void)arg;
+   if (ts == NULL) return 0;
+   g_pid_count[ts->header.PID]++;
+   ts_free(ts);
+   return 1;
+}
+
+static int register_all_es(mpeg2ts_program_t *m2p, void *arg)
+{
+   (void)arg;
+   for (int i = 0; i < vqarray_length(m2p->pmt->es_info); i++)
+   {
+      elementary_stream_info_t *esi = vqarray_get(m2p->pmt->es_info, i);
+      demux_pid_handler_t *h = calloc(1, sizeof(demux_pid_handler_t));
+      h->process_ts_packet = count_ts_packet;
+      mpeg2ts_program_register_pid_processor(m2p, esi->elementary_PID, h, NULL);
+   }
+   return 1;
+}
+
+static int set_pmt_processors(mpeg2ts_stream_t *m2s, void *arg)
+{
+   (void)arg;
+   for (int i = 0; i < vqarray_length(m2s->programs); i++)
+   {
+      mpeg2ts_program_t *m2p = vqarray_get(m2s->programs, i);
+      m2p->pmt_processor = register_all_es;
+   }
+   return 1;
+}
+
+static mpeg2ts_program_t* find_program(mpeg2ts_stream_t *m2s, uint32_t program_number)
+{
+   for (int i = 0; i < vqarray_length(m2s->programs); i++)
+   {
+      mpeg2ts_program_t *m2p = vqarray_get(m2s->programs, i);
+      if (m2p->program_number == program_number) return m2p;
+   }
+   return NULL;
+}
+
+static int es_pid(int prog, int es)
+{
+   return ES_PID_BASE + prog * NUM_ES_PER_PROGRAM + es;
+}
+
+static int feed(mpeg2ts_stream_t *m2s, uint8_t *pkt)
+{
+   ts_packet_t *ts = ts_new();
+   if (!ts_read(ts, pkt, TS_SIZE))
+   {
+      ts_free(ts);
+      return 0;
+   }
+   mpeg2ts_stream_read_ts_packet(m2s, ts);
+   return 1;
+}
+
+static int feed_pooled(mpeg2ts_stream_t *m2s, uint8_t *pkt)
+{
+   ts_packet_t *ts = mpeg2ts_stream_new_ts_packet(m2s);
+   memcpy(ts->bytes, pkt, TS_SIZE);
+   if (!ts_read_view(ts, ts->bytes, TS_SIZE))
+   {
+      ts_free(ts);
+      return 0;
+   }
+   mpeg2ts_stream_read_ts_packet(m2s, ts);
+   return 1;
+}
+
+/**
+ * Feed PAT and all PMTs of a synthetic MPTS into m2s
+ */
+static void feed_psi(mpeg2ts_stream_t *m2s)
+{
+   uint8_t section[1024];
+   uint8_t pkt[TS_SIZE];
+   uint32_t program_numbers[NUM_PROGRAMS], pmt_pids[NUM_PROGRAMS];
+
+   for (int i = 0; i < NUM_PROGRAMS; i++)
+   {
+      program_numbers[i] = i + 1;
+      pmt_pids[i] = PMT_PID_BASE + i;
+   }
+   int len = ts_test_build_pat(section, 0, NUM_PROGRAMS, program_numbers, pmt_pids);
+   ts_test_write_section_packet(pkt, PAT_PID, 0, section, len);
+   feed(m2s, pkt);
+
+   for (int i = 0; i < NUM_PROGRAMS; i++)
+   {
+      uint32_t stream_types[NUM_ES_PER_PROGRAM], es_pids[NUM_ES_PER_PROGRAM];
+      for (int j = 0; j < NUM_ES_PER_PROGRAM; j++)
+      {
+         stream_types[j] = (j == 0) ? 0x1B : 0x0F;
+         es_pids[j] = es_pid(i, j);
+      }
+      len = ts_test_build_pmt(section, 0, program_numbers[i], es_pids[0], NUM_ES_PER_PROGRAM, stream_types, es_pids);
+      ts_test_write_section_packet(pkt, pmt_pids[i], 0, section, len);
+      feed(m2s, pkt);
+   }
+}
+
+static mpeg2ts_stream_t* new_test_stream()
+{
+   mpeg2ts_stream_t *m2s = mpeg2ts_stream_new();
+   m2s->pat_processor = set_pmt_processors;
+   feed_psi(m2s);
+   return m2s;
+}
+
+START_TEST(test_pid_dispatch)
+{
+   uint8_t pkt[TS_SIZE];
+   mpeg2ts_stream_t *m2s = new_test_stream();
+   memset(g_pid_count, 0, sizeof(g_pid_count));
+
+   fail_unless(vqarray_length(m2s->programs) == NUM_PROGRAMS, "wrong number of programs");
+
+   for (int i = 0; i < NUM_PROGRAMS; i++)
+   {
+      mpeg2ts_program_t *m2p = find_program(m2s, i + 1);
+      fail_unless(m2s->pid_map[PMT_PID_BASE + i].program == m2p, "PMT PID not mapped");
+      fail_unless(m2s->pid_map[PMT_PID_BASE + i].is_pmt, "PMT PID not marked as PMT");
+      for (int j = 0; j < NUM_ES_PER_PROGRAM; j++)
+      {
+         pid_map_entry_t *e = &m2s->pid_map[es_pid(i, j)];
+         fail_unless(e->pid_info != NULL && e->pid_info->es_info->elementary_PID == (uint32_t)es_pid(i, j),
+                     "ES PID not mapped");
+         fail_unless(e->program == m2p, "ES PID mapped to wrong program");
+      }
+   }
+
+   for (int k = 0; k < 3; k++)
+   {
+      for (int i = 0; i < NUM_PROGRAMS; i++)
+      {
+         for (int j = 0; j < NUM_ES_PER_PROGRAM; j++)
+         {
+            ts_test_write_pes_packet(pkt, es_pid(i, j), k, k == 0, 0xE0, 0, 0);
+            feed(m2s, pkt);
+         }
+      }
+   }
+   for (int i = 0; i < NUM_PROGRAMS; i++)
+   {
+      for (int j = 0; j < NUM_ES_PER_PROGRAM; j++)
+      {
+         fail_unless(g_pid_count[es_pid(i, j)] == 3, "wrong number of packets delivered");
+      }
+   }
+
+   // unknown PID
+   ts_test_write_pes_packet(pkt, 0x1000, 0, 0, 0xE0, 0, 0);
+   feed(m2s, pkt);
+   fail_unless(g_pid_count[0x1000] == 0, "unknown PID delivered");
+
+   // unregister stops delivery
+   mpeg2ts_program_t *m2p = find_program(m2s, 8);
+   mpeg2ts_program_unregister_pid_processor(m2p, es_pid(7, 2));
+   fail_unless(m2s->pid_map[es_pid(7, 2)].pid_info == NULL, "unregistered PID still mapped");
+   ts_test_write_pes_packet(pkt, es_pid(7, 2), 3, 0, 0xE0, 0, 0);
+   feed(m2s, pkt);
+   fail_unless(g_pid_count[es_pid(7, 2)] == 3, "unregistered PID delivered");
+
+   mpeg2ts_stream_free(m2s);
+}
+END_TEST
+
+START_TEST(test_packet_pool)
+{
+   uint8_t pkt[TS_SIZE];
+   mpeg2ts_stream_t *m2s = new_test_stream();
+   memset(g_pid_count, 0, sizeof(g_pid_count));
+
+   for (int k = 0; k < 100; k++)
+   {
+      ts_test_write_pes_packet(pkt, es_pid(k % NUM_PROGRAMS, 0), k, 0, 0xE0, 0, 0);
+      feed_pooled(m2s, pkt);
+   }
+   ts_test_write_pes_packet(pkt, 0x1000, 0, 0, 0xE0, 0, 0);   // unknown PID
+   feed_pooled(m2s, pkt);
+
+   fail_unless(g_pid_count[es_pid(0, 0)] == 5, "pooled packets not delivered");
+   fail_unless(m2s->ts_pool->num_outstanding == 0, "packets leaked from pool");
+   fail_unless(m2s->ts_pool->high_water_mark == 1, "unexpected high-water mark");
+   fail_unless(m2s->ts_pool->num_allocated == MPEG2TS_STREAM_POOL_SLAB_SIZE, "unexpected pool growth");
+
+   mpeg2ts_stream_free(m2s);
+}
+END_TEST
+
+START_TEST(test_psi_repetition)
+{
+   uint8_t section[1024];
+   uint8_t pkt[TS_SIZE];
+   uint32_t program_number = 1, pmt_pid = PMT_PID_BASE;
+   uint32_t stream_types[2] = { 0x1B, 0x0F };
+   uint32_t es_pids[2] = { es_pid(0, 0), es_pid(0, 1) };
+   const int num_repeats = 10000;
+
+   mpeg2ts_stream_t *m2s = new_test_stream();
+   program_association_section_t *pat = m2s->pat;
+   mpeg2ts_program_t *m2p = find_program(m2s, 1);
+   program_map_section_t *pmt = m2p->pmt;
+
+   fail_unless(m2s->pat_cache.num_parsed == 1 && m2s->pat_cache.num_skipped == 0, "PAT not parsed once");
+   fail_unless(m2p->pmt_cache.num_parsed == 1 && m2p->pmt_cache.num_skipped == 0, "PMT not parsed once");
+
+   // repetitions are skipped without touching the parsed tables
+   for (int k = 0; k < 5; k++) feed_psi(m2s);
+   fail_unless(m2s->pat_cache.num_parsed == 1 && m2s->pat_cache.num_skipped == 5, "PAT repetition parsed");
+   fail_unless(m2p->pmt_cache.num_parsed == 1 && m2p->pmt_cache.num_skipped == 5, "PMT repetition parsed");
+   fail_unless(m2s->pat == pat && m2p->pmt == pmt, "tables replaced by repetition");
+   fail_unless(vqarray_length(m2s->programs) == NUM_PROGRAMS, "programs added by repetition");
+
+   // a new version is parsed and replaces the old one
+   int len = ts_test_build_pmt(section, 1, program_number, es_pids[0], 2, stream_types, es_pids);
+   ts_test_write_section_packet(pkt, pmt_pid, 0, section, len);
+   feed(m2s, pkt);
+   fail_unless(m2p->pmt_cache.num_parsed == 2 && m2p->pmt_cache.num_skipped == 5, "new PMT version not parsed");
+   fail_unless(m2p->pmt != pmt && m2p->pmt->version_number == 1, "new PMT version not in force");
+
+   // same length, different content, so only the CRC tells it apart
+   ts_test_write_section_packet(pkt, pmt_pid, 0, section, len);
+   pkt[TS_HEADER_SIZE + 1 + len - 5] ^= 0x01;   // last byte before CRC_32
+   tslib_loglevel = 0;
+   feed(m2s, pkt);
+   tslib_loglevel = verbose ? TSLIB_LOG_LEVEL_INFO : TSLIB_LOG_LEVEL_ERROR;
+   fail_unless(m2p->pmt_cache.num_skipped == 5, "corrupted PMT skipped as unchanged");
+   fail_unless(m2p->pmt->version_number == 1, "corrupted PMT accepted");
+
+   // a PMT spanning several TS packets is reassembled, and its repetitions skipped too
+   uint8_t big_section[1024];
+   uint8_t pkts[8 * TS_SIZE];
+   uint32_t many_types[100], many_pids[100];
+   for (int i = 0; i < 100; i++)
+   {
+      many_types[i] = 0x0F;
+      many_pids[i] = 0x1000 + i;
+   }
+   int big_len = ts_test_build_pmt(big_section, 2, program_number, es_pids[0], 100, many_types, many_pids);
+   int num_pkts = ts_test_write_section_packets(pkts, pmt_pid, 0, big_section, big_len);
+   fail_unless(num_pkts == 3, "PMT does not span 3 packets");
+   for (int r = 0; r < 2; r++)
+   {
+      for (int i = 0; i < num_pkts; i++) feed(m2s, pkts + i * TS_SIZE);
+   }
+   fail_unless(m2p->pmt->version_number == 2 && vqarray_length(m2p->pmt->es_info) == 100, "spanning PMT not parsed");
+   fail_unless(m2p->pmt_cache.num_parsed == 3 && m2p->pmt_cache.num_skipped == 6, "spanning PMT repetition parsed");
+   fail_unless(m2s->pid_map[0x1000 + 99].pid_info != NULL, "ES of spanning PMT not mapped");
+
+   // cost of a repeated PMT, parsed in full vs. skipped
+   ts_test_write_section_packet(pkt, pmt_pid, 0, section, len);
+   uint64_t t1 = gettimeusec();
+   for (int k = 0; k < num_repeats; k++)
+   {
+      m2p->pmt_cache.section_len = 0;
+      feed(m2s, pkt);
+   }
+   uint64_t t2 = gettimeusec();
+   for (int k = 0; k < num_repeats; k++)
+   {
+      feed(m2s, pkt);
+   }
+   uint64_t t3 = gettimeusec();
+   fail_unless(m2p->pmt_cache.num_skipped == 6 + (uint64_t)num_repeats, "repeated PMT not skipped");
+   printf("# repeated PMT: %.0f ns parsed, %.0f ns skipped (including ts_read)\n", 
+          (double)(t2 - t1) * 1000.0 / num_repeats, (double)(t3 - t2) * 1000.0 / num_repeats);
+
+   mpeg2ts_stream_free(m2s);
+}
+END_TEST
+
+START_TEST(test_read_buffer)
+{
+   const int num_packets = 1000;
+   const int num_garbage = 3;
+   size_t buf_size = num_packets * TS_SIZE + num_garbage * 50;
+   uint8_t *buf = malloc(buf_size);
+   mpeg2ts_stream_t *m2s = new_test_stream();
+   memset(g_pid_count, 0, sizeof(g_pid_count));
+
+   size_t len = 0;
+   for (int k = 0; k < num_packets; k++)
+   {
+      ts_test_write_pes_packet(buf + len, es_pid(k % NUM_PROGRAMS, 0), k / NUM_PROGRAMS, 0, 0xE0, 0, 0);
+      len += TS_SIZE;
+      if (k % (num_packets / num_garbage) == 17)
+      {
+         memset(buf + len, 0x00, 50);          // junk between packets, no sync byte in it
+         len += 50;
+      }
+   }
+
+   // chunks of all sizes, from single bytes to several packets at once
+   srand(1);
+   size_t pos = 0;
+   int tiny = 1;
+   while (pos < len)
+   {
+      size_t n = tiny ? 1 + rand() % 3 : 1 + rand() % (5 * TS_SIZE);
+      if (n > len - pos) n = len - pos;
+      fail_unless(mpeg2ts_stream_read_buffer(m2s, buf + pos, n) == n, "not all bytes consumed");
+      pos += n;
+      tiny = !tiny;
+   }
+
+   int total = 0;
+   for (int i = 0; i < NUM_PROGRAMS; i++) total += g_pid_count[es_pid(i, 0)];
+   fail_unless2(total == num_packets, "wrong number of packets delivered", "(%d)", total);
+   fail_unless(m2s->sync.num_bytes_lost == (uint64_t)num_garbage * 50, "junk not skipped");
+   fail_unless(m2s->partial_len == 0, "partial packet left over");
+   fail_unless(m2s->ts_pool->num_outstanding == 0 && m2s->ts_pool->num_allocated == MPEG2TS_STREAM_POOL_SLAB_SIZE, 
+               "packets not recycled");
+
+   // a buffer ending mid-packet is completed by the next one
+   ts_test_write_pes_packet(buf, es_pid(0, 0), 0, 0, 0xE0, 0, 0);
+   fail_unless(mpeg2ts_stream_read_buffer(m2s, buf, 100) == 100, "partial packet not consumed");
+   fail_unless(g_pid_count[es_pid(0, 0)] == (uint64_t)num_packets / NUM_PROGRAMS, "partial packet delivered");
+   fail_unless(mpeg2ts_stream_read_buffer(m2s, buf + 100, TS_SIZE - 100) == TS_SIZE - 100, "rest of packet not consumed");
+   fail_unless(g_pid_count[es_pid(0, 0)] == (uint64_t)num_packets / NUM_PROGRAMS + 1, "completed packet not delivered");
+
+   mpeg2ts_stream_free(m2s);
+   free(buf);
+}
+END_TEST
+
+START_TEST(test_pid_filter)
+{
+   const int num_rounds = 100;
+   uint8_t pkt[TS_SIZE];
+   mpeg2ts_stream_t *m2s = mpeg2ts_stream_new();
+   m2s->pat_processor = set_pmt_processors;
+
+   // before the PAT only PAT and CAT are of interest
+   ts_test_write_pes_packet(pkt, es_pid(0, 0), 0, 0, 0xE0, 0, 0);
+   fail_unless(!mpeg2ts_stream_wants_packet(m2s, pkt), "ES PID wanted before PAT");
+   ts_test_write_pes_packet(pkt, PAT_PID, 0, 0, 0xE0, 0, 0);
+   fail_unless(mpeg2ts_stream_wants_packet(m2s, pkt), "PAT not wanted");
+   ts_test_write_pes_packet(pkt, CAT_PID, 0, 0, 0xE0, 0, 0);
+   fail_unless(mpeg2ts_stream_wants_packet(m2s, pkt), "CAT not wanted");
+
+   feed_psi(m2s);
+   memset(g_pid_count, 0, sizeof(g_pid_count));
+   mpeg2ts_program_unregister_pid_processor(find_program(m2s, 1), es_pid(0, 1));
+
+   for (int i = 0; i < NUM_PROGRAMS; i++)
+   {
+      ts_test_write_pes_packet(pkt, PMT_PID_BASE + i, 0, 0, 0xE0, 0, 0);
+      fail_unless(mpeg2ts_stream_wants_packet(m2s, pkt), "PMT PID not wanted");
+      for (int j = 0; j < NUM_ES_PER_PROGRAM; j++)
+      {
+         ts_test_write_pes_packet(pkt, es_pid(i, j), 0, 0, 0xE0, 0, 0);
+         fail_unless2(mpeg2ts_stream_wants_packet(m2s, pkt) == !(i == 0 && j == 1), 
+                      "wrong interest in ES PID", "(0x%04X)", es_pid(i, j));
+      }
+   }
+
+   // registered, unregistered, unknown and null packets interleaved; the unknown 
+   // ones have a corrupted adaptation field, which must not even be looked at
+   uint8_t *buf = malloc(num_rounds * 4 * TS_SIZE);
+   size_t len = 0;
+   for (int k = 0; k < num_rounds; k++)
+   {
+      ts_test_write_pes_packet(buf + len, es_pid(k % NUM_PROGRAMS, 0), k, 0, 0xE0, 0, 0);
+      len += TS_SIZE;
+      ts_test_write_pes_packet(buf + len, es_pid(0, 1), k, 0, 0xE0, 0, 0);
+      len += TS_SIZE;
+      memset(buf + len, 0xFF, TS_SIZE);
+      buf[len] = TS_SYNC_BYTE;
+      buf[len + 1] = 0x10;
+      buf[len + 2] = 0x00;
+      buf[len + 3] = 0x30;                    // adaptation field and payload
+      buf[len + 4] = 200;                     // adaptation_field_length > 182
+      len += TS_SIZE;
+      memset(buf + len, 0xFF, TS_SIZE);
+      buf[len] = TS_SYNC_BYTE;
+      buf[len + 1] = 0x1F;
+      buf[len + 2] = 0xFF;
+      buf[len + 3] = 0x10;
+      len += TS_SIZE;
+   }
+
+   tslib_errno = 0;
+   fail_unless(mpeg2ts_stream_read_buffer(m2s, buf, len) == len, "not all bytes consumed");
+   int total = 0;
+   for (int i = 0; i < 0x2000; i++) total += g_pid_count[i];
+   fail_unless2(total == num_rounds, "wrong number of packets delivered", "(%d)", total);
+   fail_unless2(m2s->num_packets_filtered == 3 * (uint64_t)num_rounds, "wrong number of packets filtered",
+                "(%llu)", (unsigned long long)m2s->num_packets_filtered);
+   fail_unless(tslib_errno == 0, "filtered packet was parsed");
+
+   mpeg2ts_stream_free(m2s);
+   free(buf);
+}
+END_TEST
+
+START_TEST(test_pid_dispatch_benchmark)
+{
+   const int num_buf_packets = NUM_PROGRAMS * NUM_ES_PER_PROGRAM * 10;
+   const int num_repeats = 200;
+   uint8_t *buf = malloc(num_buf_packets * TS_SIZE);
+   mpeg2ts_stream_t *m2s = new_test_stream();
+   memset(g_pid_count, 0, sizeof(g_pid_count));
+
+   int n = 0;
+   for (int k = 0; k < 10; k++)
+   {
+      for (int j = 0; j < NUM_ES_PER_PROGRAM; j++)
+      {
+         for (int i = 0; i < NUM_PROGRAMS; i++)
+         {
+            ts_test_write_pes_packet(buf + n * TS_SIZE, es_pid(i, j), k, 0, 0xE0, 0, 0);
+            n++;
+         }
+      }
+   }
+
+   uint64_t t1 = gettimeusec();
+   for (int r = 0; r < num_repeats; r++)
+   {
+      for (int i = 0; i < num_buf_packets; i++)
+      {
+         feed(m2s, buf + i * TS_SIZE);
+      }
+   }
+   uint64_t t2 = gettimeusec();
+   for (int r = 0; r < num_repeats; r++)
+   {
+      for (int i = 0; i < num_buf_packets; i++)
+      {
+         feed_pooled(m2s, buf + i * TS_SIZE);
+      }
+   }
+   uint64_t t3 = gettimeusec();
+   for (int r = 0; r < num_repeats; r++)
+   {
+      mpeg2ts_stream_read_buffer(m2s, buf, num_buf_packets * TS_SIZE);
+   }
+   uint64_t t4 = gettimeusec();
+
+   uint64_t total = 0;
+   for (int i = 0; i < 0x2000; i++) total += g_pid_count[i];
+   fail_unless(total == 3 * (uint64_t)num_buf_packets * num_repeats, "not all packets delivered");
+
+   // same packets on PIDs nobody registered for
+   for (int i = 0; i < num_buf_packets; i++)
+   {
+      buf[i * TS_SIZE + 1] = (buf[i * TS_SIZE + 1] & 0xE0) | 0x10;
+   }
+   uint64_t t5 = gettimeusec();
+   for (int r = 0; r < num_repeats; r++)
+   {
+      mpeg2ts_stream_read_buffer(m2s, buf, num_buf_packets * TS_SIZE);
+   }
+   uint64_t t6 = gettimeusec();
+   fail_unless(m2s->num_packets_filtered == (uint64_t)num_buf_packets * num_repeats, "not all packets filtered");
+
+   printf("# demux %d programs x %d PIDs: %.0f packets/sec (ts_new), %.0f packets/sec (pool), %.0f packets/sec (read_buffer)\n",
+          NUM_PROGRAMS, NUM_ES_PER_PROGRAM,
+          (double)num_buf_packets * num_repeats * 1000000.0 / (double)(t2 - t1 + 1),
+          (double)num_buf_packets * num_repeats * 1000000.0 / (double)(t3 - t2 + 1),
+          (double)num_buf_packets * num_repeats * 1000000.0 / (double)(t4 - t3 + 1));
+   printf("# unregistered PIDs: %.0f packets/sec (read_buffer, filtered)\n",
+          (double)num_buf_packets * num_repeats * 1000000.0 / (double)(t6 - t5 + 1));
+
+   mpeg2ts_stream_free(m2s);
+   free(buf);
+}
+END_TEST
+
+int main(int argc, char **argv)
+{
+   int _testnum = 1;
+   int failed = 0;
+   int r;
+
+   if (argc > 1 && strcmp(argv[1], "-v") == 0) verbose = 1;
+   tslib_loglevel = verbose ? TSLIB_LOG_LEVEL_INFO : TSLIB_LOG_LEVEL_ERROR;
+
+   r = test_pid_dispatch(); ok(r, "pid_dispatch"); failed += !r;
+   r = test_packet_pool(); ok(r, "packet_pool"); failed += !r;
+   r = test_psi_repetition(); ok(r, "psi_repetition"); failed += !r;
+   r = test_read_buffer(); ok(r, "read_buffer"); failed += !r;
+   r = test_pid_filter(); ok(r, "pid_filter"); failed += !r;
+   r = test_pid_dispatch_benchmark(); ok(r, "pid_dispatch_benchmark"); failed += !r;
+
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,526 @@
+/*
+
+ Copyright (c) 2012-, ISO/IEC JTC1/SC29/WG11
+ Written by Alex Giladi <alex.giladi@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of the ISO/IEC nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "log.h"
+#include "libts_common.h"
+#include "descriptors.h"
+#include "mpeg2ts_demux.h"
+#include "tpes.h"
+#include "crc32m.h"
+#include "ts_test_util.h"
+#include "test_macros.h"
+
+// Independent streams demultiplexed on one thread each: no shared state
+// between them may race, and per-thread error and log state must not leak
+// from one stream to another. Also one stream demultiplexed in threaded mode
+// (mpeg2ts_stream_start_workers). Run under ThreadSanitizer with "make tsan".
+
+#define NUM_THREADS        8
+#define NUM_ROUNDS         500
+#define NUM_ES             2
+#define PMT_PID            0x100
+#define ES_PID_BASE        0x200
+#define PES_PAYLOAD_LEN    1000
+#define VERSION_INTERVAL   4       /// PMT version changes every VERSION_INTERVAL rounds
+#define CORRUPT_INTERVAL   16      /// in corrupting streams, every CORRUPT_INTERVAL-th PMT has a bad CRC
+#define SECTION_CRC_ERROR  (-33)   /// tslib_errno set by the section assembler on CRC mismatch
+
+#define NUM_PROGRAM_ES     3       /// threaded mode: one video and two audio PIDs
+#define VIDEO_PES_LEN      4000
+#define AUDIO_PES_LEN      500
+#define PTS_STEP           3000
+
+int verbose = 0;
+
+typedef struct 
+{
+   int corrupt;                 /// send PMTs with a bad CRC now and then
+   int num_rounds;              
+   uint8_t *pkts;               /// the whole stream, built up front
+   int num_pkts;                
+   uint64_t num_pes;            /// PES packets delivered
+   uint64_t num_bad_pes;        /// PES packets delivered with unexpected content
+   int num_lang_descriptors;    /// ISO 639 descriptors found in the last PMT
+   int errno_seen;              /// tslib_errno of the worker thread when done
+   int loglevel_seen;           /// tslib_loglevel of the worker thread when done
+   uint64_t usec;               /// time spent demultiplexing
+} stream_worker_t; 
+
+static int build_pmt_with_lang(uint8_t *section, int version)
+{
+   int section_length = 9 + NUM_ES * (5 + 6) + 4;
+   uint8_t *p = section;
+
+   *p++ = 0x02;
+   *p++ = 0xB0 | (section_length >> 8);
+   *p++ = section_length & 0xFF;
+   *p++ = 0x00; *p++ = 0x01;                     // program_number
+   *p++ = 0xC1 | ((version & 0x1F) << 1);
+   *p++ = 0x00; *p++ = 0x00;
+   *p++ = 0xE0 | (ES_PID_BASE >> 8);
+   *p++ = ES_PID_BASE & 0xFF;
+   *p++ = 0xF0; *p++ = 0x00;                     // program_info_length
+   for (int i = 0; i < NUM_ES; i++)
+   {
+      *p++ = 0x0F;
+      *p++ = 0xE0 | ((ES_PID_BASE + i) >> 8);
+      *p++ = (ES_PID_BASE + i) & 0xFF;
+      *p++ = 0xF0; *p++ = 6;                     // ES_info_length
+      *p++ = ISO_639_LANGUAGE_DESCRIPTOR; *p++ = 4; 
+      *p++ = 'e'; *p++ = 'n'; *p++ = 'g'; *p++ = 0x00; 
+   }
+   ts_test_put_crc(section, p - section);
+   return (p - section) + 4;
+}
+
+static void build_stream(stream_worker_t *w)
+{
+   uint8_t section[1024];
+   uint8_t pes[14 + PES_PAYLOAD_LEN];
+   uint32_t program_number = 1, pmt_pid = PMT_PID;
+   uint32_t cc[NUM_ES] = { 0 };
+   int pes_len = ts_test_build_pes(pes, 0xC0, 0, PES_PAYLOAD_LEN, 1);
+   int pkts_per_pes = (pes_len + TS_SIZE - TS_HEADER_SIZE - 1) / (TS_SIZE - TS_HEADER_SIZE);
+
+   w->pkts = malloc((size_t)w->num_rounds * (2 + NUM_ES * pkts_per_pes) * TS_SIZE);
+   w->num_pkts = 0;
+
+   for (int r = 0; r < w->num_rounds; r++)
+   {
+      int len = ts_test_build_pat(section, 0, 1, &program_number, &pmt_pid);
+      ts_test_write_section_packet(w->pkts + TS_SIZE * w->num_pkts++, PAT_PID, r, section, len);
+
+      len = build_pmt_with_lang(section, r / VERSION_INTERVAL);
+      if (w->corrupt && (r % CORRUPT_INTERVAL) == CORRUPT_INTERVAL - 1) section[len - 1] ^= 0x01;
+      ts_test_write_section_packet(w->pkts + TS_SIZE * w->num_pkts++, PMT_PID, r, section, len);
+
+      for (int i = 0; i < NUM_ES; i++)
+      {
+         for (int pos = 0; pos < pes_len; )
+         {
+            pos += ts_test_write_payload_packet(w->pkts + TS_SIZE * w->num_pkts++, ES_PID_BASE + i, 
+                                                cc[i]++, pos == 0, pes + pos, pes_len - pos);
+         }
+      }
+   }
+}
+
+static int count_pes_packet(pes_packet_t *pes, elementary_stream_info_t *es_info, vqarray_t *ts_queue, void *arg)
+{
+   (void)es_info;
+   (void)ts_queue;
+   stream_worker_t *w = (stream_worker_t *)arg;
+   w->num_pes++;
+   if (pes->status != 0 || pes->buf_len != 14 + PES_PAYLOAD_LEN || pes->buf[14 + 100] != 100) w->num_bad_pes++;
+   pes_free(pes);
+   return 1;
+}
+
+static int free_pes_demux(void *arg)
+{
+   pes_demux_free((pes_demux_t *)arg);
+   return 1;
+}
+
+static int register_pes_demuxes(mpeg2ts_program_t *m2p, void *arg)
+{
+   for (int i = 0; i < vqarray_length(m2p->pmt->es_info); i++)
+   {
+      elementary_stream_info_t *esi = vqarray_get(m2p->pmt->es_info, i);
+      pes_demux_t *pdm = pes_demux_new(count_pes_packet);
+      pdm->pes_arg = arg;
+      demux_pid_handler_t *h = calloc(1, sizeof(demux_pid_handler_t));
+      h->process_ts_packet = pes_demux_process_ts_packet;
+      h->arg = pdm;
+      h->arg_destructor = free_pes_demux;
+      mpeg2ts_program_register_pid_processor(m2p, esi->elementary_PID, h, NULL);
+   }
+   return 1;
+}
+
+static int set_pmt_processors(mpeg2ts_stream_t *m2s, void *arg)
+{
+   for (int i = 0; i < vqarray_length(m2s->programs); i++)
+   {
+      mpeg2ts_program_t *m2p = vqarray_get(m2s->programs, i);
+      m2p->pmt_processor = register_pes_demuxes;
+      m2p->arg = arg;
+   }
+   return 1;
+}
+
+static void* run_worker(void *arg)
+{
+   stream_worker_t *w = (stream_worker_t *)arg;
+
+   // errors are expected in corrupting streams, keep them quiet there only
+   tslib_loglevel = w->corrupt ? 0 : TSLIB_LOG_LEVEL_ERROR;
+   int loglevel = tslib_loglevel;
+
+   uint64_t start = gettimeusec();
+   mpeg2ts_stream_t *m2s = mpeg2ts_stream_new();
+   m2s->pat_processor = set_pmt_processors;
+   m2s->arg = w;
+
+   for (int i = 0; i < w->num_pkts; i++)
+   {
+      ts_packet_t *ts = mpeg2ts_stream_new_ts_packet(m2s);
+      memcpy(ts->bytes, w->pkts + TS_SIZE * i, TS_SIZE);
+      if (!ts_read_view(ts, ts->bytes, TS_SIZE))
+      {
+         ts_free(ts);
+         continue;
+      }
+      mpeg2ts_stream_read_ts_packet(m2s, ts);
+   }
+   w->usec = gettimeusec() - start;
+
+   mpeg2ts_program_t *m2p = vqarray_get(m2s->programs, 0);
+   for (int i = 0; m2p != NULL && m2p->pmt != NULL && i < vqarray_length(m2p->pmt->es_info); i++)
+   {
+      elementary_stream_info_t *esi = vqarray_get(m2p->pmt->es_info, i);
+      for (int j = 0; j < vqarray_length(esi->descriptors); j++)
+      {
+         descriptor_t *desc = vqarray_get(esi->descriptors, j);
+         if (desc->tag == ISO_639_LANGUAGE_DESCRIPTOR && ((language_descriptor_t *)desc)->num_languages == 1) 
+            w->num_lang_descriptors++;
+      }
+   }
+   mpeg2ts_stream_free(m2s);
+
+   w->errno_seen = tslib_errno;
+   w->loglevel_seen = (tslib_loglevel == loglevel);
+   return NULL;
+}
+
+static int run_workers(stream_worker_t *workers, int num_threads)
+{
+   pthread_t threads[NUM_THREADS];
+   for (int i = 0; i < num_threads; i++)
+   {
+      if (pthread_create(&threads[i], NULL, run_worker, &workers[i]) != 0) return 0;
+   }
+   for (int i = 0; i < num_threads; i++) pthread_join(threads[i], NULL);
+   return 1;
+}
+
+static stream_worker_t* new_workers(int num_threads, int num_rounds, int corrupt)
+{
+   stream_worker_t *workers = calloc(num_threads, sizeof(stream_worker_t));
+   for (int i = 0; i < num_threads; i++)
+   {
+      workers[i].corrupt = corrupt && (i % 2 == 1);
+      workers[i].num_rounds = num_rounds;
+      build_stream(&workers[i]);
+   }
+   return workers;
+}
+
+static void free_workers(stream_worker_t *workers, int num_threads)
+{
+   for (int i = 0; i < num_threads; i++) free(workers[i].pkts);
+   free(workers);
+}
+
+START_TEST(test_parallel_streams)
+{
+   // descriptors are registered by the first mpeg2ts_stream_new, which the workers race for
+   stream_worker_t *workers = new_workers(NUM_THREADS, NUM_ROUNDS, 1);
+   tslib_errno = 0;
+
+   fail_unless(run_workers(workers, NUM_THREADS), "failed to start threads");
+   for (int i = 0; i < NUM_THREADS; i++)
+   {
+      stream_worker_t *w = &workers[i];
+      fail_unless2(w->num_pes == NUM_ROUNDS * NUM_ES, "PES packets lost", "(thread %d: %"PRIu64")", i, w->num_pes);
+      fail_unless2(w->num_bad_pes == 0, "PES content mismatch", "(thread %d)", i);
+      fail_unless2(w->num_lang_descriptors == NUM_ES, "language descriptors not parsed", "(thread %d)", i);
+      fail_unless2(w->loglevel_seen, "log level changed by another thread", "(thread %d)", i);
+      fail_unless2(w->errno_seen == (w->corrupt ? SECTION_CRC_ERROR : 0), "wrong tslib_errno", 
+                   "(thread %d: %d)", i, w->errno_seen);
+   }
+   fail_unless(tslib_errno == 0, "tslib_errno of the main thread set by a worker");
+
+   free_workers(workers, NUM_THREADS);
+}
+END_TEST
+
+START_TEST(test_scaling_benchmark)
+{
+   long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+   int num_threads = (num_cpus > NUM_THREADS) ? NUM_THREADS : (num_cpus < 1 ? 1 : (int)num_cpus);
+   stream_worker_t *workers = new_workers(num_threads, 4 * NUM_ROUNDS, 0);
+
+   fail_unless(run_workers(workers, 1), "failed to start threads");
+   double single = (double)workers[0].num_pkts / workers[0].usec;
+   workers[0].num_pes = 0;
+
+   fail_unless(run_workers(workers, num_threads), "failed to start threads");
+   double total = 0;
+   for (int i = 0; i < num_threads; i++)
+   {
+      fail_unless2(workers[i].num_pes == 4 * NUM_ROUNDS * NUM_ES, "PES packets lost", "(thread %d)", i);
+      total += (double)workers[i].num_pkts / workers[i].usec;
+   }
+   printf("# 1 stream: %.2f Mpackets/s, %d streams: %.2f Mpackets/s (%.1fx)\n", single, num_threads, total, total / single);
+
+   free_workers(workers, num_threads);
+}
+END_TEST
+
+typedef struct 
+{
+   int expected_len;            /// PES payload length
+   int work;                    /// times the payload is run through CRC, simulates parsing
+   uint64_t num_pes;            
+   uint64_t num_bad;            /// out of order or wrong content
+   uint64_t num_thread_switches; /// PES delivered on a different thread than the first one
+   pthread_t thread;            /// thread the first PES was delivered on
+   uint32_t crc; 
+} pid_sink_t; 
+
+static uint8_t* build_program_stream(int num_rounds, int *num_pkts)
+{
+   uint8_t section[1024];
+   uint8_t pes[14 + VIDEO_PES_LEN];
+   uint32_t program_number = 1, pmt_pid = PMT_PID;
+   uint32_t stream_types[NUM_PROGRAM_ES] = { STREAM_TYPE_AVC, STREAM_TYPE_MPEG2_AAC, STREAM_TYPE_AC3_AUDIO };
+   uint32_t es_pids[NUM_PROGRAM_ES];
+   uint32_t cc[NUM_PROGRAM_ES] = { 0 };
+   int max_pkts_per_round = 2 + (VIDEO_PES_LEN + 14) / (TS_SIZE - TS_HEADER_SIZE) + 1 
+                              + (NUM_PROGRAM_ES - 1) * ((AUDIO_PES_LEN + 14) / (TS_SIZE - TS_HEADER_SIZE) + 1);
+   uint8_t *pkts = malloc((size_t)num_rounds * max_pkts_per_round * TS_SIZE);
+   int n = 0;
+
+   for (int i = 0; i < NUM_PROGRAM_ES; i++) es_pids[i] = ES_PID_BASE + i;
+
+   for (int r = 0; r < num_rounds; r++)
+   {
+      int len = ts_test_build_pat(section, 0, 1, &program_number, &pmt_pid);
+      ts_test_write_section_packet(pkts + TS_SIZE * n++, PAT_PID, r, section, len);
+
+      // handlers are replaced on every new PMT version, under the workers' feet unless synchronized
+      len = ts_test_build_pmt(section, r / VERSION_INTERVAL, program_number, ES_PID_BASE, NUM_PROGRAM_ES, stream_types, es_pids);
+      ts_test_write_section_packet(pkts + TS_SIZE * n++, PMT_PID, r, section, len);
+
+      for (int i = 0; i < NUM_PROGRAM_ES; i++)
+      {
+         int pes_len = ts_test_build_pes(pes, i == 0 ? 0xE0 : 0xC0, (uint64_t)r * PTS_STEP, 
+                                         i == 0 ? VIDEO_PES_LEN : AUDIO_PES_LEN, 1);
+         for (int pos = 0; pos < pes_len; )
+         {
+            pos += ts_test_write_payload_packet(pkts + TS_SIZE * n++, es_pids[i], cc[i]++, pos == 0, pes + pos, pes_len - pos);
+         }
+      }
+   }
+   *num_pkts = n;
+   return pkts;
+}
+
+static int check_ordered_pes(pes_packet_t *pes, elementary_stream_info_t *es_info, vqarray_t *ts_queue, void *arg)
+{
+   (void)es_info;
+   (void)ts_queue;
+   pid_sink_t *sink = (pid_sink_t *)arg;
+
+   if (sink->num_pes == 0) sink->thread = pthread_self();
+   else if (!pthread_equal(sink->thread, pthread_self())) sink->num_thread_switches++;
+
+   if (pes->status != 0 || (int)pes->payload_len != sink->expected_len || 
+       pes->header.PTS != (int64_t)(sink->num_pes * PTS_STEP)) sink->num_bad++;
+   for (int i = 0; i < sink->work; i++) sink->crc = crc_update(sink->crc, pes->payload, pes->payload_len);
+
+   sink->num_pes++;
+   pes_free(pes);
+   return 1;
+}
+
+static int register_pid_sinks(mpeg2ts_program_t *m2p, void *arg)
+{
+   pid_sink_t *sinks = (pid_sink_t *)arg;
+   for (int i = 0; i < vqarray_length(m2p->pmt->es_info); i++)
+   {
+      elementary_stream_info_t *esi = vqarray_get(m2p->pmt->es_info, i);
+      pes_demux_t *pdm = pes_demux_new(check_ordered_pes);
+      pdm->pes_arg = &sinks[esi->elementary_PID - ES_PID_BASE];
+      demux_pid_handler_t *h = calloc(1, sizeof(demux_pid_handler_t));
+      h->process_ts_packet = pes_demux_process_ts_packet;
+      h->arg = pdm;
+      h->arg_destructor = free_pes_demux;
+      mpeg2ts_program_register_pid_processor(m2p, esi->elementary_PID, h, NULL);
+   }
+   return 1;
+}
+
+static int set_sink_pmt_processors(mpeg2ts_stream_t *m2s, void *arg)
+{
+   for (int i = 0; i < vqarray_length(m2s->programs); i++)
+   {
+      mpeg2ts_program_t *m2p = vqarray_get(m2s->programs, i);
+      m2p->pmt_processor = register_pid_sinks;
+      m2p->arg = arg;
+   }
+   return 1;
+}
+
+static void init_sinks(pid_sink_t *sinks, int video_work)
+{
+   memset(sinks, 0, NUM_PROGRAM_ES * sizeof(pid_sink_t));
+   for (int i = 0; i < NUM_PROGRAM_ES; i++)
+   {
+      sinks[i].expected_len = (i == 0) ? VIDEO_PES_LEN : AUDIO_PES_LEN;
+      sinks[i].work = (i == 0) ? video_work : 0;
+   }
+}
+
+static mpeg2ts_stream_t* new_sink_stream(pid_sink_t *sinks)
+{
+   mpeg2ts_stream_t *m2s = mpeg2ts_stream_new();
+   m2s->pat_processor = set_sink_pmt_processors;
+   m2s->arg = sinks;
+   return m2s;
+}
+
+static void feed_stream(mpeg2ts_stream_t *m2s, const uint8_t *pkts, int num_pkts)
+{
+   for (int i = 0; i < num_pkts; i++)
+   {
+      ts_packet_t *ts = mpeg2ts_stream_new_ts_packet(m2s);
+      memcpy(ts->bytes, pkts + TS_SIZE * i, TS_SIZE);
+      ts_read_view(ts, ts->bytes, TS_SIZE);
+      mpeg2ts_stream_read_ts_packet(m2s, ts);
+   }
+}
+
+START_TEST(test_threaded_demux)
+{
+   int num_pkts = 0;
+   uint8_t *pkts = build_program_stream(NUM_ROUNDS, &num_pkts);
+   pid_sink_t sinks[NUM_PROGRAM_ES];
+
+   // default assignment: video alone on the first worker, one audio PID on each of the others
+   init_sinks(sinks, 0);
+   mpeg2ts_stream_t *m2s = new_sink_stream(sinks);
+   fail_unless(mpeg2ts_stream_start_workers(m2s, NUM_PROGRAM_ES, 64), "failed to start workers");
+   fail_unless(!mpeg2ts_stream_start_workers(m2s, 2, 0), "workers started twice");
+   feed_stream(m2s, pkts, num_pkts);
+   mpeg2ts_stream_sync_workers(m2s);
+
+   for (int i = 0; i < NUM_PROGRAM_ES; i++)
+   {
+      fail_unless2(mpeg2ts_stream_get_pid_worker(m2s, ES_PID_BASE + i) == i, "unexpected PID assignment", 
+                   "(PID 0x%X on worker %d)", ES_PID_BASE + i, mpeg2ts_stream_get_pid_worker(m2s, ES_PID_BASE + i));
+      fail_unless2(sinks[i].num_pes == NUM_ROUNDS, "PES packets lost", "(PID 0x%X: %"PRIu64")", ES_PID_BASE + i, sinks[i].num_pes);
+      fail_unless2(sinks[i].num_bad == 0, "PES out of order or corrupted", "(PID 0x%X)", ES_PID_BASE + i);
+      fail_unless2(sinks[i].num_thread_switches == 0, "PID processed on more than one thread", "(PID 0x%X)", ES_PID_BASE + i);
+      fail_unless2(!pthread_equal(sinks[i].thread, pthread_self()), "PID processed on the reading thread", "(PID 0x%X)", ES_PID_BASE + i);
+      for (int j = 0; j < i; j++)
+      {
+         fail_unless(!pthread_equal(sinks[i].thread, sinks[j].thread), "PIDs of different workers processed on the same thread");
+      }
+   }
+
+   mpeg2ts_stream_stop_workers(m2s);
+   fail_unless(m2s->ts_pool->num_outstanding == 0, "packets not returned to the pool");
+
+   // back on the calling thread
+   feed_stream(m2s, pkts, num_pkts);
+   fail_unless(sinks[0].num_pes == 2 * NUM_ROUNDS, "PES packets lost after stopping workers");
+   fail_unless(sinks[1].num_thread_switches == NUM_ROUNDS, "PES not processed on the calling thread after stopping workers");
+   mpeg2ts_stream_free(m2s);
+
+   // everything pinned to one worker, the other one idles
+   init_sinks(sinks, 0);
+   m2s = new_sink_stream(sinks);
+   fail_unless(mpeg2ts_stream_start_workers(m2s, 2, 0), "failed to start workers");
+   for (int i = 0; i < NUM_PROGRAM_ES; i++) fail_unless(mpeg2ts_stream_set_pid_worker(m2s, ES_PID_BASE + i, 1), "failed to pin PID");
+   fail_unless(!mpeg2ts_stream_set_pid_worker(m2s, ES_PID_BASE, 2), "pinned to a non-existent worker");
+   feed_stream(m2s, pkts, num_pkts);
+   mpeg2ts_stream_free(m2s); // stops the workers after processing everything queued
+
+   for (int i = 0; i < NUM_PROGRAM_ES; i++)
+   {
+      fail_unless2(sinks[i].num_pes == NUM_ROUNDS && sinks[i].num_bad == 0, "PES packets lost or corrupted", "(PID 0x%X)", ES_PID_BASE + i);
+      fail_unless(pthread_equal(sinks[i].thread, sinks[0].thread), "pinned PIDs processed on different threads");
+   }
+
+   free(pkts);
+}
+END_TEST
+
+START_TEST(test_threaded_demux_benchmark)
+{
+   int num_pkts = 0;
+   uint8_t *pkts = build_program_stream(NUM_ROUNDS, &num_pkts);
+   pid_sink_t sinks[NUM_PROGRAM_ES];
+   double rate[2];
+
+   // video "parsing" heavy enough to dominate
+   for (int threaded = 0; threaded < 2; threaded++)
+   {
+      init_sinks(sinks, 4);
+      mpeg2ts_stream_t *m2s = new_sink_stream(sinks);
+      if (threaded) mpeg2ts_stream_start_workers(m2s, NUM_PROGRAM_ES, 0);
+      uint64_t start = gettimeusec();
+      feed_stream(m2s, pkts, num_pkts);
+      mpeg2ts_stream_sync_workers(m2s);
+      rate[threaded] = (double)num_pkts / (gettimeusec() - start);
+      fail_unless(sinks[0].num_pes == NUM_ROUNDS, "PES packets lost");
+      mpeg2ts_stream_free(m2s);
+   }
+   printf("# heavy video PID: %.2f Mpackets/s on the calling thread, %.2f Mpackets/s with %d workers\n", 
+          rate[0], rate[1], NUM_PROGRAM_ES);
+
+   free(pkts);
+}
+END_TEST
+
+int main(int argc, char **argv)
+{
+   int _testnum = 1;
+   int failed = 0;
+   int r;
+
+   if (argc > 1 && strcmp(argv[1], "-v") == 0) verbose = 1;
+   tslib_loglevel = verbose ? TSLIB_LOG_LEVEL_INFO : TSLIB_LOG_LEVEL_ERROR;
+
+   r = test_parallel_streams(); ok(r, "parallel_streams"); failed += !r;
+   r = test_scaling_benchmark(); ok(r, "scaling_benchmark"); failed += !r;
+   r = test_threaded_demux(); ok(r, "threaded_demux"); failed += !r;
+   r = test_threaded_demux_benchmark(); ok(r, "threaded_demux_benchmark"); failed += !r;
+
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
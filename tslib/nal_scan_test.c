@@ -0,0 +1,351 @@
+/*
+
+ Copyright (c) 2012-, ISO/IEC JTC1/SC29/WG11
+ Written by Alex Giladi <alex.giladi@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of the ISO/IEC nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "h264_nal_scan.h"
+#include "ts_test_util.h"
+#include "test_macros.h"
+
+#define BENCH_ES_SIZE (256 << 20)
+
+int verbose = 0;
+
+static const int impls[] = { NAL_SCAN_IMPL_SCALAR, NAL_SCAN_IMPL_SSE2, NAL_SCAN_IMPL_AVX2 };
+static const char *impl_names[] = { "scalar", "SSE2", "AVX2" };
+
+// Byte-at-a-time scanner, as find_nal_unit used to do it; reference for
+// correctness and the "before" side of the benchmark.
+static int ref_scan(const uint8_t *buf, int size, int stop_at_zero)
+{
+   for (int i = 0; i + 2 < size; i++)
+   {
+      if (buf[i] == 0 && buf[i + 1] == 0 && (buf[i + 2] == 1 || (stop_at_zero && buf[i + 2] == 0))) return i;
+   }
+   return size;
+}
+
+// Byte-at-a-time nal_to_rbsp, as h264bitstream used to implement it
+static int ref_nal_to_rbsp(const uint8_t *nal_buf, int *nal_size, uint8_t *rbsp_buf, int *rbsp_size)
+{
+   int i, j = 0, count = 0;
+   for (i = 0; i < *nal_size; i++)
+   {
+      if (count == 2 && nal_buf[i] < 0x03) return -1;
+      if (count == 2 && nal_buf[i] == 0x03)
+      {
+         if (i < *nal_size - 1 && nal_buf[i + 1] > 0x03) return -1;
+         if (i == *nal_size - 1) break;
+         i++;
+         count = 0;
+      }
+      if (j >= *rbsp_size) return -1;
+      rbsp_buf[j] = nal_buf[i];
+      count = (nal_buf[i] == 0x00) ? count + 1 : 0;
+      j++;
+   }
+   *nal_size = i;
+   *rbsp_size = j;
+   return j;
+}
+
+// insert emulation prevention bytes, returns NAL size
+static int escape_rbsp(const uint8_t *rbsp, int size, uint8_t *nal)
+{
+   int j = 0;
+   for (int i = 0; i < size; i++)
+   {
+      if (j >= 2 && nal[j - 1] == 0 && nal[j - 2] == 0 && rbsp[i] <= 3) nal[j++] = 3;
+      nal[j++] = rbsp[i];
+   }
+   return j;
+}
+
+// mostly zeros and ones, so that there are lots of (partial) start codes
+static void fill_random(uint8_t *buf, int size)
+{
+   for (int i = 0; i < size; i++)
+   {
+      int r = rand() % 16;
+      buf[i] = (r < 6) ? 0 : (r < 9) ? 1 : (uint8_t)rand();
+   }
+}
+
+// NAL units of random length and content, with 3- and 4-byte start codes
+static int build_es(uint8_t *buf, int size)
+{
+   uint32_t x32 = 2463534242u;   // xorshift, rand() is too slow for a few hundred MB
+   int n = 0, num_nals = 0;
+   while (n + 8 < size)
+   {
+      if (num_nals % 4 == 0) buf[n++] = 0;
+      buf[n++] = 0; buf[n++] = 0; buf[n++] = 1;
+      int len = 100 + rand() % 20000;
+      for (int i = 0; i < len && n < size; i++)
+      {
+         x32 ^= x32 << 13; x32 ^= x32 >> 17; x32 ^= x32 << 5;
+         uint8_t x = (uint8_t)(x32 >> 24);
+         // emulation prevention
+         buf[n] = (n >= 2 && buf[n - 1] == 0 && buf[n - 2] == 0 && x <= 3) ? 3 : x;
+         n++;
+      }
+      num_nals++;
+   }
+   memset(buf + n, 0xFF, size - n);
+   return num_nals;
+}
+
+START_TEST(test_nal_scan)
+{
+   uint8_t buf[300];
+
+   for (int k = 0; k < 3; k++)
+   {
+      if (!nal_scan_set_impl(impls[k]))
+      {
+         printf("# %s not supported, skipped\n", impl_names[k]);
+         continue;
+      }
+      for (int t = 0; t < 20000; t++)
+      {
+         int size = rand() % sizeof(buf);
+         fill_random(buf, size);
+         int off = rand() % 4;
+         if (off > size) off = size;
+
+         int r1 = nal_find_start_code(buf + off, size - off);
+         int r2 = nal_find_end(buf + off, size - off);
+         fail_unless2(r1 == ref_scan(buf + off, size - off, 0), "start code mismatch", "(%s, size %d)", impl_names[k], size);
+         fail_unless2(r2 == ref_scan(buf + off, size - off, 1), "NAL end mismatch", "(%s, size %d)", impl_names[k], size);
+      }
+
+      // start code in the very last bytes, and at every position of a vector
+      for (int pos = 0; pos < 70; pos++)
+      {
+         memset(buf, 0xAA, 80);
+         buf[pos] = 0; buf[pos + 1] = 0; buf[pos + 2] = 1;
+         fail_unless2(nal_find_start_code(buf, pos + 3) == pos, "start code at end of buffer missed", "(%s, pos %d)", impl_names[k], pos);
+         fail_unless2(nal_find_start_code(buf, pos + 2) == pos + 2, "partial start code reported", "(%s, pos %d)", impl_names[k], pos);
+      }
+   }
+   nal_scan_set_impl(NAL_SCAN_IMPL_AUTO);
+}
+END_TEST
+
+START_TEST(test_nal_unescape)
+{
+   uint8_t rbsp[200], nal[300], out1[300], out2[300];
+   int num_valid = 0;
+
+   for (int k = 0; k < 3; k++)
+   {
+      if (!nal_scan_set_impl(impls[k])) continue;
+      for (int t = 0; t < 20000; t++)
+      {
+         int n;
+         int rbsp_len = rand() % sizeof(rbsp);
+         fill_random(rbsp, rbsp_len);
+         if (t % 2) n = escape_rbsp(rbsp, rbsp_len, nal);   // valid
+         else memcpy(nal, rbsp, n = rbsp_len);              // mostly invalid
+         int cap = (t % 5 == 0) ? rand() % (n + 1) : n;
+
+         int n1 = n, s1 = cap, n2 = n, s2 = cap;
+         int r1 = ref_nal_to_rbsp(nal, &n1, out1, &s1);
+         int r2 = nal_unescape(nal, &n2, out2, &s2, 0);
+         fail_unless2(r1 == r2, "return value mismatch", "(%s, size %d)", impl_names[k], n);
+         if (r1 < 0 || r2 < 0) continue;
+         num_valid++;
+         fail_unless2(n1 == n2 && s1 == s2 && memcmp(out1, out2, s1) == 0, "RBSP mismatch", "(%s, size %d)", impl_names[k], n);
+
+         // in place
+         int n3 = n, s3 = cap;
+         memcpy(out2, nal, n);
+         fail_unless2(nal_unescape(out2, &n3, out2, &s3, 0) == r1 && memcmp(out1, out2, s1) == 0,
+                      "in-place RBSP mismatch", "(%s, size %d)", impl_names[k], n);
+
+         // only the first few bytes, as for a slice header
+         int n4 = n, s4 = s1 / 3;
+         fail_unless2(nal_unescape(nal, &n4, out2, &s4, 1) == s1 / 3 && memcmp(out1, out2, s4) == 0,
+                      "partial RBSP mismatch", "(%s, size %d)", impl_names[k], n);
+      }
+   }
+   fail_unless(num_valid > 10000, "too few valid NAL units tested");
+   nal_scan_set_impl(NAL_SCAN_IMPL_AUTO);
+}
+END_TEST
+
+START_TEST(test_nal_scanner_stream)
+{
+   const int size = 1 << 20;
+   uint8_t *buf = malloc(size);
+   int num_start_codes = 0;
+
+   fill_random(buf, size);
+
+   for (int r = 0; r < 10; r++)
+   {
+      nal_scanner_t s;
+      nal_scanner_init(&s);
+      int pos = 0, found = 0, expected = 0, mismatches = 0;
+      int next = nal_find_start_code(buf, size);
+
+      // fragments of 1 to ~200 bytes, like PES payload in TS packets
+      while (pos < size)
+      {
+         int len = 1 + rand() % (r < 5 ? 8 : 200);
+         if (len > size - pos) len = size - pos;
+         const uint8_t *p = buf + pos;
+         int left = len;
+         int n;
+         while ((n = nal_scanner_next(&s, p, left)) >= 0)
+         {
+            if (s.start_code_pos != (uint64_t)next) mismatches++;
+            next += 3 + nal_find_start_code(buf + next + 3, size - next - 3);
+            p += n;
+            left -= n;
+            found++;
+         }
+         pos += len;
+      }
+      for (int i = nal_find_start_code(buf, size); i < size; i += 3 + nal_find_start_code(buf + i + 3, size - i - 3)) expected++;
+
+      fail_unless2(found == expected, "wrong number of start codes", "(%d instead of %d)", found, expected);
+      fail_unless2(mismatches == 0, "start code position mismatch", "(%d)", mismatches);
+      fail_unless(s.pos == (uint64_t)size, "not all data consumed");
+      num_start_codes = expected;
+   }
+   fail_unless(num_start_codes > 1000, "test data has too few start codes");
+   free(buf);
+}
+END_TEST
+
+START_TEST(test_nal_scan_benchmark)
+{
+   uint8_t *buf = malloc(BENCH_ES_SIZE);
+   int num_nals = build_es(buf, BENCH_ES_SIZE);
+   uint64_t t1, t2;
+   int n;
+
+   // a find_nal_unit loop: start code, then the end of the NAL unit
+   t1 = gettimeusec();
+   n = 0;
+   for (int i = ref_scan(buf, BENCH_ES_SIZE, 0); i < BENCH_ES_SIZE; n++)
+   {
+      i += 3;
+      i += ref_scan(buf + i, BENCH_ES_SIZE - i, 1);
+      i += ref_scan(buf + i, BENCH_ES_SIZE - i, 0);
+   }
+   t2 = gettimeusec();
+   fail_unless2(n == num_nals, "wrong number of NAL units", "(byte-at-a-time: %d instead of %d)", n, num_nals);
+   printf("# %d MB ES, %d NAL units: byte-at-a-time %.0f MB/s", BENCH_ES_SIZE >> 20, num_nals,
+          (double)BENCH_ES_SIZE / (double)(t2 - t1 + 1));
+
+   for (int k = 0; k < 3; k++)
+   {
+      if (!nal_scan_set_impl(impls[k])) continue;
+      t1 = gettimeusec();
+      n = 0;
+      for (int i = nal_find_start_code(buf, BENCH_ES_SIZE); i < BENCH_ES_SIZE; n++)
+      {
+         i += 3;
+         i += nal_find_end(buf + i, BENCH_ES_SIZE - i);
+         i += nal_find_start_code(buf + i, BENCH_ES_SIZE - i);
+      }
+      t2 = gettimeusec();
+      fail_unless2(n == num_nals, "wrong number of NAL units", "(%s: %d instead of %d)", impl_names[k], n, num_nals);
+      printf(", %s %.0f MB/s", impl_names[k], (double)BENCH_ES_SIZE / (double)(t2 - t1 + 1));
+   }
+   printf("\n");
+   nal_scan_set_impl(NAL_SCAN_IMPL_AUTO);
+
+   // emulation prevention removal, NAL unit by NAL unit, into a reused scratch buffer
+   uint8_t *rbsp = malloc(BENCH_ES_SIZE);
+   int *nal_offset = malloc(num_nals * sizeof(int));
+   int *nal_len = malloc(num_nals * sizeof(int));
+   int64_t sum1 = 0, sum2 = 0, sum3 = 0;
+   n = 0;
+   for (int i = 3 + nal_find_start_code(buf, BENCH_ES_SIZE); i < BENCH_ES_SIZE && n < num_nals; n++)
+   {
+      nal_offset[n] = i;
+      nal_len[n] = nal_find_end(buf + i, BENCH_ES_SIZE - i);
+      i += nal_len[n];
+      i += 3 + nal_find_start_code(buf + i, BENCH_ES_SIZE - i);
+   }
+
+   t1 = gettimeusec();
+   for (int i = 0; i < n; i++)
+   {
+      int nal_size = nal_len[i], rbsp_size = nal_len[i];
+      sum1 += ref_nal_to_rbsp(buf + nal_offset[i], &nal_size, rbsp, &rbsp_size);
+   }
+   t2 = gettimeusec();
+   for (int i = 0; i < n; i++)
+   {
+      int nal_size = nal_len[i], rbsp_size = nal_len[i];
+      sum2 += nal_unescape(buf + nal_offset[i], &nal_size, rbsp, &rbsp_size, 0);
+   }
+   uint64_t t3 = gettimeusec();
+   for (int i = 0; i < n; i++)
+   {
+      // first 64 bytes only, plenty for a slice header
+      int nal_size = nal_len[i], rbsp_size = (nal_len[i] < 64) ? nal_len[i] : 64;
+      sum3 += nal_unescape(buf + nal_offset[i], &nal_size, rbsp, &rbsp_size, 1);
+   }
+   uint64_t t4 = gettimeusec();
+   fail_unless(sum1 == sum2 && sum1 > 0 && sum3 > 0, "nal_unescape result differs from reference");
+   printf("# unescape %d MB: byte-at-a-time %.0f MB/s, nal_unescape %.0f MB/s, first 64 bytes %.0f ns/NAL\n",
+          BENCH_ES_SIZE >> 20, (double)BENCH_ES_SIZE / (double)(t2 - t1 + 1), (double)BENCH_ES_SIZE / (double)(t3 - t2 + 1),
+          (double)(t4 - t3) * 1000.0 / n);
+
+   free(nal_offset);
+   free(nal_len);
+   free(rbsp);
+   free(buf);
+}
+END_TEST
+
+int main(int argc, char **argv)
+{
+   int _testnum = 1;
+   int failed = 0;
+   int r;
+
+   if (argc > 1 && strcmp(argv[1], "-v") == 0) verbose = 1;
+   srand(1);
+
+   r = test_nal_scan(); ok(r, "nal_scan"); failed += !r;
+   r = test_nal_unescape(); ok(r, "nal_unescape"); failed += !r;
+   r = test_nal_scanner_stream(); ok(r, "nal_scanner_stream"); failed += !r;
+   r = test_nal_scan_benchmark(); ok(r, "nal_scan_benchmark"); failed += !r;
+
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -116,22 +116,133 @@ int pes_read_vec(pes_packet_t *pes, const buf_t *vec, int buf_count)
    return bs_pos(&b);
 }
 
-int pes_read_buf(pes_packet_t* pes, const uint8_t* buf, size_t len) 
+// copy len bytes starting at offset out of a list of fragments, returns number of bytes copied
+static size_t pes_vec_copy(const buf_t *vec, int buf_count, size_t offset, uint8_t *buf, size_t len) 
 { 
+   size_t copied = 0; 
    
-   if (pes == NULL || buf == NULL) return 0; 
+   for (int i = 0; i < buf_count && copied < len; i++) 
+   {
+      if (offset >= vec[i].len) 
+      {
+         offset -= vec[i].len; 
+         continue;
+      }
+      size_t n = vec[i].len - offset; 
+      if (n > len - copied) n = len - copied; 
+      memcpy(buf + copied, vec[i].bytes + offset, n); 
+      copied += n; 
+      offset = 0;
+   }
+   return copied;
+}
+
+int pes_view_init(pes_view_t *pv, const buf_t *vec, int buf_count) 
+{ 
+   if (pv == NULL) return 0; 
+   memset(pv, 0, sizeof(pes_view_t)); 
+   if (vec == NULL || buf_count <= 0) return 0; 
    
-   if (pes->buf != NULL) 
+   pv->vec = vec; 
+   pv->buf_count = buf_count; 
+   for (int i = 0; i < buf_count; i++) pv->len += vec[i].len; 
+   
+   // skip leading empty fragments (e.g. TS packets with adaptation field only)
+   int first = 0; 
+   while (first < buf_count && vec[first].len == 0) first++; 
+   if (first == buf_count) return 0; 
+   
+   // the header is only copied if it straddles fragments
+   uint8_t hdr_copy[PES_MAX_HEADER_SIZE]; 
+   const uint8_t *hdr = vec[first].bytes; 
+   size_t hdr_len = 9; 
+   
+   if (vec[first].len < hdr_len) 
    {
-      free(pes->buf); 
-      pes->buf_len = 0;
+      hdr_len = pes_vec_copy(vec, buf_count, 0, hdr_copy, hdr_len); 
+      hdr = hdr_copy;
+   }
+   if (hdr_len >= 9 && HAS_PES_HEADER(hdr[3])) 
+   {
+      hdr_len = 9 + hdr[8]; 
+      if (vec[first].len < hdr_len) 
+      {
+         hdr_len = pes_vec_copy(vec, buf_count, 0, hdr_copy, hdr_len); 
+         hdr = hdr_copy;
+      }
    }
    
-   pes->buf = malloc(len); 
-   pes->buf_len = len; 
+   bs_t b; 
+   bs_init(&b, (uint8_t *)hdr, hdr_len); 
+   int header_bytes = pes_read_header(&pv->header, &b); 
+   if ( header_bytes < 0 ) 
+   {
+      pv->status = header_bytes; 
+      return 0;
+   }
    
-   memcpy(pes->buf, buf, len); 
+   size_t total_len = pv->len; 
+   if (pv->header.PES_packet_length > 0) 
+   {
+      if (pv->header.PES_packet_length + 6 > total_len) 
+      {
+         pv->status = PES_ERROR_NOT_ENOUGH_DATA; 
+         LOG_ERROR_ARGS("PES packet header promises %u bytes, only %zu found in buffer", 
+                        pv->header.PES_packet_length + 6, total_len); 
+      }
+      else 
+      {
+         total_len = pv->header.PES_packet_length + 6;
+      }
+   }
    
+   pv->header_len = header_bytes; 
+   pv->payload_len = (total_len > pv->header_len) ? total_len - pv->header_len : 0; 
+   return header_bytes;
+}
+
+void pes_view_iter_init(pes_view_iter_t *it, const pes_view_t *pv) 
+{ 
+   it->pv = pv; 
+   it->i = 0; 
+   it->offset = pv->header_len; 
+   it->payload_left = pv->payload_len;
+}
+
+int pes_view_iter_next(pes_view_iter_t *it, const uint8_t **bytes, size_t *len) 
+{ 
+   const pes_view_t *pv = it->pv; 
+   
+   while (it->payload_left > 0 && it->i < pv->buf_count) 
+   {
+      const buf_t *frag = &pv->vec[it->i]; 
+      if (it->offset >= frag->len) 
+      {
+         it->offset -= frag->len; 
+         it->i++; 
+         continue;
+      }
+      
+      size_t n = frag->len - it->offset; 
+      if (n > it->payload_left) n = it->payload_left; 
+      *bytes = frag->bytes + it->offset; 
+      *len = n; 
+      it->offset += n; 
+      it->payload_left -= n; 
+      return 1;
+   }
+   return 0;
+}
+
+size_t pes_view_read_payload(const pes_view_t *pv, size_t offset, uint8_t *buf, size_t len) 
+{ 
+   if (offset >= pv->payload_len) return 0; 
+   if (len > pv->payload_len - offset) len = pv->payload_len - offset; 
+   return pes_vec_copy(pv->vec, pv->buf_count, pv->header_len + offset, buf, len);
+}
+
+static int pes_parse_buf(pes_packet_t* pes) 
+{ 
    bs_t b; 
    bs_init(&b, pes->buf, pes->buf_len); 
    int header_bytes = pes_read_header(&pes->header, &b); 
@@ -157,6 +268,37 @@ int pes_read_buf(pes_packet_t* pes, const uint8_t* buf, size_t len)
    return bs_pos(&b);
 }
 
+int pes_read_buf(pes_packet_t* pes, const uint8_t* buf, size_t len) 
+{ 
+   
+   if (pes == NULL || buf == NULL) return 0; 
+   
+   if (pes->buf != NULL) 
+   {
+      free(pes->buf); 
+      pes->buf_len = 0;
+   }
+   
+   pes->buf = malloc(len); 
+   pes->buf_len = len; 
+   
+   memcpy(pes->buf, buf, len); 
+   
+   return pes_parse_buf(pes);
+}
+
+int pes_read_buf_owned(pes_packet_t* pes, uint8_t* buf, size_t len) 
+{ 
+   if (pes == NULL || buf == NULL) return 0; 
+   
+   if (pes->buf != NULL) free(pes->buf); 
+   
+   pes->buf = buf; 
+   pes->buf_len = len; 
+   
+   return pes_parse_buf(pes);
+}
+
 int pes_read_header(pes_header_t *ph, bs_t *b) 
 { 
    int PES_packet_start = bs_pos(b); 
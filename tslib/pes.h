@@ -176,6 +176,17 @@ int pes_read_header(pes_header_t *ph, bs_t *b);
  */
 int pes_read_buf(pes_packet_t *pes, const uint8_t *buf, size_t len);
 
+/**
+ * Same as pes_read_buf, but takes ownership of buf instead of copying it
+ * 
+ * @param pes PES packet to parse
+ * @param buf malloc'd buffer containing PES packet bytes, freed by pes_free
+ * @param len number of PES packet bytes in buf
+ * 
+ * @return int 
+ */
+int pes_read_buf_owned(pes_packet_t *pes, uint8_t *buf, size_t len);
+
 
 /**
  * scatter-gather version of pes_read_buf
@@ -191,6 +202,72 @@ int pes_read_buf(pes_packet_t *pes, const uint8_t *buf, size_t len);
  */
 int pes_read_vec(pes_packet_t *pes, const buf_t *vec, int buf_count); 
 
+#define PES_MAX_HEADER_SIZE (9 + 255)   /// fixed part of the PES header plus maximum PES_header_data_length
+
+/**
+ * Zero-copy view of a PES packet scattered across several buffers (typically
+ * TS packet payloads). Only the PES header is parsed; the payload stays where
+ * it is and is accessed with pes_view_iter_next or pes_view_read_payload.
+ * The view references vec, which must outlive it.
+ */
+typedef struct 
+{
+   const buf_t *vec;     /// fragments, in order
+   int buf_count;        /// number of fragments
+   size_t len;           /// total number of bytes in all fragments
+   pes_header_t header;  /// parsed PES header
+   size_t header_len;    /// offset of the payload from the start of the PES packet
+   size_t payload_len;   /// length of the payload, limited by PES_packet_length if non-zero
+   int status;
+} pes_view_t; 
+
+/**
+ * Payload iterator over a pes_view_t, see pes_view_iter_next
+ */
+typedef struct 
+{
+   const pes_view_t *pv; 
+   int i;                /// current fragment
+   size_t offset;        /// offset within current fragment
+   size_t payload_left;  /// payload bytes not yet returned
+} pes_view_iter_t; 
+
+/**
+ * Parse the PES header from a list of fragments without copying the payload.
+ * The header may span fragment boundaries.
+ * 
+ * @param pv view to initialize
+ * @param vec list of buffers containing parts of a PES packet
+ * @param buf_count number of buffers
+ * 
+ * @return size of the PES header in bytes, 0 if the header is broken or incomplete
+ */
+int pes_view_init(pes_view_t *pv, const buf_t *vec, int buf_count); 
+
+/**
+ * Position an iterator at the start of the payload of pv
+ */
+void pes_view_iter_init(pes_view_iter_t *it, const pes_view_t *pv); 
+
+/**
+ * Get the next contiguous chunk of payload
+ * 
+ * @param it iterator
+ * @param bytes set to the start of the chunk
+ * @param len set to the length of the chunk
+ * 
+ * @return 1 if a chunk was returned, 0 at the end of the payload
+ */
+int pes_view_iter_next(pes_view_iter_t *it, const uint8_t **bytes, size_t *len); 
+
+/**
+ * Copy up to len payload bytes, starting at offset, into buf. Meant for
+ * peeking at the first few bytes of the payload (e.g. NAL unit type).
+ * 
+ * @return number of bytes copied
+ */
+size_t pes_view_read_payload(const pes_view_t *pv, size_t offset, uint8_t *buf, size_t len); 
+
 
 int pes_write_header(pes_header_t *ph, bs_t *b); 
 int pes_write(pes_packet_t *pes, uint8_t *buf, size_t len); 
@@ -32,7 +32,6 @@
 #include "descriptors.h"
 #include "section.h"
 #include "log.h"
-#include "crc32m.h"
 #include "vqarray.h"
 
 
@@ -116,8 +115,7 @@ void program_association_section_free(program_association_section_t *pas)
    free(pas);
 }
 
-int program_association_section_read(program_association_section_t *pas, uint8_t *buf, size_t buf_len, uint32_t payload_unit_start_indicator,
-                                     psi_table_buffer_t *patBuffer)
+int program_association_section_read(program_association_section_t *pas, uint8_t *buf, size_t buf_len)
 { 
    vqarray_t *programs;
    int num_programs = 0;
@@ -128,52 +126,7 @@ int program_association_section_read(program_association_section_t *pas, uint8_t
       return 0;
    }
 
-   bs_t *b = NULL;
-
-   if (!payload_unit_start_indicator &&  patBuffer->buffer == NULL)
-   {
-      // this TS packet is not start of table, and we have no cached table data
-      LOG_WARN ("program_association_section_read: payload_unit_start_indicator not set and no cached data");
-      return 0;
-   }
-
-   if (payload_unit_start_indicator)
-   {
-      uint8_t payloadStartPtr = buf[0];
-      buf += (payloadStartPtr + 1);
-      buf_len -= (payloadStartPtr + 1);
-      LOG_DEBUG_ARGS ("program_association_section_read: payloadStartPtr = %d", payloadStartPtr);
-   }
-
-
-   // check for pat spanning multiple TS packets
-   if (patBuffer->buffer != NULL)
-   {
-      LOG_DEBUG_ARGS ("program_association_section_read: patBuffer detected: patBufferAllocSz = %ld, patBufferUsedSz = %ld", 
-         patBuffer->bufferAllocSz, patBuffer->bufferUsedSz);
-      size_t numBytesToCopy = buf_len;
-      if (buf_len > (patBuffer->bufferAllocSz - patBuffer->bufferUsedSz))
-      {
-         numBytesToCopy = patBuffer->bufferAllocSz - patBuffer->bufferUsedSz;
-      }
-         
-      LOG_DEBUG_ARGS ("program_association_section_read: copying %ld bytes to patBuffer", numBytesToCopy);
-      memcpy (patBuffer->buffer + patBuffer->bufferUsedSz, buf, numBytesToCopy);
-      patBuffer->bufferUsedSz += numBytesToCopy;
-      
-      if (patBuffer->bufferUsedSz < patBuffer->bufferAllocSz)
-      {
-         LOG_DEBUG ("program_association_section_read: patBuffer not yet full -- returning");
-         return 0;
-      }
-
-      b = bs_new(patBuffer->buffer, patBuffer->bufferUsedSz);
-   }
-   else
-   {
-      b = bs_new(buf, buf_len);
-   }
-      
+   bs_t *b = bs_new(buf, buf_len);
 
    pas->table_id = bs_read_u8(b); 
    if (pas->table_id != program_association_section) 
@@ -181,7 +134,6 @@ int program_association_section_read(program_association_section_t *pas, uint8_t
       LOG_ERROR_ARGS("Table ID in PAT is 0x%02X instead of expected 0x%02X", 
                      pas->table_id, program_association_section); 
       SAFE_REPORT_TS_ERR(-30); 
-      resetPSITableBuffer(patBuffer);
       bs_free (b);
       return 0;
    }
@@ -193,7 +145,6 @@ int program_association_section_read(program_association_section_t *pas, uint8_t
    {
       LOG_ERROR("section_syntax_indicator not set in PAT"); 
       SAFE_REPORT_TS_ERR(-31); 
-      resetPSITableBuffer(patBuffer);
       bs_free (b);
       return 0;
    }
@@ -204,27 +155,14 @@ int program_association_section_read(program_association_section_t *pas, uint8_t
       LOG_ERROR_ARGS("PAT section length is 0x%02X, larger than maximum allowed 0x%02X", 
                      pas->section_length, MAX_SECTION_LEN); 
       SAFE_REPORT_TS_ERR(-32); 
-      resetPSITableBuffer(patBuffer);
       bs_free (b);
       return 0;
    }
    
    if (pas->section_length > bs_bytes_left(b))
    {
-      LOG_DEBUG ("program_association_section_read: Detected section spans more than one TS packet -- allocating buffer");
-
-      if (patBuffer->buffer != NULL)
-      {
-         // should never get here
-         LOG_ERROR ("program_association_section_read: unexpected patBufffer");
-         resetPSITableBuffer(patBuffer);
-      }
-
-      patBuffer->bufferAllocSz = pas->section_length + 3;
-      patBuffer->buffer = (uint8_t *)calloc (pas->section_length + 3, 1);
-      memcpy (patBuffer->buffer, buf, buf_len);
-      patBuffer->bufferUsedSz = buf_len;
-
+      LOG_ERROR_ARGS("PAT section length is %d, but only %d bytes left", pas->section_length, bs_bytes_left(b)); 
+      SAFE_REPORT_TS_ERR(-32); 
       bs_free (b);
       return 0;
    }
@@ -285,30 +223,9 @@ int program_association_section_read(program_association_section_t *pas, uint8_t
    }
    vqarray_free(programs);
    
-   pas->CRC_32 = bs_read_u32(b); 
+   pas->CRC_32 = bs_read_u32(b);  // checked by the section assembler
    
-   // check CRC
-   crc_t pas_crc = crc_init(); 
-   pas_crc = crc_update(pas_crc, buf, bs_pos(b) - 4); 
-   pas_crc = crc_finalize(pas_crc); 
-   if (pas_crc != pas->CRC_32) 
-   {
-      LOG_ERROR_ARGS("PAT CRC_32 specified as 0x%08X, but calculated as 0x%08X", pas->CRC_32, pas_crc); 
-      SAFE_REPORT_TS_ERR(-33); 
-      resetPSITableBuffer(patBuffer);
-      bs_free (b);
-      return 0;
-   } 
-   else 
-   {
-      // LOG_DEBUG("PAT CRC_32 checked successfully");
-      // don't enable unless you want to see this every ~100ms
-   }
-   
-
    bs_free(b); 
-            
-   resetPSITableBuffer(patBuffer);
 
    return 1;
 }
@@ -441,19 +358,30 @@ void program_map_section_free(program_map_section_t *pms)
    free(pms);
 }
 
-void resetPSITableBuffer(psi_table_buffer_t *psiTableBuffer)
+int psi_section_cache_check(psi_section_cache_t *cache, const uint8_t *section, size_t section_len)
 {
-   if (psiTableBuffer->buffer != NULL)
+   // the stored section passed its CRC check, so identical bytes need no new one
+   if (cache->section_len == 0 || section_len != cache->section_len) return 0; 
+   if (memcmp(section + section_len - 4, cache->section + section_len - 4, 4) != 0) return 0; 
+   if (memcmp(section, cache->section, section_len - 4) != 0) return 0; 
+   
+   cache->num_skipped++; 
+   return 1;
+}
+
+void psi_section_cache_store(psi_section_cache_t *cache, const uint8_t *section, size_t section_len)
+{
+   cache->num_parsed++; 
+   if (section_len < 4 || section_len > sizeof(cache->section)) 
    {
-      free (psiTableBuffer->buffer);
-      psiTableBuffer->buffer = NULL;
-      psiTableBuffer->bufferAllocSz = 0;
-      psiTableBuffer->bufferUsedSz = 0;
+      cache->section_len = 0; 
+      return;
    }
+   memcpy(cache->section, section, section_len); 
+   cache->section_len = section_len;
 }
 
-int program_map_section_read(program_map_section_t *pms, uint8_t *buf, size_t buf_size, uint32_t payload_unit_start_indicator,
-   psi_table_buffer_t *pmtBuffer) 
+int program_map_section_read(program_map_section_t *pms, uint8_t *buf, size_t buf_size) 
 { 
    LOG_DEBUG ("program_map_section_read -- entering");
    if (pms == NULL || buf == NULL) 
@@ -462,56 +390,13 @@ int program_map_section_read(program_map_section_t *pms, uint8_t *buf, size_t bu
       return 0;
    }
 
-   bs_t *b = NULL;
-
-   if (!payload_unit_start_indicator &&  pmtBuffer->buffer == NULL)
-   {
-      // this TS packet is not start of table, and we have no cached table data
-      LOG_WARN ("program_map_section_read: payload_unit_start_indicator not set and no cached data");
-      return 0;
-   }
-
-   if (payload_unit_start_indicator)
-   {
-      uint8_t payloadStartPtr = buf[0];
-      buf += (payloadStartPtr + 1);
-      buf_size -= (payloadStartPtr + 1);
-      LOG_DEBUG_ARGS ("program_map_section_read: payloadStartPtr = %d", payloadStartPtr);
-   }
+   bs_t *b = bs_new(buf, buf_size);
 
-   // check for pmt spanning multiple TS packets
-   if (pmtBuffer->buffer != NULL)
-   {
-      LOG_DEBUG_ARGS ("program_map_section_read: pmtBuffer detected: pmtBufferAllocSz = %ld, pmtBufferUsedSz = %ld", pmtBuffer->bufferAllocSz, pmtBuffer->bufferUsedSz);
-      size_t numBytesToCopy = buf_size;
-      if (buf_size > (pmtBuffer->bufferAllocSz - pmtBuffer->bufferUsedSz))
-      {
-         numBytesToCopy = pmtBuffer->bufferAllocSz - pmtBuffer->bufferUsedSz;
-      }
-         
-      LOG_DEBUG_ARGS ("program_map_section_read: copying %ld bytes to pmtBuffer", numBytesToCopy);
-      memcpy (pmtBuffer->buffer + pmtBuffer->bufferUsedSz, buf, numBytesToCopy);
-      pmtBuffer->bufferUsedSz += numBytesToCopy;
-      
-      if (pmtBuffer->bufferUsedSz < pmtBuffer->bufferAllocSz)
-      {
-         LOG_DEBUG ("program_map_section_read: pmtBuffer not yet full -- returning");
-         return 0;
-      }
-
-      b = bs_new(pmtBuffer->buffer, pmtBuffer->bufferUsedSz);
-   }
-   else
-   {
-      b = bs_new(buf, buf_size);
-   }
-      
    pms->table_id = bs_read_u8(b); 
    if (pms->table_id != TS_program_map_section) 
    {
       LOG_ERROR_ARGS("Table ID in PMT is 0x%02X instead of expected 0x%02X", pms->table_id, TS_program_map_section); 
       SAFE_REPORT_TS_ERR(-40);
-      resetPSITableBuffer(pmtBuffer);
       bs_free (b);
       return 0;
    }
@@ -521,7 +406,6 @@ int program_map_section_read(program_map_section_t *pms, uint8_t *buf, size_t bu
    {
       LOG_ERROR("section_syntax_indicator not set in PMT"); 
       SAFE_REPORT_TS_ERR(-41); 
-      resetPSITableBuffer(pmtBuffer);
       bs_free (b);
       return 0;
    }
@@ -534,27 +418,14 @@ int program_map_section_read(program_map_section_t *pms, uint8_t *buf, size_t bu
       LOG_ERROR_ARGS("PMT section length is 0x%02X, larger than maximum allowed 0x%02X", 
                      pms->section_length, MAX_SECTION_LEN); 
       SAFE_REPORT_TS_ERR(-42); 
-      resetPSITableBuffer(pmtBuffer);
       bs_free (b);
       return 0;
    }
 
    if (pms->section_length > bs_bytes_left(b))
    {
-      LOG_DEBUG ("program_map_section_read: Detected section spans more than one TS packet -- allocating buffer");
-
-      if (pmtBuffer->buffer != NULL)
-      {
-         // should never get here
-         LOG_ERROR ("program_map_section_read: unexpected pmtBufffer");
-         resetPSITableBuffer(pmtBuffer);
-      }
-
-      pmtBuffer->bufferAllocSz = pms->section_length + 3;
-      pmtBuffer->buffer = (uint8_t *)calloc (pms->section_length + 3, 1);
-      memcpy (pmtBuffer->buffer, buf, buf_size);
-      pmtBuffer->bufferUsedSz = buf_size;
-
+      LOG_ERROR_ARGS("PMT section length is %d, but only %d bytes left", pms->section_length, bs_bytes_left(b)); 
+      SAFE_REPORT_TS_ERR(-42); 
       bs_free (b);
       return 0;
    }
@@ -577,7 +448,6 @@ int program_map_section_read(program_map_section_t *pms, uint8_t *buf, size_t bu
    {
       LOG_ERROR("Multi-section PMT is not allowed/n"); 
       SAFE_REPORT_TS_ERR(-43); 
-      resetPSITableBuffer(pmtBuffer);
       bs_free (b);
       return 0;
    }
@@ -588,7 +458,6 @@ int program_map_section_read(program_map_section_t *pms, uint8_t *buf, size_t bu
    {
       LOG_ERROR_ARGS("PCR PID has invalid value 0x%02X", pms->PCR_PID); 
       SAFE_REPORT_TS_ERR(-44); 
-      resetPSITableBuffer(pmtBuffer);
       bs_free (b);
       return 0;
    }
@@ -601,7 +470,6 @@ int program_map_section_read(program_map_section_t *pms, uint8_t *buf, size_t bu
       LOG_ERROR_ARGS("PMT program info length is 0x%02X, larger than maximum allowed 0x%02X", 
                      pms->program_info_length, MAX_PROGRAM_INFO_LEN); 
       SAFE_REPORT_TS_ERR(-45); 
-      resetPSITableBuffer(pmtBuffer);
       bs_free (b);
       return 0;
    }
@@ -615,30 +483,11 @@ int program_map_section_read(program_map_section_t *pms, uint8_t *buf, size_t bu
       vqarray_add(pms->es_info, es);
    }
    
-   pms->CRC_32 = bs_read_u32(b); 
-   
-   // check CRC
-   crc_t pas_crc = crc_init(); 
-   pas_crc = crc_update(pas_crc, b->start, bs_pos(b) - 4); 
-   pas_crc = crc_finalize(pas_crc); 
-   if (pas_crc != pms->CRC_32) 
-   {
-      LOG_ERROR_ARGS("PMT CRC_32 specified as 0x%08X, but calculated as 0x%08X", pms->CRC_32, pas_crc); 
-      SAFE_REPORT_TS_ERR(-46); 
-      resetPSITableBuffer(pmtBuffer);
-      bs_free (b);
-      return 0;
-   } 
-   else 
-   {
-      // LOG_DEBUG("PMT CRC_32 checked successfully");
-   }
+   pms->CRC_32 = bs_read_u32(b);  // checked by the section assembler
    
    int bytes_read = bs_pos(b); 
    bs_free(b); 
 
-   resetPSITableBuffer(pmtBuffer);
-
    return bytes_read;
 }
 
@@ -693,8 +542,7 @@ void conditional_access_section_free(conditional_access_section_t *cas)
    free(cas);
 }
 
-int conditional_access_section_read(conditional_access_section_t *cas, uint8_t *buf, size_t buf_len, uint32_t payload_unit_start_indicator,
-                                    psi_table_buffer_t *catBuffer) 
+int conditional_access_section_read(conditional_access_section_t *cas, uint8_t *buf, size_t buf_len) 
 { 
    if (cas == NULL || buf == NULL) 
    {
@@ -702,58 +550,14 @@ int conditional_access_section_read(conditional_access_section_t *cas, uint8_t *
       return 0;
    }
    
-   bs_t *b = NULL;
-
-   if (!payload_unit_start_indicator &&  catBuffer->buffer == NULL)
-   {
-      // this TS packet is not start of table, and we have no cached table data
-      LOG_WARN ("conditional_access_section_read: payload_unit_start_indicator not set and no cached data");
-      return 0;
-   }
+   bs_t *b = bs_new(buf, buf_len);
 
-   if (payload_unit_start_indicator)
-   {
-      uint8_t payloadStartPtr = buf[0];
-      buf += (payloadStartPtr + 1);
-      buf_len -= (payloadStartPtr + 1);
-      LOG_DEBUG_ARGS ("conditional_access_section_read: payloadStartPtr = %d", payloadStartPtr);
-   }
-
-   // check for pat spanning multiple TS packets
-   if (catBuffer->buffer != NULL)
-   {
-      LOG_DEBUG_ARGS ("conditional_access_section_read: catBuffer detected: catBufferAllocSz = %ld, catBufferUsedSz = %ld", 
-         catBuffer->bufferAllocSz, catBuffer->bufferUsedSz);
-      size_t numBytesToCopy = buf_len;
-      if (buf_len > (catBuffer->bufferAllocSz - catBuffer->bufferUsedSz))
-      {
-         numBytesToCopy = catBuffer->bufferAllocSz - catBuffer->bufferUsedSz;
-      }
-         
-      LOG_DEBUG_ARGS ("conditional_access_section_read: copying %ld bytes to catBuffer", numBytesToCopy);
-      memcpy (catBuffer->buffer + catBuffer->bufferUsedSz, buf, numBytesToCopy);
-      catBuffer->bufferUsedSz += numBytesToCopy;
-      
-      if (catBuffer->bufferUsedSz < catBuffer->bufferAllocSz)
-      {
-         LOG_DEBUG ("conditional_access_section_read: catBuffer not yet full -- returning");
-         return 0;
-      }
-
-      b = bs_new(catBuffer->buffer, catBuffer->bufferUsedSz);
-   }
-   else
-   {
-      b = bs_new(buf, buf_len);
-   }
-         
    cas->table_id = bs_read_u8(b); 
    if (cas->table_id != conditional_access_section) 
    {
       LOG_ERROR_ARGS("Table ID in CAT is 0x%02X instead of expected 0x%02X", 
                      cas->table_id, conditional_access_section); 
       SAFE_REPORT_TS_ERR(-30); 
-      resetPSITableBuffer(catBuffer);
       bs_free (b);
       return 0;
    }
@@ -765,7 +569,6 @@ int conditional_access_section_read(conditional_access_section_t *cas, uint8_t *
    {
       LOG_ERROR("section_syntax_indicator not set in CAT"); 
       SAFE_REPORT_TS_ERR(-31); 
-      resetPSITableBuffer(catBuffer);
       bs_free (b);
       return 0;
    }
@@ -776,27 +579,14 @@ int conditional_access_section_read(conditional_access_section_t *cas, uint8_t *
       LOG_ERROR_ARGS("CAT section length is 0x%02X, larger than maximum allowed 0x%02X", 
                      cas->section_length, MAX_SECTION_LEN); 
       SAFE_REPORT_TS_ERR(-32); 
-      resetPSITableBuffer(catBuffer);
       bs_free (b);
       return 0;
    }
    
    if (cas->section_length > bs_bytes_left(b))
    {
-      LOG_DEBUG ("conditional_access_section_read: Detected section spans more than one TS packet -- allocating buffer");
-
-      if (catBuffer->buffer != NULL)
-      {
-         // should never get here
-         LOG_ERROR ("conditional_access_section_read: unexpected catBufffer");
-         resetPSITableBuffer(catBuffer);
-      }
-
-      catBuffer->bufferAllocSz = cas->section_length + 3;
-      catBuffer->buffer = (uint8_t *)calloc (cas->section_length + 3, 1);
-      memcpy (catBuffer->buffer, buf, buf_len);
-      catBuffer->bufferUsedSz = buf_len;
-
+      LOG_ERROR_ARGS("CAT section length is %d, but only %d bytes left", cas->section_length, bs_bytes_left(b)); 
+      SAFE_REPORT_TS_ERR(-32); 
       bs_free (b);
       return 0;
    }
@@ -825,24 +615,9 @@ int conditional_access_section_read(conditional_access_section_t *cas, uint8_t *
    // again, it's much shorter in C :-)
    
 
-   cas->CRC_32 = bs_read_u32(b); 
-   
-   // check CRC
-   crc_t cas_crc = crc_init(); 
-   cas_crc = crc_update(cas_crc, buf, bs_pos(b) - 4); 
-   cas_crc = crc_finalize(cas_crc); 
-   if (cas_crc != cas->CRC_32) 
-   {
-      LOG_ERROR_ARGS("CAT CRC_32 specified as 0x%08X, but calculated as 0x%08X", cas->CRC_32, cas_crc); 
-      SAFE_REPORT_TS_ERR(-33); 
-      resetPSITableBuffer(catBuffer);
-      bs_free (b);
-      return 0;
-   } 
+   cas->CRC_32 = bs_read_u32(b);  // checked by the section assembler
 
-   
    bs_free(b); 
-   resetPSITableBuffer(catBuffer);
    return 1;
 }
 
@@ -56,12 +56,18 @@ typedef enum {
 #define MAX_PROGRAM_INFO_LEN	        0x03FF
 #define MAX_ES_INFO_LEN			0x03FF
 
+/**
+ * Last accepted section of a table. PSI is repeated every few hundred ms,
+ * almost always unchanged; comparing against this avoids allocating and
+ * parsing the table again.
+ */
 typedef struct
 {
-   uint8_t *buffer;
-   size_t bufferAllocSz;
-   size_t bufferUsedSz;
-} psi_table_buffer_t;
+   size_t section_len;                      /// length of section, 0 if none
+   uint8_t section[MAX_SECTION_LEN + 3];    /// table_id through CRC_32
+   uint64_t num_skipped;                    /// sections found unchanged, not parsed
+   uint64_t num_parsed;                     /// sections parsed in full
+} psi_section_cache_t;
 
 
 // PAT
@@ -88,8 +94,17 @@ typedef struct {
 
 program_association_section_t* program_association_section_new(); 
 void program_association_section_free(program_association_section_t *pas); 
-int program_association_section_read(program_association_section_t *pas, uint8_t *buf, size_t buf_len, 
-                                     uint32_t payload_unit_start_indicator, psi_table_buffer_t *patBuffer); 
+
+/**
+ * Parse a PAT section
+ * 
+ * @param pas PAT to fill in
+ * @param buf complete section, with CRC_32 already verified (see section_assembler_push)
+ * @param buf_len section length
+ * 
+ * @return 1 on success, 0 on error
+ */
+int program_association_section_read(program_association_section_t *pas, uint8_t *buf, size_t buf_len); 
 int program_association_section_print(const program_association_section_t *pas, char *str, size_t str_len); 
 
 typedef struct {
@@ -109,8 +124,8 @@ typedef struct {
 
 conditional_access_section_t* conditional_access_section_new();
 void conditional_access_section_free(conditional_access_section_t *cas);
-int conditional_access_section_read(conditional_access_section_t *cas, uint8_t *buf, size_t buf_len, 
-                                    uint32_t payload_unit_start_indicator, psi_table_buffer_t *catBuffer);
+// complete section, see program_association_section_read
+int conditional_access_section_read(conditional_access_section_t *cas, uint8_t *buf, size_t buf_len);
 int conditional_access_section_print(const conditional_access_section_t *cas, char *str, size_t str_len); 
  
 // PMT
@@ -140,15 +155,32 @@ typedef struct {
 
 program_map_section_t* program_map_section_new(); 
 elementary_stream_info_t* es_info_new();
+void es_info_free(elementary_stream_info_t *es);
 
 void program_map_section_free(program_map_section_t *pms); 
 
-int program_map_section_read(program_map_section_t *pms, uint8_t *buf, size_t buf_size, uint32_t payload_unit_start_indicator,
-                             psi_table_buffer_t *pmtBuffer); 
+// complete section, see program_association_section_read
+int program_map_section_read(program_map_section_t *pms, uint8_t *buf, size_t buf_size); 
 int program_map_section_write(program_map_section_t *pms, uint8_t *buf, size_t buf_size); 
 int program_map_section_print(program_map_section_t *pms, char *str, size_t str_len); 
 
-void resetPSITableBuffer(psi_table_buffer_t *psiTableBuffer);
+/**
+ * Check whether a complete section is the same as the last one accepted.
+ * Length and CRC_32 are compared first, so a changed section is usually
+ * rejected after a few bytes.
+ * 
+ * @param cache last accepted section
+ * @param section section bytes, table_id through CRC_32
+ * @param section_len section length
+ * 
+ * @return 1 if unchanged (counted in num_skipped), 0 if it has to be parsed
+ */
+int psi_section_cache_check(psi_section_cache_t *cache, const uint8_t *section, size_t section_len);
+
+/**
+ * Record a successfully parsed section (counted in num_parsed)
+ */
+void psi_section_cache_store(psi_section_cache_t *cache, const uint8_t *section, size_t section_len);
 
 
 // stream types
@@ -219,6 +251,8 @@ void resetPSITableBuffer(psi_table_buffer_t *psiTableBuffer);
 #define GENERAL_PURPOSE_PID_MIN		0x0010
 #define GENERAL_PURPOSE_PID_MAX		0x1FFE
 
+#define NUM_PIDS			0x2000   // 13-bit PID space
+
 char* stream_desc(uint8_t stream_id); 
 
 // Multi-section tables are not supported
@@ -25,7 +25,6 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
-#include <unistd.h>
 
 #include "scte35.h"
 #include "log.h"
@@ -145,54 +144,9 @@ scte35_time_signal * get_time_signal (scte35_splice_info_section *sis)
 }
 
 
-int scte35_splice_info_section_read(scte35_splice_info_section *sis, uint8_t *buf, size_t buf_len,
-   uint32_t payload_unit_start_indicator, psi_table_buffer_t *scte35TableBuffer)
+int scte35_splice_info_section_read(scte35_splice_info_section *sis, uint8_t *buf, size_t buf_len)
 {
-   if (!payload_unit_start_indicator &&  scte35TableBuffer->buffer == NULL)
-   {
-      // this TS packet is not start of table, and we have no cached table data
-      LOG_WARN ("scte35_splice_info_section_read: payload_unit_start_indicator not set and no cached data");
-      return 0;
-   }
-
-   bs_t *b = NULL;
-
-   if (payload_unit_start_indicator)
-   {
-      uint8_t payloadStartPtr = buf[0];
-      buf += (payloadStartPtr + 1);
-      buf_len -= (payloadStartPtr + 1);
-      LOG_DEBUG_ARGS ("scte35_splice_info_section_read: payloadStartPtr = %d", payloadStartPtr);
-   }
-
-   // check for pat spanning multiple TS packets
-   if (scte35TableBuffer->buffer != NULL)
-   {
-      LOG_DEBUG_ARGS ("scte35_splice_info_section_read: scte35TableBuffer detected: scte35TableBufferAllocSz = %ld, scte35TableBufferUsedSz = %ld", 
-         scte35TableBuffer->bufferAllocSz, scte35TableBuffer->bufferUsedSz);
-      size_t numBytesToCopy = buf_len;
-      if (buf_len > (scte35TableBuffer->bufferAllocSz - scte35TableBuffer->bufferUsedSz))
-      {
-         numBytesToCopy = scte35TableBuffer->bufferAllocSz - scte35TableBuffer->bufferUsedSz;
-      }
-         
-      LOG_DEBUG_ARGS ("scte35_splice_info_section_read: copying %ld bytes to catBuffer", numBytesToCopy);
-      memcpy (scte35TableBuffer->buffer + scte35TableBuffer->bufferUsedSz, buf, numBytesToCopy);
-      scte35TableBuffer->bufferUsedSz += numBytesToCopy;
-      
-      if (scte35TableBuffer->bufferUsedSz < scte35TableBuffer->bufferAllocSz)
-      {
-         LOG_DEBUG ("scte35_splice_info_section_read: scte35Buffer not yet full -- returning");
-         return 0;
-      }
-
-      b = bs_new(scte35TableBuffer->buffer, scte35TableBuffer->bufferUsedSz);
-   }
-   else
-   {
-      b = bs_new(buf, buf_len);
-      sleep (1);
-   }
+   bs_t *b = bs_new(buf, buf_len);
             
    sis->table_id = bs_read_u8(b); 
    if (SCTE35_SPLICE_TABLE_ID != sis->table_id)
@@ -209,22 +163,10 @@ int scte35_splice_info_section_read(scte35_splice_info_section *sis, uint8_t *bu
 
    if (sis->section_length > bs_bytes_left(b))
    {
-      LOG_DEBUG ("scte35_splice_info_section_read: Detected section spans more than one TS packet -- allocating buffer");
-
-      if (scte35TableBuffer->buffer != NULL)
-      {
-         // should never get here
-         LOG_ERROR ("scte35_splice_info_section_read: unexpected catBufffer");
-         resetPSITableBuffer(scte35TableBuffer);
-      }
-
-      scte35TableBuffer->bufferAllocSz = sis->section_length + 3;
-      scte35TableBuffer->buffer = (uint8_t *)calloc (sis->section_length + 3, 1);
-      memcpy (scte35TableBuffer->buffer, buf, buf_len);
-      scte35TableBuffer->bufferUsedSz = buf_len;
-
+      LOG_ERROR_ARGS ("scte35_splice_info_section_read: FAIL: section length is %d, but only %d bytes left", 
+                      sis->section_length, bs_bytes_left(b));
       bs_free (b);
-      return 0;
+      return -1;
    }
 
    sis->protocol_version = bs_read_u(b, 8); 
@@ -282,11 +224,9 @@ int scte35_splice_info_section_read(scte35_splice_info_section *sis, uint8_t *bu
       sis->E_CRC_32 = bs_read_u32(b);
    }
 
-   sis->CRC_32 = bs_read_u32(b);
+   sis->CRC_32 = bs_read_u32(b);  // checked by the section assembler
 
    bs_free(b);
-    
-   resetPSITableBuffer(scte35TableBuffer);
 
    return 1;
 }
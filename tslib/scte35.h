@@ -163,8 +163,8 @@ typedef struct
 
 scte35_splice_info_section* scte35_splice_info_section_new(); 
 void scte35_splice_info_section_free(scte35_splice_info_section *sis); 
-int scte35_splice_info_section_read(scte35_splice_info_section *sis, uint8_t *buf, size_t buf_len, 
-    uint32_t payload_unit_start_indicator, psi_table_buffer_t *scte35TableBuffer); 
+// complete section from a section_assembler_t with force_crc set, see program_association_section_read
+int scte35_splice_info_section_read(scte35_splice_info_section *sis, uint8_t *buf, size_t buf_len); 
 scte35_splice_info_section* scte35_splice_info_section_copy(scte35_splice_info_section *sis);
 void scte35_splice_info_section_print_stdout(const scte35_splice_info_section *sis); 
 
@@ -27,8 +27,148 @@
  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <string.h>
+
 #include "section.h"
 #include "libts_common.h"
+#include "crc32m.h"
 #include "log.h"
 
-// TODO implement generic section reader
+void section_assembler_init(section_assembler_t *sa) 
+{
+   memset(sa, 0, sizeof(section_assembler_t)); 
+}
+
+void section_assembler_reset(section_assembler_t *sa) 
+{
+   sa->len = 0; 
+   sa->expected_len = 0; 
+   sa->in_section = 0;
+}
+
+static int section_assembler_deliver(section_assembler_t *sa, section_processor_t process_section, void *arg) 
+{
+   uint8_t *section = sa->buf; 
+   size_t len = sa->len; 
+   
+   sa->len = 0; 
+   sa->expected_len = 0; 
+   
+   if ((section[1] & 0x80) || sa->force_crc) 
+   {
+      // CRC of a section including its CRC_32 is 0
+      if (len < SECTION_HEADER_SIZE + 4 || crc_finalize(crc_update(crc_init(), section, len)) != 0) 
+      {
+         LOG_ERROR_ARGS("CRC_32 mismatch in section with table_id 0x%02X, dropping it", section[0]); 
+         SAFE_REPORT_TS_ERR(-33); 
+         sa->num_crc_errors++; 
+         return 0;
+      }
+   }
+   
+   sa->num_sections++; 
+   if (process_section != NULL) process_section(section, len, arg); 
+   return 1;
+}
+
+/**
+ * Append up to len bytes of the section in progress
+ * 
+ * @return number of bytes consumed, the rest of buf (if any) follows the section
+ */
+static size_t section_assembler_append(section_assembler_t *sa, const uint8_t *buf, size_t len) 
+{
+   size_t pos = 0; 
+   
+   // header first, to learn the section length
+   if (sa->expected_len == 0) 
+   {
+      size_t n = SECTION_HEADER_SIZE - sa->len; 
+      if (n > len) n = len; 
+      memcpy(sa->buf + sa->len, buf, n); 
+      sa->len += n; 
+      pos += n; 
+      if (sa->len < SECTION_HEADER_SIZE) return pos; 
+      
+      sa->expected_len = SECTION_HEADER_SIZE + (((sa->buf[1] & 0x0F) << 8) | sa->buf[2]); 
+      if (sa->expected_len > SECTION_MAX_SIZE) 
+      {
+         LOG_ERROR_ARGS("Section length %zu is larger than maximum allowed %d", sa->expected_len, SECTION_MAX_SIZE); 
+         SAFE_REPORT_TS_ERR(-32); 
+         sa->num_dropped++; 
+         section_assembler_reset(sa); 
+         return len;
+      }
+   }
+   
+   size_t n = sa->expected_len - sa->len; 
+   if (n > len - pos) n = len - pos; 
+   memcpy(sa->buf + sa->len, buf + pos, n); 
+   sa->len += n; 
+   return pos + n;
+}
+
+int section_assembler_push(section_assembler_t *sa, const uint8_t *buf, size_t len, uint32_t payload_unit_start_indicator, 
+                           section_processor_t process_section, void *arg) 
+{
+   int num_sections = 0; 
+   size_t pos = 0; 
+   
+   if (sa == NULL || buf == NULL) return 0; 
+   
+   if (payload_unit_start_indicator) 
+   {
+      size_t pointer_field = (len > 0) ? buf[0] : 0; 
+      if (len == 0 || 1 + pointer_field > len) 
+      {
+         LOG_ERROR_ARGS("pointer_field %zu points past the end of the TS packet payload", pointer_field); 
+         if (sa->len > 0) sa->num_dropped++; 
+         section_assembler_reset(sa); 
+         return 0;
+      }
+      
+      // the bytes before the new section finish the one in progress
+      if (sa->len > 0) 
+      {
+         section_assembler_append(sa, buf + 1, pointer_field); 
+         if (sa->expected_len > 0 && sa->len == sa->expected_len) 
+         {
+            num_sections += section_assembler_deliver(sa, process_section, arg); 
+         }
+         else 
+         {
+            LOG_WARN("Section cut short by a new section, dropping it"); 
+            sa->num_dropped++;
+         }
+      }
+      
+      sa->len = 0; 
+      sa->expected_len = 0; 
+      sa->in_section = 1; 
+      pos = 1 + pointer_field;
+   }
+   else if (!sa->in_section || sa->len == 0) 
+   {
+      // sections only start in PUSI packets, nothing to continue
+      return 0;
+   }
+   
+   while (pos < len) 
+   {
+      // after the last section of a packet, the rest is stuffing
+      if (sa->len == 0 && buf[pos] == SECTION_STUFFING_BYTE) break; 
+      
+      pos += section_assembler_append(sa, buf + pos, len - pos); 
+      if (!sa->in_section) break; 
+      
+      if (sa->expected_len > 0 && sa->len == sa->expected_len) 
+      {
+         num_sections += section_assembler_deliver(sa, process_section, arg);
+      }
+   }
+   
+   // nothing in progress: a new section needs a PUSI packet
+   if (sa->len == 0) sa->in_section = 0; 
+   
+   return num_sections;
+}
@@ -30,7 +30,75 @@
 #ifndef _TSLIB_SECTION_H_
 #define _TSLIB_SECTION_H_        
 
-// TODO: generic section reader
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" 
+{
+#endif
+
+#define SECTION_HEADER_SIZE   3                    /// table_id through section_length
+#define SECTION_MAX_SIZE      4096                 /// private sections: section_length up to 0xFFD
+#define SECTION_STUFFING_BYTE 0xFF
+
+/**
+ * Called by section_assembler_push for every complete section. The section 
+ * is only valid for the duration of the call.
+ * 
+ * @param section section bytes, table_id through CRC_32 (if any)
+ * @param section_len 3 + section_length
+ * @param arg argument given to section_assembler_push
+ * 
+ * @return 1 if processed successfully, 0 otherwise
+ */
+typedef int (*section_processor_t)(uint8_t *section, size_t section_len, void *arg); 
+
+/**
+ * Reassembles the sections carried in the TS packets of one PID into a fixed
+ * buffer: pointer_field, several sections per packet, sections spanning 
+ * packets and stuffing are handled here, so that table readers only ever see
+ * whole sections. Sections with section_syntax_indicator set (and all of them
+ * if force_crc is set) are delivered only if their CRC_32 is correct.
+ */
+typedef struct 
+{
+   uint8_t buf[SECTION_MAX_SIZE];   /// section being assembled
+   size_t len;                      /// bytes in buf
+   size_t expected_len;             /// 3 + section_length, 0 until the section header is in
+   int in_section;                  /// synchronized, i.e. a PUSI packet has been seen
+   int force_crc;                   /// check CRC_32 even if section_syntax_indicator is not set (e.g. SCTE-35)
+
+   uint64_t num_sections;           /// sections delivered
+   uint64_t num_crc_errors;         /// sections dropped because of CRC_32 mismatch
+   uint64_t num_dropped;            /// incomplete or malformed sections dropped
+} section_assembler_t; 
+
+void section_assembler_init(section_assembler_t *sa); 
+
+/**
+ * Drop the section in progress, e.g. after a discontinuity
+ */
+void section_assembler_reset(section_assembler_t *sa); 
+
+/**
+ * Feed the payload of the next TS packet of the PID
+ * 
+ * @param sa section assembler
+ * @param buf TS packet payload
+ * @param len payload length
+ * @param payload_unit_start_indicator PUSI of the TS packet, set if a pointer_field is present
+ * @param process_section called for each complete section, in order
+ * @param arg argument for process_section
+ * 
+ * @return number of sections delivered
+ */
+int section_assembler_push(section_assembler_t *sa, const uint8_t *buf, size_t len, uint32_t payload_unit_start_indicator, 
+                           section_processor_t process_section, void *arg); 
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif // _TSLIB_SECTION_H_
 
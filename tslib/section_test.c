@@ -0,0 +1,285 @@
+/*
+
+ Copyright (c) 2012-, ISO/IEC JTC1/SC29/WG11
+ Written by Alex Giladi <alex.giladi@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of the ISO/IEC nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "log.h"
+#include "section.h"
+#include "crc32m.h"
+#include "ts_test_util.h"
+#include "test_macros.h"
+
+#define MAX_TEST_SECTIONS 64
+
+int verbose = 0;
+
+typedef struct
+{
+   uint8_t data[MAX_TEST_SECTIONS * SECTION_MAX_SIZE];   // sections back to back
+   size_t start[MAX_TEST_SECTIONS + 1];
+   int num_sections;
+} section_list_t;
+
+typedef struct
+{
+   const section_list_t *expected;
+   int num_received;
+   int num_mismatched;
+} section_check_t;
+
+static int check_section(uint8_t *section, size_t section_len, void *arg)
+{
+   section_check_t *sc = (section_check_t *)arg;
+   const section_list_t *sl = sc->expected;
+   int i = sc->num_received++;
+   if (i >= sl->num_sections || section_len != sl->start[i + 1] - sl->start[i] ||
+       memcmp(section, sl->data + sl->start[i], section_len) != 0)
+   {
+      sc->num_mismatched++;
+   }
+   return 1;
+}
+
+// section with table_id 0x40 + index and len - 3 - 4 bytes of body; CRC_32 if syntax is set
+static void add_section(section_list_t *sl, size_t len, int syntax)
+{
+   uint8_t *s = sl->data + sl->start[sl->num_sections];
+   s[0] = 0x40 + sl->num_sections;
+   s[1] = (syntax ? 0x80 : 0x00) | 0x30 | (((len - 3) >> 8) & 0x0F);
+   s[2] = (len - 3) & 0xFF;
+   for (size_t i = 3; i < len - 4; i++) s[i] = (uint8_t)rand();
+   ts_test_put_crc(s, len - 4);
+   sl->num_sections++;
+   sl->start[sl->num_sections] = sl->start[sl->num_sections - 1] + len;
+}
+
+/**
+ * Split back-to-back sections into TS packet payloads of at most max_payload 
+ * bytes, with a pointer_field in every packet in which a section starts, and
+ * push them; optionally end every section with stuffing.
+ */
+static void push_sections(section_assembler_t *sa, const section_list_t *sl, size_t max_payload, int random_payload, 
+                          int stuff_after_each, section_check_t *sc)
+{
+   uint8_t payload[TS_SIZE];
+   size_t end = sl->start[sl->num_sections];
+   size_t pos = 0;
+   int next = 0;   // next section to start
+
+   while (pos < end)
+   {
+      size_t payload_len = random_payload ? 1 + rand() % max_payload : max_payload;
+      size_t n = 0;
+      uint32_t pusi = 0;
+      // PUSI if a section starts in this packet, with room for pointer_field and its first byte
+      if (next < sl->num_sections && sl->start[next] - pos + 1 < payload_len)
+      {
+         pusi = 1;
+         payload[n++] = (uint8_t)(sl->start[next] - pos);
+      }
+      size_t chunk = payload_len - n;
+      if (chunk > end - pos) chunk = end - pos;
+      // without PUSI, no section may start in this packet
+      if (!pusi && next < sl->num_sections && sl->start[next] < pos + chunk) chunk = sl->start[next] - pos;
+      // a section which only starts here must not be cut by stuffing
+      if (stuff_after_each && pusi)
+      {
+         size_t sec_end = sl->start[next + 1];
+         if (pos + chunk > sec_end) chunk = sec_end - pos;
+      }
+      memcpy(payload + n, sl->data + pos, chunk);
+      n += chunk;
+      pos += chunk;
+      while (next < sl->num_sections && sl->start[next] < pos) next++;
+      memset(payload + n, SECTION_STUFFING_BYTE, payload_len - n);
+      section_assembler_push(sa, payload, payload_len, pusi, (sc != NULL) ? check_section : NULL, sc);
+   }
+}
+
+START_TEST(test_section_single)
+{
+   static section_list_t sl;
+   section_assembler_t sa;
+   section_check_t sc = { &sl, 0, 0 };
+   memset(&sl, 0, sizeof(sl));
+
+   section_assembler_init(&sa);
+   add_section(&sl, 32, 1);
+   push_sections(&sa, &sl, TS_SIZE - TS_HEADER_SIZE, 0, 0, &sc);
+   fail_unless(sc.num_received == 1 && sc.num_mismatched == 0, "single section not delivered");
+   fail_unless(sa.num_sections == 1 && sa.num_dropped == 0 && sa.num_crc_errors == 0, "wrong counters");
+
+   // no PUSI yet: nothing to synchronize to
+   uint8_t payload[TS_SIZE - TS_HEADER_SIZE];
+   section_assembler_init(&sa);
+   memcpy(payload, sl.data, 32);
+   memset(payload + 32, 0xFF, sizeof(payload) - 32);
+   fail_unless(section_assembler_push(&sa, payload, sizeof(payload), 0, check_section, &sc) == 0,
+               "section delivered without PUSI");
+}
+END_TEST
+
+START_TEST(test_section_multiple)
+{
+   static section_list_t sl;
+   section_assembler_t sa;
+   section_check_t sc = { &sl, 0, 0 };
+   memset(&sl, 0, sizeof(sl));
+
+   // several small sections per packet, back to back
+   section_assembler_init(&sa);
+   for (int i = 0; i < 20; i++) add_section(&sl, 16 + i, 1);
+   push_sections(&sa, &sl, TS_SIZE - TS_HEADER_SIZE, 0, 0, &sc);
+   fail_unless(sc.num_received == 20 && sc.num_mismatched == 0, "back to back sections not delivered");
+
+   // one section per packet, then stuffing
+   memset(&sc, 0, sizeof(sc));
+   sc.expected = &sl;
+   section_assembler_init(&sa);
+   push_sections(&sa, &sl, TS_SIZE - TS_HEADER_SIZE, 0, 1, &sc);
+   fail_unless(sc.num_received == 20 && sc.num_mismatched == 0, "stuffed sections not delivered");
+   fail_unless(sa.num_dropped == 0, "stuffing taken for a section");
+}
+END_TEST
+
+START_TEST(test_section_spanning)
+{
+   static section_list_t sl;
+   section_assembler_t sa;
+   section_check_t sc = { &sl, 0, 0 };
+   memset(&sl, 0, sizeof(sl));
+
+   // PMT-sized and maximum-size private sections, tail of one and head of the next in the same packet
+   section_assembler_init(&sa);
+   add_section(&sl, 1024, 1);
+   add_section(&sl, 100, 1);
+   add_section(&sl, SECTION_MAX_SIZE, 1);
+   add_section(&sl, 500, 0);
+   push_sections(&sa, &sl, TS_SIZE - TS_HEADER_SIZE, 0, 0, &sc);
+   fail_unless(sc.num_received == 4 && sc.num_mismatched == 0, "spanning sections not delivered");
+}
+END_TEST
+
+START_TEST(test_section_errors)
+{
+   static section_list_t sl;
+   section_assembler_t sa;
+   section_check_t sc = { &sl, 0, 0 };
+   memset(&sl, 0, sizeof(sl));
+
+   tslib_loglevel = 0;
+
+   // CRC error in the second section
+   section_assembler_init(&sa);
+   add_section(&sl, 300, 1);
+   add_section(&sl, 300, 1);
+   add_section(&sl, 300, 1);
+   sl.data[sl.start[1] + 150] ^= 0x10;
+   push_sections(&sa, &sl, TS_SIZE - TS_HEADER_SIZE, 0, 0, &sc);
+   fail_unless(sa.num_crc_errors == 1 && sa.num_sections == 2, "CRC error not detected");
+   fail_unless(sc.num_received == 2, "corrupted section delivered");
+
+   // no CRC check without section_syntax_indicator, unless forced
+   memset(&sl, 0, sizeof(sl));
+   add_section(&sl, 100, 0);
+   sl.data[50] ^= 0x10;
+   section_assembler_init(&sa);
+   push_sections(&sa, &sl, TS_SIZE - TS_HEADER_SIZE, 0, 0, NULL);
+   fail_unless(sa.num_sections == 1, "section without syntax indicator not delivered");
+   section_assembler_init(&sa);
+   sa.force_crc = 1;
+   push_sections(&sa, &sl, TS_SIZE - TS_HEADER_SIZE, 0, 0, NULL);
+   fail_unless(sa.num_sections == 0 && sa.num_crc_errors == 1, "forced CRC check not done");
+
+   // section cut short by the next PUSI packet
+   memset(&sl, 0, sizeof(sl));
+   add_section(&sl, 400, 1);
+   uint8_t payload[TS_SIZE - TS_HEADER_SIZE];
+   section_assembler_init(&sa);
+   payload[0] = 0;
+   memcpy(payload + 1, sl.data, sizeof(payload) - 1);
+   section_assembler_push(&sa, payload, sizeof(payload), 1, NULL, NULL);
+   section_assembler_push(&sa, payload, sizeof(payload), 1, NULL, NULL);
+   fail_unless(sa.num_dropped == 1 && sa.len == sizeof(payload) - 1, "cut short section not dropped");
+
+   // pointer_field past the end of the payload
+   section_assembler_init(&sa);
+   payload[0] = 200;
+   fail_unless(section_assembler_push(&sa, payload, sizeof(payload), 1, NULL, NULL) == 0 && !sa.in_section,
+               "bad pointer_field accepted");
+
+   tslib_loglevel = verbose ? TSLIB_LOG_LEVEL_INFO : TSLIB_LOG_LEVEL_ERROR;
+}
+END_TEST
+
+START_TEST(test_section_random)
+{
+   static section_list_t sl;
+   section_assembler_t sa;
+
+   for (int t = 0; t < 200; t++)
+   {
+      section_check_t sc = { &sl, 0, 0 };
+      memset(&sl, 0, sizeof(sl));
+      int n = 1 + rand() % 16;
+      for (int i = 0; i < n; i++)
+      {
+         size_t len = (rand() % 4 == 0) ? 8 + rand() % (SECTION_MAX_SIZE - 8) : 8 + rand() % 300;
+         add_section(&sl, len, rand() % 2);
+      }
+
+      section_assembler_init(&sa);
+      push_sections(&sa, &sl, TS_SIZE - TS_HEADER_SIZE, 1, t % 2, &sc);
+      fail_unless2(sc.num_received == n && sc.num_mismatched == 0, "random", "trial %d: %d of %d sections, %d mismatched",
+                   t, sc.num_received, n, sc.num_mismatched);
+   }
+}
+END_TEST
+
+int main(int argc, char **argv)
+{
+   int _testnum = 1;
+   int failed = 0;
+   int r;
+
+   if (argc > 1 && strcmp(argv[1], "-v") == 0) verbose = 1;
+   tslib_loglevel = verbose ? TSLIB_LOG_LEVEL_INFO : TSLIB_LOG_LEVEL_ERROR;
+   srand(1);
+
+   r = test_section_single(); ok(r, "section_single"); failed += !r;
+   r = test_section_multiple(); ok(r, "section_multiple"); failed += !r;
+   r = test_section_spanning(); ok(r, "section_spanning"); failed += !r;
+   r = test_section_errors(); ok(r, "section_errors"); failed += !r;
+   r = test_section_random(); ok(r, "section_random"); failed += !r;
+
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
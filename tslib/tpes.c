@@ -37,7 +37,7 @@
 pes_demux_t* pes_demux_new(pes_processor_t pes_processor) 
 { 
    
-   pes_demux_t *pdm = malloc(sizeof(pes_demux_t)); 
+   pes_demux_t *pdm = calloc(1, sizeof(pes_demux_t)); 
    if (pdm != NULL) 
    {
       pdm->ts_queue = vqarray_new(); 
@@ -46,6 +46,16 @@ pes_demux_t* pes_demux_new(pes_processor_t pes_processor)
    return pdm;
 }
 
+pes_demux_t* pes_demux_new_view(pes_view_processor_t pes_view_processor) 
+{ 
+   pes_demux_t *pdm = pes_demux_new(NULL); 
+   if (pdm != NULL) 
+   {
+      pdm->process_pes_view = pes_view_processor; 
+   }
+   return pdm;
+}
+
 void pes_demux_free(pes_demux_t *pdm) 
 { 
    if (pdm == NULL) return; 
@@ -60,91 +70,185 @@ void pes_demux_free(pes_demux_t *pdm)
       pdm->pes_arg_destructor(pdm->pes_arg);
    }
    
+   free(pdm->pes_buf); 
+   free(pdm->view_vec); 
    free(pdm);
 }
 
+static int pes_demux_append(pes_demux_t *pdm, const uint8_t *bytes, size_t len) 
+{ 
+   size_t needed = pdm->pes_buf_len + len; 
+   
+   if (needed > pdm->pes_buf_size) 
+   {
+      // grow geometrically, but go straight to the expected/last PES size if we know it
+      size_t new_size = 2 * pdm->pes_buf_size; 
+      if (new_size < PES_DEMUX_INITIAL_BUF_SIZE) new_size = PES_DEMUX_INITIAL_BUF_SIZE; 
+      if (new_size < pdm->pes_size_hint) new_size = pdm->pes_size_hint; 
+      if (new_size < pdm->pes_expected_len) new_size = pdm->pes_expected_len; 
+      if (new_size < needed) new_size = needed; 
+      
+      uint8_t *new_buf = realloc(pdm->pes_buf, new_size); 
+      if (new_buf == NULL) 
+      {
+         LOG_ERROR_ARGS("Failed to grow PES buffer to %zu bytes", new_size); 
+         return 0;
+      }
+      pdm->pes_buf = new_buf; 
+      pdm->pes_buf_size = new_size;
+   }
+   
+   memcpy(pdm->pes_buf + pdm->pes_buf_len, bytes, len); 
+   pdm->pes_buf_len += len; 
+   return 1;
+}
+
+static int pes_demux_append_view(pes_demux_t *pdm, uint8_t *bytes, size_t len) 
+{ 
+   if (pdm->view_vec_len == pdm->view_vec_size) 
+   {
+      int new_size = pdm->view_vec_size ? 2 * pdm->view_vec_size : 64; 
+      buf_t *new_vec = realloc(pdm->view_vec, new_size * sizeof(buf_t)); 
+      if (new_vec == NULL) 
+      {
+         LOG_ERROR_ARGS("Failed to grow PES fragment list to %d entries", new_size); 
+         return 0;
+      }
+      pdm->view_vec = new_vec; 
+      pdm->view_vec_size = new_size;
+   }
+   
+   pdm->view_vec[pdm->view_vec_len].bytes = bytes; 
+   pdm->view_vec[pdm->view_vec_len].len = len; 
+   pdm->view_vec_len++; 
+   pdm->pes_buf_len += len; 
+   return 1;
+}
+
+// PES_packet_length from the first 6 bytes of the current PES, which may be split across fragments
+static uint32_t pes_demux_peek_length(pes_demux_t *pdm) 
+{ 
+   if (pdm->process_pes_view == NULL) return (pdm->pes_buf[4] << 8) | pdm->pes_buf[5]; 
+   
+   uint8_t hdr[6]; 
+   size_t n = 0; 
+   for (int i = 0; i < pdm->view_vec_len && n < sizeof(hdr); i++) 
+   {
+      for (size_t j = 0; j < pdm->view_vec[i].len && n < sizeof(hdr); j++) hdr[n++] = pdm->view_vec[i].bytes[j];
+   }
+   return (hdr[4] << 8) | hdr[5];
+}
+
+static void pes_demux_emit(pes_demux_t *pdm, elementary_stream_info_t *es_info) 
+{ 
+   if (pdm->in_pes && pdm->process_pes_view != NULL) 
+   {
+      if (pdm->view_vec_len > 0) 
+      {
+         pes_view_t pv; 
+         pes_view_init(&pv, pdm->view_vec, pdm->view_vec_len); 
+         pdm->process_pes_view(&pv, es_info, pdm->ts_queue, pdm->pes_arg);
+      }
+   }
+   else if (pdm->in_pes && pdm->pes_buf_len > 0) 
+   {
+      // the buffer is handed over to the PES packet, next PES gets a fresh one sized by the hint
+      pes_packet_t *pes = pes_new(); 
+      pes_read_buf_owned(pes, pdm->pes_buf, pdm->pes_buf_len); 
+      pdm->pes_size_hint = pdm->pes_buf_len; 
+      pdm->pes_buf = NULL; 
+      pdm->pes_buf_size = 0; 
+      
+      if (pdm->process_pes_packet != NULL) 
+      {
+         // at this point we don't own the PES packet memory
+         pdm->process_pes_packet(pes, es_info, pdm->ts_queue, pdm->pes_arg);  
+      }
+      else 
+      {
+         pes_free(pes);
+      }
+   }
+   
+   // clean up 
+   ts_packet_t *tmp = NULL; 
+   while ((tmp = vqarray_shift(pdm->ts_queue)) != NULL) 
+   {
+      ts_free(tmp);
+   }
+   
+   pdm->pes_buf_len = 0; 
+   pdm->view_vec_len = 0; 
+   pdm->pes_expected_len = 0; 
+   pdm->in_pes = 0; 
+   pdm->skipping = 1; // anything before the next PUSI=1 is stray payload
+}
 
 int pes_demux_process_ts_packet(ts_packet_t *ts, elementary_stream_info_t *es_info, void *arg) 
 { 
    if ( es_info == NULL || arg == NULL)
        return 0; 
 
-//   printf ("pes_demux_process_ts_packet\n");
-
-
-   int end_of_pes = !!( ts == NULL );
-   if ( !end_of_pes ) end_of_pes = ts->header.payload_unit_start_indicator;
-   
    pes_demux_t *pdm = (pes_demux_t *)arg; 
    
-   if ( end_of_pes ) 
-   {      
-      int packets_in_queue = vqarray_length(pdm->ts_queue); 
-      if (packets_in_queue > 0) 
+   if ( ts == NULL ) 
+   {
+      // end of stream -- flush whatever we have
+      if (pdm->in_pes) pes_demux_emit(pdm, es_info); 
+      return 1;
+   }
+   
+   int pusi = ts->header.payload_unit_start_indicator; 
+   if ( pusi ) 
+   {
+      if (pdm->in_pes) pes_demux_emit(pdm, es_info); 
+      
+      pdm->in_pes = 1; 
+      pdm->skipping = 0; 
+      vqarray_add(pdm->ts_queue, ts); 
+   }
+   else if ( !pdm->in_pes ) 
+   {
+      if (!pdm->skipping) 
       {
-         // we have something in the queue
-         // chances are this is a PES packet
-         int i;
-         
-         ts_packet_t *tsp = vqarray_get(pdm->ts_queue, 0);
-         if (tsp->header.payload_unit_start_indicator == 0)
-         {
-            // the queue doesn't start with a complete TS packet
-            LOG_WARN("PES queue does not start from PUSI=1");
-
-            // this will occur if we start ingestng a stream at an arbitrary point, in 
-            // the middle of a PES packet
-         }
-         else
-         {
-         
-            buf_t *vec = malloc(packets_in_queue * sizeof(buf_t)); // can be optimized...
-         
-            for (int i = 0; i < packets_in_queue; i++)
-            {
-               tsp = vqarray_get(pdm->ts_queue, i);
-               if ((tsp != NULL) && (tsp->header.adaptation_field_control & TS_PAYLOAD))
-               {
-                  vec[i].len = tsp->payload.len;
-                  vec[i].bytes = tsp->payload.bytes;
-               }
-               else
-               {
-                  vec[i].len = 0;
-                  vec[i].bytes = NULL;
-               }
-            }
-            pes_packet_t *pes = pes_new();
-            pes_read_vec(pes, vec, packets_in_queue);
-            
-            if (pdm->process_pes_packet != NULL) 
-            {
-               // at this point we don't own the PES packet memory
-               pdm->process_pes_packet(pes, es_info, pdm->ts_queue, pdm->pes_arg);  
-            }
-            else 
-            {
-               pes_free(pes);
-            }
-         
-            free(vec);        
-         }
-         
-         
-         // clean up 
-         ts_packet_t *tmp = NULL; 
-         while ((tmp = vqarray_shift(pdm->ts_queue)) != NULL) 
-         {
-            ts_free(tmp);
-         }
-                 
+         // this will occur if we start ingestng a stream at an arbitrary point, in 
+         // the middle of a PES packet
+         LOG_WARN("PES queue does not start from PUSI=1");
+         pdm->skipping = 1;
       }
+      ts_free(ts); 
+      return 1;
+   }
+   
+   int ret = 1; 
+   int has_payload = (ts->header.adaptation_field_control & TS_PAYLOAD) && ts->payload.bytes != NULL && ts->payload.len > 0; 
+   if ( pdm->process_pes_view != NULL ) 
+   {
+      // view mode: the packet stays queued, we only keep a reference to its payload
+      if ( !pusi ) vqarray_add(pdm->ts_queue, ts); 
+      if ( has_payload ) ret = pes_demux_append_view(pdm, ts->payload.bytes, ts->payload.len); 
+   }
+   else 
+   {
+      if ( has_payload ) ret = pes_demux_append(pdm, ts->payload.bytes, ts->payload.len); 
+      if ( !pusi ) ts_free(ts); 
+   }
+   
+   if ( pdm->pes_expected_len == 0 && pdm->pes_buf_len >= 6 ) 
+   {
+      uint32_t PES_packet_length = pes_demux_peek_length(pdm); 
+      if (PES_packet_length > 0) pdm->pes_expected_len = PES_packet_length + 6;
    }
-   if ( ts != NULL ) 
+   
+   if ( pdm->pes_expected_len > 0 && pdm->pes_buf_len >= pdm->pes_expected_len ) 
    {
-       vqarray_add(pdm->ts_queue, ts);
+      // PES_packet_length satisfied, no need to wait for the next PUSI
+      // (pes_view_init applies the same limit to the payload)
+      pdm->pes_buf_len = pdm->pes_expected_len; 
+      pes_demux_emit(pdm, es_info);
    }
-   return 1;   
+   
+   return ret;   
 }
 
 char* pts_dts_to_string(uint64_t pts_dts, char inout[13]) {
@@ -53,18 +53,56 @@ extern "C"
 
 
 typedef int (*pes_processor_t)(pes_packet_t *, elementary_stream_info_t *, vqarray_t*, void *); 
+typedef int (*pes_view_processor_t)(pes_view_t *, elementary_stream_info_t *, vqarray_t*, void *); 
 typedef int (*pes_arg_destructor_t)(void *); 
 
+#define PES_DEMUX_INITIAL_BUF_SIZE (16 * TS_SIZE)  /// reassembly buffer size before the first PES size is known
+
+/**
+ * PES demultiplexer. Payload bytes are appended to a per-PID buffer as TS
+ * packets arrive; the PES packet is emitted as soon as PES_packet_length
+ * bytes are in, or at the next PUSI for unbounded (PES_packet_length == 0)
+ * PES packets. Only the TS packet that started the PES is kept in ts_queue,
+ * so that the PES processor can still look at its adaptation field (PCR, 
+ * random access, EBP); the rest are freed as soon as they are copied.
+ *
+ * In view mode (pes_demux_new_view) nothing is copied: all TS packets of the
+ * PES stay in ts_queue and the PES is delivered as a pes_view_t over their
+ * payloads, valid only for the duration of the callback.
+ */
 typedef struct 
 {
-   vqarray_t *ts_queue; 
+   vqarray_t *ts_queue;                 /// TS packet which started the current PES (PUSI=1), all of its packets in view mode
    pes_processor_t process_pes_packet; 
    void *pes_arg; 
    pes_arg_destructor_t pes_arg_destructor;
+
+   uint8_t *pes_buf;                    /// reassembly buffer, handed over to the emitted pes_packet_t
+   size_t pes_buf_size;                 /// allocated size of pes_buf
+   size_t pes_buf_len;                  /// bytes of the current PES in pes_buf
+   size_t pes_expected_len;             /// PES_packet_length + 6, 0 if unbounded or not known yet
+   size_t pes_size_hint;                /// size of the last PES, used to size the next buffer
+   int in_pes;                          /// a PES packet is being reassembled
+   int skipping;                        /// dropping payload until the next PUSI (already reported)
+
+   pes_view_processor_t process_pes_view; /// set in view mode, process_pes_packet is not used then
+   buf_t *view_vec;                     /// payload fragments of the queued TS packets
+   int view_vec_len;                    /// number of fragments in view_vec
+   int view_vec_size;                   /// allocated size of view_vec
 } pes_demux_t; 
 
 
 pes_demux_t* pes_demux_new(pes_processor_t pes_processor); 
+
+/**
+ * Create a PES demultiplexer delivering zero-copy pes_view_t's instead of
+ * pes_packet_t's. Suited for consumers which only look at PES headers and
+ * the first few payload bytes.
+ * 
+ * @param pes_view_processor callback called per PES packet; the view and the
+ *                           TS packets it references are freed once it returns
+ */
+pes_demux_t* pes_demux_new_view(pes_view_processor_t pes_view_processor); 
 void pes_demux_free(pes_demux_t *pdm); 
 int pes_demux_process_ts_packet(ts_packet_t *ts, elementary_stream_info_t *es_info, void *arg); 
 
@@ -0,0 +1,357 @@
+/*
+
+ Copyright (c) 2012-, ISO/IEC JTC1/SC29/WG11
+ Written by Alex Giladi <alex.giladi@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of the ISO/IEC nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "log.h"
+#include "tpes.h"
+#include "ts_test_util.h"
+#include "test_macros.h"
+
+#define TEST_PID        0x100
+#define MAX_PES_SIZE    0x4000
+#define MAX_TEST_PES    10
+
+int verbose = 0;
+
+typedef struct
+{
+   int num_pes;                  /// PES packets delivered so far
+   int num_bad;                  /// PES packets which didn't match what was sent
+   int num_bad_queue;            /// deliveries without the PUSI packet in ts_queue
+   uint8_t expected_pes[MAX_TEST_PES][MAX_PES_SIZE];
+   int expected_len[MAX_TEST_PES];
+} pes_sink_t;
+
+static int check_pes_packet(pes_packet_t *pes, elementary_stream_info_t *es_info, vqarray_t *ts_queue, void *arg)
+{
+   (void)es_info;
+   pes_sink_t *sink = (pes_sink_t *)arg;
+   int k = sink->num_pes++;
+
+   if (k >= MAX_TEST_PES || pes->status != 0 || (int)pes->buf_len != sink->expected_len[k] ||
+       memcmp(pes->buf, sink->expected_pes[k], pes->buf_len) != 0)
+   {
+      sink->num_bad++;
+   }
+
+   ts_packet_t *ts = vqarray_length(ts_queue) == 1 ? vqarray_get(ts_queue, 0) : NULL;
+   if (ts == NULL || !ts->header.payload_unit_start_indicator) sink->num_bad_queue++;
+
+   pes_free(pes);
+   return 1;
+}
+
+static void feed_packet(pes_demux_t *pdm, elementary_stream_info_t *esi, ts_packet_pool_t *pool, const uint8_t *pkt)
+{
+   ts_packet_t *ts = ts_packet_pool_get(pool);
+   memcpy(ts->bytes, pkt, TS_SIZE);
+   ts_read_view(ts, ts->bytes, TS_SIZE);
+   pes_demux_process_ts_packet(ts, esi, pdm);
+}
+
+// packetize a PES packet and feed TS packets [first, last) of it to pdm; returns the total number of TS packets
+static int feed_pes(pes_demux_t *pdm, elementary_stream_info_t *esi, ts_packet_pool_t *pool,
+                    const uint8_t *pes, int len, uint32_t cc, int first, int last)
+{
+   uint8_t pkt[TS_SIZE];
+   int n = 0;
+
+   for (int pos = 0; pos < len; n++)
+   {
+      pos += ts_test_write_payload_packet(pkt, TEST_PID, cc + n, pos == 0, pes + pos, len - pos);
+      if (n >= first && n < last) feed_packet(pdm, esi, pool, pkt);
+   }
+   return n;
+}
+
+START_TEST(test_bounded_pes)
+{
+   pes_sink_t *sink = calloc(1, sizeof(pes_sink_t));
+   pes_demux_t *pdm = pes_demux_new(check_pes_packet);
+   ts_packet_pool_t *pool = ts_packet_pool_new(16);
+   elementary_stream_info_t *esi = es_info_new();
+   uint32_t cc = 0;
+   pdm->pes_arg = sink;
+
+   for (int k = 0; k < MAX_TEST_PES; k++)
+   {
+      // audio-sized PES packets, the last TS packet of each is padded with stuffing
+      int len = ts_test_build_pes(sink->expected_pes[k], 0xC0, 90000 + 1920 * k, 100 + 50 * k, 1);
+      sink->expected_len[k] = len;
+
+      int n = feed_pes(pdm, esi, pool, sink->expected_pes[k], len, cc, 0, 0);
+      feed_pes(pdm, esi, pool, sink->expected_pes[k], len, cc, 0, n - 1);
+      fail_unless2(sink->num_pes == k, "PES emitted before PES_packet_length was satisfied", "(PES %d)", k);
+
+      // bounded PES goes out on its last packet, without waiting for the next PUSI
+      feed_pes(pdm, esi, pool, sink->expected_pes[k], len, cc, n - 1, n);
+      fail_unless2(sink->num_pes == k + 1, "PES not emitted on its last packet", "(PES %d)", k);
+      fail_unless(pool->num_outstanding == 0, "TS packets held after PES was emitted");
+      cc += n;
+   }
+
+   pes_demux_process_ts_packet(NULL, esi, pdm);
+   fail_unless(sink->num_pes == MAX_TEST_PES, "spurious PES at end of stream");
+   fail_unless(sink->num_bad == 0, "PES content mismatch");
+   fail_unless(sink->num_bad_queue == 0, "PUSI packet missing from ts_queue");
+
+   pes_demux_free(pdm);
+   ts_packet_pool_free(pool);
+   es_info_free(esi);
+   free(sink);
+}
+END_TEST
+
+START_TEST(test_unbounded_pes)
+{
+   pes_sink_t *sink = calloc(1, sizeof(pes_sink_t));
+   pes_demux_t *pdm = pes_demux_new(check_pes_packet);
+   ts_packet_pool_t *pool = ts_packet_pool_new(16);
+   elementary_stream_info_t *esi = es_info_new();
+   uint32_t cc = 0;
+   pdm->pes_arg = sink;
+
+   for (int k = 0; k < MAX_TEST_PES; k++)
+   {
+      // video PES with PES_packet_length == 0 can only end at the next PUSI or at end of stream
+      int len = ts_test_build_pes(sink->expected_pes[k], 0xE0, 90000 + 3003 * k, 1000 + 1200 * k, 0);
+      sink->expected_len[k] = len;
+
+      int n = feed_pes(pdm, esi, pool, sink->expected_pes[k], len, cc, 0, MAX_PES_SIZE);
+      fail_unless2(sink->num_pes == k, "PES not emitted at next PUSI", "(PES %d)", k);
+      fail_unless(pool->num_outstanding == 1, "only the PUSI packet should be held");
+      cc += n;
+   }
+
+   pes_demux_process_ts_packet(NULL, esi, pdm);
+   fail_unless(sink->num_pes == MAX_TEST_PES, "last PES not flushed at end of stream");
+   fail_unless(sink->num_bad == 0, "PES content mismatch");
+   fail_unless(sink->num_bad_queue == 0, "PUSI packet missing from ts_queue");
+   fail_unless(pool->num_outstanding == 0, "TS packets leaked");
+
+   pes_demux_free(pdm);
+   ts_packet_pool_free(pool);
+   es_info_free(esi);
+   free(sink);
+}
+END_TEST
+
+START_TEST(test_orphan_packets)
+{
+   pes_sink_t *sink = calloc(1, sizeof(pes_sink_t));
+   pes_demux_t *pdm = pes_demux_new(check_pes_packet);
+   ts_packet_pool_t *pool = ts_packet_pool_new(16);
+   elementary_stream_info_t *esi = es_info_new();
+   uint32_t cc = 0;
+   uint8_t pkt[TS_SIZE];
+   pdm->pes_arg = sink;
+
+   // join mid-PES: the tail of some earlier PES is dropped
+   tslib_loglevel = 0;
+   for (int i = 0; i < 3; i++)
+   {
+      ts_test_write_pes_packet(pkt, TEST_PID, cc++, 0, 0xC0, 0, 0);
+      feed_packet(pdm, esi, pool, pkt);
+   }
+   fail_unless(pool->num_outstanding == 0, "orphan packets held");
+
+   int len = ts_test_build_pes(sink->expected_pes[0], 0xC0, 12345, 1000, 1);
+   sink->expected_len[0] = len;
+   cc += feed_pes(pdm, esi, pool, sink->expected_pes[0], len, cc, 0, MAX_PES_SIZE);
+
+   // so is stray payload after a complete bounded PES
+   ts_test_write_pes_packet(pkt, TEST_PID, cc++, 0, 0xC0, 0, 0);
+   feed_packet(pdm, esi, pool, pkt);
+   pes_demux_process_ts_packet(NULL, esi, pdm);
+   tslib_loglevel = verbose ? TSLIB_LOG_LEVEL_INFO : TSLIB_LOG_LEVEL_ERROR;
+
+   fail_unless(sink->num_pes == 1, "expected exactly one PES");
+   fail_unless(sink->num_bad == 0, "PES content mismatch");
+   fail_unless(pool->num_outstanding == 0, "TS packets leaked");
+
+   pes_demux_free(pdm);
+   ts_packet_pool_free(pool);
+   es_info_free(esi);
+   free(sink);
+}
+END_TEST
+
+static int check_pes_view(pes_view_t *pv, elementary_stream_info_t *es_info, vqarray_t *ts_queue, void *arg)
+{
+   (void)es_info;
+   pes_sink_t *sink = (pes_sink_t *)arg;
+   int k = sink->num_pes++;
+   uint8_t payload[MAX_PES_SIZE];
+   size_t len = 0;
+
+   pes_view_iter_t it;
+   const uint8_t *bytes;
+   size_t n;
+   pes_view_iter_init(&it, pv);
+   while (pes_view_iter_next(&it, &bytes, &n))
+   {
+      memcpy(payload + len, bytes, n);
+      len += n;
+   }
+
+   if (k >= MAX_TEST_PES || pv->status != 0 || pv->header_len + len != (size_t)sink->expected_len[k] ||
+       memcmp(payload, sink->expected_pes[k] + pv->header_len, len) != 0)
+   {
+      sink->num_bad++;
+   }
+
+   // all TS packets of the PES are still around, the first one with PUSI=1
+   ts_packet_t *ts = vqarray_get(ts_queue, 0);
+   if (ts == NULL || !ts->header.payload_unit_start_indicator ||
+       vqarray_length(ts_queue) != (sink->expected_len[k] + TS_SIZE - TS_HEADER_SIZE - 1) / (TS_SIZE - TS_HEADER_SIZE))
+   {
+      sink->num_bad_queue++;
+   }
+   return 1;
+}
+
+START_TEST(test_pes_view)
+{
+   uint8_t pes[2000];
+   buf_t vec[4];
+
+   // PTS + DTS + 10 stuffing bytes in the header, so that it can be split at many places
+   int len = sizeof(pes);
+   memset(pes, 0xFF, len);
+   uint8_t hdr[] = { 0x00, 0x00, 0x01, 0xE0, (len - 6) >> 8, (len - 6) & 0xFF, 0x80, 0xC0, 20,
+                     0x3F, 0xFF, 0xFF, 0xFF, 0xFF,     // PTS = 0x1FFFFFFFF
+                     0x1F, 0xFF, 0xFF, 0xFF, 0xFF };   // DTS = 0x1FFFFFFFF
+   memcpy(pes, hdr, sizeof(hdr));
+   for (int i = 9 + 20; i < len; i++) pes[i] = (uint8_t)i;
+
+   pes_packet_t *ref = pes_new();
+   pes_read_buf(ref, pes, len);
+   fail_unless(ref->status == 0 && ref->header.DTS == 0x1FFFFFFFFULL, "reference PES broken");
+
+   for (int split = 0; split <= 40; split++)
+   {
+      // empty fragment, header split at 'split', then the rest in two pieces
+      vec[0].bytes = pes; vec[0].len = 0;
+      vec[1].bytes = pes; vec[1].len = split;
+      vec[2].bytes = pes + split; vec[2].len = 500;
+      vec[3].bytes = pes + split + 500; vec[3].len = len - split - 500;
+
+      pes_view_t pv;
+      int header_len = pes_view_init(&pv, vec, 4);
+      fail_unless2(header_len == (int)(ref->payload - ref->buf), "wrong header length", "(split %d)", split);
+      fail_unless2(pv.header.PTS == ref->header.PTS && pv.header.DTS == ref->header.DTS,
+                   "PTS/DTS mismatch", "(split %d)", split);
+      fail_unless2(pv.payload_len == ref->payload_len, "payload length mismatch", "(split %d)", split);
+
+      pes_view_iter_t it;
+      const uint8_t *bytes;
+      size_t n, pos = 0;
+      int chunks = 0;
+      pes_view_iter_init(&it, &pv);
+      while (pes_view_iter_next(&it, &bytes, &n))
+      {
+         if (memcmp(bytes, ref->payload + pos, n) != 0) break;
+         pos += n;
+         chunks++;
+      }
+      fail_unless2(pos == ref->payload_len, "payload mismatch", "(split %d)", split);
+      fail_unless2(chunks >= 2 && chunks <= 3, "payload was not returned in place", "(split %d)", split);
+
+      uint8_t first[4];
+      fail_unless(pes_view_read_payload(&pv, 0, first, 4) == 4 && memcmp(first, ref->payload, 4) == 0,
+                  "pes_view_read_payload mismatch");
+   }
+
+   // truncated header
+   vec[0].bytes = pes; vec[0].len = 12;
+   pes_view_t pv;
+   tslib_loglevel = 0;
+   fail_unless(pes_view_init(&pv, vec, 1) == 0 && pv.status != 0, "truncated header not detected");
+   tslib_loglevel = verbose ? TSLIB_LOG_LEVEL_INFO : TSLIB_LOG_LEVEL_ERROR;
+
+   pes_free(ref);
+}
+END_TEST
+
+START_TEST(test_pes_demux_view)
+{
+   pes_sink_t *sink = calloc(1, sizeof(pes_sink_t));
+   pes_demux_t *pdm = pes_demux_new_view(check_pes_view);
+   ts_packet_pool_t *pool = ts_packet_pool_new(16);
+   elementary_stream_info_t *esi = es_info_new();
+   uint32_t cc = 0;
+   pdm->pes_arg = sink;
+
+   for (int k = 0; k < MAX_TEST_PES; k++)
+   {
+      // alternate bounded and unbounded PES packets
+      int bounded = k & 1;
+      int len = ts_test_build_pes(sink->expected_pes[k], bounded ? 0xC0 : 0xE0, 90000 + 3003 * k, 100 + 700 * k, bounded);
+      sink->expected_len[k] = len;
+
+      int n = feed_pes(pdm, esi, pool, sink->expected_pes[k], len, cc, 0, MAX_PES_SIZE);
+      fail_unless2(sink->num_pes == k + bounded, "PES not emitted", "(PES %d)", k);
+      fail_unless2(pool->num_outstanding == (size_t)(bounded ? 0 : n), "TS packets not queued", "(PES %d)", k);
+      cc += n;
+   }
+   pes_demux_process_ts_packet(NULL, esi, pdm);
+
+   fail_unless(sink->num_pes == MAX_TEST_PES, "not all PES delivered");
+   fail_unless(sink->num_bad == 0, "PES view payload mismatch");
+   fail_unless(sink->num_bad_queue == 0, "TS packets missing from ts_queue");
+   fail_unless(pool->num_outstanding == 0, "TS packets leaked");
+
+   pes_demux_free(pdm);
+   ts_packet_pool_free(pool);
+   es_info_free(esi);
+   free(sink);
+}
+END_TEST
+
+int main(int argc, char **argv)
+{
+   int _testnum = 1;
+   int failed = 0;
+   int r;
+
+   if (argc > 1 && strcmp(argv[1], "-v") == 0) verbose = 1;
+   tslib_loglevel = verbose ? TSLIB_LOG_LEVEL_INFO : TSLIB_LOG_LEVEL_ERROR;
+
+   r = test_bounded_pes(); ok(r, "bounded_pes"); failed += !r;
+   r = test_unbounded_pes(); ok(r, "unbounded_pes"); failed += !r;
+   r = test_orphan_packets(); ok(r, "orphan_packets"); failed += !r;
+   r = test_pes_view(); ok(r, "pes_view"); failed += !r;
+   r = test_pes_demux_view(); ok(r, "pes_demux_view"); failed += !r;
+
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
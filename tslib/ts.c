@@ -39,7 +39,17 @@
 // until done, we can read or write, not both.
 // idea: have an "expand" flag, if off -- everything is in place, on -- everything is nicely copied and allocated
 
-volatile int tslib_errno = 0; 
+__thread volatile int tslib_errno = 0; 
+
+// packet pool entry, ts must come first
+typedef struct _ts_pool_entry_ 
+{
+   ts_packet_t ts; 
+   struct _ts_pool_entry_ *next; 
+   uint8_t storage[TS_SIZE]; 
+} ts_pool_entry_t; 
+
+static void ts_packet_pool_put(ts_packet_pool_t *pool, ts_packet_t *ts); 
 
 ts_packet_t* ts_new() 
 { 
@@ -48,10 +58,110 @@ ts_packet_t* ts_new()
    return ts;
 }
 
+ts_packet_pool_t* ts_packet_pool_new(size_t slab_size) 
+{ 
+   if (slab_size == 0) return NULL; 
+   ts_packet_pool_t *pool = calloc(1, sizeof(ts_packet_pool_t)); 
+   pool->slabs = vqarray_new(); 
+   pool->slab_size = slab_size; 
+   return pool;
+}
+
+static void ts_packet_pool_destroy(ts_packet_pool_t *pool) 
+{ 
+   vqarray_foreach(pool->slabs, free); 
+   vqarray_free(pool->slabs); 
+   free(pool);
+}
+
+void ts_packet_pool_free(ts_packet_pool_t *pool) 
+{ 
+   if (pool == NULL) return; 
+   ts_packet_pool_set_concurrent(pool, 0); 
+   if (pool->num_outstanding > 0) 
+   {
+      pool->closing = 1; 
+      return;
+   }
+   ts_packet_pool_destroy(pool);
+}
+
+// move packets returned in concurrent mode to the free list
+static void ts_packet_pool_reclaim(ts_packet_pool_t *pool) 
+{ 
+   ts_pool_entry_t *e = __atomic_exchange_n((ts_pool_entry_t **)&pool->returned, NULL, __ATOMIC_ACQUIRE); 
+   while (e != NULL) 
+   {
+      ts_pool_entry_t *next = e->next; 
+      e->next = pool->free_list; 
+      pool->free_list = e; 
+      pool->num_outstanding--; 
+      e = next;
+   }
+}
+
+void ts_packet_pool_set_concurrent(ts_packet_pool_t *pool, int concurrent) 
+{ 
+   if (pool == NULL) return; 
+   ts_packet_pool_reclaim(pool); 
+   pool->concurrent = concurrent;
+}
+
+ts_packet_t* ts_packet_pool_get(ts_packet_pool_t *pool) 
+{ 
+   if (pool == NULL || pool->closing) return NULL; 
+
+   if (pool->free_list == NULL && pool->concurrent) ts_packet_pool_reclaim(pool); 
+   if (pool->free_list == NULL) 
+   {
+      ts_pool_entry_t *slab = malloc(pool->slab_size * sizeof(ts_pool_entry_t)); 
+      if (slab == NULL) return NULL; 
+      vqarray_add(pool->slabs, slab); 
+      for (size_t i = 0; i < pool->slab_size; i++) 
+      {
+         slab[i].next = (i + 1 < pool->slab_size) ? &slab[i + 1] : NULL;
+      }
+      pool->free_list = slab; 
+      pool->num_allocated += pool->slab_size;
+   }
+
+   ts_pool_entry_t *e = pool->free_list; 
+   pool->free_list = e->next; 
+   if (++pool->num_outstanding > pool->high_water_mark) pool->high_water_mark = pool->num_outstanding; 
+
+   memset(&e->ts, 0, sizeof(ts_packet_t)); 
+   e->ts.pcr_int = UINT64_MAX; 
+   e->ts.bytes = e->storage; 
+   e->ts.pool = pool; 
+   return &e->ts;
+}
+
+static void ts_packet_pool_put(ts_packet_pool_t *pool, ts_packet_t *ts) 
+{ 
+   ts_pool_entry_t *e = (ts_pool_entry_t *)ts; 
+   if (pool->concurrent) 
+   {
+      // lock-free push, only the thread using the pool pops (all at once, so no ABA)
+      e->next = __atomic_load_n((ts_pool_entry_t **)&pool->returned, __ATOMIC_RELAXED); 
+      while (!__atomic_compare_exchange_n((ts_pool_entry_t **)&pool->returned, &e->next, e, 1, 
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED)) 
+         ; 
+      return;
+   }
+   e->next = pool->free_list; 
+   pool->free_list = e; 
+   pool->num_outstanding--; 
+
+   if (pool->closing && pool->num_outstanding == 0) ts_packet_pool_destroy(pool);
+}
+
 void ts_free(ts_packet_t *ts) 
 { 
    if (ts == NULL) return; 
-   if (ts->adaptation_field.private_data_bytes.bytes != NULL) free(ts->adaptation_field.private_data_bytes.bytes); 
+   if (ts->adaptation_field.private_data_bytes.bytes != NULL && !ts->adaptation_field.private_data_view) 
+   {
+      free(ts->adaptation_field.private_data_bytes.bytes); 
+   }
    if (ts->adaptation_field.scte128_private_data != NULL)
    {
       vqarray_iterator_t *it =
@@ -67,6 +177,11 @@ void ts_free(ts_packet_t *ts)
       vqarray_iterator_free (it);
       vqarray_free(ts->adaptation_field.scte128_private_data);
    }
+   if (ts->pool != NULL) 
+   {
+      ts_packet_pool_put(ts->pool, ts); 
+      return;
+   }
    free(ts);
 }
 
@@ -166,8 +281,16 @@ int ts_read_adaptation_field(ts_adaptation_field_t *af, bs_t *b, int payload_in_
             if (af->transport_private_data_length > 0) 
             {
                af->private_data_bytes.len = af->transport_private_data_length; 
-               af->private_data_bytes.bytes = malloc(af->transport_private_data_length); 
-               bs_read_bytes(b, af->private_data_bytes.bytes, af->transport_private_data_length);
+               if (af->private_data_view) 
+               {
+                  af->private_data_bytes.bytes = b->p; 
+                  bs_skip_bytes(b, af->transport_private_data_length);
+               }
+               else 
+               {
+                  af->private_data_bytes.bytes = malloc(af->transport_private_data_length); 
+                  bs_read_bytes(b, af->private_data_bytes.bytes, af->transport_private_data_length);
+               }
             }
          }
          
@@ -217,6 +340,52 @@ int ts_read_adaptation_field(ts_adaptation_field_t *af, bs_t *b, int payload_in_
    return (1 + bs_pos(b) - start_pos);
 }
 
+static int ts_parse_scte128_af_private_view(ts_adaptation_field_t *af)
+{
+   bs_t b = { 0 };
+   bs_init(&b, af->private_data_bytes.bytes, af->private_data_bytes.len);
+
+   while (bs_bytes_left(&b))
+   {
+      ts_scte128_private_data_t *scte128 = &af->scte128_items[af->num_scte128_items];
+      uint32_t datalen;
+
+      scte128->tag = bs_read_u8(&b);
+      scte128->length = datalen = bs_read_u8(&b);
+      if (scte128->tag == 0xDF)
+      {
+         if (datalen < 4)
+         {
+            LOG_ERROR("Illegal scte128 private data! Ignoring.");
+            return 0;
+         }
+         scte128->format_identifier = bs_read_u32(&b);
+         datalen -= 4;
+      }
+      if (datalen == 0) {
+         LOG_WARN("SCTE128 data with 0-length! Ignoring.");
+         continue;
+      }
+      if (datalen > (uint32_t)bs_bytes_left(&b))
+      {
+         LOG_ERROR("Illegal scte128 private data! Ignoring.");
+         return 0;
+      }
+      if (af->num_scte128_items == TS_SCTE128_MAX_ITEMS)
+      {
+         LOG_WARN_ARGS("More than %d scte128 items in adaptation field, ignoring the rest", TS_SCTE128_MAX_ITEMS);
+         return 1;
+      }
+
+      scte128->private_data_bytes.bytes = b.p;
+      scte128->private_data_bytes.len = datalen;
+      bs_skip_bytes(&b, datalen);
+      af->num_scte128_items++;
+   }
+
+   return 1;
+}
+
 int ts_parse_scte128_af_private(ts_adaptation_field_t *af)
 {
    if (af == NULL || af->private_data_bytes.len == 0)
@@ -224,14 +393,20 @@ int ts_parse_scte128_af_private(ts_adaptation_field_t *af)
       return 0;
    }
 
-   if (af->scte128_private_data != NULL)
+   if (af->scte128_parsed || af->scte128_private_data != NULL)
    {
       LOG_WARN("adaptation field scte128 private data already parsed");
       return 0;
    }
+   af->scte128_parsed = 1;
+
+   if (af->private_data_view)
+   {
+      return ts_parse_scte128_af_private_view(af);
+   }
 
    af->scte128_private_data = vqarray_new();
-   bs_t b;
+   bs_t b = { 0 };
    bs_init(&b, af->private_data_bytes.bytes, af->private_data_bytes.len);
 
    while (bs_bytes_left(&b))
@@ -272,7 +447,21 @@ int ts_parse_scte128_af_private(ts_adaptation_field_t *af)
    return 1;
 }
 
-int ts_read(ts_packet_t *ts, uint8_t *buf, size_t buf_size) 
+int ts_scte128_private_data_count(const ts_adaptation_field_t *af)
+{
+   if (af == NULL) return 0;
+   if (af->private_data_view) return af->num_scte128_items;
+   return (af->scte128_private_data != NULL) ? vqarray_length(af->scte128_private_data) : 0;
+}
+
+ts_scte128_private_data_t* ts_scte128_private_data_get(ts_adaptation_field_t *af, int i)
+{
+   if (i < 0 || i >= ts_scte128_private_data_count(af)) return NULL;
+   if (af->private_data_view) return &af->scte128_items[i];
+   return vqarray_get(af->scte128_private_data, i);
+}
+
+static int _ts_read(ts_packet_t *ts, uint8_t *buf, size_t buf_size, int view) 
 { 
    if (buf == NULL || buf_size < TS_SIZE || ts == NULL) 
    {
@@ -294,6 +483,7 @@ int ts_read(ts_packet_t *ts, uint8_t *buf, size_t buf_size)
    if (ts->header.adaptation_field_control & TS_ADAPTATION_FIELD) 
    {
       memset(&(ts->adaptation_field), 0x00, sizeof(ts_adaptation_field_t)); 
+      ts->adaptation_field.private_data_view = view; 
       if ( (res = ts_read_adaptation_field(&(ts->adaptation_field), &b, ts->header.adaptation_field_control & TS_PAYLOAD)) < 1 )
       {
          SAFE_REPORT_TS_ERR(-3); 
@@ -313,6 +503,132 @@ int ts_read(ts_packet_t *ts, uint8_t *buf, size_t buf_size)
    return bs_pos(&b);
 }
 
+int ts_read(ts_packet_t *ts, uint8_t *buf, size_t buf_size) 
+{ 
+   return _ts_read(ts, buf, buf_size, 0);
+}
+
+int ts_read_view(ts_packet_t *ts, uint8_t *buf, size_t buf_size) 
+{ 
+   return _ts_read(ts, buf, buf_size, 1);
+}
+
+ts_header_block_t* ts_header_block_new(size_t capacity) 
+{ 
+   if (capacity == 0) return NULL; 
+
+   ts_header_block_t *blk = calloc(1, sizeof(ts_header_block_t)); 
+   if (blk == NULL) return NULL; 
+
+   // one allocation for all the arrays, PID first to keep it aligned
+   uint8_t *p = malloc(capacity * (sizeof(uint16_t) + 7)); 
+   if (p == NULL) 
+   {
+      free(blk); 
+      return NULL;
+   }
+
+   blk->capacity = capacity; 
+   blk->PID = (uint16_t *)p;                  p += capacity * sizeof(uint16_t); 
+   blk->payload_unit_start_indicator = p;     p += capacity; 
+   blk->continuity_counter = p;               p += capacity; 
+   blk->adaptation_field_control = p;         p += capacity; 
+   blk->transport_scrambling_control = p;     p += capacity; 
+   blk->transport_error_indicator = p;        p += capacity; 
+   blk->PCR_flag = p;                         p += capacity; 
+   blk->payload_offset = p; 
+
+   return blk;
+}
+
+void ts_header_block_free(ts_header_block_t *blk) 
+{ 
+   if (blk == NULL) return; 
+   free(blk->PID); 
+   free(blk);
+}
+
+/**
+ * Index of the first packet in buf not starting with a sync byte, n if all do
+ */
+static size_t ts_find_sync_loss(const uint8_t *buf, size_t n) 
+{ 
+   size_t i = 0; 
+   for (; i < n; i++) 
+   {
+      if (buf[i * TS_SIZE] != TS_SYNC_BYTE) return i;
+   }
+   return n;
+}
+
+int ts_read_batch(const uint8_t *buf, size_t n_packets, ts_header_block_t *blk) 
+{ 
+   if (buf == NULL || blk == NULL) 
+   {
+      SAFE_REPORT_TS_ERR(-1); 
+      return TS_ERROR_NOT_ENOUGH_DATA;
+   }
+
+   size_t n = (n_packets < blk->capacity) ? n_packets : blk->capacity; 
+   size_t num_synced = ts_find_sync_loss(buf, n); 
+   if (num_synced < n) 
+   {
+      LOG_ERROR_ARGS("Got 0x%02X instead of expected sync byte 0x%02X in packet %zu of batch", 
+                     buf[num_synced * TS_SIZE], TS_SYNC_BYTE, num_synced); 
+      SAFE_REPORT_TS_ERR(-2);
+   }
+
+   for (size_t i = 0; i < num_synced; i++) 
+   {
+      const uint8_t *p = buf + i * TS_SIZE; 
+      uint32_t afc = (p[3] >> 4) & 0x03; 
+      uint32_t payload_offset = TS_HEADER_SIZE; 
+
+      blk->transport_error_indicator[i] = p[1] >> 7; 
+      blk->payload_unit_start_indicator[i] = (p[1] >> 6) & 0x01; 
+      blk->PID[i] = ((p[1] & 0x1F) << 8) | p[2]; 
+      blk->transport_scrambling_control[i] = p[3] >> 6; 
+      blk->adaptation_field_control[i] = afc; 
+      blk->continuity_counter[i] = p[3] & 0x0F; 
+      blk->PCR_flag[i] = 0; 
+
+      if (afc & TS_ADAPTATION_FIELD) 
+      {
+         blk->PCR_flag[i] = (p[4] > 0) && (p[5] & 0x10); 
+         payload_offset += 1 + p[4];
+      }
+      if (!(afc & TS_PAYLOAD) || payload_offset > TS_SIZE) payload_offset = TS_SIZE; 
+      blk->payload_offset[i] = payload_offset;
+   }
+
+   blk->bytes = buf; 
+   blk->num_packets = num_synced; 
+   return (int)num_synced;
+}
+
+int ts_header_block_read_adaptation_field(const ts_header_block_t *blk, size_t i, ts_adaptation_field_t *af) 
+{ 
+   if (blk == NULL || af == NULL || i >= blk->num_packets) return 0; 
+   if (!(blk->adaptation_field_control[i] & TS_ADAPTATION_FIELD)) return 0; 
+
+   bs_t b; 
+   bs_init(&b, (uint8_t *)blk->bytes + i * TS_SIZE + TS_HEADER_SIZE, TS_SIZE - TS_HEADER_SIZE); 
+   memset(af, 0x00, sizeof(ts_adaptation_field_t)); 
+   af->private_data_view = 1; 
+   return ts_read_adaptation_field(af, &b, blk->adaptation_field_control[i] & TS_PAYLOAD);
+}
+
+int64_t ts_header_block_get_pcr(const ts_header_block_t *blk, size_t i) 
+{ 
+   if (blk == NULL || i >= blk->num_packets || !blk->PCR_flag[i] || blk->bytes[i * TS_SIZE + 4] < 7) 
+      return PCR_INVALID; 
+
+   const uint8_t *p = blk->bytes + i * TS_SIZE + 6; 
+   int64_t base = ((int64_t)p[0] << 25) | (p[1] << 17) | (p[2] << 9) | (p[3] << 1) | (p[4] >> 7); 
+   int64_t ext = ((p[4] & 0x01) << 8) | p[5]; 
+   return base * 300 + ext;
+}
+
 int ts_adaptation_field_extension_min_length(ts_adaptation_field_t *af) 
 { 
    if (!af->adaptation_field_extension_flag) return 0; 
@@ -50,6 +50,8 @@ extern "C"
 #define TS_HAS_ADAPTATION_FIELD(ts) ((ts).header.adaptation_field_control & 2)
 #define TS_HAS_PAYLOAD(ts) ((ts).header.adaptation_field_control & 1)
 
+#define TS_SCTE128_MAX_ITEMS     4   /// SCTE-128 items kept per adaptation field in view mode
+
 #define PCR_MAX          (1LL << 42)
 #define PCR_INVALID       INT64_MAX
 #define PCR_IS_VALID(P)  ( ( (P) >= 0 ) && ((P) <  PCR_MAX))
@@ -106,8 +108,16 @@ typedef struct {
 
    vqarray_t *scte128_private_data;
 
+   uint32_t private_data_view;   /// view mode: private_data_bytes and SCTE-128 items point into the
+                                 /// packet bytes and scte128_items, nothing is allocated or freed
+   uint32_t scte128_parsed;      /// ts_parse_scte128_af_private was called
+   uint32_t num_scte128_items;   /// view mode: number of valid entries in scte128_items
+   ts_scte128_private_data_t scte128_items[TS_SCTE128_MAX_ITEMS];
+
 } ts_adaptation_field_t;
 
+struct _ts_packet_pool_;
+
 typedef struct {
    ts_header_t header;
    ts_adaptation_field_t adaptation_field;
@@ -120,15 +130,124 @@ typedef struct {
 
    int status;
 
+   struct _ts_packet_pool_ *pool; /// pool this packet came from, ts_free returns it there. NULL if from ts_new
+
 } ts_packet_t;
 
+/**
+ * Packet pool. Packets are carved out of slabs, each with TS_SIZE bytes of
+ * inline storage pointed to by ts->bytes, and recycled by ts_free.
+ * Packets are taken from the pool by one thread only. By default they must
+ * be returned on that thread too; in concurrent mode ts_free may be called
+ * on any thread, see ts_packet_pool_set_concurrent.
+ */
+typedef struct _ts_packet_pool_ {
+   void *free_list;            /// recycled packets
+   void *returned;             /// packets ts_free'd in concurrent mode, moved to free_list when it runs dry
+   int concurrent;             /// ts_free may be called on threads other than the one using the pool
+   vqarray_t *slabs;           /// allocated slabs
+   size_t slab_size;           /// packets per slab
+
+   size_t num_allocated;       /// packets in all slabs
+   size_t num_outstanding;     /// packets handed out and not yet freed
+   size_t high_water_mark;     /// max num_outstanding seen
+   int closing;                /// ts_packet_pool_free called while packets were outstanding
+} ts_packet_pool_t;
+
+/**
+ * Headers of a run of contiguous TS packets, decoded by ts_read_batch into
+ * parallel arrays (one entry per packet).
+ * Adaptation fields are not decoded, see ts_header_block_read_adaptation_field.
+ */
+typedef struct {
+   const uint8_t *bytes;     /// first packet of the last batch, managed by the caller
+   size_t num_packets;       /// number of packets decoded by the last ts_read_batch
+   size_t capacity;          /// number of entries in each of the arrays below
+
+   uint16_t *PID;
+   uint8_t *payload_unit_start_indicator;
+   uint8_t *continuity_counter;
+   uint8_t *adaptation_field_control;
+   uint8_t *transport_scrambling_control;
+   uint8_t *transport_error_indicator;
+   uint8_t *PCR_flag;        /// adaptation field present and carries a PCR
+   uint8_t *payload_offset;  /// offset of the payload within the packet, TS_SIZE if there is none
+} ts_header_block_t;
+
 ts_packet_t* ts_new();
 void ts_free(ts_packet_t *ts);
 
+/**
+ * Create a packet pool growing by slab_size packets at a time
+ */
+ts_packet_pool_t* ts_packet_pool_new(size_t slab_size);
+
+/**
+ * Free a packet pool. If packets are still outstanding, the pool is freed
+ * when the last of them goes through ts_free.
+ */
+void ts_packet_pool_free(ts_packet_pool_t *pool);
+
+/**
+ * Switch concurrent mode on or off. In concurrent mode ts_free pushes packets
+ * onto a lock-free list, so they can be returned on any thread, and
+ * num_outstanding is only brought up to date when the pool runs out of
+ * recycled packets. Must be switched while no other thread is using
+ * the pool's packets; switching it off reclaims all returned packets.
+ * ts_packet_pool_free switches it off.
+ */
+void ts_packet_pool_set_concurrent(ts_packet_pool_t *pool, int concurrent);
+
+/**
+ * Get a packet from the pool, initialized as by ts_new. ts->bytes points to
+ * TS_SIZE bytes of storage owned by the packet.
+ */
+ts_packet_t* ts_packet_pool_get(ts_packet_pool_t *pool);
+
+/**
+ * Allocate a header block for up to capacity packets
+ */
+ts_header_block_t* ts_header_block_new(size_t capacity);
+void ts_header_block_free(ts_header_block_t *blk);
+
+/**
+ * Decode the headers of up to n_packets contiguous TS packets
+ * 
+ * @param buf packets, TS_SIZE bytes each. Must stay valid as long as blk is
+ *        used to access packet bytes.
+ * @param n_packets number of packets in buf; at most blk->capacity are decoded
+ * @param blk header block to fill
+ * 
+ * @return number of packets decoded. Decoding stops at the first packet
+ *         without a sync byte, the caller is expected to resync there.
+ */
+int ts_read_batch(const uint8_t *buf, size_t n_packets, ts_header_block_t *blk);
+
+/**
+ * Fully decode the adaptation field of packet i of the last batch, in view mode
+ * 
+ * @return same as ts_read_adaptation_field, 0 if the packet has no adaptation field
+ */
+int ts_header_block_read_adaptation_field(const ts_header_block_t *blk, size_t i, ts_adaptation_field_t *af);
+
+/**
+ * PCR of packet i of the last batch, in 27MHz units, PCR_INVALID if it has none
+ */
+int64_t ts_header_block_get_pcr(const ts_header_block_t *blk, size_t i);
+
 int ts_read_header(ts_header_t *tsh, bs_t *b);
 int ts_read_adaptation_field(ts_adaptation_field_t *af, bs_t *b, int payload_in_tp);
 int ts_read(ts_packet_t *ts, uint8_t *buf, size_t buf_size);
 
+/**
+ * Same as ts_read, but in view mode: adaptation field private data, and
+ * SCTE-128 items parsed from it, point into buf rather than into copies.
+ * buf must outlive the packet (e.g. ts->bytes of a pooled packet).
+ * 
+ * @see ts_adaptation_field_t.private_data_view
+ */
+int ts_read_view(ts_packet_t *ts, uint8_t *buf, size_t buf_size);
+
 int ts_write_adaptation_field(ts_adaptation_field_t *af, bs_t *b);
 int ts_write_header(ts_header_t *tsh, bs_t *b);
 int ts_write(ts_packet_t *ts, uint8_t *buf, size_t buf_size);
@@ -139,6 +258,16 @@ int ts_print(const ts_packet_t *const ts, char *str, size_t str_len);
 
 int ts_parse_scte128_af_private(ts_adaptation_field_t *af);
 
+/**
+ * Number of SCTE-128 items parsed by ts_parse_scte128_af_private, in either mode
+ */
+int ts_scte128_private_data_count(const ts_adaptation_field_t *af);
+
+/**
+ * i-th SCTE-128 item parsed by ts_parse_scte128_af_private, in either mode
+ */
+ts_scte128_private_data_t* ts_scte128_private_data_get(ts_adaptation_field_t *af, int i);
+
 int64_t ts_read_pcr(const ts_packet_t* const ts);
 
 
@@ -0,0 +1,152 @@
+/*
+
+ Copyright (c) 2012-, ISO/IEC JTC1/SC29/WG11
+ Written by Alex Giladi <alex.giladi@gmail.com>
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of the ISO/IEC nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _DEFAULT_SOURCE        // madvise
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ts_file.h"
+#include "libts_common.h"
+#include "log.h"
+
+ts_file_t* ts_file_open(const char *path, int flags) 
+{ 
+   int fd = open(path, O_RDONLY); 
+   if (fd < 0) 
+   {
+      LOG_ERROR_ARGS("Cannot open %s: %s", path, strerror(errno)); 
+      return NULL;
+   }
+   
+   struct stat st; 
+   if (fstat(fd, &st) != 0) 
+   {
+      LOG_ERROR_ARGS("Cannot stat %s: %s", path, strerror(errno)); 
+      close(fd); 
+      return NULL;
+   }
+   
+   ts_file_t *f = calloc(1, sizeof(ts_file_t)); 
+   if (f == NULL) 
+   {
+      close(fd); 
+      return NULL;
+   }
+   f->size = st.st_size; 
+   ts_sync_init(&f->sync, 0); 
+   
+   if (f->size > 0) 
+   {
+      void *data = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0); 
+      if (data == MAP_FAILED) 
+      {
+         LOG_ERROR_ARGS("Cannot map %s: %s", path, strerror(errno)); 
+         free(f); 
+         close(fd); 
+         return NULL;
+      }
+      f->data = data; 
+      
+      madvise(data, f->size, MADV_SEQUENTIAL); 
+#ifdef MADV_HUGEPAGE
+      if ((flags & TS_FILE_HUGE_PAGES) && madvise(data, f->size, MADV_HUGEPAGE) != 0) 
+      {
+         LOG_INFO_ARGS("No huge pages for %s: %s", path, strerror(errno));
+      }
+#else
+      (void)flags; 
+#endif
+   }
+   close(fd); // the mapping keeps the file
+   
+   return f;
+}
+
+void ts_file_close(ts_file_t *f) 
+{ 
+   if (f == NULL) return; 
+   if (f->data != NULL) munmap((void *)f->data, f->size); 
+   free(f);
+}
+
+const uint8_t* ts_file_next(ts_file_t *f) 
+{ 
+   if (f == NULL || f->data == NULL) return NULL; 
+   return ts_sync_next(&f->sync, f->data, f->size, &f->pos, 1);
+}
+
+int ts_file_read(ts_file_t *f, ts_packet_t *ts) 
+{ 
+   if (ts == NULL) return 0; 
+   const uint8_t *p = ts_file_next(f); 
+   if (p == NULL) return 0; 
+   ts->bytes = (uint8_t *)p; 
+   return ts_read_view(ts, ts->bytes, TS_SIZE);
+}
+
+size_t ts_file_read_stream(ts_file_t *f, mpeg2ts_stream_t *m2s, size_t max_packets) 
+{ 
+   if (f == NULL || m2s == NULL) return 0; 
+   
+   size_t n = 0; 
+   while (max_packets == 0 || n < max_packets) 
+   {
+      const uint8_t *p = ts_file_next(f); 
+      if (p == NULL) break; 
+      n++; 
+      
+      if (!mpeg2ts_stream_wants_packet(m2s, p)) 
+      {
+         m2s->num_packets_filtered++; 
+         continue;
+      }
+      
+      ts_packet_t *ts = mpeg2ts_stream_new_ts_packet(m2s); 
+      if (ts == NULL) 
+      {
+         LOG_ERROR("Out of memory for TS packets"); 
+         ts_sync_unread(&f->sync, f->data, p, &f->pos); // read it again next time
+         return n - 1;
+      }
+      ts->bytes = (uint8_t *)p; 
+      if (!ts_read_view(ts, ts->bytes, TS_SIZE)) 
+      {
+         ts_free(ts);   // broken packet, already reported
+         continue;
+      }
+      mpeg2ts_stream_read_ts_packet(m2s, ts);
+   }
+   return n;
+}
@@ -0,0 +1,112 @@
+/*
+
+ Copyright (c) 2012-, ISO/IEC JTC1/SC29/WG11
+ Written by Alex Giladi <alex.giladi@gmail.com>
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of the ISO/IEC nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TSLIB_TS_FILE_H_
+#define _TSLIB_TS_FILE_H_        
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "ts.h"
+#include "ts_sync.h"
+#include "mpeg2ts_demux.h"
+
+#ifdef __cplusplus
+extern "C" 
+{
+#endif
+
+#define TS_FILE_HUGE_PAGES     0x01   /// ask for (transparent) huge pages on the mapping, ignored if unsupported
+
+/**
+ * Recorded transport stream read straight out of a read-only memory mapping.
+ * Packets are handed out as pointers into the mapping, so nothing is read 
+ * into a bounce buffer or copied per packet. Packet size (188, 192 or 204 
+ * bytes) is detected by ts_sync_next; leading junk and sync losses are skipped.
+ */
+typedef struct 
+{
+   const uint8_t *data;          /// mapped file, NULL if empty
+   size_t size;                  /// file size
+   size_t pos;                   /// offset of the next packet, including any M2TS header
+   ts_sync_t sync;               /// packet size, packets read and bytes lost, see ts_sync_t
+} ts_file_t; 
+
+/**
+ * Map a transport stream file. The mapping is advised for sequential access,
+ * so the kernel reads ahead aggressively and drops pages behind.
+ * 
+ * @param path file name
+ * @param flags 0 or TS_FILE_HUGE_PAGES
+ * @return file, or NULL if it could not be opened or mapped (reported)
+ */
+ts_file_t* ts_file_open(const char *path, int flags); 
+
+/**
+ * Unmap the file. Packets read from it, including those still queued in a
+ * mpeg2ts_stream_t, must not be used afterwards.
+ */
+void ts_file_close(ts_file_t *f); 
+
+/**
+ * Get the next TS packet: TS_SIZE bytes starting with the sync byte, i.e.
+ * past the M2TS header or before the Reed-Solomon parity. The bytes are read 
+ * only and valid until ts_file_close.
+ * 
+ * @return packet, or NULL at the end of the file
+ */
+const uint8_t* ts_file_next(ts_file_t *f); 
+
+/**
+ * Parse the next packet into ts with ts_read_view, without copying it: 
+ * ts->bytes points into the mapping and must not be written to.
+ * 
+ * @return as ts_read_view, 0 at the end of the file
+ */
+int ts_file_read(ts_file_t *f, ts_packet_t *ts); 
+
+/**
+ * Feed packets into a stream, as by mpeg2ts_stream_read_ts_packet with 
+ * packets from its pool pointing into the mapping. Packets the stream has no
+ * use for are dropped before parsing (see mpeg2ts_stream_wants_packet).
+ * 
+ * @param f file
+ * @param m2s MPEG-2 TS multiplex
+ * @param max_packets stop after this many packets, 0 for the whole file
+ * @return number of packets consumed: max_packets, or fewer at the end of the 
+ *         file (0 past it) or if out of memory, in which case the packet that
+ *         could not be fed is read again by the next call
+ */
+size_t ts_file_read_stream(ts_file_t *f, mpeg2ts_stream_t *m2s, size_t max_packets); 
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _TSLIB_TS_FILE_H_
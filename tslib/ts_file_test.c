@@ -0,0 +1,267 @@
+/*
+
+ Copyright (c) 2012-, ISO/IEC JTC1/SC29/WG11
+ Written by Alex Giladi <alex.giladi@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of the ISO/IEC nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _DEFAULT_SOURCE        // mkstemp
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "ts_file.h"
+#include "mpeg2ts_demux.h"
+#include "ts_test_util.h"
+#include "test_macros.h"
+
+
+int verbose = 0;
+
+/**
+ * Write TS packets to a temporary file in packet_size packetization,
+ * preceded by junk_len bytes without a sync byte in them
+ */
+static int write_ts_file(char *path, const uint8_t *pkts, int num_packets, int packet_size, int junk_len)
+{
+   uint8_t *buf = malloc(junk_len + (size_t)num_packets * packet_size);
+   uint8_t *p = buf;
+
+   memset(p, 0x11, junk_len);
+   p += junk_len;
+   for (int i = 0; i < num_packets; i++)
+   {
+      memset(p, 0xAA, packet_size);                 // Reed-Solomon parity
+      if (packet_size == M2TS_PACKET_SIZE)
+      {
+         uint32_t ats = i * 1000;                   // copy permission 0, arrival time stamp
+         *p++ = (ats >> 24) & 0x3F; *p++ = ats >> 16; *p++ = ats >> 8; *p++ = ats;
+         memcpy(p, pkts + i * TS_SIZE, TS_SIZE);
+         p += TS_SIZE;
+      }
+      else
+      {
+         memcpy(p, pkts + i * TS_SIZE, TS_SIZE);
+         p += packet_size;
+      }
+   }
+
+   int r = ts_test_write_file(path, buf, p - buf);
+   free(buf);
+   return r;
+}
+
+START_TEST(test_packet_sizes)
+{
+   const int num_packets = 100;
+   const int junk_len = 37;
+   const int packet_sizes[] = { TS_SIZE, M2TS_PACKET_SIZE, TS_RS_PACKET_SIZE };
+   uint8_t *pkts = malloc(num_packets * TS_SIZE);
+   char path[64];
+
+   for (int i = 0; i < num_packets; i++)
+   {
+      ts_test_write_pes_packet(pkts + i * TS_SIZE, TS_TEST_ES_PID, i, 0, 0xE0, 0, 0);
+   }
+
+   for (int k = 0; k < 3; k++)
+   {
+      int packet_size = packet_sizes[k];
+      fail_unless(write_ts_file(path, pkts, num_packets, packet_size, junk_len), "cannot write file");
+      ts_file_t *f = ts_file_open(path, TS_FILE_HUGE_PAGES);
+      fail_unless(f != NULL, "cannot open file");
+      if (f == NULL) break;
+
+      ts_packet_t *ts = ts_new();
+      int n = 0;
+      int in_place = 1;
+      while (ts_file_read(f, ts))
+      {
+         size_t offset = junk_len + (size_t)n * packet_size + (packet_size == M2TS_PACKET_SIZE ? 4 : 0);
+         in_place &= (ts->bytes == f->data + offset);
+         fail_unless2(ts->header.PID == TS_TEST_ES_PID && ts->header.continuity_counter == (n & 0x0F),
+                      "wrong packet", "(%d-byte packet %d)", packet_size, n);
+         n++;
+      }
+      ts->bytes = NULL;
+      ts_free(ts);
+
+      fail_unless2(f->sync.packet_size == packet_size, "wrong packet size", "(%d instead of %d)", f->sync.packet_size, packet_size);
+      fail_unless2(n == num_packets, "wrong number of packets", "(%d %d-byte packets)", n, packet_size);
+      fail_unless(in_place, "packet not read in place");
+      fail_unless2(f->sync.num_bytes_lost == (uint64_t)junk_len, "wrong number of bytes skipped", 
+                   "(%llu)", (unsigned long long)f->sync.num_bytes_lost);
+
+      ts_file_close(f);
+      unlink(path);
+   }
+
+   free(pkts);
+}
+END_TEST
+
+START_TEST(test_sync_loss)
+{
+   const int num_packets = 100;
+   uint8_t *pkts = malloc(num_packets * TS_SIZE);
+   char path[64];
+
+   for (int i = 0; i < num_packets; i++)
+   {
+      ts_test_write_pes_packet(pkts + i * TS_SIZE, TS_TEST_ES_PID, i, 0, 0xE0, 0, 0);
+   }
+   // packet 40 lost its first 50 bytes, the rest of it is skipped to get back in sync
+   memmove(pkts + 40 * TS_SIZE, pkts + 40 * TS_SIZE + 50, (num_packets - 40) * TS_SIZE - 50);
+
+   fail_unless(ts_test_write_file(path, pkts, num_packets * TS_SIZE - 50), "cannot write file");
+   ts_file_t *f = ts_file_open(path, 0);
+   fail_unless(f != NULL, "cannot open file");
+   if (f == NULL) return 0;
+
+   int n = 0;
+   int num_good = 0;
+   const uint8_t *p;
+   while ((p = ts_file_next(f)) != NULL)
+   {
+      n++;
+      num_good += (p[1] & 0x1F) == (TS_TEST_ES_PID >> 8) && p[2] == (TS_TEST_ES_PID & 0xFF);
+   }
+   fail_unless2(n == num_packets - 1, "wrong number of packets", "(%d)", n);
+   fail_unless2(num_good == num_packets - 1, "wrong number of intact headers", "(%d)", num_good);
+   fail_unless2(f->sync.num_bytes_lost == TS_SIZE - 50, "wrong number of bytes skipped", 
+                "(%llu)", (unsigned long long)f->sync.num_bytes_lost);
+
+   ts_file_close(f);
+   unlink(path);
+   free(pkts);
+}
+END_TEST
+
+START_TEST(test_read_stream)
+{
+   const int num_packets = 3002;
+   uint8_t *pkts = malloc(num_packets * TS_SIZE);
+   char path[64];
+
+   ts_test_build_stream(pkts, num_packets, 3);
+   fail_unless(write_ts_file(path, pkts, num_packets, M2TS_PACKET_SIZE, 0), "cannot write file");
+   ts_file_t *f = ts_file_open(path, 0);
+   fail_unless(f != NULL, "cannot open file");
+   if (f == NULL) return 0;
+
+   mpeg2ts_stream_t *m2s = mpeg2ts_stream_new();
+   m2s->pat_processor = ts_test_set_pmt_processor;
+   uint64_t num_delivered = 0;
+   m2s->arg = &num_delivered;
+
+   size_t total = 0, n;
+   while ((n = ts_file_read_stream(f, m2s, 7)) > 0)
+   {
+      fail_unless(n <= 7, "max_packets exceeded");
+      total += n;
+   }
+   fail_unless2(total == (size_t)num_packets, "wrong number of packets consumed", "(%zu)", total);
+   fail_unless2(num_delivered == 2000, "wrong number of packets delivered", 
+                "(%llu)", (unsigned long long)num_delivered);
+   fail_unless2(m2s->num_packets_filtered == 1000, "wrong number of packets filtered", 
+                "(%llu)", (unsigned long long)m2s->num_packets_filtered);
+   fail_unless(m2s->ts_pool->num_outstanding == 0, "packets not recycled");
+
+   mpeg2ts_stream_free(m2s);
+   ts_file_close(f);
+   unlink(path);
+   free(pkts);
+}
+END_TEST
+
+START_TEST(test_read_stream_benchmark)
+{
+   const int num_packets = 100000;
+   const size_t bounce_size = 1 << 20;
+   uint8_t *pkts = malloc(num_packets * TS_SIZE);
+   uint8_t *bounce = malloc(bounce_size);
+   char path[64];
+
+   ts_test_build_stream(pkts, num_packets, num_packets);
+   fail_unless(write_ts_file(path, pkts, num_packets, TS_SIZE, 0), "cannot write file");
+
+   uint64_t num_delivered = 0;
+   uint64_t t1 = gettimeusec();
+   mpeg2ts_stream_t *m2s = mpeg2ts_stream_new();
+   m2s->pat_processor = ts_test_set_pmt_processor;
+   m2s->arg = &num_delivered;
+   FILE *fp = fopen(path, "rb");
+   size_t len;
+   while (fp != NULL && (len = fread(bounce, 1, bounce_size, fp)) > 0)
+   {
+      mpeg2ts_stream_read_buffer(m2s, bounce, len);
+   }
+   if (fp != NULL) fclose(fp);
+   mpeg2ts_stream_free(m2s);
+   uint64_t t2 = gettimeusec();
+   fail_unless(num_delivered == (uint64_t)num_packets - 2, "not all packets delivered (fread)");
+
+   num_delivered = 0;
+   uint64_t t3 = gettimeusec();
+   m2s = mpeg2ts_stream_new();
+   m2s->pat_processor = ts_test_set_pmt_processor;
+   m2s->arg = &num_delivered;
+   ts_file_t *f = ts_file_open(path, 0);
+   ts_file_read_stream(f, m2s, 0);
+   mpeg2ts_stream_free(m2s);
+   ts_file_close(f);
+   uint64_t t4 = gettimeusec();
+   fail_unless(num_delivered == (uint64_t)num_packets - 2, "not all packets delivered (mmap)");
+
+   printf("# %d packets from file: %.0f packets/sec (fread + read_buffer), %.0f packets/sec (ts_file)\n", num_packets,
+          (double)num_packets * 1000000.0 / (double)(t2 - t1 + 1),
+          (double)num_packets * 1000000.0 / (double)(t4 - t3 + 1));
+
+   unlink(path);
+   free(bounce);
+   free(pkts);
+}
+END_TEST
+
+int main(int argc, char **argv)
+{
+   int _testnum = 1;
+   int failed = 0;
+   int r;
+
+   if (argc > 1 && strcmp(argv[1], "-v") == 0) verbose = 1;
+   tslib_loglevel = verbose ? TSLIB_LOG_LEVEL_INFO : TSLIB_LOG_LEVEL_ERROR;
+
+   r = test_packet_sizes(); ok(r, "packet_sizes"); failed += !r;
+   r = test_sync_loss(); ok(r, "sync_loss"); failed += !r;
+   r = test_read_stream(); ok(r, "read_stream"); failed += !r;
+   r = test_read_stream_benchmark(); ok(r, "read_stream_benchmark"); failed += !r;
+
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
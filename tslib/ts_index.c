@@ -0,0 +1,361 @@
+/*
+
+ Copyright (c) 2012-, ISO/IEC JTC1/SC29/WG11
+ Written by Alex Giladi <alex.giladi@gmail.com>
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of the ISO/IEC nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _DEFAULT_SOURCE        // madvise
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ts_index.h"
+#include "ts_file.h"
+#include "ebp.h"
+#include "pes.h"
+#include "psi.h"
+#include "log.h"
+
+#define TS_INDEX_PTS_WRAP      (1ULL << 33)
+
+typedef struct 
+{
+   uint64_t time;                /// last PTS on the PID, extended
+   int has_time; 
+   uint64_t pcr_time;            /// last PCR / 300 on the PID, extended on its own
+   int has_pcr_time; 
+} ts_index_pid_t; 
+
+static uint64_t ts_index_read_timestamp(const uint8_t *p)
+{
+   return ((uint64_t)((p[0] >> 1) & 0x07) << 30) | ((uint64_t)p[1] << 22) |
+          ((uint64_t)(p[2] >> 1) << 15) | ((uint64_t)p[3] << 7) | (p[4] >> 1);
+}
+
+static void ts_index_read_pes_header(const ts_packet_t *ts, ts_index_entry_t *e)
+{
+   const uint8_t *p = ts->payload.bytes;
+   if (!ts->header.payload_unit_start_indicator || p == NULL || ts->payload.len < 14)
+   {
+      return;
+   }
+   if (p[0] != 0 || p[1] != 0 || p[2] != 1 || !HAS_PES_HEADER(p[3]) || (p[6] & 0xC0) != 0x80)
+   {
+      return;
+   }
+   
+   int pts_dts_flags = p[7] >> 6; 
+   if (pts_dts_flags & 0x02)
+   {
+      e->pts = ts_index_read_timestamp(p + 9); 
+      e->flags |= TS_INDEX_PTS;
+   }
+   if (pts_dts_flags == 0x03 && ts->payload.len >= 19)
+   {
+      e->dts = ts_index_read_timestamp(p + 14); 
+      e->flags |= TS_INDEX_DTS;
+   }
+}
+
+// time of t (33 bits) after last, counting on past 2^33 if it wrapped; going back a bit is allowed, down to 0
+static uint64_t ts_index_extend_time(uint64_t last, uint64_t t)
+{
+   uint64_t delta = (t - last) & (TS_INDEX_PTS_WRAP - 1); 
+   if (delta < TS_INDEX_PTS_WRAP / 2) return last + delta; 
+   delta = TS_INDEX_PTS_WRAP - delta; 
+   return (last >= delta) ? last - delta : 0;
+}
+
+static int ts_index_compare(const void *a, const void *b)
+{
+   const ts_index_entry_t *x = a; 
+   const ts_index_entry_t *y = b; 
+   if (x->pid != y->pid) return (x->pid < y->pid) ? -1 : 1; 
+   if (x->time != y->time) return (x->time < y->time) ? -1 : 1; 
+   if (x->offset != y->offset) return (x->offset < y->offset) ? -1 : 1; 
+   return 0;
+}
+
+static int ts_index_write(const char *index_path, const ts_index_header_t *header, const ts_index_entry_t *entries)
+{
+   size_t path_len = strlen(index_path); 
+   char *tmp_path = malloc(path_len + 5); 
+   if (tmp_path == NULL) return 0; 
+   memcpy(tmp_path, index_path, path_len); 
+   memcpy(tmp_path + path_len, ".tmp", 5); 
+   
+   FILE *f = fopen(tmp_path, "wb"); 
+   if (f == NULL) 
+   {
+      LOG_ERROR_ARGS("Cannot create %s: %s", tmp_path, strerror(errno)); 
+      free(tmp_path); 
+      return 0;
+   }
+   
+   int ok = (fwrite(header, sizeof(ts_index_header_t), 1, f) == 1) && 
+            (fwrite(entries, sizeof(ts_index_entry_t), header->num_entries, f) == header->num_entries); 
+   ok = (fclose(f) == 0) && ok; 
+   if (ok && rename(tmp_path, index_path) != 0) 
+   {
+      ok = 0;
+   }
+   if (!ok) 
+   {
+      LOG_ERROR_ARGS("Cannot write %s: %s", index_path, strerror(errno)); 
+      unlink(tmp_path);
+   }
+   free(tmp_path); 
+   return ok;
+}
+
+int ts_index_build(const char *ts_path, const char *index_path) 
+{ 
+   ts_file_t *f = ts_file_open(ts_path, 0); 
+   if (f == NULL) return 0; 
+   
+   ts_index_pid_t *pids = calloc(NUM_PIDS, sizeof(ts_index_pid_t)); 
+   ts_packet_t *ts = ts_new(); 
+   ts_index_entry_t *entries = NULL; 
+   size_t num_entries = 0; 
+   size_t max_entries = 0; 
+   int ok = (pids != NULL && ts != NULL); 
+   
+   const uint8_t *p; 
+   while (ok && (p = ts_file_next(f)) != NULL) 
+   {
+      // only packets with an adaptation field are of interest, look before parsing
+      if (!(p[3] & 0x20) || p[4] == 0) continue; 
+      if (!ts_read_view(ts, (uint8_t *)p, TS_SIZE)) continue; 
+      
+      ts_index_entry_t e; 
+      memset(&e, 0, sizeof(e)); 
+      
+      ebp_info_t ebp; 
+      if (ebp_decode_ts_packet(ts, 0, &ebp, NULL)) 
+      {
+         if (ebp.ebp_fragment_flag) e.flags |= TS_INDEX_FRAGMENT; 
+         if (ebp.ebp_segment_flag) e.flags |= TS_INDEX_SEGMENT; 
+         if (ebp.ebp_sap_flag) 
+         {
+            e.flags |= TS_INDEX_SAP; 
+            e.sap_type = ebp.ebp_sap_type;
+         }
+      }
+      if (ts->adaptation_field.random_access_indicator) e.flags |= TS_INDEX_RAP; 
+      if (ts->adaptation_field.PCR_flag) 
+      {
+         e.pcr = ts->adaptation_field.program_clock_reference_base * 300 + 
+                 ts->adaptation_field.program_clock_reference_extension; 
+         e.flags |= TS_INDEX_PCR;
+      }
+      if (!(e.flags & (TS_INDEX_FRAGMENT | TS_INDEX_SEGMENT | TS_INDEX_RAP | TS_INDEX_PCR))) continue; 
+      
+      ts_index_read_pes_header(ts, &e); 
+      e.pid = ts->header.PID; 
+      e.offset = (p - f->data) - f->sync.sync_offset; 
+      
+      // PTS and PCR are different clocks: a PCR neither moves nor takes the PTS timeline
+      ts_index_pid_t *pid = &pids[e.pid]; 
+      if (e.flags & (TS_INDEX_PTS | TS_INDEX_DTS)) 
+      {
+         uint64_t t = (e.flags & TS_INDEX_PTS) ? e.pts : e.dts; 
+         pid->time = pid->has_time ? ts_index_extend_time(pid->time, t) : t; 
+         pid->has_time = 1; 
+         e.time = pid->time;
+      }
+      else if (e.flags & TS_INDEX_PCR) 
+      {
+         uint64_t t = (e.pcr / 300) & (TS_INDEX_PTS_WRAP - 1); 
+         pid->pcr_time = pid->has_pcr_time ? ts_index_extend_time(pid->pcr_time, t) : t; 
+         pid->has_pcr_time = 1; 
+         e.time = pid->pcr_time;
+      }
+      else 
+      {
+         e.time = pid->time;
+      }
+      
+      if (num_entries == max_entries) 
+      {
+         size_t n = (max_entries == 0) ? 4096 : 2 * max_entries; 
+         ts_index_entry_t *tmp = realloc(entries, n * sizeof(ts_index_entry_t)); 
+         if (tmp == NULL) 
+         {
+            LOG_ERROR("Out of memory for index entries"); 
+            ok = 0; 
+            break;
+         }
+         entries = tmp; 
+         max_entries = n;
+      }
+      entries[num_entries++] = e;
+   }
+   
+   if (ok) 
+   {
+      // mostly sorted already, per PID
+      qsort(entries, num_entries, sizeof(ts_index_entry_t), ts_index_compare); 
+      
+      ts_index_header_t header; 
+      memset(&header, 0, sizeof(header)); 
+      header.magic = TS_INDEX_MAGIC; 
+      header.version = TS_INDEX_VERSION; 
+      header.entry_size = sizeof(ts_index_entry_t); 
+      header.packet_size = f->sync.packet_size ? f->sync.packet_size : TS_SIZE; 
+      header.ts_size = f->size; 
+      header.num_entries = num_entries; 
+      ok = ts_index_write(index_path, &header, entries); 
+      LOG_INFO_ARGS("Indexed %s: %zu entries in %llu packets", ts_path, num_entries, (unsigned long long)f->sync.num_packets);
+   }
+   
+   free(entries); 
+   if (ts != NULL) 
+   {
+      ts->bytes = NULL; 
+      ts_free(ts);
+   }
+   free(pids); 
+   ts_file_close(f); 
+   return ok;
+}
+
+ts_index_t* ts_index_open(const char *index_path, uint64_t ts_size, int packet_size) 
+{ 
+   int fd = open(index_path, O_RDONLY); 
+   if (fd < 0) 
+   {
+      LOG_ERROR_ARGS("Cannot open %s: %s", index_path, strerror(errno)); 
+      return NULL;
+   }
+   
+   struct stat st; 
+   if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ts_index_header_t)) 
+   {
+      LOG_ERROR_ARGS("%s is not a TS index", index_path); 
+      close(fd); 
+      return NULL;
+   }
+   
+   void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0); 
+   close(fd); 
+   if (data == MAP_FAILED) 
+   {
+      LOG_ERROR_ARGS("Cannot map %s: %s", index_path, strerror(errno)); 
+      return NULL;
+   }
+   
+   const ts_index_header_t *header = data; 
+   if (header->magic != TS_INDEX_MAGIC || header->version != TS_INDEX_VERSION || 
+       header->entry_size != sizeof(ts_index_entry_t) || 
+       header->num_entries > ((size_t)st.st_size - sizeof(ts_index_header_t)) / sizeof(ts_index_entry_t)) 
+   {
+      LOG_ERROR_ARGS("%s is not a TS index of version %d, or is truncated", index_path, TS_INDEX_VERSION); 
+      munmap(data, st.st_size); 
+      return NULL;
+   }
+   if ((header->packet_size != TS_SIZE && header->packet_size != M2TS_PACKET_SIZE && header->packet_size != TS_RS_PACKET_SIZE) || 
+       (ts_size != 0 && header->ts_size != ts_size) || 
+       (packet_size != 0 && header->packet_size != (uint32_t)packet_size)) 
+   {
+      LOG_ERROR_ARGS("%s indexes a %llu-byte file of %u-byte packets, not this one", index_path, 
+                     (unsigned long long)header->ts_size, header->packet_size); 
+      munmap(data, st.st_size); 
+      return NULL;
+   }
+   madvise(data, st.st_size, MADV_RANDOM); 
+   
+   ts_index_t *idx = calloc(1, sizeof(ts_index_t)); 
+   if (idx == NULL) 
+   {
+      munmap(data, st.st_size); 
+      return NULL;
+   }
+   idx->header = header; 
+   idx->entries = (const ts_index_entry_t *)(header + 1); 
+   idx->size = st.st_size; 
+   return idx;
+}
+
+void ts_index_close(ts_index_t *idx) 
+{ 
+   if (idx == NULL) return; 
+   munmap((void *)idx->header, idx->size); 
+   free(idx);
+}
+
+// first entry after (pid, time)
+static size_t ts_index_upper_bound(const ts_index_t *idx, uint32_t pid, uint64_t time)
+{
+   size_t lo = 0; 
+   size_t hi = idx->header->num_entries; 
+   while (lo < hi) 
+   {
+      size_t mid = lo + (hi - lo) / 2; 
+      const ts_index_entry_t *e = &idx->entries[mid]; 
+      if (e->pid < pid || (e->pid == pid && e->time <= time)) lo = mid + 1; 
+      else hi = mid;
+   }
+   return lo;
+}
+
+static const ts_index_entry_t* ts_index_find_pid(const ts_index_t *idx, uint32_t pid, uint64_t time, int flags)
+{
+   size_t i = ts_index_upper_bound(idx, pid, time); 
+   while (i > 0) 
+   {
+      const ts_index_entry_t *e = &idx->entries[--i]; 
+      if (e->pid != pid) break; 
+      if ((e->flags & flags) == flags) return e;
+   }
+   return NULL;
+}
+
+const ts_index_entry_t* ts_index_find(const ts_index_t *idx, uint32_t pid, uint64_t time, int flags) 
+{ 
+   if (idx == NULL || idx->header->num_entries == 0) return NULL; 
+   if (pid != TS_INDEX_ANY_PID) return ts_index_find_pid(idx, pid, time, flags); 
+   
+   // latest over all PIDs, skipping from one PID to the next
+   const ts_index_entry_t *best = NULL; 
+   size_t i = 0; 
+   while (i < idx->header->num_entries) 
+   {
+      uint32_t p = idx->entries[i].pid; 
+      const ts_index_entry_t *e = ts_index_find_pid(idx, p, time, flags); 
+      if (e != NULL && (best == NULL || e->time > best->time || (e->time == best->time && e->offset > best->offset))) 
+      {
+         best = e;
+      }
+      i = ts_index_upper_bound(idx, p, UINT64_MAX);
+   }
+   return best;
+}
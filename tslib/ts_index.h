@@ -0,0 +1,146 @@
+/*
+
+ Copyright (c) 2012-, ISO/IEC JTC1/SC29/WG11
+ Written by Alex Giladi <alex.giladi@gmail.com>
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of the ISO/IEC nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TSLIB_TS_INDEX_H_
+#define _TSLIB_TS_INDEX_H_        
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" 
+{
+#endif
+
+#define TS_INDEX_MAGIC         0x58495354   /// "TSIX", read back byte-swapped on a machine of the other endianness
+#define TS_INDEX_VERSION       1
+
+// ts_index_entry_t flags
+#define TS_INDEX_FRAGMENT      0x01   /// EBP fragment boundary
+#define TS_INDEX_SEGMENT       0x02   /// EBP segment boundary
+#define TS_INDEX_SAP           0x04   /// EBP with a SAP type
+#define TS_INDEX_RAP           0x08   /// random_access_indicator
+#define TS_INDEX_PCR           0x10   /// pcr is set
+#define TS_INDEX_PTS           0x20   /// pts is set
+#define TS_INDEX_DTS           0x40   /// dts is set
+
+#define TS_INDEX_ANY_PID       0xFFFFFFFF
+
+/**
+ * Sidecar index file header, followed by num_entries entries. Both are 
+ * written in host byte order.
+ */
+typedef struct 
+{
+   uint32_t magic;               /// TS_INDEX_MAGIC
+   uint32_t version;             /// TS_INDEX_VERSION
+   uint32_t entry_size;          /// sizeof(ts_index_entry_t)
+   uint32_t packet_size;         /// 188, 192 or 204
+   uint64_t ts_size;             /// size of the indexed file, to tell a stale index
+   uint64_t num_entries; 
+} ts_index_header_t; 
+
+/**
+ * Indexed packet: one with an EBP, a random_access_indicator or a PCR.
+ * Entries are sorted by PID, then time, then offset.
+ */
+typedef struct 
+{
+   uint64_t offset;              /// offset of the packet in the file, M2TS header included
+   uint64_t time;                /// PTS (else DTS), else the previous PTS on the PID; in 90kHz, counting 
+                                 /// on past 2^33 when the PID wraps, never below 0. A PCR without a 
+                                 /// PTS has PCR / 300 instead, extended on the PID's own PCR timeline
+   uint64_t pts;                 /// PTS of a PES starting in the packet
+   uint64_t dts; 
+   uint64_t pcr;                 /// 27MHz
+   uint16_t pid; 
+   uint8_t flags;                /// TS_INDEX_*
+   uint8_t sap_type;             /// with TS_INDEX_SAP
+   uint32_t reserved; 
+} ts_index_entry_t; 
+
+/**
+ * Boundary index of a recorded transport stream, read out of a read-only 
+ * memory mapping. Lookups are binary searches, so only the pages touched 
+ * by them are read in, whatever the size of the recording.
+ */
+typedef struct 
+{
+   const ts_index_header_t *header; 
+   const ts_index_entry_t *entries;   /// header->num_entries, sorted by PID, time and offset
+   size_t size;                  /// size of the mapping
+} ts_index_t; 
+
+/**
+ * Index a transport stream file: every EBP, random access point and PCR, 
+ * with its offset, PID and PTS/DTS. The index is written next to index_path
+ * and renamed into place, so a reader never sees half of it.
+ * 
+ * @param ts_path TS file, packet size detected as by ts_file_open
+ * @param index_path index file
+ * @return 1 on success, 0 on failure (reported)
+ */
+int ts_index_build(const char *ts_path, const char *index_path); 
+
+/**
+ * Map an index file. Its offsets are only good for the file it was built 
+ * from, so the size and packet size of that file are checked against it.
+ * 
+ * @param index_path index file
+ * @param ts_size size of the TS file, 0 not to check it
+ * @param packet_size packet size of the TS file (188, 192 or 204), 0 not to 
+ *                    check it
+ * @return index, or NULL if it could not be mapped, is not an index of this
+ *         version or was built for another file (reported)
+ */
+ts_index_t* ts_index_open(const char *index_path, uint64_t ts_size, int packet_size); 
+
+void ts_index_close(ts_index_t *idx); 
+
+/**
+ * Find the nearest entry at or before a time, e.g. the segment boundary to 
+ * start from when seeking to it.
+ * 
+ * @param idx index
+ * @param pid PID, or TS_INDEX_ANY_PID for the latest entry on any PID
+ * @param time in 90kHz, on the timeline of ts_index_entry_t.time: a PTS as 
+ *             is unless the PID wrapped before it. Entries with a PCR and no 
+ *             PTS are on the PCR clock instead, PCR / 300; TS_INDEX_PTS in 
+ *             flags leaves them out
+ * @param flags all of these flags must be set in the entry, e.g. 
+ *              TS_INDEX_SEGMENT; 0 for any entry
+ * @return entry, or NULL if there is none
+ */
+const ts_index_entry_t* ts_index_find(const ts_index_t *idx, uint32_t pid, uint64_t time, int flags); 
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _TSLIB_TS_INDEX_H_
@@ -0,0 +1,314 @@
+/*
+
+ Copyright (c) 2012-, ISO/IEC JTC1/SC29/WG11
+ Written by Alex Giladi <alex.giladi@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of the ISO/IEC nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _DEFAULT_SOURCE        // mkstemp
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "ts_index.h"
+#include "ts_file.h"
+#include "ts_test_util.h"
+#include "test_macros.h"
+
+#define VIDEO_PID      0x100
+#define AUDIO_PID      0x101
+#define FRAME_TICKS    3003
+#define PCR_DELAY      45000
+#define PTS_WRAP       (1ULL << 33)
+
+int verbose = 0;
+
+/**
+ * Build a stream of num_frames frames starting at PTS start_pts. Video has a
+ * fragment (EBP, random access) every 15 frames, a segment every 30, a PCR 
+ * packet every 10 and one more packet per frame; audio has a random access 
+ * point on every frame. offsets[k] is set to the packet index of the video
+ * packet of frame k.
+ *
+ * @return number of packets
+ */
+static int build_stream(uint8_t *pkts, int num_frames, uint64_t start_pts, int *offsets)
+{
+   uint8_t ebp_buf[32];
+   int n = 0;
+   int cc = 0;
+
+   for (int k = 0; k < num_frames; k++)
+   {
+      uint64_t pts = (start_pts + (uint64_t)FRAME_TICKS * k) % PTS_WRAP;
+
+      offsets[k] = n;
+      if (k % 15 == 0)
+      {
+         int len = ts_test_build_ebp(ebp_buf, 1, k % 30 == 0, 1, NULL, 0, 0);
+         ts_test_write_ebp_packet(pkts + n * TS_SIZE, VIDEO_PID, cc++, ebp_buf, len, pts);
+         pkts[n * TS_SIZE + 5] |= 0x40;                  // random_access_indicator
+      }
+      else
+      {
+         ts_test_write_pes_packet(pkts + n * TS_SIZE, VIDEO_PID, cc++, 1, 0xE0, pts, 0);
+      }
+      n++;
+      ts_test_write_pes_packet(pkts + n * TS_SIZE, VIDEO_PID, cc++, 0, 0xE0, 0, 0);
+      n++;
+
+      if (k % 10 == 0)
+      {
+         uint64_t pcr_base = (pts + PTS_WRAP - PCR_DELAY) % PTS_WRAP;
+         ts_test_write_pcr_packet(pkts + n * TS_SIZE, VIDEO_PID, cc, 7, pcr_base, 0);
+         n++;
+      }
+
+      int len = ts_test_build_ebp(ebp_buf, 0, 0, -1, NULL, 0, 0);
+      ts_test_write_ebp_packet(pkts + n * TS_SIZE, AUDIO_PID, k, ebp_buf, len, (pts + 1000) % PTS_WRAP);
+      pkts[n * TS_SIZE + 5] |= 0x40;
+      n++;
+   }
+   return n;
+}
+
+static int write_ts_file(char *path, const uint8_t *pkts, int num_packets, int packet_size)
+{
+   strcpy(path, "/tmp/ts_index_test_XXXXXX");
+   int fd = mkstemp(path);
+   if (fd < 0) return 0;
+   FILE *fp = fdopen(fd, "wb");
+   size_t n = 0;
+   for (int i = 0; i < num_packets; i++)
+   {
+      if (packet_size == M2TS_PACKET_SIZE)
+      {
+         uint8_t ats[4] = { 0, 0, i >> 8, i };
+         fwrite(ats, 1, 4, fp);
+      }
+      n += fwrite(pkts + i * TS_SIZE, TS_SIZE, 1, fp);
+   }
+   fclose(fp);
+   return n == (size_t)num_packets;
+}
+
+START_TEST(test_index)
+{
+   const int num_frames = 300;
+   const uint64_t start = PTS_WRAP - FRAME_TICKS * 100;   // wraps at frame 100
+   uint8_t *pkts = malloc(num_frames * 4 * TS_SIZE);
+   int offsets[300];
+   char path[64];
+   char index_path[80];
+   char tmp_path[96];
+
+   int num_packets = build_stream(pkts, num_frames, start, offsets);
+   const int packet_sizes[] = { TS_SIZE, M2TS_PACKET_SIZE };
+
+   for (int s = 0; s < 2; s++)
+   {
+      int packet_size = packet_sizes[s];
+      fail_unless(write_ts_file(path, pkts, num_packets, packet_size), "cannot write file");
+      snprintf(index_path, sizeof(index_path), "%s.idx", path);
+      fail_unless(ts_index_build(path, index_path), "build failed");
+      snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", index_path);
+      fail_unless(access(tmp_path, F_OK) != 0, "temporary file left behind");
+
+      ts_index_t *idx = ts_index_open(index_path, (uint64_t)num_packets * packet_size, packet_size);
+      fail_unless(idx != NULL, "open failed");
+      // video: 20 EBPs and 30 PCRs, audio: 300 random access points
+      fail_unless2(idx->header->num_entries == 350 && idx->header->packet_size == (uint32_t)packet_size &&
+                   idx->header->ts_size == (uint64_t)num_packets * packet_size, "wrong header",
+                   "(%llu entries)", (unsigned long long)idx->header->num_entries);
+      for (uint64_t i = 1; i < idx->header->num_entries; i++)
+      {
+         fail_unless2(idx->entries[i - 1].pid < idx->entries[i].pid ||
+                      (idx->entries[i - 1].pid == idx->entries[i].pid && idx->entries[i - 1].time <= idx->entries[i].time),
+                      "entries not sorted", "(%llu)", (unsigned long long)i);
+      }
+
+      // segment before frame 37
+      const ts_index_entry_t *e = ts_index_find(idx, VIDEO_PID, start + FRAME_TICKS * 37, TS_INDEX_SEGMENT);
+      fail_unless(e != NULL, "segment not found");
+      fail_unless2(e->offset == (uint64_t)offsets[30] * packet_size && e->pid == VIDEO_PID &&
+                   e->pts == (start + FRAME_TICKS * 30) % PTS_WRAP && e->sap_type == 1 &&
+                   e->flags == (TS_INDEX_FRAGMENT | TS_INDEX_SEGMENT | TS_INDEX_SAP | TS_INDEX_RAP | TS_INDEX_PTS),
+                   "wrong segment", "(offset %llu, flags 0x%02x)", (unsigned long long)e->offset, e->flags);
+
+      // fragments, exactly on one, and after the wrap
+      e = ts_index_find(idx, VIDEO_PID, start + FRAME_TICKS * 45, TS_INDEX_FRAGMENT);
+      fail_unless(e != NULL && e->offset == (uint64_t)offsets[45] * packet_size, "fragment at the time");
+      e = ts_index_find(idx, VIDEO_PID, start + FRAME_TICKS * 250 + 5, TS_INDEX_SEGMENT);
+      fail_unless2(e != NULL && e->offset == (uint64_t)offsets[240] * packet_size && e->time > PTS_WRAP &&
+                   e->pts == FRAME_TICKS * 140, "segment after the wrap", "(%p)", (void *)e);
+
+      // PCRs are PCR_DELAY behind
+      e = ts_index_find(idx, VIDEO_PID, start + FRAME_TICKS * 25, TS_INDEX_PCR);
+      fail_unless2(e != NULL && e->pcr / 300 == start + FRAME_TICKS * 30 - PCR_DELAY && !(e->flags & TS_INDEX_PTS),
+                   "wrong PCR", "(%p)", (void *)e);
+
+      // nothing before the first entry, or on other PIDs
+      fail_unless(ts_index_find(idx, VIDEO_PID, start - PCR_DELAY - 1, 0) == NULL, "entry before the first one");
+      e = ts_index_find(idx, VIDEO_PID, start - PCR_DELAY, 0);
+      fail_unless(e != NULL && e->flags == TS_INDEX_PCR && e->offset == (uint64_t)(offsets[0] + 2) * packet_size,
+                  "first entry");
+      fail_unless(ts_index_find(idx, 0x102, start + FRAME_TICKS * 100, 0) == NULL, "entry on a PID without any");
+
+      // audio random access points are 1000 ticks after the video frames
+      e = ts_index_find(idx, TS_INDEX_ANY_PID, start + FRAME_TICKS * 37 + 1000, TS_INDEX_RAP);
+      fail_unless(e != NULL && e->pid == AUDIO_PID && e->time == start + FRAME_TICKS * 37 + 1000, "latest on any PID");
+      e = ts_index_find(idx, TS_INDEX_ANY_PID, start + FRAME_TICKS * 37 + 1000, TS_INDEX_SEGMENT);
+      fail_unless(e != NULL && e->pid == VIDEO_PID && e->offset == (uint64_t)offsets[30] * packet_size,
+                  "segment on any PID");
+
+      // not for a file of another size or packet size
+      tslib_loglevel = 0;
+      fail_unless(ts_index_open(index_path, (uint64_t)num_packets * packet_size + 1, 0) == NULL, "stale index opened");
+      fail_unless(ts_index_open(index_path, 0, packet_sizes[1 - s]) == NULL, "index of another packet size opened");
+      tslib_loglevel = verbose ? TSLIB_LOG_LEVEL_INFO : TSLIB_LOG_LEVEL_ERROR;
+
+      ts_index_close(idx);
+      unlink(index_path);
+      unlink(path);
+   }
+
+   // not an index
+   fail_unless(write_ts_file(path, pkts, 10, TS_SIZE), "cannot write file");
+   tslib_loglevel = 0;
+   fail_unless(ts_index_open(path, 0, 0) == NULL, "TS file opened as an index");
+   fail_unless(ts_index_open("/nonexistent/ts_index_test.idx", 0, 0) == NULL, "missing index opened");
+   fail_unless(!ts_index_build("/nonexistent/ts_index_test.ts", "/tmp/ts_index_test.idx"), "missing TS file indexed");
+   tslib_loglevel = verbose ? TSLIB_LOG_LEVEL_INFO : TSLIB_LOG_LEVEL_ERROR;
+   unlink(path);
+
+   free(pkts);
+}
+END_TEST
+
+/**
+ * A PCR near the wrap ahead of the first PTS: the PTS timeline starts at 
+ * the PTS, and PCRs count on their own
+ */
+START_TEST(test_pcr_timeline)
+{
+   uint8_t pkts[4 * TS_SIZE];
+   uint8_t ebp_buf[32];
+   char path[64];
+   char index_path[80];
+
+   ts_test_write_pcr_packet(pkts, VIDEO_PID, 0, 7, PTS_WRAP - 1000, 0);
+   int len = ts_test_build_ebp(ebp_buf, 1, 1, 1, NULL, 0, 0);
+   ts_test_write_ebp_packet(pkts + TS_SIZE, VIDEO_PID, 1, ebp_buf, len, 1000);
+   pkts[TS_SIZE + 5] |= 0x40;                        // random_access_indicator
+   ts_test_write_pcr_packet(pkts + 2 * TS_SIZE, VIDEO_PID, 2, 7, 0, 0);
+   pkts[2 * TS_SIZE + 5] = 0x40;                     // random access, no PCR
+   ts_test_write_pcr_packet(pkts + 3 * TS_SIZE, VIDEO_PID, 3, 7, 2003, 0);
+
+   fail_unless(write_ts_file(path, pkts, 4, TS_SIZE), "cannot write file");
+   snprintf(index_path, sizeof(index_path), "%s.idx", path);
+   fail_unless(ts_index_build(path, index_path), "build failed");
+   ts_index_t *idx = ts_index_open(index_path, 4 * TS_SIZE, TS_SIZE);
+   fail_unless(idx != NULL && idx->header->num_entries == 4, "wrong number of entries");
+   if (idx == NULL) return 0;
+
+   const ts_index_entry_t *e = ts_index_find(idx, VIDEO_PID, 1000, TS_INDEX_PTS);
+   fail_unless2(e != NULL && e->offset == TS_SIZE && e->time == 1000, "PTS moved by the PCR", 
+                "(time %llu)", e ? (unsigned long long)e->time : 0ULL);
+   e = ts_index_find(idx, VIDEO_PID, 1000, TS_INDEX_RAP);
+   fail_unless(e != NULL && e->offset == 2 * TS_SIZE && e->flags == TS_INDEX_RAP && e->time == 1000, 
+               "random access point not on the PTS timeline");
+   e = ts_index_find(idx, VIDEO_PID, PTS_WRAP - 1000, TS_INDEX_PCR);
+   fail_unless(e != NULL && e->offset == 0 && e->time == PTS_WRAP - 1000, "first PCR");
+   e = ts_index_find(idx, VIDEO_PID, UINT64_MAX, TS_INDEX_PCR);
+   fail_unless(e != NULL && e->offset == 3 * TS_SIZE && e->time == PTS_WRAP + 2003, "PCR after the wrap");
+
+   ts_index_close(idx);
+   unlink(index_path);
+   unlink(path);
+}
+END_TEST
+
+START_TEST(test_index_benchmark)
+{
+   const int num_frames = 30000;
+   const int num_lookups = 1000000;
+   uint8_t *pkts = malloc((size_t)num_frames * 4 * TS_SIZE);
+   int *offsets = malloc(num_frames * sizeof(int));
+   char path[64];
+   char index_path[80];
+
+   int num_packets = build_stream(pkts, num_frames, 0, offsets);
+   fail_unless(write_ts_file(path, pkts, num_packets, TS_SIZE), "cannot write file");
+   snprintf(index_path, sizeof(index_path), "%s.idx", path);
+
+   uint64_t t1 = gettimeusec();
+   fail_unless(ts_index_build(path, index_path), "build failed");
+   uint64_t t2 = gettimeusec();
+
+   ts_index_t *idx = ts_index_open(index_path, 0, 0);
+   fail_unless(idx != NULL, "open failed");
+   int found = 0;
+   uint64_t t3 = gettimeusec();
+   for (int i = 0; i < num_lookups; i++)
+   {
+      uint64_t time = (((uint64_t)i * 7919) % num_frames) * FRAME_TICKS;
+      const ts_index_entry_t *e = ts_index_find(idx, VIDEO_PID, time, TS_INDEX_SEGMENT);
+      found += (e != NULL && e->time <= time && time - e->time < 30 * FRAME_TICKS);
+   }
+   uint64_t t4 = gettimeusec();
+   fail_unless2(found == num_lookups, "segment not found", "(%d)", found);
+
+   printf("# TS index: %.0f MB/sec built (%llu entries for %d packets), %.0f lookups/sec\n",
+          (double)num_packets * TS_SIZE / (double)(t2 - t1 + 1),
+          (unsigned long long)idx->header->num_entries, num_packets,
+          (double)num_lookups * 1000000.0 / (double)(t4 - t3 + 1));
+
+   ts_index_close(idx);
+   unlink(index_path);
+   unlink(path);
+   free(offsets);
+   free(pkts);
+}
+END_TEST
+
+int main(int argc, char **argv)
+{
+   int _testnum = 1;
+   int failed = 0;
+   int r;
+
+   if (argc > 1 && strcmp(argv[1], "-v") == 0) verbose = 1;
+   tslib_loglevel = verbose ? TSLIB_LOG_LEVEL_INFO : TSLIB_LOG_LEVEL_ERROR;
+
+   r = test_index(); ok(r, "index"); failed += !r;
+   r = test_pcr_timeline(); ok(r, "pcr_timeline"); failed += !r;
+   r = test_index_benchmark(); ok(r, "index_benchmark"); failed += !r;
+
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
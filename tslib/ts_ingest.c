@@ -0,0 +1,525 @@
+/*
+
+ Copyright (c) 2012-, ISO/IEC JTC1/SC29/WG11
+ Written by Alex Giladi <alex.giladi@gmail.com>
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of the ISO/IEC nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _DEFAULT_SOURCE        // syscall, MAP_POPULATE, pread
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define TS_INGEST_HAVE_URING 1
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#include "ts_ingest.h"
+#include "libts_common.h"
+#include "log.h"
+
+enum 
+{
+   TS_INGEST_IDLE = 0,        // free, or handed out
+   TS_INGEST_IN_FLIGHT,       // read submitted
+   TS_INGEST_DONE             // read completed, result is valid
+}; 
+
+typedef struct _ts_ingest_buffer_ 
+{
+   uint8_t *data; 
+   struct iovec iov; 
+   uint64_t offset;           // file offset read from, if seekable
+   int state; 
+   int result;                // bytes read, or -errno
+} ts_ingest_buffer_t; 
+
+#ifdef TS_INGEST_HAVE_URING
+
+// a minimal io_uring: READV requests only, one submitter, one reaper
+typedef struct _ts_ingest_uring_ 
+{
+   int fd; 
+   void *sq_ptr; 
+   size_t sq_size; 
+   void *cq_ptr; 
+   size_t cq_size; 
+   struct io_uring_sqe *sqes; 
+   size_t sqes_size; 
+   
+   unsigned *sq_tail; 
+   unsigned *sq_mask; 
+   unsigned *sq_array; 
+   unsigned *cq_head; 
+   unsigned *cq_tail; 
+   unsigned *cq_mask; 
+   struct io_uring_cqe *cqes; 
+} ts_ingest_uring_t; 
+
+static void ts_ingest_uring_free(ts_ingest_uring_t *u) 
+{ 
+   if (u == NULL) return; 
+   if (u->sqes != NULL) munmap(u->sqes, u->sqes_size); 
+   if (u->cq_ptr != NULL && u->cq_ptr != u->sq_ptr) munmap(u->cq_ptr, u->cq_size); 
+   if (u->sq_ptr != NULL) munmap(u->sq_ptr, u->sq_size); 
+   if (u->fd >= 0) close(u->fd); 
+   free(u);
+}
+
+static ts_ingest_uring_t* ts_ingest_uring_new(unsigned entries) 
+{ 
+   struct io_uring_params p; 
+   memset(&p, 0, sizeof(p)); 
+   int fd = syscall(__NR_io_uring_setup, entries, &p); 
+   if (fd < 0) 
+   {
+      LOG_INFO_ARGS("io_uring not available (%s), using blocking reads", strerror(errno)); 
+      return NULL;
+   }
+   
+   ts_ingest_uring_t *u = calloc(1, sizeof(ts_ingest_uring_t)); 
+   if (u == NULL) 
+   {
+      close(fd); 
+      return NULL;
+   }
+   u->fd = fd; 
+   u->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned); 
+   u->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe); 
+   if (p.features & IORING_FEAT_SINGLE_MMAP) 
+   {
+      if (u->cq_size > u->sq_size) u->sq_size = u->cq_size; 
+      u->cq_size = u->sq_size;
+   }
+   
+   u->sq_ptr = mmap(NULL, u->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING); 
+   if (u->sq_ptr == MAP_FAILED) 
+   {
+      u->sq_ptr = NULL; 
+      goto fail;
+   }
+   if (p.features & IORING_FEAT_SINGLE_MMAP) 
+   {
+      u->cq_ptr = u->sq_ptr;
+   }
+   else 
+   {
+      u->cq_ptr = mmap(NULL, u->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING); 
+      if (u->cq_ptr == MAP_FAILED) 
+      {
+         u->cq_ptr = NULL; 
+         goto fail;
+      }
+   }
+   u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe); 
+   u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES); 
+   if (u->sqes == MAP_FAILED) 
+   {
+      u->sqes = NULL; 
+      goto fail;
+   }
+   
+   uint8_t *sq = u->sq_ptr; 
+   uint8_t *cq = u->cq_ptr; 
+   u->sq_tail = (unsigned *)(sq + p.sq_off.tail); 
+   u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask); 
+   u->sq_array = (unsigned *)(sq + p.sq_off.array); 
+   u->cq_head = (unsigned *)(cq + p.cq_off.head); 
+   u->cq_tail = (unsigned *)(cq + p.cq_off.tail); 
+   u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask); 
+   u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes); 
+   return u; 
+   
+fail: 
+   LOG_INFO_ARGS("Cannot map io_uring (%s), using blocking reads", strerror(errno)); 
+   ts_ingest_uring_free(u); 
+   return NULL;
+}
+
+// next SQE to fill in, zeroed; only one is ever queued at a time
+static struct io_uring_sqe* ts_ingest_uring_sqe(ts_ingest_uring_t *u) 
+{ 
+   struct io_uring_sqe *sqe = &u->sqes[*u->sq_tail & *u->sq_mask]; 
+   memset(sqe, 0, sizeof(struct io_uring_sqe)); 
+   return sqe;
+}
+
+// submit the SQE from ts_ingest_uring_sqe, returns 0 or -errno. If the kernel 
+// did not take it, it is taken back off the ring, so a later enter never submits it
+static int ts_ingest_uring_submit(ts_ingest_uring_t *u) 
+{ 
+   unsigned tail = *u->sq_tail; 
+   unsigned index = tail & *u->sq_mask; 
+   u->sq_array[index] = index; 
+   __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE); 
+   
+   int ret; 
+   while ((ret = syscall(__NR_io_uring_enter, u->fd, 1, 0, 0, NULL, 0)) < 0 && errno == EINTR) 
+      ;
+   if (ret == 1) return 0; 
+   
+   int err = (ret < 0) ? -errno : -EBUSY; 
+   __atomic_store_n(u->sq_tail, tail, __ATOMIC_RELEASE); 
+   return err;
+}
+
+static int ts_ingest_uring_read(ts_ingest_uring_t *u, int fd, struct iovec *iov, uint64_t offset, uint64_t user_data) 
+{ 
+   struct io_uring_sqe *sqe = ts_ingest_uring_sqe(u); 
+   sqe->opcode = IORING_OP_READV; 
+   sqe->fd = fd; 
+   sqe->addr = (uint64_t)(uintptr_t)iov; 
+   sqe->len = 1; 
+   sqe->off = offset; 
+   sqe->user_data = user_data; 
+   return ts_ingest_uring_submit(u);
+}
+
+// ask the kernel to cancel the read submitted with user_data; the read then 
+// completes as usual, with -ECANCELED unless it got done first
+static int ts_ingest_uring_cancel(ts_ingest_uring_t *u, uint64_t user_data) 
+{ 
+   struct io_uring_sqe *sqe = ts_ingest_uring_sqe(u); 
+   sqe->opcode = IORING_OP_ASYNC_CANCEL; 
+   sqe->fd = -1; 
+   sqe->addr = user_data; 
+   sqe->user_data = UINT64_MAX;  // not a buffer, ignored when reaped
+   return ts_ingest_uring_submit(u);
+}
+
+#else
+
+typedef struct _ts_ingest_uring_ 
+{
+   int fd;
+} ts_ingest_uring_t; 
+
+static void ts_ingest_uring_free(ts_ingest_uring_t *u) 
+{ 
+   free(u);
+}
+
+static ts_ingest_uring_t* ts_ingest_uring_new(unsigned entries) 
+{ 
+   (void)entries; 
+   LOG_INFO("Built without io_uring, using blocking reads"); 
+   return NULL;
+}
+
+static int ts_ingest_uring_cancel(ts_ingest_uring_t *u, uint64_t user_data) 
+{ 
+   (void)u; 
+   (void)user_data; 
+   return -ENOSYS;
+}
+
+#endif
+
+static int ts_ingest_num_buffers(const ts_ingest_t *in) 
+{ 
+   return in->queue_depth + 1;
+}
+
+static void ts_ingest_submit(ts_ingest_t *in, int i, uint64_t offset) 
+{ 
+   ts_ingest_buffer_t *b = &in->buffers[i]; 
+   b->offset = offset; 
+   b->iov.iov_base = b->data; 
+   b->iov.iov_len = in->buffer_size; 
+   b->state = TS_INGEST_IN_FLIGHT; 
+   
+#ifdef TS_INGEST_HAVE_URING
+   // offset -1 reads from the current position, as read() does
+   int res = ts_ingest_uring_read(in->uring, in->fd, &b->iov, in->seekable ? offset : (uint64_t)-1, i); 
+#else
+   int res = -ENOSYS;
+#endif
+   if (res < 0) 
+   {
+      b->state = TS_INGEST_DONE; 
+      b->result = res;
+   }
+}
+
+// collect completed reads, waiting for at least one if wait is set; returns 0 or -errno
+static int ts_ingest_reap(ts_ingest_t *in, int wait) 
+{ 
+   int ret = 0; 
+#ifdef TS_INGEST_HAVE_URING
+   ts_ingest_uring_t *u = in->uring; 
+   if (wait) 
+   {
+      unsigned head = *u->cq_head; 
+      if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) 
+      {
+         if (syscall(__NR_io_uring_enter, u->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) 
+         {
+            ret = -errno;
+         }
+      }
+   }
+   
+   unsigned head = *u->cq_head; 
+   while (head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) 
+   {
+      struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask]; 
+      if (cqe->user_data < (uint64_t)ts_ingest_num_buffers(in)) 
+      {
+         ts_ingest_buffer_t *b = &in->buffers[cqe->user_data]; 
+         b->result = cqe->res; 
+         b->state = TS_INGEST_DONE;
+      }
+      head++;
+   }
+   __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE); 
+#else
+   (void)in; 
+   (void)wait; 
+#endif
+   return ret;
+}
+
+// keep queue_depth reads in flight, in the order the buffers are handed out
+static void ts_ingest_fill(ts_ingest_t *in) 
+{ 
+   while (in->in_flight < in->queue_depth && !in->eof) 
+   {
+      int i = (in->head + in->in_flight) % ts_ingest_num_buffers(in); 
+      if (in->buffers[i].state != TS_INGEST_IDLE || i == in->current) break; 
+      ts_ingest_submit(in, i, in->next_offset); 
+      in->next_offset += in->buffer_size; 
+      in->in_flight++;
+   }
+}
+
+ts_ingest_t* ts_ingest_new(int fd, int queue_depth, size_t buffer_size, int flags) 
+{ 
+   if (fd < 0) return NULL; 
+   if (queue_depth <= 0) queue_depth = TS_INGEST_QUEUE_DEPTH; 
+   if (queue_depth > TS_INGEST_MAX_QUEUE_DEPTH) queue_depth = TS_INGEST_MAX_QUEUE_DEPTH; 
+   if (buffer_size == 0) buffer_size = TS_INGEST_BUFFER_SIZE; 
+   
+   ts_ingest_t *in = calloc(1, sizeof(ts_ingest_t)); 
+   if (in == NULL) return NULL; 
+   in->fd = fd; 
+   in->buffer_size = buffer_size; 
+   in->current = -1; 
+   
+   struct stat st; 
+   in->seekable = (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)); 
+   if (in->seekable) 
+   {
+      off_t pos = lseek(fd, 0, SEEK_CUR); 
+      in->next_offset = (pos > 0) ? (uint64_t)pos : 0;
+   }
+   in->queue_depth = in->seekable ? queue_depth : 1; 
+   
+   int num_buffers = ts_ingest_num_buffers(in); 
+   in->buffers = calloc(num_buffers, sizeof(ts_ingest_buffer_t)); 
+   uint8_t *data = malloc(num_buffers * buffer_size); 
+   if (in->buffers == NULL || data == NULL) 
+   {
+      free(data); 
+      free(in->buffers); 
+      free(in); 
+      return NULL;
+   }
+   for (int i = 0; i < num_buffers; i++) 
+   {
+      in->buffers[i].data = data + i * buffer_size;
+   }
+   
+   if (!(flags & TS_INGEST_BLOCKING)) 
+   {
+      in->uring = ts_ingest_uring_new(num_buffers);
+   }
+   in->use_uring = (in->uring != NULL); 
+   if (in->use_uring) ts_ingest_fill(in); 
+   
+   return in;
+}
+
+void ts_ingest_free(ts_ingest_t *in) 
+{ 
+   if (in == NULL) return; 
+   
+   if (in->use_uring) 
+   {
+      // the kernel may still be writing into the buffers: cancel the reads in 
+      // flight and wait for them. Closing the ring would only cancel them 
+      // asynchronously, so if waiting fails the buffers are leaked, not freed
+      int num_buffers = ts_ingest_num_buffers(in); 
+      for (int i = 0; i < num_buffers; i++) 
+      {
+         if (in->buffers[i].state == TS_INGEST_IN_FLIGHT) ts_ingest_uring_cancel(in->uring, i);
+      }
+      int res = 0; 
+      for (int i = 0; i < num_buffers && res == 0; i++) 
+      {
+         while (in->buffers[i].state == TS_INGEST_IN_FLIGHT && (res = ts_ingest_reap(in, 1)) == 0) 
+            ;
+      }
+      ts_ingest_uring_free(in->uring); 
+      if (res < 0) 
+      {
+         LOG_ERROR_ARGS("io_uring_enter failed: %s, leaking the read buffers", strerror(-res)); 
+         free(in); 
+         return;
+      }
+   }
+   free(in->buffers[0].data); 
+   free(in->buffers); 
+   free(in);
+}
+
+static const uint8_t* ts_ingest_next_blocking(ts_ingest_t *in, size_t *len) 
+{ 
+   ts_ingest_buffer_t *b = &in->buffers[0]; 
+   ssize_t res; 
+   while ((res = read(in->fd, b->data, in->buffer_size)) < 0 && errno == EINTR) 
+      ;
+   in->num_stalls++; // every read is waited for
+   
+   if (res < 0) 
+   {
+      LOG_ERROR_ARGS("Read failed: %s", strerror(errno)); 
+      in->eof = 1; 
+      return NULL;
+   }
+   if (res == 0) 
+   {
+      in->eof = 1; 
+      return NULL;
+   }
+   in->num_reads++; 
+   in->num_bytes += res; 
+   *len = res; 
+   return b->data;
+}
+
+const uint8_t* ts_ingest_next(ts_ingest_t *in, size_t *len) 
+{ 
+   if (in == NULL || len == NULL) return NULL; 
+   *len = 0; 
+   
+   // the caller is done with the buffer handed out last
+   in->current = -1; 
+   if (in->eof) return NULL; 
+   if (!in->use_uring) return ts_ingest_next_blocking(in, len); 
+   
+   ts_ingest_fill(in); 
+   ts_ingest_buffer_t *b = &in->buffers[in->head]; 
+   for (;;) 
+   {
+      if (b->state == TS_INGEST_IN_FLIGHT) 
+      {
+         ts_ingest_reap(in, 0); 
+         if (b->state == TS_INGEST_IN_FLIGHT) 
+         {
+            in->num_stalls++; 
+            while (b->state == TS_INGEST_IN_FLIGHT) 
+            {
+               int res = ts_ingest_reap(in, 1); 
+               if (res < 0) 
+               {
+                  // the reads stay in flight, for ts_ingest_free to cancel
+                  LOG_ERROR_ARGS("io_uring_enter failed: %s", strerror(-res)); 
+                  in->eof = 1; 
+                  return NULL;
+               }
+            }
+         }
+      }
+      if (b->result != -EINTR && b->result != -EAGAIN) break; 
+      ts_ingest_submit(in, in->head, b->offset); // try again, still first in line
+   }
+   b->state = TS_INGEST_IDLE; 
+   in->in_flight--; 
+   
+   if (b->result < 0) 
+   {
+      LOG_ERROR_ARGS("Read failed: %s", strerror(-b->result)); 
+      in->eof = 1; 
+      return NULL;
+   }
+   
+   size_t n = b->result; 
+   if (in->seekable && n < in->buffer_size) 
+   {
+      // short read of a file: complete it, the reads after it start further on. 
+      // if that fails, this is the end of the file
+      ssize_t res; 
+      while (n < in->buffer_size && 
+             ((res = pread(in->fd, b->data + n, in->buffer_size - n, b->offset + n)) > 0 || (res < 0 && errno == EINTR))) 
+      {
+         if (res > 0) n += res;
+      }
+      if (n < in->buffer_size) in->eof = 1;
+   }
+   if (n == 0) 
+   {
+      in->eof = 1; 
+      return NULL;
+   }
+   
+   in->num_reads++; 
+   in->num_bytes += n; 
+   in->current = in->head; 
+   in->head = (in->head + 1) % ts_ingest_num_buffers(in); 
+   ts_ingest_fill(in); // read ahead while the caller works on this one
+   
+   *len = n; 
+   return b->data;
+}
+
+uint64_t ts_ingest_read_stream(ts_ingest_t *in, mpeg2ts_stream_t *m2s) 
+{ 
+   if (in == NULL || m2s == NULL) return 0; 
+   
+   uint64_t total = 0; 
+   const uint8_t *buf; 
+   size_t len; 
+   while ((buf = ts_ingest_next(in, &len)) != NULL) 
+   {
+      size_t pos = 0; 
+      while (pos < len) 
+      {
+         size_t n = mpeg2ts_stream_read_buffer(m2s, buf + pos, len - pos); 
+         if (n == 0) return total + pos; // out of memory, already reported
+         pos += n;
+      }
+      total += len;
+   }
+   return total;
+}
@@ -0,0 +1,115 @@
+/*
+
+ Copyright (c) 2012-, ISO/IEC JTC1/SC29/WG11
+ Written by Alex Giladi <alex.giladi@gmail.com>
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of the ISO/IEC nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TSLIB_TS_INGEST_H_
+#define _TSLIB_TS_INGEST_H_        
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "mpeg2ts_demux.h"
+
+#ifdef __cplusplus
+extern "C" 
+{
+#endif
+
+#define TS_INGEST_BUFFER_SIZE      (1 << 20)   /// default read size
+#define TS_INGEST_QUEUE_DEPTH      4           /// default number of reads kept in flight
+#define TS_INGEST_MAX_QUEUE_DEPTH  64
+
+#define TS_INGEST_BLOCKING         0x01        /// use blocking read() even if io_uring is available
+
+/**
+ * Asynchronous input from a file, pipe or socket. With io_uring, up to 
+ * queue_depth reads are kept in flight into their own buffers while the 
+ * caller works on the buffer read before, and each buffer goes back into the
+ * queue as soon as the caller is done with it. The data is handed out in 
+ * the buffers it was read into. Regular files have queue_depth reads at 
+ * consecutive offsets in flight; pipes and sockets have one, as reads of a 
+ * stream cannot be ordered. Where io_uring is not available (old kernel,
+ * seccomp, or TS_INGEST_BLOCKING), the same interface does blocking reads.
+ */
+typedef struct 
+{
+   int fd;                             /// input, not owned
+   int use_uring;                      /// reads go through io_uring, blocking read() otherwise
+   int seekable;                       /// fd is a regular file, read at explicit offsets
+   int queue_depth;                    /// reads kept in flight
+   size_t buffer_size;                 /// bytes per read
+   int eof;                            /// end of input or read error reached
+   
+   uint64_t num_reads;                 /// reads completed
+   uint64_t num_bytes;                 /// bytes read
+   uint64_t num_stalls;                /// times ts_ingest_next had to wait for a read to complete
+   int in_flight;                      /// current read-ahead depth, i.e. reads submitted and not yet handed out
+
+   struct _ts_ingest_buffer_ *buffers; /// queue_depth + 1 buffers, in the order they are read and handed out
+   int head;                           /// next buffer to hand out
+   int current;                        /// buffer handed out last, -1 if none
+   uint64_t next_offset;               /// file offset of the next read to submit
+   struct _ts_ingest_uring_ *uring;    /// io_uring state, NULL in blocking mode
+} ts_ingest_t; 
+
+/**
+ * @param fd file, pipe or socket to read from, positioned where reading starts
+ * @param queue_depth reads in flight, 0 for TS_INGEST_QUEUE_DEPTH
+ * @param buffer_size bytes per read, 0 for TS_INGEST_BUFFER_SIZE
+ * @param flags 0 or TS_INGEST_BLOCKING
+ * @return input, or NULL if out of memory
+ */
+ts_ingest_t* ts_ingest_new(int fd, int queue_depth, size_t buffer_size, int flags); 
+
+/**
+ * Wait for reads still in flight and free the buffers. fd is not closed.
+ */
+void ts_ingest_free(ts_ingest_t *in); 
+
+/**
+ * Get the next buffer of input. It stays valid until the next call, which 
+ * queues it for reading again.
+ * 
+ * @param in input
+ * @param len set to the number of bytes in the buffer
+ * @return data, or NULL at the end of the input or on a read error (reported)
+ */
+const uint8_t* ts_ingest_next(ts_ingest_t *in, size_t *len); 
+
+/**
+ * Feed the whole input into a stream with mpeg2ts_stream_read_buffer.
+ * 
+ * @return number of bytes fed
+ */
+uint64_t ts_ingest_read_stream(ts_ingest_t *in, mpeg2ts_stream_t *m2s); 
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _TSLIB_TS_INGEST_H_
@@ -0,0 +1,277 @@
+/*
+
+ Copyright (c) 2012-, ISO/IEC JTC1/SC29/WG11
+ Written by Alex Giladi <alex.giladi@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of the ISO/IEC nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _DEFAULT_SOURCE        // mkstemp
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "log.h"
+#include "ts_ingest.h"
+#include "mpeg2ts_demux.h"
+#include "ts_test_util.h"
+#include "test_macros.h"
+
+
+int verbose = 0;
+
+static void fill_pattern(uint8_t *buf, size_t len)
+{
+   for (size_t i = 0; i < len; i++) buf[i] = (uint8_t)((i * 2654435761u) >> 13);
+}
+
+START_TEST(test_file)
+{
+   const size_t len = 3000000;
+   const size_t buffer_size = 1000 * TS_SIZE + 77;
+   const int flags[2] = { 0, TS_INGEST_BLOCKING };
+   uint8_t *data = malloc(len);
+   uint8_t *copy = malloc(len);
+   char path[64];
+
+   fill_pattern(data, len);
+   fail_unless(ts_test_write_file(path, data, len), "cannot write file");
+
+   for (int k = 0; k < 2; k++)
+   {
+      int fd = open(path, O_RDONLY);
+      fail_unless(fd >= 0, "cannot open file");
+      if (fd < 0) break;
+      ts_ingest_t *in = ts_ingest_new(fd, 3, buffer_size, flags[k]);
+      fail_unless(in != NULL, "cannot create input");
+      if (in == NULL) break;
+      fail_unless(in->seekable, "file not seekable");
+      fail_unless(k == 0 || !in->use_uring, "io_uring used in blocking mode");
+
+      size_t total = 0, n;
+      int max_in_flight = 0;
+      const uint8_t *buf;
+      while ((buf = ts_ingest_next(in, &n)) != NULL)
+      {
+         if (in->in_flight > max_in_flight) max_in_flight = in->in_flight;
+         fail_unless2(total + n <= len, "too much data", "(flags %d)", flags[k]);
+         if (total + n > len) break;
+         fail_unless2(n == buffer_size || total + n == len, "short read", "(%zu bytes at %zu)", n, total);
+         memcpy(copy + total, buf, n);
+         total += n;
+      }
+      fail_unless2(total == len, "wrong number of bytes read", "(%zu, flags %d)", total, flags[k]);
+      fail_unless2(in->num_bytes == len, "wrong byte count", "(%llu)", (unsigned long long)in->num_bytes);
+      fail_unless(memcmp(data, copy, total) == 0, "data corrupted");
+      fail_unless(in->eof, "end of file not reached");
+      fail_unless2(max_in_flight <= 3, "queue depth exceeded", "(%d)", max_in_flight);
+      fail_unless2(ts_ingest_next(in, &n) == NULL && n == 0, "data after end of file", "(flags %d)", flags[k]);
+      if (verbose) printf("# %s: %llu reads, %llu stalls, %d reads in flight at most\n", in->use_uring ? "io_uring" : "blocking",
+                          (unsigned long long)in->num_reads, (unsigned long long)in->num_stalls, max_in_flight);
+
+      ts_ingest_free(in);
+      close(fd);
+      memset(copy, 0, len);
+   }
+
+   unlink(path);
+   free(copy);
+   free(data);
+}
+END_TEST
+
+typedef struct
+{
+   int fd;
+   const uint8_t *data;
+   size_t len;
+} pipe_writer_t;
+
+static void* write_pipe(void *arg)
+{
+   pipe_writer_t *w = arg;
+   size_t pos = 0;
+   size_t chunk = 1;
+   while (pos < w->len)
+   {
+      size_t n = (chunk < w->len - pos) ? chunk : w->len - pos;
+      ssize_t r = write(w->fd, w->data + pos, n);
+      if (r <= 0) break;
+      pos += r;
+      chunk = (chunk * 7 + 3) % 20011;
+   }
+   close(w->fd);
+   return NULL;
+}
+
+START_TEST(test_pipe)
+{
+   const size_t len = 2000000;
+   uint8_t *data = malloc(len);
+   uint8_t *copy = malloc(len);
+   int fds[2];
+
+   fill_pattern(data, len);
+   fail_unless(pipe(fds) == 0, "cannot create pipe");
+
+   pipe_writer_t w = { fds[1], data, len };
+   pthread_t thread;
+   pthread_create(&thread, NULL, write_pipe, &w);
+
+   ts_ingest_t *in = ts_ingest_new(fds[0], 8, 65536, 0);
+   fail_unless(in != NULL, "cannot create input");
+   fail_unless(!in->seekable && in->queue_depth == 1, "pipe read at more than one offset");
+
+   size_t total = 0, n;
+   const uint8_t *buf;
+   while ((buf = ts_ingest_next(in, &n)) != NULL && total + n <= len)
+   {
+      memcpy(copy + total, buf, n);
+      total += n;
+   }
+   pthread_join(thread, NULL);
+
+   fail_unless2(total == len, "wrong number of bytes read", "(%zu)", total);
+   fail_unless(memcmp(data, copy, total) == 0, "data corrupted");
+
+   ts_ingest_free(in);
+   close(fds[0]);
+   free(copy);
+   free(data);
+}
+END_TEST
+
+/**
+ * Freeing with a read in flight on a pipe nobody writes to: the read has to
+ * be cancelled, waiting for it would never return
+ */
+START_TEST(test_free_pending)
+{
+   int fds[2];
+   fail_unless(pipe(fds) == 0, "cannot create pipe");
+
+   ts_ingest_t *in = ts_ingest_new(fds[0], 0, 0, 0);
+   fail_unless(in != NULL, "cannot create input");
+   if (in != NULL && !in->use_uring) printf("# io_uring not available, nothing in flight\n");
+   ts_ingest_free(in);
+
+   close(fds[1]);
+   close(fds[0]);
+}
+END_TEST
+
+START_TEST(test_read_stream)
+{
+   const int num_packets = 30002;
+   uint8_t *pkts = malloc(num_packets * TS_SIZE);
+   char path[64];
+
+   ts_test_build_stream(pkts, num_packets, 3);
+   fail_unless(ts_test_write_file(path, pkts, (size_t)num_packets * TS_SIZE), "cannot write file");
+   int fd = open(path, O_RDONLY);
+   fail_unless(fd >= 0, "cannot open file");
+   if (fd < 0) return 0;
+
+   mpeg2ts_stream_t *m2s = mpeg2ts_stream_new();
+   m2s->pat_processor = ts_test_set_pmt_processor;
+   uint64_t num_delivered = 0;
+   m2s->arg = &num_delivered;
+
+   ts_ingest_t *in = ts_ingest_new(fd, 0, 100 * TS_SIZE + 5, 0);
+   uint64_t total = ts_ingest_read_stream(in, m2s);
+   fail_unless2(total == (uint64_t)num_packets * TS_SIZE, "wrong number of bytes fed", "(%llu)", (unsigned long long)total);
+   fail_unless2(num_delivered == 20000, "wrong number of packets delivered", 
+                "(%llu)", (unsigned long long)num_delivered);
+   fail_unless(m2s->ts_pool->num_outstanding == 0, "packets not recycled");
+
+   ts_ingest_free(in);
+   mpeg2ts_stream_free(m2s);
+   close(fd);
+   unlink(path);
+   free(pkts);
+}
+END_TEST
+
+START_TEST(test_read_stream_benchmark)
+{
+   const int num_packets = 200000;
+   const int flags[2] = { TS_INGEST_BLOCKING, 0 };
+   uint8_t *pkts = malloc(num_packets * TS_SIZE);
+   char path[64];
+
+   ts_test_build_stream(pkts, num_packets, num_packets);
+   fail_unless(ts_test_write_file(path, pkts, (size_t)num_packets * TS_SIZE), "cannot write file");
+
+   for (int k = 0; k < 2; k++)
+   {
+      int fd = open(path, O_RDONLY);
+      fail_unless(fd >= 0, "cannot open file");
+      if (fd < 0) break;
+
+      uint64_t num_delivered = 0;
+      uint64_t t1 = gettimeusec();
+      mpeg2ts_stream_t *m2s = mpeg2ts_stream_new();
+      m2s->pat_processor = ts_test_set_pmt_processor;
+      m2s->arg = &num_delivered;
+      ts_ingest_t *in = ts_ingest_new(fd, 0, 0, flags[k]);
+      uint64_t total = ts_ingest_read_stream(in, m2s);
+      mpeg2ts_stream_free(m2s);
+      uint64_t t2 = gettimeusec();
+
+      fail_unless2(num_delivered == (uint64_t)num_packets - 2, "not all packets delivered", "(flags %d)", flags[k]);
+      printf("# %d packets from file, %s: %.1f MB/s, %llu reads, %llu stalls\n", num_packets, 
+             in->use_uring ? "io_uring" : "blocking", (double)total / (double)(t2 - t1 + 1),
+             (unsigned long long)in->num_reads, (unsigned long long)in->num_stalls);
+
+      ts_ingest_free(in);
+      close(fd);
+   }
+
+   unlink(path);
+   free(pkts);
+}
+END_TEST
+
+int main(int argc, char **argv)
+{
+   int _testnum = 1;
+   int failed = 0;
+   int r;
+
+   if (argc > 1 && strcmp(argv[1], "-v") == 0) verbose = 1;
+   tslib_loglevel = verbose ? TSLIB_LOG_LEVEL_INFO : TSLIB_LOG_LEVEL_ERROR;
+
+   r = test_file(); ok(r, "file"); failed += !r;
+   r = test_pipe(); ok(r, "pipe"); failed += !r;
+   r = test_free_pending(); ok(r, "free_pending"); failed += !r;
+   r = test_read_stream(); ok(r, "read_stream"); failed += !r;
+   r = test_read_stream_benchmark(); ok(r, "read_stream_benchmark"); failed += !r;
+
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
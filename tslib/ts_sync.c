@@ -0,0 +1,254 @@
+/*
+
+ Copyright (c) 2012-, ISO/IEC JTC1/SC29/WG11
+ Written by Alex Giladi <alex.giladi@gmail.com>
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of the ISO/IEC nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "ts_sync.h"
+#include "libts_common.h"
+#include "log.h"
+
+#define TS_SYNC_NUM_SIZES 3
+
+static int ts_sync_offset(int packet_size) 
+{ 
+   return (packet_size == M2TS_PACKET_SIZE) ? M2TS_PACKET_SIZE - TS_SIZE : 0;
+}
+
+void ts_sync_init(ts_sync_t *s, int packet_size) 
+{ 
+   memset(s, 0, sizeof(ts_sync_t)); 
+   if (packet_size == TS_SIZE || packet_size == M2TS_PACKET_SIZE || packet_size == TS_RS_PACKET_SIZE) 
+   {
+      s->fixed_packet_size = packet_size; 
+      s->packet_size = packet_size; 
+      s->sync_offset = ts_sync_offset(packet_size);
+   }
+}
+
+// candidate packet sizes, the one locked onto last first
+static int ts_sync_sizes(const ts_sync_t *s, int sizes[TS_SYNC_NUM_SIZES]) 
+{ 
+   if (s->fixed_packet_size != 0) 
+   {
+      sizes[0] = s->fixed_packet_size; 
+      return 1;
+   }
+   
+   int n = 0; 
+   if (s->packet_size != 0) sizes[n++] = s->packet_size; 
+   if (s->packet_size != TS_SIZE) sizes[n++] = TS_SIZE; 
+   if (s->packet_size != TS_RS_PACKET_SIZE) sizes[n++] = TS_RS_PACKET_SIZE; 
+   if (s->packet_size != M2TS_PACKET_SIZE) sizes[n++] = M2TS_PACKET_SIZE; 
+   return n;
+}
+
+/**
+ * First p in [from, end) with a sync byte at p and another one at p + one of
+ * the strides, end if there is none. buf must extend past end + the largest stride.
+ */
+static size_t ts_sync_scan(const uint8_t *buf, size_t from, size_t end, const int *sizes, int num_sizes) 
+{ 
+   // with fewer candidates the missing ones repeat the first, which doesn't change the result
+   size_t s0 = sizes[0]; 
+   size_t s1 = sizes[num_sizes > 1 ? 1 : 0]; 
+   size_t s2 = sizes[num_sizes > 2 ? 2 : 0]; 
+   size_t p = from; 
+   
+#if defined(__SSE2__)
+   const __m128i sync = _mm_set1_epi8((char)TS_SYNC_BYTE); 
+   for (; p + 16 <= end; p += 16) 
+   {
+      __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + p)), sync); 
+      __m128i b = _mm_or_si128(_mm_or_si128(
+                     _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + p + s0)), sync), 
+                     _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + p + s1)), sync)), 
+                     _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + p + s2)), sync)); 
+      int mask = _mm_movemask_epi8(_mm_and_si128(a, b)); 
+      if (mask != 0) return p + __builtin_ctz(mask);
+   }
+#endif
+   
+   for (; p < end; p++) 
+   {
+      if (buf[p] == TS_SYNC_BYTE && 
+          (buf[p + s0] == TS_SYNC_BYTE || buf[p + s1] == TS_SYNC_BYTE || buf[p + s2] == TS_SYNC_BYTE)) 
+      {
+         return p;
+      }
+   }
+   return end;
+}
+
+/**
+ * Check for TS_SYNC_LOCK_PACKETS sync bytes from the one at q. Returns the 
+ * packet size locked onto, 0 if there is no lock at q, -1 if buf ends before
+ * that is known.
+ */
+static int ts_sync_confirm(const int *sizes, int num_sizes, const uint8_t *buf, size_t len, size_t q, int eof) 
+{ 
+   int undecided = 0; 
+   for (int i = 0; i < num_sizes; i++) 
+   {
+      if (q < (size_t)ts_sync_offset(sizes[i])) continue; // header would be before buf
+      
+      int k = 0; 
+      size_t x = q; 
+      while (k < TS_SYNC_LOCK_PACKETS && x + TS_SIZE <= len && buf[x] == TS_SYNC_BYTE) 
+      {
+         k++; 
+         x += sizes[i];
+      }
+      if (k == TS_SYNC_LOCK_PACKETS) return sizes[i]; 
+      if (x + TS_SIZE > len)  // all there was matched
+      {
+         // at the end a lone sync byte only counts if it starts the very last packet
+         if (eof && (k > 1 || (k == 1 && len - q <= (size_t)(sizes[i] - ts_sync_offset(sizes[i]))))) return sizes[i]; 
+         if (!eof) undecided = 1;
+      }
+   }
+   return undecided ? -1 : 0;
+}
+
+/**
+ * Find the next lock at or after *pos. Returns 1 with *pos at the packet, 
+ * otherwise 0 with *pos at where to continue with more data (len if eof).
+ */
+static int ts_sync_acquire(ts_sync_t *s, const uint8_t *buf, size_t len, size_t *pos, int eof) 
+{ 
+   int sizes[TS_SYNC_NUM_SIZES]; 
+   int num_sizes = ts_sync_sizes(s, sizes); 
+   int max_size = 0; 
+   size_t max_offset = 0; 
+   for (int i = 0; i < num_sizes; i++) 
+   {
+      if (sizes[i] > max_size) max_size = sizes[i]; 
+      if ((size_t)ts_sync_offset(sizes[i]) > max_offset) max_offset = ts_sync_offset(sizes[i]);
+   }
+   
+   size_t start = *pos; 
+   size_t p = start; 
+   size_t end = (len > (size_t)max_size) ? len - max_size : 0; 
+   
+   while (p < len) 
+   {
+      // bulk of the data: a sync byte with another one a stride further
+      size_t q = (p < end) ? ts_sync_scan(buf, p, end, sizes, num_sizes) : end; 
+      if (q >= end) 
+      {
+         // no room for the second sync byte, any sync byte may start a lock
+         if (q < p) q = p; 
+         const uint8_t *c = memchr(buf + q, TS_SYNC_BYTE, len - q); 
+         q = (c != NULL) ? (size_t)(c - buf) : len;
+      }
+      if (q >= len) 
+      {
+         // keep what could be the M2TS header of a packet in the next buffer
+         p = (len > start + max_offset) ? len - max_offset : start; 
+         break;
+      }
+      
+      int packet_size = ts_sync_confirm(sizes, num_sizes, buf, len, q, eof); 
+      if (packet_size > 0) 
+      {
+         size_t packet_start = q - ts_sync_offset(packet_size); 
+         if (packet_start > start) 
+         {
+            s->num_bytes_lost += packet_start - start; 
+            s->lost_since_lock += packet_start - start;
+         }
+         if (s->lost_since_lock > 0 || packet_size != s->packet_size) 
+         {
+            LOG_INFO_ARGS("Locked onto %d-byte packets, %llu bytes lost", packet_size, (unsigned long long)s->lost_since_lock);
+         }
+         s->locked = 1; 
+         s->packet_size = packet_size; 
+         s->sync_offset = ts_sync_offset(packet_size); 
+         s->lost_since_lock = 0; 
+         *pos = packet_start; 
+         return 1;
+      }
+      if (packet_size < 0) // wait for more data, with the M2TS header if there is one
+      {
+         p = (q > start + max_offset) ? q - max_offset : start; 
+         break;
+      }
+      p = q + 1;
+   }
+   
+   if (eof) p = len; 
+   s->num_bytes_lost += p - start; 
+   s->lost_since_lock += p - start; 
+   *pos = p; 
+   return 0;
+}
+
+const uint8_t* ts_sync_next(ts_sync_t *s, const uint8_t *buf, size_t len, size_t *pos, int eof) 
+{ 
+   if (s == NULL || buf == NULL || pos == NULL) return NULL; 
+   
+   for (;;) 
+   {
+      size_t p = *pos; 
+      if (s->locked) 
+      {
+         size_t need = eof ? (size_t)s->sync_offset + TS_SIZE : (size_t)s->packet_size; 
+         if (p + need > len) 
+         {
+            if (eof && p < len) 
+            {
+               s->num_bytes_lost += len - p; 
+               *pos = len;
+            }
+            return NULL;
+         }
+         if (buf[p + s->sync_offset] == TS_SYNC_BYTE) 
+         {
+            *pos = (p + s->packet_size < len) ? p + s->packet_size : len; 
+            s->num_packets++; 
+            return buf + p + s->sync_offset;
+         }
+         LOG_WARN_ARGS("Lost sync after %llu packets", (unsigned long long)s->num_packets); 
+         s->locked = 0; 
+         s->num_sync_losses++;
+      }
+      
+      if (!ts_sync_acquire(s, buf, len, pos, eof)) return NULL;
+   }
+}
+
+void ts_sync_unread(ts_sync_t *s, const uint8_t *buf, const uint8_t *packet, size_t *pos) 
+{ 
+   if (s == NULL || buf == NULL || packet == NULL || pos == NULL) return; 
+   *pos = (packet - buf) - s->sync_offset; 
+   s->num_packets--;
+}
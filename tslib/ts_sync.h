@@ -0,0 +1,114 @@
+/*
+
+ Copyright (c) 2012-, ISO/IEC JTC1/SC29/WG11
+ Written by Alex Giladi <alex.giladi@gmail.com>
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of the ISO/IEC nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TSLIB_TS_SYNC_H_
+#define _TSLIB_TS_SYNC_H_        
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "ts.h"
+
+#ifdef __cplusplus
+extern "C" 
+{
+#endif
+
+#define M2TS_PACKET_SIZE       192    /// 4-byte TP_extra_header (copy permission, arrival timestamp) + TS packet
+#define TS_RS_PACKET_SIZE      204    /// TS packet + 16 bytes of Reed-Solomon parity
+
+#define TS_SYNC_LOCK_PACKETS   5      /// consecutive sync bytes at the same stride needed to lock
+#define TS_SYNC_WINDOW_SIZE    (TS_SYNC_LOCK_PACKETS * TS_RS_PACKET_SIZE) /// enough data to decide on any lock
+
+/**
+ * Packet synchronization. Locks onto TS_SYNC_LOCK_PACKETS sync bytes in a 
+ * row at a 188, 192 (M2TS) or 204 (Reed-Solomon) byte stride, then follows 
+ * the stride as long as the sync bytes are there. When one is missing the 
+ * lock is dropped, and the data is scanned 16 bytes at a time for a sync 
+ * byte with another one a stride further, until the lock is confirmed again.
+ * Bytes in between are lost and counted.
+ */
+typedef struct 
+{
+   int locked;                   /// packets are being followed
+   int packet_size;              /// stride of the (last) lock, 0 before the first one
+   int sync_offset;              /// offset of the TS sync byte within a packet: 4 for M2TS, 0 otherwise
+   int fixed_packet_size;        /// only lock onto this packet size, 0 for any of them
+   
+   uint64_t num_packets;         /// packets returned
+   uint64_t num_bytes_lost;      /// bytes skipped while out of lock
+   uint64_t num_sync_losses;     /// times the lock was lost
+   uint64_t lost_since_lock;     /// bytes lost since the lock was lost, for reporting
+} ts_sync_t; 
+
+/**
+ * @param s sync state
+ * @param packet_size 188, M2TS_PACKET_SIZE or TS_RS_PACKET_SIZE to only 
+ *                    accept that packetization, 0 to detect it
+ */
+void ts_sync_init(ts_sync_t *s, int packet_size); 
+
+/**
+ * Get the next TS packet of buf at or after *pos, acquiring lock if needed.
+ * 
+ * buf may be a chunk of a longer stream: if no complete packet is left, or 
+ * the lock cannot be confirmed yet, NULL is returned and the stream continues
+ * at *pos, i.e. buf + *pos up to len has to be passed again followed by more
+ * data. That is less than TS_SYNC_WINDOW_SIZE bytes. At the end of the 
+ * stream (eof set), a lock is accepted on as many packets as are left, the 
+ * Reed-Solomon parity of the last packet may be missing, and *pos is len
+ * once NULL is returned.
+ * 
+ * @param s sync state
+ * @param buf data
+ * @param len bytes in buf
+ * @param pos offset in buf to continue from; set past the packet returned 
+ *            (all of it, including any parity)
+ * @param eof nothing follows buf
+ * @return TS_SIZE bytes starting with the sync byte, or NULL
+ */
+const uint8_t* ts_sync_next(ts_sync_t *s, const uint8_t *buf, size_t len, size_t *pos, int eof); 
+
+/**
+ * Give back the packet ts_sync_next just returned, e.g. one that could not 
+ * be processed for lack of memory: *pos is set back to its start, so that 
+ * the next call returns it again, and it is no longer counted.
+ * 
+ * @param s sync state
+ * @param buf data passed to ts_sync_next
+ * @param packet packet it returned, the last one
+ * @param pos offset in buf to continue from
+ */
+void ts_sync_unread(ts_sync_t *s, const uint8_t *buf, const uint8_t *packet, size_t *pos); 
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _TSLIB_TS_SYNC_H_
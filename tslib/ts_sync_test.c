@@ -0,0 +1,316 @@
+/*
+
+ Copyright (c) 2012-, ISO/IEC JTC1/SC29/WG11
+ Written by Alex Giladi <alex.giladi@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of the ISO/IEC nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "log.h"
+#include "ts_sync.h"
+#include "ts_test_util.h"
+#include "test_macros.h"
+
+#define TEST_PID 0x100
+
+int verbose = 0;
+
+/**
+ * Write num_packets packets of packet_size bytes to buf, the TS packets 
+ * numbered by their continuity counter and first payload bytes
+ */
+static size_t build_stream(uint8_t *buf, int num_packets, int packet_size)
+{
+   uint8_t *p = buf;
+   for (int i = 0; i < num_packets; i++)
+   {
+      memset(p, 0xAA, packet_size);
+      if (packet_size == M2TS_PACKET_SIZE)
+      {
+         p[0] = 0x00; p[1] = i >> 16; p[2] = i >> 8; p[3] = i;
+         p += 4;
+      }
+      ts_test_write_pes_packet(p, TEST_PID, i, 0, 0xE0, 0, 0);
+      p[4] = i >> 8;
+      p[5] = i;
+      p += (packet_size == M2TS_PACKET_SIZE) ? TS_SIZE : packet_size;
+   }
+   return p - buf;
+}
+
+static int packet_number(const uint8_t *pkt)
+{
+   return (pkt[4] << 8) | pkt[5];
+}
+
+/**
+ * Junk with sync bytes in it, but none that could line up with a packet at 
+ * either end of the junk
+ */
+static void fill_junk(uint8_t *buf, size_t len)
+{
+   for (size_t i = 0; i < len; i++) buf[i] = (i % 7 == 3) ? TS_SYNC_BYTE : rand();
+   for (int k = 1; k <= TS_SYNC_LOCK_PACKETS; k++)
+   {
+      int sizes[] = { TS_SIZE, M2TS_PACKET_SIZE, TS_RS_PACKET_SIZE };
+      for (int j = 0; j < 3; j++)
+      {
+         if ((size_t)(k * sizes[j]) <= len) buf[len - k * sizes[j]] = 0x00;
+         if ((size_t)(k * sizes[j] - 4) <= len) buf[len - k * sizes[j] + 4] = 0x00;
+      }
+   }
+}
+
+START_TEST(test_packet_sizes)
+{
+   const int num_packets = 50;
+   const int packet_sizes[] = { TS_SIZE, M2TS_PACKET_SIZE, TS_RS_PACKET_SIZE };
+   uint8_t *buf = malloc(100 + num_packets * TS_RS_PACKET_SIZE);
+   srand(1);
+
+   for (int k = 0; k < 3; k++)
+   {
+      fill_junk(buf, 100);
+      size_t len = 100 + build_stream(buf + 100, num_packets, packet_sizes[k]);
+
+      ts_sync_t s;
+      ts_sync_init(&s, 0);
+      size_t pos = 0;
+      const uint8_t *p;
+      int n = 0;
+      while ((p = ts_sync_next(&s, buf, len, &pos, 1)) != NULL)
+      {
+         fail_unless2(packet_number(p) == n, "wrong packet", "(%d instead of %d)", packet_number(p), n);
+         n++;
+      }
+      fail_unless2(s.packet_size == packet_sizes[k], "wrong packet size", "(%d)", s.packet_size);
+      fail_unless2(n == num_packets, "wrong number of packets", "(%d %d-byte packets)", n, packet_sizes[k]);
+      fail_unless2(s.num_bytes_lost == 100, "wrong number of bytes lost", "(%llu)", (unsigned long long)s.num_bytes_lost);
+      fail_unless(pos == len, "not all data consumed");
+
+      // forced to the wrong size, nothing is found but maybe the last packet, which could be either
+      ts_sync_init(&s, packet_sizes[(k + 1) % 3]);
+      pos = 0;
+      n = 0;
+      while ((p = ts_sync_next(&s, buf, len, &pos, 1)) != NULL) n++;
+      fail_unless2(n <= 1 && s.num_bytes_lost >= len - TS_RS_PACKET_SIZE, "locked onto the wrong size", 
+                   "(%d %d-byte packets)", n, packet_sizes[(k + 1) % 3]);
+   }
+
+   free(buf);
+}
+END_TEST
+
+START_TEST(test_unread)
+{
+   const int num_packets = 10;
+   uint8_t *buf = malloc(num_packets * M2TS_PACKET_SIZE);
+   size_t len = build_stream(buf, num_packets, M2TS_PACKET_SIZE);
+
+   ts_sync_t s;
+   ts_sync_init(&s, 0);
+   size_t pos = 0;
+   const uint8_t *p = NULL;
+   for (int i = 0; i < 3; i++) p = ts_sync_next(&s, buf, len, &pos, 1);
+   fail_unless(p != NULL && packet_number(p) == 2, "wrong packet");
+   ts_sync_unread(&s, buf, p, &pos);
+   fail_unless2(pos == 2 * M2TS_PACKET_SIZE && s.num_packets == 2, "packet not given back", 
+                "(pos %zu, %llu packets)", pos, (unsigned long long)s.num_packets);
+   const uint8_t *q = ts_sync_next(&s, buf, len, &pos, 1);
+   fail_unless(q == p && s.num_packets == 3, "packet not read again");
+
+   free(buf);
+}
+END_TEST
+
+/**
+ * 1000 packets with a corrupted sync byte in packet 100, 1000 bytes of junk
+ * in front of packet 300 and packet 600 cut short by 50 bytes. The sync byte
+ * of packet 600 is fine, so it is the rest of packet 601 that gets lost.
+ */
+static size_t build_damaged_stream(uint8_t *buf, int packet_size, int *expected, size_t *expected_lost)
+{
+   uint8_t *pkts = malloc(1000 * packet_size);
+   build_stream(pkts, 1000, packet_size);
+   int sync_offset = (packet_size == M2TS_PACKET_SIZE) ? 4 : 0;
+
+   pkts[100 * packet_size + sync_offset] = 0x48;
+   size_t len = 0;
+   memcpy(buf, pkts, 300 * packet_size);
+   len += 300 * packet_size;
+   fill_junk(buf + len, 1000);
+   len += 1000;
+   memcpy(buf + len, pkts + 300 * packet_size, 300 * packet_size);
+   len += 300 * packet_size;
+   memcpy(buf + len, pkts + 600 * packet_size, packet_size - 50);
+   len += packet_size - 50;
+   memcpy(buf + len, pkts + 601 * packet_size, 399 * packet_size);
+   len += 399 * packet_size;
+   free(pkts);
+
+   *expected = 1000 - 2;
+   *expected_lost = packet_size + 1000 + packet_size - 50;
+   return len;
+}
+
+START_TEST(test_resync)
+{
+   const int packet_sizes[] = { TS_SIZE, M2TS_PACKET_SIZE, TS_RS_PACKET_SIZE };
+   uint8_t *buf = malloc(1000 * TS_RS_PACKET_SIZE + 1000);
+   srand(2);
+
+   for (int k = 0; k < 3; k++)
+   {
+      int expected;
+      size_t expected_lost;
+      size_t len = build_damaged_stream(buf, packet_sizes[k], &expected, &expected_lost);
+
+      ts_sync_t s;
+      ts_sync_init(&s, 0);
+      size_t pos = 0;
+      const uint8_t *p;
+      int n = 0, in_order = 1, last = -1;
+      while ((p = ts_sync_next(&s, buf, len, &pos, 1)) != NULL)
+      {
+         int i = packet_number(p);
+         in_order &= (i > last) && (i != 100) && (i != 601);
+         last = i;
+         n++;
+      }
+      fail_unless2(n == expected, "wrong number of packets", "(%d %d-byte packets)", n, packet_sizes[k]);
+      fail_unless(in_order, "damaged packet delivered");
+      fail_unless2(s.num_bytes_lost == expected_lost, "wrong number of bytes lost", "(%llu instead of %zu)",
+                   (unsigned long long)s.num_bytes_lost, expected_lost);
+      fail_unless2(s.num_sync_losses == 3, "wrong number of sync losses", "(%llu)", (unsigned long long)s.num_sync_losses);
+   }
+
+   free(buf);
+}
+END_TEST
+
+/**
+ * Same damaged stream in chunks of random size, the way a reader would use
+ * it: whatever is not consumed is carried over in front of the next chunk
+ */
+START_TEST(test_chunks)
+{
+   const int packet_sizes[] = { TS_SIZE, M2TS_PACKET_SIZE, TS_RS_PACKET_SIZE };
+   const size_t max_chunk = 3 * TS_RS_PACKET_SIZE;
+   uint8_t *buf = malloc(1000 * TS_RS_PACKET_SIZE + 1000);
+   uint8_t *carry = malloc(TS_SYNC_WINDOW_SIZE + max_chunk);
+   srand(3);
+
+   for (int k = 0; k < 3; k++)
+   {
+      int expected;
+      size_t expected_lost;
+      size_t len = build_damaged_stream(buf, packet_sizes[k], &expected, &expected_lost);
+
+      ts_sync_t s;
+      ts_sync_init(&s, 0);
+      size_t carry_len = 0, in = 0;
+      int n = 0, in_order = 1, last = -1, carried_too_much = 0;
+      while (in < len)
+      {
+         size_t chunk = 1 + rand() % max_chunk;
+         if (chunk > len - in) chunk = len - in;
+         memcpy(carry + carry_len, buf + in, chunk);
+         carry_len += chunk;
+         in += chunk;
+
+         size_t pos = 0;
+         const uint8_t *p;
+         while ((p = ts_sync_next(&s, carry, carry_len, &pos, in == len)) != NULL)
+         {
+            int i = packet_number(p);
+            in_order &= (i > last);
+            last = i;
+            n++;
+         }
+         carried_too_much |= (carry_len - pos >= TS_SYNC_WINDOW_SIZE);
+         memmove(carry, carry + pos, carry_len - pos);
+         carry_len -= pos;
+      }
+      fail_unless2(n == expected, "wrong number of packets", "(%d %d-byte packets)", n, packet_sizes[k]);
+      fail_unless(in_order, "packets out of order");
+      fail_unless(!carried_too_much, "more than TS_SYNC_WINDOW_SIZE left over");
+      fail_unless2(s.num_bytes_lost == expected_lost, "wrong number of bytes lost", "(%llu instead of %zu)",
+                   (unsigned long long)s.num_bytes_lost, expected_lost);
+   }
+
+   free(carry);
+   free(buf);
+}
+END_TEST
+
+START_TEST(test_sync_benchmark)
+{
+   const size_t junk_len = 64 << 20;
+   const int num_packets = 200000;
+   uint8_t *buf = malloc(junk_len + num_packets * TS_SIZE);
+   srand(4);
+   for (size_t i = 0; i < junk_len; i++) buf[i] = rand();
+   build_stream(buf + junk_len, num_packets, TS_SIZE);
+
+   ts_sync_t s;
+   ts_sync_init(&s, 0);
+   size_t pos = 0;
+   uint64_t t1 = gettimeusec();
+   const uint8_t *p = ts_sync_next(&s, buf, junk_len + num_packets * TS_SIZE, &pos, 1);
+   uint64_t t2 = gettimeusec();
+   int n = (p != NULL);
+   while (ts_sync_next(&s, buf, junk_len + num_packets * TS_SIZE, &pos, 1) != NULL) n++;
+   uint64_t t3 = gettimeusec();
+
+   fail_unless2(n == num_packets, "wrong number of packets", "(%d)", n);
+   fail_unless(s.num_bytes_lost == junk_len, "wrong number of bytes lost");
+   printf("# resync through %zu MB of junk: %.0f MB/s, locked: %.1f ns/packet\n", junk_len >> 20, 
+          (double)junk_len / (double)(t2 - t1 + 1), (double)(t3 - t2) * 1000.0 / num_packets);
+
+   free(buf);
+}
+END_TEST
+
+int main(int argc, char **argv)
+{
+   int _testnum = 1;
+   int failed = 0;
+   int r;
+
+   if (argc > 1 && strcmp(argv[1], "-v") == 0) verbose = 1;
+   tslib_loglevel = verbose ? TSLIB_LOG_LEVEL_INFO : TSLIB_LOG_LEVEL_ERROR;
+
+   r = test_packet_sizes(); ok(r, "packet_sizes"); failed += !r;
+   r = test_resync(); ok(r, "resync"); failed += !r;
+   r = test_unread(); ok(r, "unread"); failed += !r;
+   r = test_chunks(); ok(r, "chunks"); failed += !r;
+   r = test_sync_benchmark(); ok(r, "sync_benchmark"); failed += !r;
+
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
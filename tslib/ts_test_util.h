@@ -0,0 +1,415 @@
+/*
+
+ Copyright (c) 2012-, ISO/IEC JTC1/SC29/WG11
+ Written by Alex Giladi <alex.giladi@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of the ISO/IEC nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Helpers shared by the tslib *_test.c programs: synthetic PSI and PES
+// packet builders, so that tests and benchmarks don't depend on captures.
+
+#ifndef _TSLIB_TS_TEST_UTIL_H_
+#define _TSLIB_TS_TEST_UTIL_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "ts.h"
+#include "crc32m.h"
+#include "mpeg2ts_demux.h"
+
+#define TS_TEST_ES_PID        0x100
+#define TS_TEST_PMT_PID       0x20
+#define TS_TEST_OTHER_PID     0x101
+
+static inline uint64_t gettimeusec()
+{
+   struct timeval tv;
+   gettimeofday(&tv, NULL);
+   return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static inline void ts_test_put_crc(uint8_t *section, int len)
+{
+   crc_t crc = crc_finalize(crc_update(crc_init(), section, len));
+   section[len] = crc >> 24;
+   section[len + 1] = crc >> 16;
+   section[len + 2] = crc >> 8;
+   section[len + 3] = crc;
+}
+
+/**
+ * Build a single-section PAT
+ *
+ * @return total section length, including CRC_32
+ */
+static inline int ts_test_build_pat(uint8_t *section, int version, int num_programs,
+                                    const uint32_t *program_numbers, const uint32_t *pmt_pids)
+{
+   int section_length = 5 + 4 * num_programs + 4;
+   uint8_t *p = section;
+
+   *p++ = 0x00;
+   *p++ = 0xB0 | (section_length >> 8);
+   *p++ = section_length & 0xFF;
+   *p++ = 0x00; *p++ = 0x01;                     // transport_stream_id
+   *p++ = 0xC1 | ((version & 0x1F) << 1);
+   *p++ = 0x00; *p++ = 0x00;
+   for (int i = 0; i < num_programs; i++)
+   {
+      *p++ = program_numbers[i] >> 8;
+      *p++ = program_numbers[i] & 0xFF;
+      *p++ = 0xE0 | (pmt_pids[i] >> 8);
+      *p++ = pmt_pids[i] & 0xFF;
+   }
+   ts_test_put_crc(section, p - section);
+   return (p - section) + 4;
+}
+
+/**
+ * Build a single-section PMT without descriptors
+ *
+ * @return total section length, including CRC_32
+ */
+static inline int ts_test_build_pmt(uint8_t *section, int version, uint32_t program_number, uint32_t PCR_PID,
+                                    int num_es, const uint32_t *stream_types, const uint32_t *es_pids)
+{
+   int section_length = 9 + 5 * num_es + 4;
+   uint8_t *p = section;
+
+   *p++ = 0x02;
+   *p++ = 0xB0 | (section_length >> 8);
+   *p++ = section_length & 0xFF;
+   *p++ = program_number >> 8;
+   *p++ = program_number & 0xFF;
+   *p++ = 0xC1 | ((version & 0x1F) << 1);
+   *p++ = 0x00; *p++ = 0x00;
+   *p++ = 0xE0 | (PCR_PID >> 8);
+   *p++ = PCR_PID & 0xFF;
+   *p++ = 0xF0; *p++ = 0x00;                     // program_info_length
+   for (int i = 0; i < num_es; i++)
+   {
+      *p++ = stream_types[i];
+      *p++ = 0xE0 | (es_pids[i] >> 8);
+      *p++ = es_pids[i] & 0xFF;
+      *p++ = 0xF0; *p++ = 0x00;                  // ES_info_length
+   }
+   ts_test_put_crc(section, p - section);
+   return (p - section) + 4;
+}
+
+/**
+ * Write a TS packet carrying a complete section (pointer_field = 0)
+ */
+static inline void ts_test_write_section_packet(uint8_t *pkt, uint32_t PID, uint32_t cc,
+                                                const uint8_t *section, int len)
+{
+   memset(pkt, 0xFF, TS_SIZE);
+   pkt[0] = TS_SYNC_BYTE;
+   pkt[1] = 0x40 | (PID >> 8);
+   pkt[2] = PID & 0xFF;
+   pkt[3] = 0x10 | (cc & 0x0F);
+   pkt[4] = 0x00;
+   memcpy(pkt + 5, section, len);
+}
+
+/**
+ * Write a section spanning as many TS packets as needed (pointer_field = 0
+ * in the first one, stuffing after the end of the section)
+ * 
+ * @return number of packets written to pkts
+ */
+static inline int ts_test_write_section_packets(uint8_t *pkts, uint32_t PID, uint32_t cc,
+                                                const uint8_t *section, int len)
+{
+   int n = 0;
+   int pos = 0;
+   while (pos < len)
+   {
+      uint8_t *pkt = pkts + n * TS_SIZE;
+      int room = TS_SIZE - TS_HEADER_SIZE - (n == 0);
+      int chunk = (len - pos < room) ? len - pos : room;
+      memset(pkt, 0xFF, TS_SIZE);
+      pkt[0] = TS_SYNC_BYTE;
+      pkt[1] = (n == 0 ? 0x40 : 0x00) | (PID >> 8);
+      pkt[2] = PID & 0xFF;
+      pkt[3] = 0x10 | ((cc + n) & 0x0F);
+      if (n == 0) pkt[4] = 0x00;
+      memcpy(pkt + TS_SIZE - room, section + pos, chunk);
+      pos += chunk;
+      n++;
+   }
+   return n;
+}
+
+/**
+ * Write a payload-only TS packet. If pusi is set, the payload starts with a
+ * minimal PES header (PTS only) with a PES_packet_length of pes_len.
+ */
+static inline void ts_test_write_pes_packet(uint8_t *pkt, uint32_t PID, uint32_t cc, int pusi,
+                                            uint32_t stream_id, uint64_t pts, uint32_t pes_len)
+{
+   pkt[0] = TS_SYNC_BYTE;
+   pkt[1] = (pusi ? 0x40 : 0x00) | (PID >> 8);
+   pkt[2] = PID & 0xFF;
+   pkt[3] = 0x10 | (cc & 0x0F);
+
+   uint8_t *p = pkt + TS_HEADER_SIZE;
+   if (pusi)
+   {
+      *p++ = 0x00; *p++ = 0x00; *p++ = 0x01;
+      *p++ = stream_id;
+      *p++ = pes_len >> 8;
+      *p++ = pes_len & 0xFF;
+      *p++ = 0x80;
+      *p++ = 0x80;                               // PTS only
+      *p++ = 0x05;
+      *p++ = 0x21 | ((pts >> 29) & 0x0E);
+      *p++ = pts >> 22;
+      *p++ = 0x01 | ((pts >> 14) & 0xFE);
+      *p++ = pts >> 7;
+      *p++ = 0x01 | ((pts << 1) & 0xFE);
+   }
+   for (int i = 0; p < pkt + TS_SIZE; i++) *p++ = (uint8_t)(PID + cc + i);
+}
+
+/**
+ * Write a TS packet with an adaptation field carrying a PCR, followed by
+ * af_len - 7 stuffing bytes and a payload (if any room is left)
+ */
+static inline void ts_test_write_pcr_packet(uint8_t *pkt, uint32_t PID, uint32_t cc, int af_len,
+                                            uint64_t pcr_base, uint32_t pcr_ext)
+{
+   int has_payload = (af_len < TS_SIZE - TS_HEADER_SIZE - 1);
+   memset(pkt, 0xFF, TS_SIZE);
+   pkt[0] = TS_SYNC_BYTE;
+   pkt[1] = PID >> 8;
+   pkt[2] = PID & 0xFF;
+   pkt[3] = (has_payload ? 0x30 : 0x20) | (cc & 0x0F);
+   pkt[4] = af_len;
+   pkt[5] = 0x10;                                // PCR_flag
+   pkt[6] = pcr_base >> 25;
+   pkt[7] = pcr_base >> 17;
+   pkt[8] = pcr_base >> 9;
+   pkt[9] = pcr_base >> 1;
+   pkt[10] = ((pcr_base & 1) << 7) | 0x7E | ((pcr_ext >> 8) & 1);
+   pkt[11] = pcr_ext & 0xFF;
+   for (int i = 5 + af_len; i < TS_SIZE; i++) pkt[i] = (uint8_t)i;
+}
+
+/**
+ * Build a PES packet with a PTS-only header followed by payload_len bytes of
+ * a counting pattern. PES_packet_length is left 0 (unbounded) unless bounded
+ * is set.
+ *
+ * @return total PES packet length
+ */
+static inline int ts_test_build_pes(uint8_t *pes, uint32_t stream_id, uint64_t pts,
+                                    int payload_len, int bounded)
+{
+   int len = 14 + payload_len;
+   uint8_t *p = pes;
+
+   *p++ = 0x00; *p++ = 0x00; *p++ = 0x01;
+   *p++ = stream_id;
+   *p++ = bounded ? (len - 6) >> 8 : 0;
+   *p++ = bounded ? (len - 6) & 0xFF : 0;
+   *p++ = 0x80;
+   *p++ = 0x80;                                  // PTS only
+   *p++ = 0x05;
+   *p++ = 0x21 | ((pts >> 29) & 0x0E);
+   *p++ = pts >> 22;
+   *p++ = 0x01 | ((pts >> 14) & 0xFE);
+   *p++ = pts >> 7;
+   *p++ = 0x01 | ((pts << 1) & 0xFE);
+   for (int i = 0; i < payload_len; i++) *p++ = (uint8_t)i;
+   return len;
+}
+
+/**
+ * Write a TS packet carrying up to 184 payload bytes; shorter payloads are
+ * padded with adaptation field stuffing
+ *
+ * @return number of payload bytes written
+ */
+static inline int ts_test_write_payload_packet(uint8_t *pkt, uint32_t PID, uint32_t cc, int pusi,
+                                               const uint8_t *payload, int len)
+{
+   int room = TS_SIZE - TS_HEADER_SIZE;
+   if (len > room) len = room;
+
+   pkt[0] = TS_SYNC_BYTE;
+   pkt[1] = (pusi ? 0x40 : 0x00) | (PID >> 8);
+   pkt[2] = PID & 0xFF;
+   pkt[3] = (len < room ? 0x30 : 0x10) | (cc & 0x0F);
+
+   uint8_t *p = pkt + TS_HEADER_SIZE;
+   if (len < room)
+   {
+      int af_len = room - len - 1;
+      *p++ = af_len;
+      if (af_len > 0)
+      {
+         *p++ = 0x00;                            // no flags
+         memset(p, 0xFF, af_len - 1);
+         p += af_len - 1;
+      }
+   }
+   memcpy(p, payload, len);
+   return len;
+}
+
+/**
+ * Build EBP private data (SCTE-128 item payload, after format_identifier).
+ * sap_type < 0 leaves the SAP out, acquisition_time 0 leaves the time out.
+ *
+ * @return length of the EBP data
+ */
+static inline int ts_test_build_ebp(uint8_t *ebp, int fragment, int segment, int sap_type,
+                                    const uint8_t *grouping_ids, int num_grouping_ids, uint64_t acquisition_time)
+{
+   uint8_t *p = ebp;
+   *p++ = (fragment ? 0x80 : 0) | (segment ? 0x40 : 0) | (sap_type >= 0 ? 0x20 : 0) |
+          (num_grouping_ids > 0 ? 0x10 : 0) | (acquisition_time != 0 ? 0x08 : 0) | 0x02;
+   if (sap_type >= 0) *p++ = (sap_type << 5) | 0x1F;
+   for (int i = 0; i < num_grouping_ids; i++)
+   {
+      *p++ = (i + 1 < num_grouping_ids ? 0x80 : 0) | grouping_ids[i];
+   }
+   if (acquisition_time != 0)
+   {
+      for (int i = 7; i >= 0; i--) *p++ = acquisition_time >> (8 * i);
+   }
+   return p - ebp;
+}
+
+/**
+ * Write a TS packet with EBP data in the adaptation field private data and 
+ * the start of a PES packet with a PTS
+ */
+static inline void ts_test_write_ebp_packet(uint8_t *pkt, uint32_t PID, uint32_t cc, 
+                                            const uint8_t *ebp, int ebp_len, uint64_t pts)
+{
+   uint8_t *p = pkt;
+   *p++ = TS_SYNC_BYTE;
+   *p++ = 0x40 | (PID >> 8);
+   *p++ = PID & 0xFF;
+   *p++ = 0x30 | (cc & 0x0F);
+   *p++ = 1 + 1 + 6 + ebp_len;                   // adaptation_field_length
+   *p++ = 0x02;                                  // transport_private_data_flag
+   *p++ = 6 + ebp_len;                           // transport_private_data_length
+   *p++ = 0xDF;                                  // registered SCTE-128 item
+   *p++ = 4 + ebp_len;
+   *p++ = 'E'; *p++ = 'B'; *p++ = 'P'; *p++ = '0';
+   memcpy(p, ebp, ebp_len);
+   p += ebp_len;
+   p += ts_test_build_pes(p, 0xE0, pts, pkt + TS_SIZE - p - 14, 0);
+}
+
+/**
+ * PID handler counting delivered packets into the uint64_t arg points to 
+ * (if not NULL)
+ */
+static inline int ts_test_count_ts_packet(ts_packet_t *ts, elementary_stream_info_t *es_info, void *arg)
+{
+   (void)es_info;
+   if (ts == NULL) return 0;
+   if (arg != NULL) (*(uint64_t *)arg)++;
+   ts_free(ts);
+   return 1;
+}
+
+/**
+ * PMT processor counting the packets on TS_TEST_ES_PID, into the counter
+ * given as arg
+ */
+static inline int ts_test_register_first_es(mpeg2ts_program_t *m2p, void *arg)
+{
+   demux_pid_handler_t *h = calloc(1, sizeof(demux_pid_handler_t));
+   h->process_ts_packet = ts_test_count_ts_packet;
+   h->arg = arg;
+   mpeg2ts_program_register_pid_processor(m2p, TS_TEST_ES_PID, h, NULL);
+   return 1;
+}
+
+/**
+ * PAT processor installing ts_test_register_first_es on every program; 
+ * set m2s->arg to a uint64_t to count the packets delivered on TS_TEST_ES_PID
+ */
+static inline int ts_test_set_pmt_processor(mpeg2ts_stream_t *m2s, void *arg)
+{
+   for (int i = 0; i < vqarray_length(m2s->programs); i++)
+   {
+      mpeg2ts_program_t *m2p = vqarray_get(m2s->programs, i);
+      m2p->pmt_processor = ts_test_register_first_es;
+      m2p->arg = arg;
+   }
+   return 1;
+}
+
+/**
+ * PAT and PMT of a single program with ES PIDs TS_TEST_ES_PID and 
+ * TS_TEST_OTHER_PID, then num_packets - 2 packets, only every other_every'th 
+ * not on TS_TEST_ES_PID
+ */
+static inline void ts_test_build_stream(uint8_t *pkts, int num_packets, int other_every)
+{
+   uint8_t section[1024];
+   uint32_t program_number = 1, pmt_pid = TS_TEST_PMT_PID;
+   uint32_t stream_types[2] = { 0x1B, 0x0F }, es_pids[2] = { TS_TEST_ES_PID, TS_TEST_OTHER_PID };
+
+   int len = ts_test_build_pat(section, 0, 1, &program_number, &pmt_pid);
+   ts_test_write_section_packet(pkts, PAT_PID, 0, section, len);
+   len = ts_test_build_pmt(section, 0, program_number, TS_TEST_ES_PID, 2, stream_types, es_pids);
+   ts_test_write_section_packet(pkts + TS_SIZE, TS_TEST_PMT_PID, 0, section, len);
+
+   for (int i = 2; i < num_packets; i++)
+   {
+      uint32_t PID = (i % other_every == 0) ? ((i / other_every) % 2 ? TS_TEST_OTHER_PID : NULL_PID) : TS_TEST_ES_PID;
+      ts_test_write_pes_packet(pkts + i * TS_SIZE, PID, i, 0, 0xE0, 0, 0);
+   }
+}
+
+#ifdef _DEFAULT_SOURCE     // mkstemp, fdopen
+/**
+ * Write len bytes to a new temporary file, its name returned in path 
+ * (at least 32 bytes)
+ */
+static inline int ts_test_write_file(char *path, const uint8_t *buf, size_t len)
+{
+   strcpy(path, "/tmp/ts_test_XXXXXX");
+   int fd = mkstemp(path);
+   if (fd < 0) return 0;
+   FILE *fp = fdopen(fd, "wb");
+   size_t n = fwrite(buf, 1, len, fp);
+   fclose(fp);
+   return n == len;
+}
+#endif
+
+#endif // _TSLIB_TS_TEST_UTIL_H_
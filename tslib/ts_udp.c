@@ -0,0 +1,276 @@
+/*
+
+ Copyright (c) 2012-, ISO/IEC JTC1/SC29/WG11
+ Written by Alex Giladi <alex.giladi@gmail.com>
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of the ISO/IEC nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE        // recvmmsg
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ts_udp.h"
+#include "libts_common.h"
+#include "log.h"
+
+typedef struct _ts_udp_msgs_ 
+{
+   struct mmsghdr *hdrs; 
+   struct iovec *iovs; 
+} ts_udp_msgs_t; 
+
+ts_udp_t* ts_udp_new(int fd, int batch_size, int flags) 
+{ 
+   if (fd < 0) return NULL; 
+   if (batch_size <= 0) batch_size = TS_UDP_BATCH_SIZE; 
+   
+   ts_udp_t *u = calloc(1, sizeof(ts_udp_t)); 
+   if (u == NULL) return NULL; 
+   u->fd = fd; 
+   u->flags = flags; 
+   u->batch_size = batch_size; 
+   u->ring = malloc((size_t)batch_size * TS_UDP_DATAGRAM_SIZE); 
+   u->payloads = calloc(batch_size, sizeof(buf_t)); 
+   u->msgs = calloc(1, sizeof(ts_udp_msgs_t)); 
+   if (u->ring == NULL || u->payloads == NULL || u->msgs == NULL) 
+   {
+      ts_udp_free(u); 
+      return NULL;
+   }
+   u->msgs->hdrs = calloc(batch_size, sizeof(struct mmsghdr)); 
+   u->msgs->iovs = calloc(batch_size, sizeof(struct iovec)); 
+   if (u->msgs->hdrs == NULL || u->msgs->iovs == NULL) 
+   {
+      ts_udp_free(u); 
+      return NULL;
+   }
+   
+   for (int i = 0; i < batch_size; i++) 
+   {
+      u->msgs->iovs[i].iov_base = u->ring + (size_t)i * TS_UDP_DATAGRAM_SIZE; 
+      u->msgs->iovs[i].iov_len = TS_UDP_DATAGRAM_SIZE; 
+      u->msgs->hdrs[i].msg_hdr.msg_iov = &u->msgs->iovs[i]; 
+      u->msgs->hdrs[i].msg_hdr.msg_iovlen = 1;
+   }
+   return u;
+}
+
+ts_udp_t* ts_udp_open(const char *address, int port, const char *interface_address, int batch_size, int flags) 
+{ 
+   struct sockaddr_in sa; 
+   memset(&sa, 0, sizeof(sa)); 
+   sa.sin_family = AF_INET; 
+   sa.sin_port = htons(port); 
+   sa.sin_addr.s_addr = htonl(INADDR_ANY); 
+   if (address != NULL && inet_pton(AF_INET, address, &sa.sin_addr) != 1) 
+   {
+      LOG_ERROR_ARGS("Invalid address %s", address); 
+      return NULL;
+   }
+   
+   int fd = socket(AF_INET, SOCK_DGRAM, 0); 
+   if (fd < 0) 
+   {
+      LOG_ERROR_ARGS("Cannot create socket: %s", strerror(errno)); 
+      return NULL;
+   }
+   
+   // several receivers may listen to the same group
+   int one = 1; 
+   setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)); 
+   // enough to ride out a few ms of demux hiccups at high bitrates, the kernel caps it at rmem_max
+   int rcvbuf = TS_UDP_RCVBUF_SIZE; 
+   setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)); 
+   
+   if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) 
+   {
+      LOG_ERROR_ARGS("Cannot bind to %s:%d: %s", address ? address : "*", port, strerror(errno)); 
+      close(fd); 
+      return NULL;
+   }
+   
+   if (IN_MULTICAST(ntohl(sa.sin_addr.s_addr))) 
+   {
+      struct ip_mreq mreq; 
+      mreq.imr_multiaddr = sa.sin_addr; 
+      mreq.imr_interface.s_addr = htonl(INADDR_ANY); 
+      if (interface_address != NULL && inet_pton(AF_INET, interface_address, &mreq.imr_interface) != 1) 
+      {
+         LOG_ERROR_ARGS("Invalid interface address %s", interface_address); 
+         close(fd); 
+         return NULL;
+      }
+      if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) 
+      {
+         LOG_ERROR_ARGS("Cannot join %s: %s", address, strerror(errno)); 
+         close(fd); 
+         return NULL;
+      }
+   }
+   
+   ts_udp_t *u = ts_udp_new(fd, batch_size, flags); 
+   if (u == NULL) 
+   {
+      close(fd); 
+      return NULL;
+   }
+   u->owns_fd = 1; 
+   return u;
+}
+
+void ts_udp_free(ts_udp_t *u) 
+{ 
+   if (u == NULL) return; 
+   if (u->owns_fd) close(u->fd); 
+   if (u->msgs != NULL) 
+   {
+      free(u->msgs->hdrs); 
+      free(u->msgs->iovs); 
+      free(u->msgs);
+   }
+   free(u->payloads); 
+   free(u->ring); 
+   free(u);
+}
+
+// RFC 3550 5.1, returns header length or -1 if the datagram is not RTP
+static int ts_udp_parse_rtp(ts_udp_t *u, const uint8_t *p, size_t *len) 
+{ 
+   if (*len < RTP_HEADER_SIZE || (p[0] >> 6) != RTP_VERSION) return -1; 
+   
+   size_t header_len = RTP_HEADER_SIZE + 4 * (p[0] & 0x0F);           // CSRC list
+   if (p[0] & 0x10)                                                     // header extension
+   {
+      if (header_len + 4 > *len) return -1; 
+      header_len += 4 + 4 * ((p[header_len + 2] << 8) | p[header_len + 3]);
+   }
+   size_t padding = (p[0] & 0x20) ? p[*len - 1] : 0; 
+   if (header_len + padding > *len) return -1; 
+   *len -= padding; 
+   
+   uint16_t seq = (p[2] << 8) | p[3]; 
+   if (u->rtp_seq_valid) 
+   {
+      uint16_t gap = seq - (uint16_t)(u->rtp_seq + 1); 
+      if (gap >= 0x8000) 
+      {
+         u->num_rtp_late++; 
+         return header_len; // behind the sequence, keep waiting for what follows the last one in order
+      }
+      if (gap > 0) 
+      {
+         LOG_WARN_ARGS("RTP sequence gap: %u datagrams lost before %u", gap, seq); 
+         u->num_rtp_gaps++; 
+         u->num_rtp_lost += gap;
+      }
+   }
+   u->rtp_seq = seq; 
+   u->rtp_seq_valid = 1; 
+   return header_len;
+}
+
+int ts_udp_receive(ts_udp_t *u, int timeout_ms) 
+{ 
+   if (u == NULL) return -1; 
+   u->num_payloads = 0; 
+   
+   struct pollfd pfd = { u->fd, POLLIN, 0 }; 
+   int r; 
+   while ((r = poll(&pfd, 1, timeout_ms)) < 0 && errno == EINTR) 
+      ;
+   if (r < 0) 
+   {
+      LOG_ERROR_ARGS("poll failed: %s", strerror(errno)); 
+      return -1;
+   }
+   if (r == 0) return 0; 
+   
+   // whatever is queued, without waiting for the batch to fill up
+   int n; 
+   while ((n = recvmmsg(u->fd, u->msgs->hdrs, u->batch_size, MSG_DONTWAIT, NULL)) < 0 && errno == EINTR) 
+      ;
+   if (n < 0) 
+   {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return 0; 
+      LOG_ERROR_ARGS("recvmmsg failed: %s", strerror(errno)); 
+      return -1;
+   }
+   u->num_receives++; 
+   u->num_datagrams += n; 
+   
+   for (int i = 0; i < n; i++) 
+   {
+      uint8_t *p = u->ring + (size_t)i * TS_UDP_DATAGRAM_SIZE; 
+      size_t len = u->msgs->hdrs[i].msg_len; 
+      if (u->msgs->hdrs[i].msg_hdr.msg_flags & MSG_TRUNC) 
+      {
+         u->num_truncated++; 
+         len = TS_UDP_DATAGRAM_SIZE;
+      }
+      
+      int header_len = 0; 
+      int is_rtp = (u->flags & TS_UDP_RTP) || (!(u->flags & TS_UDP_NO_RTP) && len > 0 && p[0] != TS_SYNC_BYTE); 
+      if (is_rtp) header_len = ts_udp_parse_rtp(u, p, &len); 
+      if (header_len < 0 || len == (size_t)header_len) 
+      {
+         u->num_bad_datagrams++; 
+         continue;
+      }
+      
+      u->payloads[u->num_payloads].bytes = p + header_len; 
+      u->payloads[u->num_payloads].len = len - header_len; 
+      u->num_bytes += len - header_len; 
+      u->num_payloads++;
+   }
+   return n;
+}
+
+int ts_udp_read_stream(ts_udp_t *u, mpeg2ts_stream_t *m2s, int timeout_ms) 
+{ 
+   if (u == NULL || m2s == NULL) return -1; 
+   int n = ts_udp_receive(u, timeout_ms); 
+   if (n < 0) return n; 
+   
+   for (int i = 0; i < u->num_payloads; i++) 
+   {
+      const uint8_t *p = u->payloads[i].bytes; 
+      size_t len = u->payloads[i].len; 
+      while (len > 0) 
+      {
+         size_t k = mpeg2ts_stream_read_buffer(m2s, p, len); 
+         if (k == 0) return -1; // out of memory, already reported
+         p += k; 
+         len -= k;
+      }
+   }
+   return n;
+}
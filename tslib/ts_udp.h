@@ -0,0 +1,134 @@
+/*
+
+ Copyright (c) 2012-, ISO/IEC JTC1/SC29/WG11
+ Written by Alex Giladi <alex.giladi@gmail.com>
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of the ISO/IEC nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TSLIB_TS_UDP_H_
+#define _TSLIB_TS_UDP_H_        
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "common.h"
+#include "mpeg2ts_demux.h"
+
+#ifdef __cplusplus
+extern "C" 
+{
+#endif
+
+#define TS_UDP_DATAGRAM_SIZE       2048        /// receive slot size, 7 TS packets plus RTP header fit easily
+#define TS_UDP_BATCH_SIZE          64          /// default number of datagrams per recvmmsg
+#define TS_UDP_RCVBUF_SIZE         (8 << 20)   /// socket receive buffer asked for
+#define RTP_HEADER_SIZE            12
+#define RTP_VERSION                2
+
+#define TS_UDP_RTP                 0x01        /// datagrams carry RTP, fail those that don't
+#define TS_UDP_NO_RTP              0x02        /// datagrams carry TS only
+                                               /// neither: RTP is detected per datagram
+
+/**
+ * Transport stream receiver for UDP, unicast or multicast, with or without 
+ * RTP (RFC 2250 / SMPTE 2022-2). Up to batch_size datagrams are received by 
+ * a single recvmmsg call into a preallocated ring of fixed size slots; RTP
+ * headers are stripped in place and the payloads handed out or fed into a 
+ * mpeg2ts_stream_t without further copies. Gaps in the RTP sequence numbers 
+ * are counted and reported, the lost TS packets show up as continuity 
+ * errors in the demux.
+ */
+typedef struct 
+{
+   int fd;                             /// socket
+   int owns_fd;                        /// fd is closed by ts_udp_free
+   int flags;                          /// TS_UDP_RTP, TS_UDP_NO_RTP or 0
+   int batch_size;                     /// datagrams per recvmmsg
+   
+   uint8_t *ring;                      /// batch_size slots of TS_UDP_DATAGRAM_SIZE bytes
+   struct _ts_udp_msgs_ *msgs;         /// recvmmsg headers, one per slot
+   buf_t *payloads;                    /// payloads of the datagrams received last, RTP headers stripped
+   int num_payloads;                   /// entries in payloads
+   
+   int rtp_seq_valid;                  /// an RTP datagram was seen, rtp_seq is set
+   uint16_t rtp_seq;                   /// sequence number of the last RTP datagram in order
+   
+   uint64_t num_receives;              /// recvmmsg calls which returned data
+   uint64_t num_datagrams;             /// datagrams received
+   uint64_t num_bytes;                 /// payload bytes handed out
+   uint64_t num_rtp_gaps;              /// breaks in the RTP sequence
+   uint64_t num_rtp_lost;              /// RTP datagrams missing in those breaks
+   uint64_t num_rtp_late;              /// RTP datagrams received out of order or twice, still handed out
+   uint64_t num_bad_datagrams;         /// datagrams dropped: not TS or RTP, or truncated RTP header
+   uint64_t num_truncated;             /// datagrams larger than a slot, handed out truncated
+} ts_udp_t; 
+
+/**
+ * Open a socket bound to address:port. If address is a multicast group, the 
+ * group is joined on the interface with interface_address (any if NULL).
+ * IPv4 only.
+ * 
+ * @param address unicast or multicast address to receive on, NULL for any
+ * @param port UDP port, 0 for an ephemeral one (see getsockname)
+ * @param interface_address address of the interface to join the group on, or NULL
+ * @param batch_size datagrams per recvmmsg, 0 for TS_UDP_BATCH_SIZE
+ * @param flags 0, TS_UDP_RTP or TS_UDP_NO_RTP
+ * @return receiver, or NULL on error (reported)
+ */
+ts_udp_t* ts_udp_open(const char *address, int port, const char *interface_address, int batch_size, int flags); 
+
+/**
+ * Receive from a socket set up by the caller, which keeps ownership of it.
+ * 
+ * @return receiver, or NULL if out of memory
+ */
+ts_udp_t* ts_udp_new(int fd, int batch_size, int flags); 
+
+void ts_udp_free(ts_udp_t *u); 
+
+/**
+ * Receive the datagrams queued on the socket, up to batch_size, waiting up 
+ * to timeout_ms for the first one. Their payloads are put in u->payloads and 
+ * stay valid until the next call. Datagrams which are not TS are dropped, so 
+ * u->num_payloads may be less than the number received.
+ * 
+ * @param timeout_ms -1 to wait indefinitely, 0 not to wait
+ * @return number of datagrams received, 0 on timeout, -1 on socket error (reported)
+ */
+int ts_udp_receive(ts_udp_t *u, int timeout_ms); 
+
+/**
+ * ts_udp_receive, then feed the payloads into a stream with 
+ * mpeg2ts_stream_read_buffer.
+ * 
+ * @return as ts_udp_receive, -1 also if out of memory
+ */
+int ts_udp_read_stream(ts_udp_t *u, mpeg2ts_stream_t *m2s, int timeout_ms); 
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _TSLIB_TS_UDP_H_
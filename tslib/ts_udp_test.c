@@ -0,0 +1,257 @@
+/*
+
+ Copyright (c) 2012-, ISO/IEC JTC1/SC29/WG11
+ Written by Alex Giladi <alex.giladi@gmail.com>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of the ISO/IEC nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "log.h"
+#include "ts_udp.h"
+#include "mpeg2ts_demux.h"
+#include "ts_test_util.h"
+#include "test_macros.h"
+
+#define PACKETS_PER_DATAGRAM 7
+
+int verbose = 0;
+
+/**
+ * Sender socket connected to the port u is bound to on the loopback interface
+ */
+static int connect_sender(ts_udp_t *u)
+{
+   struct sockaddr_in sa;
+   socklen_t sa_len = sizeof(sa);
+   if (getsockname(u->fd, (struct sockaddr *)&sa, &sa_len) < 0) return -1;
+   sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+   int fd = socket(AF_INET, SOCK_DGRAM, 0);
+   if (fd < 0) return -1;
+   if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+   {
+      close(fd);
+      return -1;
+   }
+   return fd;
+}
+
+/**
+ * RTP header with one CSRC and a one-word header extension; 
+ * returns its length
+ */
+static int write_rtp_header(uint8_t *p, uint16_t seq, uint32_t timestamp)
+{
+   p[0] = 0x80 | 0x10 | 1;       // V=2, X=1, CC=1
+   p[1] = 33;                    // MP2T
+   p[2] = seq >> 8; p[3] = seq;
+   p[4] = timestamp >> 24; p[5] = timestamp >> 16; p[6] = timestamp >> 8; p[7] = timestamp;
+   memset(p + 8, 0x5A, 4);       // SSRC
+   memset(p + 12, 0x3C, 4);      // CSRC
+   p[16] = 0xAB; p[17] = 0xCD; p[18] = 0; p[19] = 1;
+   memset(p + 20, 0xEE, 4);
+   return 24;
+}
+
+START_TEST(test_raw)
+{
+   const int num_datagrams = 200;
+   const int num_packets = num_datagrams * PACKETS_PER_DATAGRAM;
+   const int burst = 50;
+   uint8_t *pkts = malloc(num_packets * TS_SIZE);
+
+   ts_test_build_stream(pkts, num_packets, 5);
+   ts_udp_t *u = ts_udp_open("127.0.0.1", 0, NULL, 16, TS_UDP_NO_RTP);
+   fail_unless(u != NULL, "cannot open receiver");
+   if (u == NULL) return 0;
+   int fd = connect_sender(u);
+   fail_unless(fd >= 0, "cannot connect sender");
+
+   mpeg2ts_stream_t *m2s = mpeg2ts_stream_new();
+   m2s->pat_processor = ts_test_set_pmt_processor;
+   uint64_t num_delivered = 0;
+   m2s->arg = &num_delivered;
+
+   int received = 0;
+   for (int i = 0; i < num_datagrams; i += burst)
+   {
+      // a burst at a time, loopback drops what does not fit into the receive buffer
+      for (int j = i; j < i + burst; j++)
+      {
+         send(fd, pkts + j * PACKETS_PER_DATAGRAM * TS_SIZE, PACKETS_PER_DATAGRAM * TS_SIZE, 0);
+      }
+      int n;
+      while (received < i + burst && (n = ts_udp_read_stream(u, m2s, 1000)) > 0) received += n;
+   }
+
+   fail_unless2(received == num_datagrams, "wrong number of datagrams", "(%d)", received);
+   fail_unless2(u->num_bytes == (uint64_t)num_packets * TS_SIZE, "wrong number of bytes", "(%llu)", (unsigned long long)u->num_bytes);
+   fail_unless2(u->num_receives < u->num_datagrams, "datagrams not batched", 
+                "(%llu receives)", (unsigned long long)u->num_receives);
+   fail_unless2(num_delivered == (uint64_t)num_packets - 2 - (num_packets - 1) / 5, "wrong number of packets delivered", 
+                "(%llu)", (unsigned long long)num_delivered);
+   fail_unless(u->num_bad_datagrams == 0 && u->num_rtp_gaps == 0, "datagrams dropped");
+
+   mpeg2ts_stream_free(m2s);
+   close(fd);
+   ts_udp_free(u);
+   free(pkts);
+}
+END_TEST
+
+START_TEST(test_rtp)
+{
+   // sequence numbers wrap around, 65534 and 0 are lost, 65533 arrives once more at the end
+   const uint16_t seqs[] = { 65530, 65531, 65532, 65533, 65535, 1, 2, 3, 65533, 4 };
+   const int num_datagrams = ARRAYSIZE(seqs);
+   uint8_t datagram[TS_UDP_DATAGRAM_SIZE];
+   uint8_t *pkts = malloc(num_datagrams * PACKETS_PER_DATAGRAM * TS_SIZE);
+
+   for (int i = 0; i < num_datagrams * PACKETS_PER_DATAGRAM; i++)
+   {
+      ts_test_write_pes_packet(pkts + i * TS_SIZE, TS_TEST_ES_PID, i, 0, 0xE0, 0, 0);
+   }
+
+   const int flags[2] = { TS_UDP_RTP, 0 };
+   for (int k = 0; k < 2; k++)
+   {
+      ts_udp_t *u = ts_udp_open("127.0.0.1", 0, NULL, 0, flags[k]);
+      fail_unless(u != NULL, "cannot open receiver");
+      if (u == NULL) break;
+      int fd = connect_sender(u);
+
+      for (int i = 0; i < num_datagrams; i++)
+      {
+         int len = write_rtp_header(datagram, seqs[i], i * 3003);
+         memcpy(datagram + len, pkts + i * PACKETS_PER_DATAGRAM * TS_SIZE, PACKETS_PER_DATAGRAM * TS_SIZE);
+         send(fd, datagram, len + PACKETS_PER_DATAGRAM * TS_SIZE, 0);
+      }
+      // one without RTP: dropped if RTP is required, passed through if detected
+      send(fd, pkts, TS_SIZE, 0);
+
+      int n = 0, r;
+      while (n < num_datagrams + 1 && (r = ts_udp_receive(u, 1000)) > 0)
+      {
+         for (int i = 0; i < u->num_payloads; i++)
+         {
+            int d = n + i;
+            if (d < num_datagrams)
+            {
+               fail_unless2(u->payloads[i].len == PACKETS_PER_DATAGRAM * TS_SIZE && 
+                            memcmp(u->payloads[i].bytes, pkts + d * PACKETS_PER_DATAGRAM * TS_SIZE, u->payloads[i].len) == 0, 
+                            "wrong payload", "(datagram %d)", d);
+            }
+            else
+            {
+               fail_unless(u->payloads[i].len == TS_SIZE && memcmp(u->payloads[i].bytes, pkts, TS_SIZE) == 0, 
+                           "wrong TS datagram");
+            }
+         }
+         n += r;
+      }
+
+      fail_unless2(n == num_datagrams + 1, "wrong number of datagrams", "(%d)", n);
+      fail_unless2(u->num_rtp_gaps == 2 && u->num_rtp_lost == 2, "wrong RTP gaps", "(%llu gaps, %llu lost)", 
+                   (unsigned long long)u->num_rtp_gaps, (unsigned long long)u->num_rtp_lost);
+      fail_unless2(u->num_rtp_late == 1, "wrong late datagram count", "(%llu)", (unsigned long long)u->num_rtp_late);
+      fail_unless2(u->num_bad_datagrams == (flags[k] == TS_UDP_RTP ? 1u : 0u), "wrong bad datagram count", 
+                   "(%llu)", (unsigned long long)u->num_bad_datagrams);
+
+      close(fd);
+      ts_udp_free(u);
+   }
+
+   free(pkts);
+}
+END_TEST
+
+START_TEST(test_read_stream_benchmark)
+{
+   const int num_datagrams = 50000;
+   const int burst = 100;
+   uint8_t *pkts = malloc(burst * PACKETS_PER_DATAGRAM * TS_SIZE);
+   uint8_t datagram[TS_UDP_DATAGRAM_SIZE];
+
+   ts_test_build_stream(pkts, burst * PACKETS_PER_DATAGRAM, 1000000);
+   ts_udp_t *u = ts_udp_open("127.0.0.1", 0, NULL, 0, 0);
+   fail_unless(u != NULL, "cannot open receiver");
+   if (u == NULL) return 0;
+   int fd = connect_sender(u);
+
+   mpeg2ts_stream_t *m2s = mpeg2ts_stream_new();
+   m2s->pat_processor = ts_test_set_pmt_processor;
+
+   uint64_t t_recv = 0;
+   int received = 0;
+   for (int i = 0; i < num_datagrams; i += burst)
+   {
+      for (int j = 0; j < burst; j++)
+      {
+         int len = write_rtp_header(datagram, i + j, 0);
+         memcpy(datagram + len, pkts + j * PACKETS_PER_DATAGRAM * TS_SIZE, PACKETS_PER_DATAGRAM * TS_SIZE);
+         send(fd, datagram, len + PACKETS_PER_DATAGRAM * TS_SIZE, 0);
+      }
+      uint64_t t1 = gettimeusec();
+      int n;
+      while (received < i + burst && (n = ts_udp_read_stream(u, m2s, 1000)) > 0) received += n;
+      t_recv += gettimeusec() - t1;
+   }
+
+   fail_unless2(received == num_datagrams, "datagrams lost", "(%d received)", received);
+   fail_unless(u->num_rtp_gaps == 0, "RTP gaps");
+   printf("# %d datagrams over loopback: %.0f packets/sec received and demuxed, %.1f datagrams per recvmmsg\n", 
+          num_datagrams, (double)received * PACKETS_PER_DATAGRAM * 1000000.0 / (double)(t_recv + 1),
+          (double)u->num_datagrams / (double)(u->num_receives + 1));
+
+   mpeg2ts_stream_free(m2s);
+   close(fd);
+   ts_udp_free(u);
+   free(pkts);
+}
+END_TEST
+
+int main(int argc, char **argv)
+{
+   int _testnum = 1;
+   int failed = 0;
+   int r;
+
+   if (argc > 1 && strcmp(argv[1], "-v") == 0) verbose = 1;
+   tslib_loglevel = verbose ? TSLIB_LOG_LEVEL_INFO : TSLIB_LOG_LEVEL_ERROR;
+
+   r = test_raw(); ok(r, "raw"); failed += !r;
+   r = test_rtp(); ok(r, "rtp"); failed += !r;
+   r = test_read_stream_benchmark(); ok(r, "read_stream_benchmark"); failed += !r;
+
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}